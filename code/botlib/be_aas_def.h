@@ -148,6 +148,16 @@ typedef struct aas_routingcache_s
 	unsigned short int traveltimes[1];			//travel time for every area (variable sized)
 } aas_routingcache_t;
 
+//maximum number of pending routing cache requests
+#define MAX_ROUTINGREQUESTS		256
+
+//routing cache requested to be calculated ahead of time
+typedef struct aas_routingrequest_s
+{
+	int goalareanum;							//area the routing caches lead to
+	int travelflags;							//combinations of the travel flags
+} aas_routingrequest_t;
+
 //fields for the routing algorithm
 typedef struct aas_routingupdate_s
 {
@@ -255,6 +265,13 @@ typedef struct aas_s
 	//routing update
 	aas_routingupdate_t *areaupdate;
 	aas_routingupdate_t *portalupdate;
+	int maxreachabilityareas;
+	//routing update fields for every routing thread
+	aas_routingupdate_t *threadareaupdate;
+	int numthreadareaupdates;
+	//routing caches requested to be calculated at the start of the next frame
+	aas_routingrequest_t routingrequests[MAX_ROUTINGREQUESTS];
+	int numroutingrequests;
 	//number of routing updates during a frame (reset every frame)
 	int frameroutingupdates;
 	//reversed reachability links
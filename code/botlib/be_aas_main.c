@@ -140,6 +140,8 @@ void AAS_ContinueInit(float time)
 	AAS_InitRouting();
 	//at this point AAS is initialized
 	AAS_SetInitialized();
+	//calculate the routing caches towards the items at the next frames
+	AAS_RequestItemRoutingCaches();
 } //end of the function AAS_ContinueInit
 //===========================================================================
 // called at the start of every frame
@@ -159,6 +161,8 @@ int AAS_StartFrame(float time)
 	AAS_ContinueInit(time);
 	//
 	aasworld.frameroutingupdates = 0;
+	//calculate the routing caches requested during the last frame
+	AAS_UpdateRoutingRequests();
 	//
 	if (botDeveloper)
 	{
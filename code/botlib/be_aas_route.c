@@ -61,6 +61,8 @@ Suite 120, Rockville, Maryland 20850 USA.
 
 //maximum number of routing updates each frame
 #define MAX_FRAMEROUTINGUPDATES		10
+//maximum number of requested routing caches calculated each frame per routing thread
+#define MAX_THREADROUTINGREQUESTS	16
 
 
 /*
@@ -878,6 +880,11 @@ void AAS_InitRoutingUpdate(void)
 	//allocate memory for the routing update fields
 	aasworld.areaupdate = (aas_routingupdate_t *) GetClearedMemory(
 									maxreachabilityareas * sizeof(aas_routingupdate_t));
+	aasworld.maxreachabilityareas = maxreachabilityareas;
+	//the routing thread fields are allocated when first needed
+	if (aasworld.threadareaupdate) FreeMemory(aasworld.threadareaupdate);
+	aasworld.threadareaupdate = NULL;
+	aasworld.numthreadareaupdates = 0;
 	//
 	if (aasworld.portalupdate) FreeMemory(aasworld.portalupdate);
 	//allocate memory for the portal update fields
@@ -1276,6 +1283,11 @@ void AAS_FreeRoutingCaches(void)
 	aasworld.areaupdate = NULL;
 	if (aasworld.portalupdate) FreeMemory(aasworld.portalupdate);
 	aasworld.portalupdate = NULL;
+	if (aasworld.threadareaupdate) FreeMemory(aasworld.threadareaupdate);
+	aasworld.threadareaupdate = NULL;
+	aasworld.numthreadareaupdates = 0;
+	// forget any pending routing cache requests
+	aasworld.numroutingrequests = 0;
 	// free lists with areas the reachabilities go through
 	if (aasworld.reachabilityareas) FreeMemory(aasworld.reachabilityareas);
 	aasworld.reachabilityareas = NULL;
@@ -1287,13 +1299,16 @@ void AAS_FreeRoutingCaches(void)
 	aasworld.areacontentstravelflags = NULL;
 } //end of the function AAS_FreeRoutingCaches
 //===========================================================================
-// update the given routing cache
+// calculate the travel times in the given routing cache
+// only reads the routing data of the world and writes to the cache and
+// the routing update fields so it can run on a routing thread
 //
 // Parameter:			areacache		: routing cache to update
+//						areaupdate		: routing update fields for the cluster areas
 // Returns:				-
 // Changes Globals:		-
 //===========================================================================
-void AAS_UpdateAreaRoutingCache(aas_routingcache_t *areacache)
+static void AAS_CalculateAreaRoutingCache(aas_routingcache_t *areacache, aas_routingupdate_t *areaupdate)
 {
 	int i, nextareanum, cluster, badtravelflags, clusterareanum, linknum;
 	int numreachabilityareas;
@@ -1303,15 +1318,10 @@ void AAS_UpdateAreaRoutingCache(aas_routingcache_t *areacache)
 	aas_reversedreachability_t *revreach;
 	aas_reversedlink_t *revlink;
 
-#ifdef ROUTING_DEBUG
-	numareacacheupdates++;
-#endif //ROUTING_DEBUG
 	//number of reachability areas within this cluster
 	numreachabilityareas = aasworld.clusters[areacache->cluster].numreachabilityareas;
-	//
-	aasworld.frameroutingupdates++;
 	//clear the routing update fields
-//	Com_Memset(aasworld.areaupdate, 0, aasworld.numareas * sizeof(aas_routingupdate_t));
+//	Com_Memset(areaupdate, 0, aasworld.numareas * sizeof(aas_routingupdate_t));
 	//
 	badtravelflags = ~areacache->travelflags;
 	//
@@ -1320,7 +1330,7 @@ void AAS_UpdateAreaRoutingCache(aas_routingcache_t *areacache)
 	//
 	Com_Memset(startareatraveltimes, 0, sizeof(startareatraveltimes));
 	//
-	curupdate = &aasworld.areaupdate[clusterareanum];
+	curupdate = &areaupdate[clusterareanum];
 	curupdate->areanum = areacache->areanum;
 	//VectorCopy(areacache->origin, curupdate->start);
 	curupdate->areatraveltimes = startareatraveltimes;
@@ -1376,7 +1386,7 @@ void AAS_UpdateAreaRoutingCache(aas_routingcache_t *areacache)
 			{
 				areacache->traveltimes[clusterareanum] = t;
 				areacache->reachabilities[clusterareanum] = linknum - aasworld.areasettings[nextareanum].firstreachablearea;
-				nextupdate = &aasworld.areaupdate[clusterareanum];
+				nextupdate = &areaupdate[clusterareanum];
 				nextupdate->areanum = nextareanum;
 				nextupdate->tmptraveltime = t;
 				//VectorCopy(reach->start, nextupdate->start);
@@ -1397,6 +1407,23 @@ void AAS_UpdateAreaRoutingCache(aas_routingcache_t *areacache)
 			} //end if
 		} //end for
 	} //end while
+} //end of the function AAS_CalculateAreaRoutingCache
+//===========================================================================
+// update the given routing cache
+//
+// Parameter:			areacache		: routing cache to update
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+void AAS_UpdateAreaRoutingCache(aas_routingcache_t *areacache)
+{
+#ifdef ROUTING_DEBUG
+	numareacacheupdates++;
+#endif //ROUTING_DEBUG
+	//
+	aasworld.frameroutingupdates++;
+	//
+	AAS_CalculateAreaRoutingCache(areacache, aasworld.areaupdate);
 } //end of the function AAS_UpdateAreaRoutingCache
 //===========================================================================
 //
@@ -1585,6 +1612,201 @@ aas_routingcache_t *AAS_GetPortalRoutingCache(int clusternum, int areanum, int t
 	return cache;
 } //end of the function AAS_GetPortalRoutingCache
 //===========================================================================
+// request the routing cache towards the goal area to be calculated at
+// the start of the next frame so routing to the goal doesn't stall the frame
+//
+// Parameter:			goalareanum		: area to route towards
+//						travelflags		: travel flags used for routing
+// Returns:				qtrue if the request is queued
+// Changes Globals:		-
+//===========================================================================
+int AAS_RequestRoutingCache(int goalareanum, int travelflags)
+{
+	int i;
+	aas_routingrequest_t *request;
+
+	if (!aasworld.initialized) return qfalse;
+	//
+	if (goalareanum <= 0 || goalareanum >= aasworld.numareas) return qfalse;
+	if (!aasworld.areasettings[goalareanum].numreachableareas) return qfalse;
+	//same as AAS_AreaRouteToGoalArea
+	if (AAS_AreaDoNotEnter(goalareanum))
+	{
+		travelflags |= TFL_DONOTENTER;
+	} //end if
+	//don't queue the same request twice
+	for (i = 0; i < aasworld.numroutingrequests; i++)
+	{
+		request = &aasworld.routingrequests[i];
+		if (request->goalareanum == goalareanum && request->travelflags == travelflags) return qtrue;
+	} //end for
+	if (aasworld.numroutingrequests >= MAX_ROUTINGREQUESTS) return qfalse;
+	//
+	request = &aasworld.routingrequests[aasworld.numroutingrequests++];
+	request->goalareanum = goalareanum;
+	request->travelflags = travelflags;
+	return qtrue;
+} //end of the function AAS_RequestRoutingCache
+//===========================================================================
+// calculate the travel times of a requested routing cache
+//
+// Parameter:			data			: array with the requested routing caches
+//						index			: routing cache to calculate
+//						threadNum		: routing thread calculating the cache
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+static void AAS_RoutingRequestJob(void *data, int index, int threadNum)
+{
+	aas_routingcache_t **caches = (aas_routingcache_t **) data;
+
+	AAS_CalculateAreaRoutingCache(caches[index],
+			&aasworld.threadareaupdate[threadNum * aasworld.maxreachabilityareas]);
+} //end of the function AAS_RoutingRequestJob
+//===========================================================================
+// calculate the routing caches requested during the last frame
+//
+// the caches are allocated on the calling thread, the routing threads
+// only fill in the travel times of their own caches, and the finished
+// caches are linked into the cache lists once all threads are done
+//
+// only the area cache of the goal area is calculated, the portal cache
+// floods the routing caches of every portal it reaches so it is left to
+// the first route to the goal from another cluster
+//
+// Parameter:			-
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+void AAS_UpdateRoutingRequests(void)
+{
+	int i, numthreads, numcaches, maxcaches, goalclusternum, clusterareanum;
+	aas_routingcache_t *caches[MAX_ROUTINGREQUESTS];
+	aas_routingcache_t *cache, *clustercache;
+	aas_routingrequest_t *request;
+
+	if (!aasworld.initialized || !aasworld.numroutingrequests) return;
+	// make sure the routing cache doesn't grow to large
+	while(AvailableMemory() < 1 * 1024 * 1024) {
+		if (!AAS_FreeOldestCache()) break;
+	}
+	if (AvailableMemory() < 2 * 1024 * 1024)
+	{
+		aasworld.numroutingrequests = 0;
+		return;
+	} //end if
+	//
+	numthreads = 1;
+	if (botimport.ParallelThreads && botimport.ParallelFor)
+	{
+		numthreads = botimport.ParallelThreads();
+		if (numthreads < 1) numthreads = 1;
+	} //end if
+	maxcaches = numthreads * MAX_THREADROUTINGREQUESTS;
+	if (maxcaches > MAX_ROUTINGREQUESTS) maxcaches = MAX_ROUTINGREQUESTS;
+	//routing update fields for every thread
+	if (aasworld.numthreadareaupdates < numthreads)
+	{
+		if (aasworld.threadareaupdate) FreeMemory(aasworld.threadareaupdate);
+		aasworld.threadareaupdate = (aas_routingupdate_t *) GetClearedMemory(
+						numthreads * aasworld.maxreachabilityareas * sizeof(aas_routingupdate_t));
+		aasworld.numthreadareaupdates = numthreads;
+	} //end if
+	//allocate the missing caches, they aren't linked into the cache lists
+	//before the travel times are calculated
+	numcaches = 0;
+	for (i = 0; i < aasworld.numroutingrequests && numcaches < maxcaches; i++)
+	{
+		request = &aasworld.routingrequests[i];
+		//same as AAS_AreaRouteToGoalArea, portal areas use the front cluster
+		goalclusternum = aasworld.areasettings[request->goalareanum].cluster;
+		if (goalclusternum < 0)
+		{
+			goalclusternum = aasworld.portals[-goalclusternum].frontcluster;
+		} //end if
+		clusterareanum = AAS_ClusterAreaNum(goalclusternum, request->goalareanum);
+		for (cache = aasworld.clusterareacache[goalclusternum][clusterareanum]; cache; cache = cache->next)
+		{
+			if (cache->travelflags == request->travelflags) break;
+		} //end for
+		//the requests are unique so only caches that already exist are skipped
+		if (cache) continue;
+		//
+		cache = AAS_AllocRoutingCache(aasworld.clusters[goalclusternum].numreachabilityareas);
+		cache->cluster = goalclusternum;
+		cache->areanum = request->goalareanum;
+		VectorCopy(aasworld.areas[request->goalareanum].center, cache->origin);
+		cache->starttraveltime = 1;
+		cache->travelflags = request->travelflags;
+		caches[numcaches++] = cache;
+	} //end for
+	//keep the rest for the next frame
+	aasworld.numroutingrequests -= i;
+	memmove(aasworld.routingrequests, aasworld.routingrequests + i,
+				aasworld.numroutingrequests * sizeof(aas_routingrequest_t));
+	//
+	if (!numcaches) return;
+#ifdef ROUTING_DEBUG
+	numareacacheupdates += numcaches;
+#endif //ROUTING_DEBUG
+	aasworld.frameroutingupdates += numcaches;
+	//calculate the travel times
+	if (numthreads > 1)
+	{
+		botimport.ParallelFor(AAS_RoutingRequestJob, caches, numcaches);
+	} //end if
+	else
+	{
+		for (i = 0; i < numcaches; i++)
+		{
+			AAS_RoutingRequestJob(caches, i, 0);
+		} //end for
+	} //end else
+	//link the finished caches into the cluster area caches
+	for (i = 0; i < numcaches; i++)
+	{
+		cache = caches[i];
+		clusterareanum = AAS_ClusterAreaNum(cache->cluster, cache->areanum);
+		clustercache = aasworld.clusterareacache[cache->cluster][clusterareanum];
+		cache->prev = NULL;
+		cache->next = clustercache;
+		if (clustercache) clustercache->prev = cache;
+		aasworld.clusterareacache[cache->cluster][clusterareanum] = cache;
+		//
+		cache->time = AAS_RoutingTime();
+		cache->type = CACHETYPE_AREA;
+		AAS_LinkCache(cache);
+	} //end for
+} //end of the function AAS_UpdateRoutingRequests
+//===========================================================================
+// request the routing caches towards the items of the level so the first
+// goals the bots pick don't have to calculate them during the frame
+//
+// Parameter:			-
+// Returns:				-
+// Changes Globals:		-
+//===========================================================================
+void AAS_RequestItemRoutingCaches(void)
+{
+	int ent, areanum;
+	char classname[MAX_EPAIRKEY];
+	vec3_t origin, goalorigin;
+	vec3_t mins = {-15, -15, -15}, maxs = {15, 15, 15};
+
+	for (ent = AAS_NextBSPEntity(0); ent; ent = AAS_NextBSPEntity(ent))
+	{
+		if (!AAS_ValueForBSPEpairKey(ent, "classname", classname, MAX_EPAIRKEY)) continue;
+		if (Q_strncmp(classname, "item_", 5) && Q_strncmp(classname, "weapon_", 7) &&
+				Q_strncmp(classname, "ammo_", 5) && Q_strncmp(classname, "holdable_", 9) &&
+				Q_strncmp(classname, "team_CTF_", 9)) continue;
+		if (!AAS_VectorForBSPEpairKey(ent, "origin", origin)) continue;
+		//same as the item goals of the bots
+		areanum = AAS_BestReachableArea(origin, mins, maxs, goalorigin);
+		if (!areanum) continue;
+		AAS_RequestRoutingCache(areanum, TFL_DEFAULT);
+	} //end for
+} //end of the function AAS_RequestItemRoutingCaches
+//===========================================================================
 //
 // Parameter:			-
 // Returns:				-
@@ -47,6 +47,10 @@ unsigned short int AAS_AreaTravelTime(int areanum, vec3_t start, vec3_t end);
 //
 void AAS_CreateAllRoutingCache(void);
 void AAS_WriteRouteCache(void);
+//calculate the requested routing caches
+void AAS_UpdateRoutingRequests(void);
+//request the routing caches towards the items of the level
+void AAS_RequestItemRoutingCaches(void);
 //
 void AAS_RoutingInfo(void);
 #endif //AASINTERN
@@ -71,5 +75,7 @@ int AAS_AreaTravelTimeToGoalArea(int areanum, vec3_t origin, int goalareanum, in
 int AAS_PredictRoute(struct aas_predictroute_s *route, int areanum, vec3_t origin,
 							int goalareanum, int travelflags, int maxareas, int maxtime,
 							int stopevent, int stopcontents, int stoptfl, int stopareanum);
+//request the routing caches towards the goal area to be calculated at the start of the next frame
+int AAS_RequestRoutingCache(int goalareanum, int travelflags);
 
 
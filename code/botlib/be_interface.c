@@ -350,6 +350,7 @@ static void Init_AAS_Export( aas_export_t *aas ) {
 	aas->AAS_AreaTravelTime = AAS_AreaTravelTime;
 	aas->AAS_AreaTravelTimeToGoalArea = AAS_AreaTravelTimeToGoalArea;
 	aas->AAS_PredictRoute = AAS_PredictRoute;
+	aas->AAS_RequestRoutingCache = AAS_RequestRoutingCache;
 	//--------------------------------------------
 	// be_aas_altroute.c
 	//--------------------------------------------
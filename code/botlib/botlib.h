@@ -37,7 +37,7 @@ Suite 120, Rockville, Maryland 20850 USA.
  *
  *****************************************************************************/
 
-#define	BOTLIB_API_VERSION		3
+#define	BOTLIB_API_VERSION		4
 
 struct aas_clientmove_s;
 struct aas_areainfo_s;
@@ -133,6 +133,9 @@ typedef struct botlib_import_s
 	//
 	int			(*DebugPolygonCreate)(int color, int numPoints, vec3_t *points);
 	void		(*DebugPolygonDelete)(int id);
+	//optional routing threads, when not set requested routing caches are calculated on the calling thread
+	int			(*ParallelThreads)(void);
+	void		(*ParallelFor)(void (*func)(void *data, int index, int threadNum), void *data, int count);
 } botlib_import_t;
 
 typedef struct aas_export_s
@@ -212,6 +215,7 @@ typedef struct aas_export_s
 	int			(*AAS_PredictRoute)(struct aas_predictroute_s *route, int areanum, vec3_t origin,
 							int goalareanum, int travelflags, int maxareas, int maxtime,
 							int stopevent, int stopcontents, int stoptfl, int stopareanum);
+	int			(*AAS_RequestRoutingCache)(int goalareanum, int travelflags);
 	//--------------------------------------------
 	// be_aas_altroute.c
 	//--------------------------------------------
@@ -230,6 +230,8 @@ void AAS_InitBotImport(void)
 	botimport.DebugLineShow = NULL;
 	botimport.DebugPolygonCreate = NULL;
 	botimport.DebugPolygonDelete = NULL;
+	botimport.ParallelThreads = NULL;
+	botimport.ParallelFor = NULL;
 } //end of the function AAS_InitBotImport
 //===========================================================================
 //
@@ -1158,6 +1158,8 @@ void CL_ShutdownCGame( void ) {
 
 	BSP_Free( cls.cgameBsp );
 	cls.cgameBsp = NULL;
+
+	FS_PrefetchEnd();
 }
 
 /*
@@ -1749,6 +1751,70 @@ intptr_t CL_CgameSystemCalls( intptr_t *args ) {
 }
 
 
+/*
+====================
+CL_PrefetchWorldAssets
+
+Start inflating the images of the world's shaders and the models used by
+its entities while cgame loads. Textures referenced only by shader scripts
+and sounds, which are streamed through file handles, aren't included.
+====================
+*/
+static void CL_PrefetchWorldAssets( void ) {
+	static const char *imageExtensions[] = { "tga", "jpg", "jpeg", "png", "ftx", "dds", "pcx", "bmp" };
+	char	name[MAX_QPATH];
+	char	key[MAX_TOKEN_CHARS];
+	char	*entities, *p, *token;
+	int		i, j;
+
+	if ( !cls.cgameBsp ) {
+		cls.cgameBsp = BSP_Load( cl.mapname );
+		if ( !cls.cgameBsp ) {
+			return;
+		}
+	}
+
+	// in the renderer's order of preference, stop at the first that exists
+	for ( i = 0; i < cls.cgameBsp->numShaders; i++ ) {
+		COM_StripExtension( cls.cgameBsp->shaders[i].shader, name, sizeof( name ) );
+
+		for ( j = 0; j < ARRAY_LEN( imageExtensions ); j++ ) {
+			if ( FS_PrefetchFile( va( "%s.%s", name, imageExtensions[j] ) ) ) {
+				break;
+			}
+		}
+	}
+
+	// the lump isn't guaranteed to be terminated
+	entities = Z_Malloc( cls.cgameBsp->entityStringLength + 1 );
+	Com_Memcpy( entities, cls.cgameBsp->entityString, cls.cgameBsp->entityStringLength );
+
+	p = entities;
+	while ( 1 ) {
+		token = COM_Parse( &p );
+		if ( !p ) {
+			break;
+		}
+		if ( token[0] == '{' || token[0] == '}' ) {
+			continue;
+		}
+
+		Q_strncpyz( key, token, sizeof( key ) );
+		token = COM_Parse( &p );
+		if ( !p ) {
+			break;
+		}
+
+		if ( ( !Q_stricmp( key, "model" ) || !Q_stricmp( key, "model2" ) ) && token[0] && token[0] != '*' ) {
+			FS_PrefetchFile( token );
+		}
+	}
+
+	Z_Free( entities );
+
+	FS_PrefetchStart();
+}
+
 /*
 ====================
 CL_InitCGame
@@ -1834,12 +1900,16 @@ void CL_InitCGame( void ) {
 		Com_Printf("Loading level %s...\n", mapname);
 	}
 
+	CL_PrefetchWorldAssets();
+
 	// init for this gamestate
 	// use the lastExecutedServerCommand instead of the serverCommandSequence
 	// otherwise server commands sent just before a gamestate are dropped
 	VM_Call( cgvm, CG_INGAME_INIT, clc.serverMessageSequence, clc.lastExecutedServerCommand, CL_MAX_SPLITVIEW,
 			clc.playerNums[0], clc.playerNums[1], clc.playerNums[2], clc.playerNums[3] );
 
+	FS_PrefetchEnd();
+
 	// entityBaselines, parseEntities, and snapshot player states are saved across vid_restart
 	if ( !cl.entityBaselines.pointer && !cl.parseEntities.pointer ) {
 		DA_Init( &cl.entityBaselines, MAX_GENTITIES, cl.cgameEntityStateSize, qtrue );
@@ -288,6 +288,16 @@ typedef enum {
 	G_CLIPTOENTITIES, // ( trace_t *results, const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end, int passEntityNum, int contentmask );
 	G_CLIPTOENTITIESCAPSULE, // ( trace_t *results, const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end, int passEntityNum, int contentmask );
 
+	G_TRACEBATCH, // ( trace_t *results, const vec3_t *starts, const vec3_t mins, const vec3_t maxs, const vec3_t *ends, int count, int passEntityNum, int contentmask );
+	G_TRACEBATCHCAPSULE, // ( trace_t *results, const vec3_t *starts, const vec3_t mins, const vec3_t maxs, const vec3_t *ends, int count, int passEntityNum, int contentmask );
+
+	G_BOT_PARALLEL_THREADS, // ( void );
+	// number of threads G_BOT_PARALLEL_FOR runs on, always 1 for QVMs
+
+	G_BOT_PARALLEL_FOR, // ( void (*func)( void *data, int index, int threadNum ), void *data, int count );
+	// calls func for every index on the bot routing threads and returns when all are done,
+	// only game libraries may use it
+
 } gameImport_t;
 
 
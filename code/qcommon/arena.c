@@ -0,0 +1,295 @@
+/*
+===========================================================================
+Copyright (C) 1999-2010 id Software LLC, a ZeniMax Media company.
+
+This file is part of Spearmint Source Code.
+
+Spearmint Source Code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 3 of the License,
+or (at your option) any later version.
+
+Spearmint Source Code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Spearmint Source Code.  If not, see <http://www.gnu.org/licenses/>.
+
+In addition, Spearmint Source Code is also subject to certain additional terms.
+You should have received a copy of these additional terms immediately following
+the terms and conditions of the GNU General Public License.  If not, please
+request a copy in writing from id Software at the address below.
+
+If you have questions concerning this license or the applicable additional
+terms, you may contact in writing id Software LLC, c/o ZeniMax Media Inc.,
+Suite 120, Rockville, Maryland 20850 USA.
+===========================================================================
+*/
+// arena.c -- frame scoped linear allocators
+
+#include "q_shared.h"
+#include "qcommon.h"
+
+/*
+==============================================================================
+
+A frame arena hands out scratch memory by bumping a pointer.  Nothing is
+freed individually, every arena is emptied at once at the start of the next
+Com_Frame, so the memory must not be kept across frames.  Unlike the hunk
+temp memory there is no LIFO ordering to follow.
+
+Each arena belongs to one thread.  The main thread uses Com_FrameAlloc and
+job pools give each worker thread its own arena, see Job_FrameAlloc.  When an
+arena is full the allocation falls back to malloc so worker threads never
+touch the zone, and the overflow shows up in meminfo.
+
+==============================================================================
+*/
+
+#define ARENA_ALIGN		16
+
+typedef struct arenaOverflow_s {
+	struct arenaOverflow_s	*next;
+} arenaOverflow_t;
+
+struct frameArena_s {
+	char			name[MAX_QPATH];
+	struct frameArena_s	*next;
+
+	byte			*base;			// allocated on first use
+	int				size;
+	int				used;
+
+	arenaOverflow_t	*overflow;		// malloced blocks that didn't fit
+	int				overflowBytes;
+
+	int				frameHighwater;		// most bytes used in a single frame
+	int				overflowHighwater;
+	int				overflowFrames;
+};
+
+static frameArena_t	*arenas;		// all arenas, reset by Com_Frame
+static frameArena_t	*com_frameArena;
+
+/*
+=================
+Arena_Create
+
+Should only be called from the main thread
+=================
+*/
+frameArena_t *Arena_Create( const char *name, int size ) {
+	frameArena_t	*arena;
+
+	arena = Z_Malloc( sizeof( *arena ) );
+	Q_strncpyz( arena->name, name, sizeof( arena->name ) );
+	arena->size = PAD( size, ARENA_ALIGN );
+
+	arena->next = arenas;
+	arenas = arena;
+
+	return arena;
+}
+
+/*
+=================
+Arena_Destroy
+=================
+*/
+void Arena_Destroy( frameArena_t *arena ) {
+	frameArena_t	**prev;
+
+	if ( !arena ) {
+		return;
+	}
+
+	for ( prev = &arenas; *prev; prev = &(*prev)->next ) {
+		if ( *prev == arena ) {
+			*prev = arena->next;
+			break;
+		}
+	}
+
+	Arena_Reset( arena );
+	free( arena->base );
+	Z_Free( arena );
+}
+
+/*
+=================
+Arena_Alloc
+
+Returns 16 byte aligned memory that is NOT 0 filled
+=================
+*/
+void *Arena_Alloc( frameArena_t *arena, int size ) {
+	arenaOverflow_t	*block;
+	void			*buf;
+
+	if ( size < 0 ) {
+		Com_Error( ERR_FATAL, "Arena_Alloc: %s: bad size %i", arena->name, size );
+	}
+
+	size = PAD( size, ARENA_ALIGN );
+
+	if ( !arena->base && arena->size ) {
+		arena->base = malloc( arena->size );
+		if ( !arena->base ) {
+			arena->size = 0;
+		}
+	}
+
+	if ( arena->used + size <= arena->size ) {
+		buf = arena->base + arena->used;
+		arena->used += size;
+		return buf;
+	}
+
+	// full, keep going with malloc until the next reset
+	block = malloc( ARENA_ALIGN + size );
+	if ( !block ) {
+		Com_Error( ERR_FATAL, "Arena_Alloc: %s: failed on allocation of %i bytes", arena->name, size );
+	}
+
+	block->next = arena->overflow;
+	arena->overflow = block;
+	arena->overflowBytes += size;
+
+	return (byte *)block + ARENA_ALIGN;
+}
+
+/*
+=================
+Arena_Mark / Arena_ClearToMark
+
+Releases everything allocated after the mark, for scratch memory that
+is only needed for a part of the frame.  Overflow blocks are kept until
+the next reset.
+=================
+*/
+int Arena_Mark( frameArena_t *arena ) {
+	return arena->used;
+}
+
+void Arena_ClearToMark( frameArena_t *arena, int mark ) {
+	if ( mark < 0 || mark > arena->used ) {
+		Com_Error( ERR_FATAL, "Arena_ClearToMark: %s: bad mark %i", arena->name, mark );
+	}
+
+	// the highwater has to include what is being released
+	if ( arena->used + arena->overflowBytes > arena->frameHighwater ) {
+		arena->frameHighwater = arena->used + arena->overflowBytes;
+	}
+
+	arena->used = mark;
+}
+
+/*
+=================
+Arena_Reset
+=================
+*/
+void Arena_Reset( frameArena_t *arena ) {
+	arenaOverflow_t	*block, *next;
+
+	if ( arena->used + arena->overflowBytes > arena->frameHighwater ) {
+		arena->frameHighwater = arena->used + arena->overflowBytes;
+	}
+
+	if ( arena->overflow ) {
+		if ( arena->overflowBytes > arena->overflowHighwater ) {
+			arena->overflowHighwater = arena->overflowBytes;
+		}
+		arena->overflowFrames++;
+
+		for ( block = arena->overflow; block; block = next ) {
+			next = block->next;
+			free( block );
+		}
+		arena->overflow = NULL;
+		arena->overflowBytes = 0;
+	}
+
+	arena->used = 0;
+}
+
+/*
+=================
+Arena_ResetAll
+
+Called at the start of each Com_Frame, no job may be running
+=================
+*/
+void Arena_ResetAll( void ) {
+	frameArena_t	*arena;
+
+	for ( arena = arenas; arena; arena = arena->next ) {
+		Arena_Reset( arena );
+	}
+}
+
+/*
+=================
+Arena_Info
+
+Prints the highwater marks for meminfo
+=================
+*/
+void Arena_Info( void ) {
+	frameArena_t	*arena;
+	int				highwater, overflowHighwater, overflowFrames;
+
+	for ( arena = arenas; arena; arena = arena->next ) {
+		// include the frame in progress
+		highwater = MAX( arena->frameHighwater, arena->used + arena->overflowBytes );
+		overflowHighwater = MAX( arena->overflowHighwater, arena->overflowBytes );
+		overflowFrames = arena->overflowFrames + ( arena->overflow != NULL );
+
+		Com_Printf( "%8i bytes in %s frame arena, %i highwater", arena->size, arena->name, highwater );
+		if ( overflowFrames ) {
+			Com_Printf( ", " S_COLOR_YELLOW "%i overflow highwater in %i frames" S_COLOR_WHITE, overflowHighwater, overflowFrames );
+		}
+		Com_Printf( "\n" );
+	}
+}
+
+/*
+=================
+Com_InitFrameArena
+=================
+*/
+void Com_InitFrameArena( void ) {
+	cvar_t	*cv;
+
+	// like com_zoneMegs this can only be set on the command line
+	cv = Cvar_Get( "com_frameArenaKB", "1024", CVAR_LATCH | CVAR_ARCHIVE );
+	Cvar_CheckRange( cv, 64, 65536, qtrue );
+
+	com_frameArena = Arena_Create( "main", cv->integer * 1024 );
+}
+
+/*
+=================
+Com_FrameAlloc
+
+Scratch memory for the main thread that is valid until the end of the frame
+=================
+*/
+void *Com_FrameAlloc( int size ) {
+	return Arena_Alloc( com_frameArena, size );
+}
+
+/*
+=================
+Com_FrameMark / Com_FrameClearToMark
+=================
+*/
+int Com_FrameMark( void ) {
+	return Arena_Mark( com_frameArena );
+}
+
+void Com_FrameClearToMark( int mark ) {
+	Arena_ClearToMark( com_frameArena, mark );
+}
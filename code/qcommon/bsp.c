@@ -97,7 +97,7 @@ bspFile_t *BSP_Load( const char *name ) {
 	// load the file
 	//
 #ifndef BSPC
-	length = FS_ReadFile( name, &buf.v );
+	length = FS_MapFile( name, &buf.v );
 #else
 	length = LoadQuakeFile((quakefile_t *) name, &buf.v);
 #endif
@@ -121,6 +121,12 @@ bspFile_t *BSP_Load( const char *name ) {
 		int ident = LittleLong( buf.i[0] );
 		int version = LittleLong( buf.i[1] );
 
+#ifndef BSPC
+		FS_UnmapFile( buf.v );
+#else
+		FS_FreeFile( buf.v );
+#endif
+
 		Com_Error( ERR_DROP, "Unsupported BSP %s: ident %c%c%c%c, version %d",
 				name, ident & 0xff, ( ident >> 8 ) & 0xff, ( ident >> 16 ) & 0xff,
 				( ident >> 24 ) & 0xff, version );
@@ -132,7 +138,11 @@ bspFile_t *BSP_Load( const char *name ) {
 		bsp_loadedFiles[freeSlot] = bspFile;
 	}
 
-	FS_FreeFile (buf.v);
+#ifndef BSPC
+	FS_UnmapFile( buf.v );
+#else
+	FS_FreeFile( buf.v );
+#endif
 
 	return bspFile;
 }
@@ -35,10 +35,7 @@ Suite 120, Rockville, Maryland 20850 USA.
 // to allow boxes to be treated as brush models, we allocate
 // some extra indexes along with those needed by the map
 #define BOX_LEAF_BRUSHES	1
-#define	BOX_BRUSHES		1
-#define	BOX_SIDES		6
 #define	BOX_LEAFS		2
-#define	BOX_PLANES		12
 
 #if 1 // ZTM: FIXME: BSP is already swapped by BSP_Load, but removing these probably makes merging ioq3 changes harder...
 #undef LittleShort
@@ -55,21 +52,23 @@ Suite 120, Rockville, Maryland 20850 USA.
 
 clipMap_t	cm;
 bspFile_t	*cm_bsp = NULL;
-int			c_pointcontents;
-int			c_traces, c_brush_traces, c_patch_traces;
 
 #ifndef BSPC
 cvar_t		*cm_noAreas;
 cvar_t		*cm_noCurves;
 cvar_t		*cm_playerCurveClip;
 cvar_t		*cm_betterSurfaceNums;
+cvar_t		*cm_patchCache;
+cvar_t		*cm_debugSurfaceUpdate;
 #endif
 
-cmodel_t	box_model;
-cplane_t	*box_planes;
-cbrush_t	*box_brush;
+CM_THREAD_LOCAL cmThread_t	*cm_thread;
+int			cm_mapGeneration = 1;
 
-int			capsule_contents;
+static cmThread_t	*cm_threads;		// every thread that has run a query
+#ifndef BSPC
+static void			*cm_threadMutex;
+#endif
 
 
 void	CM_InitBoxHull (void);
@@ -201,6 +200,32 @@ void CM_BoundBrush( cbrush_t *b ) {
 }
 
 
+/*
+=================
+CM_BrushPlaneSoA
+
+Copies the brush's side planes to soa, CM_PLANE_SOA_FLOATS( numsides ) floats.
+The lanes past the last side are zero.
+=================
+*/
+void CM_BrushPlaneSoA( const cbrush_t *brush, float *soa ) {
+	int			i;
+	float		*group;
+	cplane_t	*plane;
+
+	Com_Memset( soa, 0, CM_PLANE_SOA_FLOATS( brush->numsides ) * sizeof( *soa ) );
+
+	for ( i = 0 ; i < brush->numsides ; i++ ) {
+		group = soa + ( i >> 2 ) * 16;
+		plane = brush->sides[i].plane;
+
+		group[ 0 + ( i & 3 )] = plane->normal[0];
+		group[ 4 + ( i & 3 )] = plane->normal[1];
+		group[ 8 + ( i & 3 )] = plane->normal[2];
+		group[12 + ( i & 3 )] = plane->dist;
+	}
+}
+
 /*
 =================
 CMod_LoadBrushes
@@ -211,11 +236,13 @@ void CMod_LoadBrushes( void ) {
 	dbrush_t	*in;
 	cbrush_t	*out;
 	int			i, count;
+	int			numFloats;
+	float		*soa;
 
 	in = cm_bsp->brushes;
 	count = cm_bsp->numBrushes;
 
-	cm.brushes = Hunk_Alloc( ( BOX_BRUSHES + count ) * sizeof( *cm.brushes ), h_high );
+	cm.brushes = Hunk_Alloc( count * sizeof( *cm.brushes ), h_high );
 	cm.numBrushes = count;
 
 	out = cm.brushes;
@@ -233,6 +260,19 @@ void CMod_LoadBrushes( void ) {
 		CM_BoundBrush( out );
 	}
 
+	// copy the planes of every brush out for the SIMD side tests
+	numFloats = 0;
+	for ( i = 0 ; i < count ; i++ ) {
+		numFloats += CM_PLANE_SOA_FLOATS( cm.brushes[i].numsides );
+	}
+
+	soa = Hunk_Alloc( numFloats * sizeof( *soa ), h_high );
+
+	for ( i = 0, out = cm.brushes ; i < count ; i++, out++ ) {
+		out->planeSoA = soa;
+		CM_BrushPlaneSoA( out, soa );
+		soa += CM_PLANE_SOA_FLOATS( out->numsides );
+	}
 }
 
 /*
@@ -294,7 +334,7 @@ void CMod_LoadPlanes( void )
 
 	if (count < 1)
 		Com_Error (ERR_DROP, "Map with no planes");
-	cm.planes = Hunk_Alloc( ( BOX_PLANES + count ) * sizeof( *cm.planes ), h_high );
+	cm.planes = Hunk_Alloc( count * sizeof( *cm.planes ), h_high );
 	cm.numPlanes = count;
 
 	out = cm.planes;	
@@ -381,7 +421,7 @@ void CMod_LoadBrushSides ( void )
 	in = cm_bsp->brushSides;
 	count = cm_bsp->numBrushSides;
 
-	cm.brushsides = Hunk_Alloc( ( BOX_SIDES + count ) * sizeof( *cm.brushsides ), h_high );
+	cm.brushsides = Hunk_Alloc( count * sizeof( *cm.brushsides ), h_high );
 	cm.numBrushSides = count;
 
 	out = cm.brushsides;	
@@ -786,7 +826,10 @@ void CMod_LoadPatches( void ) {
 			patch->surfaceFlags = cm.shaders[shaderNum].surfaceFlags;
 
 			// create the internal facet structure
-			patch->pc = CM_GenerateTriangleSoupCollide( numVertexes, vertexes, numIndexes, indexes );
+			patch->pc = CM_CachedPatchCollide( i );
+			if ( !patch->pc ) {
+				patch->pc = CM_GenerateTriangleSoupCollide( numVertexes, vertexes, numIndexes, indexes );
+			}
 			continue;
 		}
 
@@ -817,7 +860,10 @@ void CMod_LoadPatches( void ) {
 		patch->surfaceFlags = cm.shaders[shaderNum].surfaceFlags;
 
 		// create the internal facet structure
-		patch->pc = CM_GeneratePatchCollide( width, height, points, LittleFloat( in->subdivisions ) );
+		patch->pc = CM_CachedPatchCollide( i );
+		if ( !patch->pc ) {
+			patch->pc = CM_GeneratePatchCollide( width, height, points, LittleFloat( in->subdivisions ) );
+		}
 	}
 }
 
@@ -842,6 +888,14 @@ void CM_LoadMap( const char *name, qboolean clientload, int *checksum ) {
 	cm_noCurves = Cvar_Get ("cm_noCurves", "0", CVAR_CHEAT);
 	cm_playerCurveClip = Cvar_Get ("cm_playerCurveClip", "1", CVAR_ARCHIVE|CVAR_CHEAT );
 	cm_betterSurfaceNums = Cvar_Get ("cm_betterSurfaceNums", "0", CVAR_LATCH );
+	cm_debugSurfaceUpdate = Cvar_Get ("r_debugSurfaceUpdate", "1", 0 );
+	cm_patchCache = Cvar_Get ("cm_patchCache", "1", 0 );
+
+	// threads only register once a map is loaded, so the main thread is
+	// always the one creating this
+	if ( !cm_threadMutex ) {
+		cm_threadMutex = Sys_CreateMutex();
+	}
 #endif
 	Com_DPrintf( "CM_LoadMap( %s, %i )\n", name, clientload );
 
@@ -883,7 +937,9 @@ void CM_LoadMap( const char *name, qboolean clientload, int *checksum ) {
 	CMod_LoadNodes();
 	CMod_LoadEntityString();
 	CMod_LoadVisibility();
+	CM_BeginPatchCache( name, cm_bsp->checksum, cm_bsp->numSurfaces );
 	CMod_LoadPatches();
+	CM_EndPatchCache( name, cm_bsp->checksum, cm.surfaces, cm.numSurfaces );
 
 	CMod_CreateBrushSideWindings();
 
@@ -891,6 +947,10 @@ void CM_LoadMap( const char *name, qboolean clientload, int *checksum ) {
 
 	CM_FloodAreaConnections ();
 
+	// size the per-thread arrays for the new map
+	cm_mapGeneration++;
+	CM_GetThread()->mainThread = qtrue;
+
 	// allow this to be cached if it is loaded by the server
 	if ( !clientload ) {
 		Q_strncpyz( cm.name, name, sizeof( cm.name ) );
@@ -907,6 +967,13 @@ void CM_ClearMap( void ) {
 	cm_bsp = NULL;
 	Com_Memset( &cm, 0, sizeof( cm ) );
 	CM_ClearLevelPatches();
+
+	cm_mapGeneration++;
+
+#ifndef BSPC
+	// traces for the next map go in a new file
+	CM_StopRecording();
+#endif
 }
 
 /*
@@ -922,7 +989,7 @@ cmodel_t	*CM_ClipHandleToModel( clipHandle_t handle ) {
 		return &cm.cmodels[handle];
 	}
 	if ( handle == BOX_MODEL_HANDLE || handle == CAPSULE_MODEL_HANDLE ) {
-		return &box_model;
+		return &CM_GetThread()->boxModel;
 	}
 	Com_Error( ERR_DROP, "CM_ClipHandleToModel: bad handle %i (max %d)", handle, cm.numSubModels );
 
@@ -997,50 +1064,59 @@ int		CM_LeafArea( int leafnum ) {
 ===================
 CM_InitBoxHull
 
-Set up the planes and nodes so that the six floats of a bounding box
-can just be stored out and get a proper clipping hull structure.
+Point the extra leaf brush past the end of the map's at the temporary
+box, each thread has its own box brush standing in for it.
 ===================
 */
 void CM_InitBoxHull (void)
+{
+	cm.leafbrushes[cm.numLeafBrushes] = cm.numBrushes;
+}
+
+/*
+===================
+CM_InitThreadBoxHull
+
+Set up the planes so that the six floats of a bounding box can just
+be stored out and get a proper clipping hull structure.
+===================
+*/
+static void CM_InitThreadBoxHull( cmThread_t *thread )
 {
 	int			i;
 	int			side;
 	cplane_t	*p;
 	cbrushside_t	*s;
+	cbrush_t	*box_brush;
 
-	box_planes = &cm.planes[cm.numPlanes];
-
-	box_brush = &cm.brushes[cm.numBrushes];
+	box_brush = &thread->boxBrush;
 	box_brush->numsides = 6;
-	box_brush->sides = cm.brushsides + cm.numBrushSides;
+	box_brush->sides = thread->boxSides;
 	box_brush->contents = 0; // Will be set to CONTENTS_SOLID, CONTENTS_BODY, etc
-	box_brush->edges = (cbrushedge_t *)Hunk_Alloc(
-			sizeof( cbrushedge_t ) * 12, h_low );
+	box_brush->edges = thread->boxEdges;
 	box_brush->numEdges = 12;
+	box_brush->planeSoA = thread->boxPlaneSoA;
 
-	box_model.leaf.numLeafBrushes = 1;
-//	box_model.leaf.firstLeafBrush = cm.numBrushes;
-	box_model.leaf.firstLeafBrush = cm.numLeafBrushes;
-	cm.leafbrushes[cm.numLeafBrushes] = cm.numBrushes;
+	thread->boxModel.leaf.numLeafBrushes = 1;
 
 	for (i=0 ; i<6 ; i++)
 	{
 		side = i&1;
 
 		// brush sides
-		s = &cm.brushsides[cm.numBrushSides+i];
-		s->plane = 	cm.planes + (cm.numPlanes+i*2+side);
+		s = &thread->boxSides[i];
+		s->plane = &thread->boxPlanes[i*2+side];
 		s->surfaceFlags = 0;
 		s->surfaceNum = -1;
 
 		// planes
-		p = &box_planes[i*2];
+		p = &thread->boxPlanes[i*2];
 		p->type = i>>1;
 		p->signbits = 0;
 		VectorClear (p->normal);
 		p->normal[i>>1] = 1;
 
-		p = &box_planes[i*2+1];
+		p = &thread->boxPlanes[i*2+1];
 		p->type = 3 + (i>>1);
 		p->signbits = 0;
 		VectorClear (p->normal);
@@ -1050,6 +1126,133 @@ void CM_InitBoxHull (void)
 	}	
 }
 
+/*
+===================
+CM_SetupThread
+
+Slow path of CM_GetThread, creates the calling thread's query state the
+first time it runs a query and resizes it whenever a map is loaded.
+Uses malloc as job threads can't touch the zone.
+===================
+*/
+cmThread_t *CM_SetupThread( void ) {
+	cmThread_t	*thread;
+
+	thread = cm_thread;
+
+	if ( !thread ) {
+#ifndef BSPC
+		if ( cm_threadMutex ) {
+			Sys_LockMutex( cm_threadMutex );
+		}
+#endif
+		// take over the state of a thread that has exited
+		for ( thread = cm_threads; thread; thread = thread->next ) {
+			if ( !thread->inUse ) {
+				break;
+			}
+		}
+
+		if ( !thread ) {
+			thread = calloc( 1, sizeof( *thread ) );
+			if ( !thread ) {
+				Com_Error( ERR_FATAL, "CM_SetupThread: out of memory" );
+			}
+			CM_InitThreadBoxHull( thread );
+			thread->next = cm_threads;
+			cm_threads = thread;
+		}
+		thread->inUse = qtrue;
+		thread->mainThread = qfalse;
+#ifndef BSPC
+		if ( cm_threadMutex ) {
+			Sys_UnlockMutex( cm_threadMutex );
+		}
+#endif
+		cm_thread = thread;
+	}
+
+	if ( thread->mapGeneration != cm_mapGeneration ) {
+		free( thread->brushChecks );
+		free( thread->patchChecks );
+		free( thread->brushCollided );
+		free( thread->brushSlots );
+		free( thread->patchSlots );
+
+		// the temporary box is the brush past the end of the map's
+		thread->brushChecks = calloc( cm.numBrushes + 1, sizeof( *thread->brushChecks ) );
+		thread->patchChecks = calloc( cm.numSurfaces + 1, sizeof( *thread->patchChecks ) );
+		thread->brushCollided = calloc( cm.numBrushes + 1, sizeof( *thread->brushCollided ) );
+		thread->brushSlots = calloc( cm.numBrushes + 1, sizeof( *thread->brushSlots ) );
+		thread->patchSlots = calloc( cm.numSurfaces + 1, sizeof( *thread->patchSlots ) );
+		if ( !thread->brushChecks || !thread->patchChecks || !thread->brushCollided
+			|| !thread->brushSlots || !thread->patchSlots ) {
+			Com_Error( ERR_FATAL, "CM_SetupThread: out of memory" );
+		}
+
+		thread->checkcount = 0;
+		thread->boxModel.leaf.firstLeafBrush = cm.numLeafBrushes;
+		thread->mapGeneration = cm_mapGeneration;
+	}
+
+	return thread;
+}
+
+/*
+===================
+CM_ReleaseThread
+
+Called by a thread that has run queries before it exits, so a later
+thread can reuse its state
+===================
+*/
+void CM_ReleaseThread( void ) {
+	if ( !cm_thread ) {
+		return;
+	}
+
+	// the stats stay in the list until they are cleared
+	cm_thread->inUse = qfalse;
+	cm_thread = NULL;
+}
+
+/*
+===================
+CM_GetStats
+
+The counters of other threads may be mid update, good enough for
+com_showtrace
+===================
+*/
+void CM_GetStats( cmStats_t *stats ) {
+	cmThread_t	*thread;
+
+	Com_Memset( stats, 0, sizeof( *stats ) );
+
+	for ( thread = cm_threads; thread; thread = thread->next ) {
+		stats->traces += thread->c_traces;
+		stats->brushTraces += thread->c_brush_traces;
+		stats->patchTraces += thread->c_patch_traces;
+		stats->pointContents += thread->c_pointcontents;
+	}
+}
+
+/*
+===================
+CM_ClearStats
+===================
+*/
+void CM_ClearStats( void ) {
+	cmThread_t	*thread;
+
+	for ( thread = cm_threads; thread; thread = thread->next ) {
+		thread->c_traces = 0;
+		thread->c_brush_traces = 0;
+		thread->c_patch_traces = 0;
+		thread->c_pointcontents = 0;
+	}
+}
+
 /*
 ===================
 CM_TempBoxModel
@@ -1060,12 +1263,19 @@ Capsules are handled differently though.
 ===================
 */
 clipHandle_t CM_TempBoxModel( const vec3_t mins, const vec3_t maxs, collisionType_t collisionType, int contents ) {
+	cmThread_t	*thread;
+	cplane_t	*box_planes;
+	cbrush_t	*box_brush;
 
-	VectorCopy( mins, box_model.mins );
-	VectorCopy( maxs, box_model.maxs );
+	thread = CM_GetThread();
+	box_planes = thread->boxPlanes;
+	box_brush = &thread->boxBrush;
+
+	VectorCopy( mins, thread->boxModel.mins );
+	VectorCopy( maxs, thread->boxModel.maxs );
 
 	if ( collisionType == CT_CAPSULE ) {
-		capsule_contents = contents;
+		thread->capsuleContents = contents;
 		return CAPSULE_MODEL_HANDLE;
 	}
 
@@ -1115,6 +1325,8 @@ clipHandle_t CM_TempBoxModel( const vec3_t mins, const vec3_t maxs, collisionTyp
 	VectorCopy( mins, box_brush->bounds[0] );
 	VectorCopy( maxs, box_brush->bounds[1] );
 
+	CM_BrushPlaneSoA( box_brush, box_brush->planeSoA );
+
 	box_brush->contents = contents;
 
 	return BOX_MODEL_HANDLE;
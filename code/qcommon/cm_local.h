@@ -79,15 +79,13 @@ typedef struct {
 	vec3_t		bounds[2];
 	int			numsides;
 	cbrushside_t	*sides;
-	int			checkcount;		// to avoid repeated testings
-	qboolean	collided; // marker for optimisation
+	float		*planeSoA;		// sides' planes in groups of four, see CM_BrushPlaneSoA
 	cbrushedge_t	*edges;
 	int						numEdges;
 } cbrush_t;
 
 
 typedef struct {
-	int			checkcount;				// to avoid repeated testings
 	int			surfaceFlags;
 	int			contents;
 	struct patchCollide_s	*pc;
@@ -145,7 +143,6 @@ typedef struct {
 	cPatch_t	**surfaces;			// non-patches will be NULL
 
 	int			floodvalid;
-	int			checkcount;					// incremented on each trace
 } clipMap_t;
 
 
@@ -154,13 +151,110 @@ typedef struct {
 #define	SURFACE_CLIP_EPSILON	(0.125)
 
 extern	clipMap_t	cm;
-extern	int			c_pointcontents;
-extern	int			c_traces, c_brush_traces, c_patch_traces;
+extern	bspFile_t	*cm_bsp;
 extern	cvar_t		*cm_noAreas;
 extern	cvar_t		*cm_noCurves;
 extern	cvar_t		*cm_playerCurveClip;
 
-extern 	int			capsule_contents;
+#ifndef BSPC
+extern	cvar_t		*cm_debugSurfaceUpdate;
+extern	cvar_t		*cm_patchCache;
+#endif
+
+/*
+==============================================================
+
+Per-thread query state
+
+The map data is read-only once CM_LoadMap returns, so any number of
+threads may run queries at the same time.  Everything a query writes
+lives in the calling thread's cmThread_t instead: the visited stamps
+that keep a brush or patch from being tested twice, the collided
+markers used by lateral collision, the statistics counters and the
+temporary box and capsule model.
+
+==============================================================
+*/
+
+#ifdef BSPC
+#define CM_THREAD_LOCAL
+#elif defined( _MSC_VER )
+#define CM_THREAD_LOCAL	__declspec( thread )
+#else
+#define CM_THREAD_LOCAL	__thread
+#endif
+
+// brush planes are also stored as structure of arrays so that the trace code
+// can test four sides at a time, each group of four sides is
+// { normal[0] x4, normal[1] x4, normal[2] x4, dist x4 }
+#define CM_PLANE_SOA_FLOATS( numSides )		( ( ( numSides ) + 3 ) / 4 * 16 )
+
+void		CM_BrushPlaneSoA( const cbrush_t *brush, float *soa );
+
+typedef struct cmThread_s {
+	struct cmThread_s	*next;			// in cm_threads, for CM_GetStats
+	qboolean	inUse;					// cleared by CM_ReleaseThread
+	qboolean	mainThread;				// only the main thread updates debug surfaces
+
+	int			mapGeneration;			// cm_mapGeneration the arrays were sized for
+	int			checkcount;				// incremented on each query
+	int			*brushChecks;			// [cm.numBrushes + 1], last checkcount per brush
+	int			*patchChecks;			// [cm.numSurfaces], last checkcount per patch
+	unsigned	*brushSlots;			// [cm.numBrushes + 1], CM_TraceBatch slots that tested the brush
+	unsigned	*patchSlots;			// [cm.numSurfaces], CM_TraceBatch slots that tested the patch
+	byte		*brushCollided;			// [cm.numBrushes + 1], marker for lateral collision
+
+	// statistics, may be zeroed at any time
+	int			c_traces;
+	int			c_brush_traces;
+	int			c_patch_traces;
+	int			c_pointcontents;
+
+	// temporary box or capsule model from CM_TempBoxModel
+	cmodel_t	boxModel;
+	cbrush_t	boxBrush;				// stands in for cm.brushes[cm.numBrushes]
+	cbrushside_t	boxSides[6];
+	cplane_t	boxPlanes[12];
+	cbrushedge_t	boxEdges[12];
+	float		boxPlaneSoA[CM_PLANE_SOA_FLOATS( 6 )];
+	int			capsuleContents;
+} cmThread_t;
+
+extern	CM_THREAD_LOCAL cmThread_t	*cm_thread;
+extern	int			cm_mapGeneration;
+
+cmThread_t	*CM_SetupThread( void );
+
+/*
+==================
+CM_GetThread
+
+Returns the calling thread's query state, sized for the current map
+==================
+*/
+static ID_INLINE cmThread_t *CM_GetThread( void ) {
+	cmThread_t *thread = cm_thread;
+
+	if ( thread && thread->mapGeneration == cm_mapGeneration ) {
+		return thread;
+	}
+	return CM_SetupThread();
+}
+
+/*
+==================
+CM_LeafBrush
+
+Maps a leaf brush index to a brush, the one past the end is the
+thread's temporary box
+==================
+*/
+static ID_INLINE cbrush_t *CM_LeafBrush( cmThread_t *thread, int brushnum ) {
+	if ( brushnum == cm.numBrushes ) {
+		return &thread->boxBrush;
+	}
+	return &cm.brushes[brushnum];
+}
 
 // cm_test.c
 
@@ -194,6 +288,10 @@ typedef struct {
 	sphere_t	sphere;		// sphere for oriendted capsule collision
 	biSphere_t	biSphere;
 	qboolean	testLateralCollision; // whether or not to test for lateral collision
+	qboolean	brushCollided;	// set by CM_TraceThroughBrush when a plane was crossed
+	int			checkcount;	// brushes and patches stamped with this were already tested
+	unsigned	slotBit;	// CM_TraceBatch slot, the batch shares one checkcount, 0 for single traces
+	cmThread_t	*thread;	// query state of the calling thread
 } traceWork_t;
 
 typedef struct leafList_s {
@@ -204,6 +302,7 @@ typedef struct leafList_s {
 	vec3_t	bounds[2];
 	int		lastLeaf;		// for overflows where each leaf can't be stored individually
 	void	(*storeLeafs)( struct leafList_s *ll, int nodenum );
+	cmThread_t	*thread;	// query state of the calling thread
 } leafList_t;
 
 
@@ -225,3 +324,27 @@ struct patchCollide_s	*CM_GenerateTriangleSoupCollide( int numVertexes, vec3_t *
 void CM_TraceThroughPatchCollide( traceWork_t *tw, const struct patchCollide_s *pc );
 qboolean CM_PositionTestInPatchCollide( traceWork_t *tw, const struct patchCollide_s *pc );
 void CM_ClearLevelPatches( void );
+
+#ifdef BSPC
+#define CM_BeginPatchCache( mapname, checksum, numSurfaces )
+#define CM_CachedPatchCollide( surfaceNum )		NULL
+#define CM_EndPatchCache( mapname, checksum, surfaces, numSurfaces )
+#else
+void CM_BeginPatchCache( const char *mapname, int checksum, int numSurfaces );
+struct patchCollide_s *CM_CachedPatchCollide( int surfaceNum );
+void CM_EndPatchCache( const char *mapname, int checksum, cPatch_t **surfaces, int numSurfaces );
+#endif
+
+#ifndef BSPC
+// cm_replay.c
+
+extern	cvar_t			*cm_recordTraces;
+extern	fileHandle_t	cm_recordFile;
+
+void CM_RecordTrace( const vec3_t start, const vec3_t end, const vec3_t mins, const vec3_t maxs,
+		clipHandle_t model, int brushmask, const vec3_t origin, const vec3_t angles, traceType_t type );
+void CM_StopRecording( void );
+
+// only the main thread records, and it closes the file when the cvar is cleared
+#define CM_RECORDING_TRACES()	( cm_recordFile || ( cm_recordTraces && cm_recordTraces->integer ) )
+#endif
@@ -431,6 +431,55 @@ static	facet_t			facets[MAX_FACETS];
 #define	NORMAL_EPSILON	0.0001
 #define	DIST_EPSILON	0.02
 
+// planes are hashed on their distance, a bucket is wider than DIST_EPSILON
+// so any plane CM_PlaneEqual accepts is in the same or a neighbouring bucket
+#define	PLANE_HASHES		1024
+#define	PLANE_HASH_SCALE	8
+
+static	int				planeHashes[PLANE_HASHES];
+static	int				planeChain[MAX_PATCH_PLANES];	// next plane in the same bucket, or -1
+
+/*
+==================
+CM_PlaneHash
+==================
+*/
+static int CM_PlaneHash( float dist ) {
+	return (int)floor( dist * PLANE_HASH_SCALE ) & ( PLANE_HASHES - 1 );
+}
+
+/*
+==================
+CM_ClearPlanes
+==================
+*/
+static void CM_ClearPlanes( void ) {
+	numPlanes = 0;
+	Com_Memset( planeHashes, -1, sizeof( planeHashes ) );
+}
+
+/*
+==================
+CM_AddPlane
+==================
+*/
+static int CM_AddPlane( const float plane[4] ) {
+	int		hash;
+
+	if ( numPlanes == MAX_PATCH_PLANES ) {
+		Com_Error( ERR_DROP, "MAX_PATCH_PLANES" );
+	}
+
+	Vector4Copy( plane, planes[numPlanes].plane );
+	planes[numPlanes].signbits = CM_SignbitsForNormal( planes[numPlanes].plane );
+
+	hash = CM_PlaneHash( plane[3] );
+	planeChain[numPlanes] = planeHashes[hash];
+	planeHashes[hash] = numPlanes;
+
+	return numPlanes++;
+}
+
 /*
 ==================
 CM_PlaneEqual
@@ -496,26 +545,35 @@ CM_FindPlane2
 ==================
 */
 int CM_FindPlane2(float plane[4], int *flipped) {
-	int i;
-
-	// see if the points are close enough to an existing plane
-	for ( i = 0 ; i < numPlanes ; i++ ) {
-		if (CM_PlaneEqual(&planes[i], plane, flipped)) return i;
+	int		i, j, side, hash;
+	int		best;
+	int		dummy;
+
+	// see if the points are close enough to an existing plane, a flipped
+	// plane is hashed on the negated distance.  take the lowest numbered
+	// match so the result is the same as searching all planes in order
+	best = -1;
+	for ( side = 0 ; side < 2 ; side++ ) {
+		hash = CM_PlaneHash( side ? -plane[3] : plane[3] );
+
+		for ( j = -1 ; j <= 1 ; j++ ) {
+			for ( i = planeHashes[( hash + j ) & ( PLANE_HASHES - 1 )] ; i != -1 ; i = planeChain[i] ) {
+				if ( ( best == -1 || i < best ) && CM_PlaneEqual( &planes[i], plane, &dummy ) ) {
+					best = i;
+				}
+			}
+		}
 	}
 
-	// add a new plane
-	if ( numPlanes == MAX_PATCH_PLANES ) {
-		Com_Error( ERR_DROP, "MAX_PATCH_PLANES" );
+	if ( best != -1 ) {
+		CM_PlaneEqual( &planes[best], plane, flipped );
+		return best;
 	}
 
-	Vector4Copy( plane, planes[numPlanes].plane );
-	planes[numPlanes].signbits = CM_SignbitsForNormal( plane );
-
-	numPlanes++;
-
+	// add a new plane
 	*flipped = qfalse;
 
-	return numPlanes-1;
+	return CM_AddPlane( plane );
 }
 
 /*
@@ -558,16 +616,7 @@ static int CM_FindPlane( float *p1, float *p2, float *p3 ) {
 	}
 
 	// add a new plane
-	if ( numPlanes == MAX_PATCH_PLANES ) {
-		Com_Error( ERR_DROP, "MAX_PATCH_PLANES" );
-	}
-
-	Vector4Copy( plane, planes[numPlanes].plane );
-	planes[numPlanes].signbits = CM_SignbitsForNormal( plane );
-
-	numPlanes++;
-
-	return numPlanes-1;
+	return CM_AddPlane( plane );
 }
 
 /*
@@ -1030,7 +1079,7 @@ static void CM_PatchCollideFromGrid( cGrid_t *grid, patchCollide_t *pf ) {
 	int				borders[4];
 	int				noAdjust[4];
 
-	numPlanes = 0;
+	CM_ClearPlanes();
 	numFacets = 0;
 
 	// find the planes for each triangle of the grid
@@ -1343,7 +1392,7 @@ static void CM_PatchCollideFromTriangleSoup( cTriangleSoup_t *triSoup, patchColl
 	int				trianglePlanes[SHADER_MAX_TRIANGLES];
 	facet_t			*facet;
 
-	numPlanes = 0;
+	CM_ClearPlanes();
 	numFacets = 0;
 
 	// find the planes for each triangle of the grid
@@ -1455,6 +1504,318 @@ struct patchCollide_s	*CM_GenerateTriangleSoupCollide( int numVertexes, vec3_t *
 
 
 
+/*
+================================================================================
+
+PATCH COLLIDE CACHE
+
+Generating the collision data for patches is a large part of loading a map
+with many curves, so the results are written to cache/<gamedir>/<map>.pcol
+in the homepath and read back on the next load of the same bsp.  Like the
+compiled QVM cache it lives outside the game directory and is opened by OS
+path, so pure servers don't hide it and QVMs can't write it.  The file
+starts with a header that holds the bsp checksum, then has one record per
+patch or triangle soup in surface order.  Everything in it is a four byte
+little endian word.
+
+================================================================================
+*/
+
+#ifndef BSPC
+
+#define	PATCHCACHE_IDENT		(('L'<<24)+('O'<<16)+('C'<<8)+'P')
+#define	PATCHCACHE_VERSION		1
+
+typedef struct {
+	int		ident;
+	int		version;
+	int		checksum;
+	int		numSurfaces;
+} patchCacheHeader_t;
+
+static struct {
+	void		*buffer;
+	const int	*data;				// next unread word
+	const int	*end;
+	qboolean	stale;				// a patch was generated, write a new file
+} patchCache;
+
+/*
+===================
+CM_PatchCachePath
+===================
+*/
+static void CM_PatchCachePath( const char *mapname, char *ospath, int size ) {
+	char	name[MAX_QPATH];
+
+	COM_StripExtension( mapname, name, sizeof( name ) );
+	Q_strncpyz( ospath, FS_BuildOSPath( Cvar_VariableString( "fs_homepath" ), "cache",
+			va( "%s/%s.pcol", FS_GetCurrentGameDir(), name ) ), size );
+}
+
+/*
+===================
+CM_ReadPatchCacheWords
+===================
+*/
+static qboolean CM_ReadPatchCacheWords( void *out, int numWords ) {
+	int		*words = out;
+	int		i;
+
+	if ( numWords > patchCache.end - patchCache.data ) {
+		return qfalse;
+	}
+
+	for ( i = 0 ; i < numWords ; i++ ) {
+		words[i] = LittleLong( patchCache.data[i] );
+	}
+	patchCache.data += numWords;
+
+	return qtrue;
+}
+
+/*
+===================
+CM_WritePatchCacheWords
+===================
+*/
+static qboolean CM_WritePatchCacheWords( FILE *f, const void *in, int numWords ) {
+	const int	*words = in;
+	int			buffer[256];
+	int			i, count;
+
+	while ( numWords > 0 ) {
+		count = MIN( numWords, (int)ARRAY_LEN( buffer ) );
+		for ( i = 0 ; i < count ; i++ ) {
+			buffer[i] = LittleLong( words[i] );
+		}
+		if ( (int)fwrite( buffer, sizeof( buffer[0] ), count, f ) != count ) {
+			return qfalse;
+		}
+
+		words += count;
+		numWords -= count;
+	}
+
+	return qtrue;
+}
+
+/*
+===================
+CM_BeginPatchCache
+
+Reads the cache file if it was written for this bsp
+===================
+*/
+void CM_BeginPatchCache( const char *mapname, int checksum, int numSurfaces ) {
+	patchCacheHeader_t	header;
+	char				filename[MAX_OSPATH];
+	FILE				*f;
+	long				length;
+
+	Com_Memset( &patchCache, 0, sizeof( patchCache ) );
+	patchCache.stale = qtrue;
+
+	if ( !cm_patchCache->integer ) {
+		return;
+	}
+
+	CM_PatchCachePath( mapname, filename, sizeof( filename ) );
+
+	f = Sys_FOpen( filename, "rb" );
+	if ( !f ) {
+		return;
+	}
+
+	fseek( f, 0, SEEK_END );
+	length = ftell( f );
+	fseek( f, 0, SEEK_SET );
+
+	if ( length < (long)sizeof( header ) ) {
+		fclose( f );
+		return;
+	}
+
+	patchCache.buffer = Z_Malloc( length );
+	if ( (long)fread( patchCache.buffer, 1, length, f ) != length ) {
+		fclose( f );
+		return;
+	}
+	fclose( f );
+
+	patchCache.data = patchCache.buffer;
+	patchCache.end = patchCache.data + length / 4;
+
+	if ( !CM_ReadPatchCacheWords( &header, sizeof( header ) / 4 )
+		|| header.ident != PATCHCACHE_IDENT || header.version != PATCHCACHE_VERSION
+		|| header.checksum != checksum || header.numSurfaces != numSurfaces ) {
+		Com_DPrintf( "%s is out of date\n", filename );
+		return;
+	}
+
+	Com_DPrintf( "Loading patch collision from %s\n", filename );
+	patchCache.stale = qfalse;
+}
+
+/*
+===================
+CM_CachedPatchCollide
+
+Returns NULL if the patch has to be generated
+===================
+*/
+struct patchCollide_s *CM_CachedPatchCollide( int surfaceNum ) {
+	patchCollide_t	*pf;
+	int				counts[2];
+	int				num, i, j;
+	vec3_t			bounds[2];
+	facet_t			*facet;
+
+	// records are read in order, once one is bad the rest can't be trusted
+	if ( patchCache.stale ) {
+		return NULL;
+	}
+	patchCache.stale = qtrue;
+
+	if ( !CM_ReadPatchCacheWords( &num, 1 ) || num != surfaceNum
+		|| !CM_ReadPatchCacheWords( bounds, sizeof( bounds ) / 4 )
+		|| !CM_ReadPatchCacheWords( counts, 2 ) ) {
+		return NULL;
+	}
+
+	numPlanes = counts[0];
+	numFacets = counts[1];
+	if ( numPlanes < 0 || numPlanes > MAX_PATCH_PLANES || numFacets < 0 || numFacets > MAX_FACETS ) {
+		return NULL;
+	}
+
+	if ( !CM_ReadPatchCacheWords( planes, numPlanes * sizeof( planes[0] ) / 4 )
+		|| !CM_ReadPatchCacheWords( facets, numFacets * sizeof( facets[0] ) / 4 ) ) {
+		return NULL;
+	}
+
+	// the trace code trusts the plane numbers
+	for ( i = 0, facet = facets ; i < numFacets ; i++, facet++ ) {
+		if ( facet->surfacePlane < 0 || facet->surfacePlane >= numPlanes
+			|| facet->numBorders < 0 || facet->numBorders > (int)ARRAY_LEN( facet->borderPlanes ) ) {
+			return NULL;
+		}
+		for ( j = 0 ; j < facet->numBorders ; j++ ) {
+			if ( facet->borderPlanes[j] < 0 || facet->borderPlanes[j] >= numPlanes ) {
+				return NULL;
+			}
+		}
+	}
+
+	pf = Hunk_Alloc( sizeof( *pf ), h_high );
+	VectorCopy( bounds[0], pf->bounds[0] );
+	VectorCopy( bounds[1], pf->bounds[1] );
+
+	pf->numPlanes = numPlanes;
+	pf->numFacets = numFacets;
+	pf->facets = Hunk_Alloc( numFacets * sizeof( *pf->facets ), h_high );
+	Com_Memcpy( pf->facets, facets, numFacets * sizeof( *pf->facets ) );
+	pf->planes = Hunk_Alloc( numPlanes * sizeof( *pf->planes ), h_high );
+	Com_Memcpy( pf->planes, planes, numPlanes * sizeof( *pf->planes ) );
+
+	patchCache.stale = qfalse;
+
+	return pf;
+}
+
+/*
+===================
+CM_EndPatchCache
+
+Writes a new cache file if any patch had to be generated
+===================
+*/
+void CM_EndPatchCache( const char *mapname, int checksum, cPatch_t **surfaces, int numSurfaces ) {
+	patchCacheHeader_t	header;
+	const patchCollide_t	*pf;
+	char				filename[MAX_OSPATH];
+	char				tmpname[MAX_OSPATH];
+	FILE				*f;
+	int					i, counts[2];
+	qboolean			stale, ok;
+
+	stale = patchCache.stale;
+	if ( patchCache.buffer ) {
+		Z_Free( patchCache.buffer );
+	}
+	Com_Memset( &patchCache, 0, sizeof( patchCache ) );
+
+	if ( !stale || !cm_patchCache->integer ) {
+		return;
+	}
+
+	// don't leave files behind for maps without curves
+	for ( i = 0 ; i < numSurfaces ; i++ ) {
+		if ( surfaces[i] ) {
+			break;
+		}
+	}
+	if ( i == numSurfaces ) {
+		return;
+	}
+
+	CM_PatchCachePath( mapname, filename, sizeof( filename ) );
+	Com_sprintf( tmpname, sizeof( tmpname ), "%s.tmp", filename );
+
+	if ( FS_CreatePath( filename ) ) {
+		return;
+	}
+
+	// write to a temporary file and rename it, so another instance loading
+	// the same map never reads half of it
+	f = Sys_FOpen( tmpname, "wb" );
+	if ( !f ) {
+		Com_Printf( "Couldn't open %s for writing\n", tmpname );
+		return;
+	}
+
+	header.ident = PATCHCACHE_IDENT;
+	header.version = PATCHCACHE_VERSION;
+	header.checksum = checksum;
+	header.numSurfaces = numSurfaces;
+	ok = CM_WritePatchCacheWords( f, &header, sizeof( header ) / 4 );
+
+	for ( i = 0 ; ok && i < numSurfaces ; i++ ) {
+		if ( !surfaces[i] ) {
+			continue;
+		}
+		pf = surfaces[i]->pc;
+
+		counts[0] = pf->numPlanes;
+		counts[1] = pf->numFacets;
+
+		ok = CM_WritePatchCacheWords( f, &i, 1 )
+			&& CM_WritePatchCacheWords( f, pf->bounds, sizeof( pf->bounds ) / 4 )
+			&& CM_WritePatchCacheWords( f, counts, 2 )
+			&& CM_WritePatchCacheWords( f, pf->planes, pf->numPlanes * sizeof( pf->planes[0] ) / 4 )
+			&& CM_WritePatchCacheWords( f, pf->facets, pf->numFacets * sizeof( pf->facets[0] ) / 4 );
+	}
+
+	ok = !fclose( f ) && ok;
+
+	if ( ok ) {
+		remove( filename );
+		ok = !rename( tmpname, filename );
+	}
+
+	if ( !ok ) {
+		remove( tmpname );
+		Com_Printf( "Couldn't write %s\n", filename );
+		return;
+	}
+
+	Com_DPrintf( "Wrote patch collision to %s\n", filename );
+}
+
+#endif //BSPC
+
+
+
 /*
 ================================================================================
 
@@ -1479,9 +1840,6 @@ void CM_TracePointThroughPatchCollide( traceWork_t *tw, const struct patchCollid
 	int			i, j, k;
 	float		offset;
 	float		d1, d2;
-#ifndef BSPC
-	static cvar_t *cv;
-#endif //BSPC
 
 #ifndef BSPC
 	if ( !cm_playerCurveClip->integer || !tw->isPoint ) {
@@ -1539,10 +1897,7 @@ void CM_TracePointThroughPatchCollide( traceWork_t *tw, const struct patchCollid
 		if ( j == facet->numBorders ) {
 			// we hit this facet
 #ifndef BSPC
-			if (!cv) {
-				cv = Cvar_Get( "r_debugSurfaceUpdate", "1", 0 );
-			}
-			if (cv->integer) {
+			if (tw->thread->mainThread && cm_debugSurfaceUpdate->integer) {
 				debugPatchCollide = pc;
 				debugFacet = facet;
 			}
@@ -1623,9 +1978,6 @@ void CM_TraceThroughPatchCollide( traceWork_t *tw, const struct patchCollide_s *
 	facet_t	*facet;
 	float plane[4] = {0, 0, 0, 0}, bestplane[4] = {0, 0, 0, 0};
 	vec3_t startp, endp;
-#ifndef BSPC
-	static cvar_t *cv;
-#endif //BSPC
 
 	if ( !CM_BoundsIntersect( tw->bounds[0], tw->bounds[1],
 				pc->bounds[0], pc->bounds[1] ) ) {
@@ -1726,10 +2078,7 @@ void CM_TraceThroughPatchCollide( traceWork_t *tw, const struct patchCollide_s *
 					enterFrac = 0;
 				}
 #ifndef BSPC
-				if (!cv) {
-					cv = Cvar_Get( "r_debugSurfaceUpdate", "1", 0 );
-				}
-				if (cv && cv->integer) {
+				if (tw->thread->mainThread && cm_debugSurfaceUpdate->integer) {
 					debugPatchCollide = pc;
 					debugFacet = facet;
 				}
@@ -61,6 +61,10 @@ void		CM_TransformedBiSphereTrace( trace_t *results, const vec3_t start,
 							const vec3_t end, float startRad, float endRad,
 							clipHandle_t model, int mask,
 							const vec3_t origin );
+// traces the world for count traces sharing a size and mask at once
+void		CM_TraceBatch( trace_t *results, const vec3_t *starts, const vec3_t *ends, int count,
+						  const vec3_t mins, const vec3_t maxs,
+						  clipHandle_t model, int brushmask, traceType_t type );
 
 byte		*CM_ClusterPVS (int cluster);
 
@@ -79,5 +83,25 @@ qboolean	CM_AreasConnected( int area1, int area2 );
 
 int			CM_WriteAreaBits( byte *buffer, int area );
 
+// statistics summed over every thread that has run a query
+typedef struct {
+	int			traces;
+	int			brushTraces;
+	int			patchTraces;
+	int			pointContents;
+} cmStats_t;
+
+void		CM_GetStats( cmStats_t *stats );
+void		CM_ClearStats( void );
+
+// threads that have run queries call this before exiting
+void		CM_ReleaseThread( void );
+
+// cm_stress.c
+void		CM_InitCommands( void );
+
+// cm_replay.c
+void		CM_InitReplay( void );
+
 // cm_patch.c
 void CM_DrawDebugSurface( void (*drawPoly)(int color, int numPoints, float *points) );
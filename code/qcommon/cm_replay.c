@@ -0,0 +1,456 @@
+/*
+===========================================================================
+Copyright (C) 1999-2010 id Software LLC, a ZeniMax Media company.
+
+This file is part of Spearmint Source Code.
+
+Spearmint Source Code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 3 of the License,
+or (at your option) any later version.
+
+Spearmint Source Code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Spearmint Source Code.  If not, see <http://www.gnu.org/licenses/>.
+
+In addition, Spearmint Source Code is also subject to certain additional terms.
+You should have received a copy of these additional terms immediately following
+the terms and conditions of the GNU General Public License.  If not, please
+request a copy in writing from id Software at the address below.
+
+If you have questions concerning this license or the applicable additional
+terms, you may contact in writing id Software LLC, c/o ZeniMax Media Inc.,
+Suite 120, Rockville, Maryland 20850 USA.
+===========================================================================
+*/
+// cm_replay.c -- records box traces and replays them as a benchmark
+
+#include "cm_local.h"
+
+/*
+==============================================================================
+
+While cm_recordTraces is set every CM_BoxTrace and CM_TransformedBoxTrace
+made on the main thread is appended to traces/<map>.trc, including the
+bounds of the temporary box or capsule it was made against.
+
+cm_replayTraces loads the map the traces were recorded on, runs them all
+once to report the total time, then times each one on its own and prints
+nanoseconds per trace histograms for the brush, patch and capsule paths.
+A dedicated server with no map running is enough to benchmark:
+
+  spearmint-server +cm_replayTraces traces/q3dm17.trc +quit
+
+==============================================================================
+*/
+
+#define TRACES_IDENT		(('R'<<24)+('T'<<16)+('M'<<8)+'C')
+#define TRACES_VERSION		1
+
+#define REPLAY_MODEL_BOX		-1
+#define REPLAY_MODEL_CAPSULE	-2
+
+#define REPLAY_BUCKETS		14			// powers of two from 64 ns
+#define REPLAY_MIN_NSEC		64
+
+typedef struct {
+	int			ident;
+	int			version;
+	int			checksum;				// of the bsp the traces were recorded on
+	char		mapname[MAX_QPATH];
+} traceFileHeader_t;
+
+// all fields are four bytes so the record can be byte swapped as ints
+typedef struct {
+	vec3_t		start, end;
+	vec3_t		mins, maxs;
+	vec3_t		origin, angles;
+	vec3_t		boxMins, boxMaxs;		// temporary box or capsule model bounds
+	int			model;					// inline model, REPLAY_MODEL_BOX or REPLAY_MODEL_CAPSULE
+	int			boxContents;
+	int			brushmask;
+	int			type;					// traceType_t
+} recordedTrace_t;
+
+typedef enum {
+	RP_BRUSH,							// tested brushes but no patches
+	RP_PATCH,							// tested at least one patch
+	RP_CAPSULE,							// capsule trace or capsule model
+	RP_EMPTY,							// only walked the tree
+
+	RP_NUM_PATHS
+} replayPath_t;
+
+static const char *replayPathNames[RP_NUM_PATHS] = { "brush", "patch", "capsule", "empty" };
+
+typedef struct {
+	int			count;
+	int64_t		totalNsec;
+	int			buckets[REPLAY_BUCKETS];
+} replayStats_t;
+
+cvar_t			*cm_recordTraces;
+fileHandle_t	cm_recordFile;
+
+/*
+=================
+CM_SwapRecord
+=================
+*/
+static void CM_SwapRecord( void *data, int size ) {
+	int		*words = data;
+	int		i;
+
+	for ( i = 0; i < size / 4; i++ ) {
+		words[i] = LittleLong( words[i] );
+	}
+}
+
+/*
+=================
+CM_StopRecording
+=================
+*/
+void CM_StopRecording( void ) {
+	if ( !cm_recordFile ) {
+		return;
+	}
+
+	FS_FCloseFile( cm_recordFile );
+	cm_recordFile = 0;
+	Com_Printf( "Stopped recording traces\n" );
+}
+
+/*
+=================
+CM_StartRecording
+=================
+*/
+static void CM_StartRecording( void ) {
+	traceFileHeader_t	header;
+	char				name[MAX_QPATH];
+	char				filename[MAX_QPATH];
+
+	COM_StripExtension( COM_SkipPath( cm.name ), name, sizeof( name ) );
+	Com_sprintf( filename, sizeof( filename ), "traces/%s.trc", name );
+
+	cm_recordFile = FS_FOpenFileWrite( filename );
+	if ( !cm_recordFile ) {
+		Com_Printf( "Couldn't open %s for writing\n", filename );
+		Cvar_Set( "cm_recordTraces", "0" );
+		return;
+	}
+
+	Com_Memset( &header, 0, sizeof( header ) );
+	header.ident = TRACES_IDENT;
+	header.version = TRACES_VERSION;
+	header.checksum = cm_bsp->checksum;
+	Q_strncpyz( header.mapname, cm.name, sizeof( header.mapname ) );
+	CM_SwapRecord( &header, (int)( (byte *)&header.mapname - (byte *)&header ) );
+
+	FS_Write( &header, sizeof( header ), cm_recordFile );
+
+	Com_Printf( "Recording traces to %s\n", filename );
+}
+
+/*
+=================
+CM_RecordTrace
+
+Called for every box trace while cm_recordTraces is set or a file is open
+=================
+*/
+void CM_RecordTrace( const vec3_t start, const vec3_t end, const vec3_t mins, const vec3_t maxs,
+		clipHandle_t model, int brushmask, const vec3_t origin, const vec3_t angles, traceType_t type ) {
+	cmThread_t		*thread;
+	recordedTrace_t	rec;
+
+	thread = CM_GetThread();
+
+	// only the main thread touches the file
+	if ( !thread->mainThread ) {
+		return;
+	}
+
+	if ( !cm_recordTraces->integer || !cm.name[0] ) {
+		CM_StopRecording();
+		return;
+	}
+
+	if ( !cm_recordFile ) {
+		CM_StartRecording();
+		if ( !cm_recordFile ) {
+			return;
+		}
+	}
+
+	Com_Memset( &rec, 0, sizeof( rec ) );
+	VectorCopy( start, rec.start );
+	VectorCopy( end, rec.end );
+	if ( mins ) {
+		VectorCopy( mins, rec.mins );
+	}
+	if ( maxs ) {
+		VectorCopy( maxs, rec.maxs );
+	}
+	VectorCopy( origin, rec.origin );
+	VectorCopy( angles, rec.angles );
+	rec.brushmask = brushmask;
+	rec.type = type;
+
+	if ( model == BOX_MODEL_HANDLE || model == CAPSULE_MODEL_HANDLE ) {
+		VectorCopy( thread->boxModel.mins, rec.boxMins );
+		VectorCopy( thread->boxModel.maxs, rec.boxMaxs );
+		if ( model == BOX_MODEL_HANDLE ) {
+			rec.model = REPLAY_MODEL_BOX;
+			rec.boxContents = thread->boxBrush.contents;
+		} else {
+			rec.model = REPLAY_MODEL_CAPSULE;
+			rec.boxContents = thread->capsuleContents;
+		}
+	} else {
+		rec.model = model;
+	}
+
+	CM_SwapRecord( &rec, sizeof( rec ) );
+	FS_Write( &rec, sizeof( rec ), cm_recordFile );
+}
+
+/*
+=================
+CM_ReplayTrace
+=================
+*/
+static void CM_ReplayTrace( const recordedTrace_t *rec ) {
+	trace_t			trace;
+	clipHandle_t	model;
+
+	if ( rec->model == REPLAY_MODEL_BOX ) {
+		model = CM_TempBoxModel( rec->boxMins, rec->boxMaxs, CT_AABB, rec->boxContents );
+	} else if ( rec->model == REPLAY_MODEL_CAPSULE ) {
+		model = CM_TempBoxModel( rec->boxMins, rec->boxMaxs, CT_CAPSULE, rec->boxContents );
+	} else {
+		model = rec->model;
+	}
+
+	if ( !model && VectorCompare( rec->origin, vec3_origin ) && VectorCompare( rec->angles, vec3_origin ) ) {
+		CM_BoxTrace( &trace, rec->start, rec->end, rec->mins, rec->maxs, model, rec->brushmask, rec->type );
+	} else {
+		CM_TransformedBoxTrace( &trace, rec->start, rec->end, rec->mins, rec->maxs, model, rec->brushmask,
+				rec->origin, rec->angles, rec->type );
+	}
+}
+
+/*
+=================
+CM_ReplayPercentile
+
+Upper bound of the bucket holding the given fraction of the traces
+=================
+*/
+static int CM_ReplayPercentile( const replayStats_t *stats, float fraction ) {
+	int		i, count;
+
+	count = 0;
+	for ( i = 0; i < REPLAY_BUCKETS - 1; i++ ) {
+		count += stats->buckets[i];
+		if ( count >= stats->count * fraction ) {
+			break;
+		}
+	}
+	return REPLAY_MIN_NSEC << ( i + 1 );
+}
+
+/*
+=================
+CM_ReplayTraces_f
+
+cm_replayTraces <file> [repeats]
+=================
+*/
+static void CM_ReplayTraces_f( void ) {
+	traceFileHeader_t	*header;
+	recordedTrace_t		*recs;
+	replayStats_t		stats[RP_NUM_PATHS];
+	replayStats_t		*path;
+	cmThread_t			*thread;
+	void				*buffer;
+	int					length, numTraces, repeats;
+	int					i, j, brushes, patches, nsec;
+	int					checksum;
+	int64_t				start, usec;
+	qboolean			loadedMap;
+
+	if ( Cmd_Argc() < 2 ) {
+		Com_Printf( "usage: cm_replayTraces <file> [repeats]\n" );
+		return;
+	}
+
+	repeats = Cmd_Argc() > 2 ? atoi( Cmd_Argv( 2 ) ) : 8;
+	if ( repeats < 1 ) {
+		repeats = 1;
+	}
+
+	if ( cm_recordTraces->integer ) {
+		Com_Printf( "Can't replay traces while cm_recordTraces is set\n" );
+		return;
+	}
+
+	// flush a recording that was just stopped, it may be the file to replay
+	CM_StopRecording();
+
+	length = FS_ReadFile( Cmd_Argv( 1 ), &buffer );
+	if ( !buffer ) {
+		Com_Printf( "Couldn't load %s\n", Cmd_Argv( 1 ) );
+		return;
+	}
+
+	header = buffer;
+	if ( length >= (int)sizeof( *header ) ) {
+		CM_SwapRecord( header, (int)( (byte *)&header->mapname - (byte *)header ) );
+	}
+	if ( length < (int)sizeof( *header ) || header->ident != TRACES_IDENT || header->version != TRACES_VERSION ) {
+		Com_Printf( "%s is not a version %d trace file\n", Cmd_Argv( 1 ), TRACES_VERSION );
+		FS_FreeFile( buffer );
+		return;
+	}
+	header->mapname[sizeof( header->mapname ) - 1] = '\0';
+
+	recs = (recordedTrace_t *)( header + 1 );
+	numTraces = ( length - (int)sizeof( *header ) ) / (int)sizeof( *recs );
+	for ( i = 0; i < numTraces; i++ ) {
+		CM_SwapRecord( &recs[i], sizeof( recs[i] ) );
+	}
+
+	// don't replace a map the server or client is using
+	loadedMap = qfalse;
+	if ( Q_stricmp( cm.name, header->mapname ) ) {
+		if ( com_sv_running->integer || cm.numNodes ) {
+			Com_Printf( "Another map is in use, the traces were recorded on %s\n", header->mapname );
+			FS_FreeFile( buffer );
+			return;
+		}
+		CM_LoadMap( header->mapname, qfalse, &checksum );
+		loadedMap = qtrue;
+	}
+
+	if ( cm_bsp->checksum != header->checksum ) {
+		Com_Printf( S_COLOR_YELLOW "WARNING: %s has changed since the traces were recorded\n", header->mapname );
+	}
+
+	// drop traces against models this map doesn't have
+	for ( i = j = 0; i < numTraces; i++ ) {
+		if ( recs[i].model >= cm.numSubModels || recs[i].model < REPLAY_MODEL_CAPSULE ) {
+			continue;
+		}
+		recs[j++] = recs[i];
+	}
+	if ( j != numTraces ) {
+		Com_Printf( "Skipping %d traces against unknown models\n", numTraces - j );
+		numTraces = j;
+	}
+
+	Com_Printf( "Replaying %d traces on %s\n", numTraces, header->mapname );
+
+	// one pass in recorded order, with the cache behaviour of a real frame
+	start = Sys_Microseconds();
+	for ( i = 0; i < numTraces; i++ ) {
+		CM_ReplayTrace( &recs[i] );
+	}
+	usec = Sys_Microseconds() - start;
+
+	Com_Printf( "%d traces in %.1f msec, %d ns per trace\n", numTraces, usec / 1000.0,
+			numTraces ? (int)( usec * 1000 / numTraces ) : 0 );
+
+	// then each trace repeated on its own, timers are only microsecond precise
+	Com_Memset( stats, 0, sizeof( stats ) );
+	thread = CM_GetThread();
+
+	for ( i = 0; i < numTraces; i++ ) {
+		brushes = thread->c_brush_traces;
+		patches = thread->c_patch_traces;
+
+		start = Sys_Microseconds();
+		for ( j = 0; j < repeats; j++ ) {
+			CM_ReplayTrace( &recs[i] );
+		}
+		nsec = (int)( ( Sys_Microseconds() - start ) * 1000 / repeats );
+
+		if ( recs[i].type == TT_CAPSULE || recs[i].model == REPLAY_MODEL_CAPSULE ) {
+			path = &stats[RP_CAPSULE];
+		} else if ( thread->c_patch_traces != patches ) {
+			path = &stats[RP_PATCH];
+		} else if ( thread->c_brush_traces != brushes ) {
+			path = &stats[RP_BRUSH];
+		} else {
+			path = &stats[RP_EMPTY];
+		}
+
+		path->count++;
+		path->totalNsec += nsec;
+
+		for ( j = 0; j < REPLAY_BUCKETS - 1; j++ ) {
+			if ( nsec < ( REPLAY_MIN_NSEC << ( j + 1 ) ) ) {
+				break;
+			}
+		}
+		path->buckets[j]++;
+	}
+
+	Com_Printf( "\n%10s", "ns" );
+	for ( i = 0; i < RP_NUM_PATHS; i++ ) {
+		Com_Printf( " %9s", replayPathNames[i] );
+	}
+	Com_Printf( "\n" );
+
+	for ( j = 0; j < REPLAY_BUCKETS; j++ ) {
+		if ( j == REPLAY_BUCKETS - 1 ) {
+			Com_Printf( "%3s%7d", ">=", REPLAY_MIN_NSEC << j );
+		} else {
+			Com_Printf( "%3s%7d", "<", REPLAY_MIN_NSEC << ( j + 1 ) );
+		}
+		for ( i = 0; i < RP_NUM_PATHS; i++ ) {
+			Com_Printf( " %9d", stats[i].buckets[j] );
+		}
+		Com_Printf( "\n" );
+	}
+
+	Com_Printf( "%10s", "count" );
+	for ( i = 0; i < RP_NUM_PATHS; i++ ) {
+		Com_Printf( " %9d", stats[i].count );
+	}
+	Com_Printf( "\n%10s", "mean" );
+	for ( i = 0; i < RP_NUM_PATHS; i++ ) {
+		Com_Printf( " %9d", stats[i].count ? (int)( stats[i].totalNsec / stats[i].count ) : 0 );
+	}
+	Com_Printf( "\n%10s", "p50 <" );
+	for ( i = 0; i < RP_NUM_PATHS; i++ ) {
+		Com_Printf( " %9d", stats[i].count ? CM_ReplayPercentile( &stats[i], 0.5f ) : 0 );
+	}
+	Com_Printf( "\n%10s", "p99 <" );
+	for ( i = 0; i < RP_NUM_PATHS; i++ ) {
+		Com_Printf( " %9d", stats[i].count ? CM_ReplayPercentile( &stats[i], 0.99f ) : 0 );
+	}
+	Com_Printf( "\n" );
+
+	FS_FreeFile( buffer );
+
+	if ( loadedMap ) {
+		CM_ClearMap();
+	}
+}
+
+/*
+=================
+CM_InitReplay
+=================
+*/
+void CM_InitReplay( void ) {
+	Cmd_AddCommand( "cm_replayTraces", CM_ReplayTraces_f );
+
+	cm_recordTraces = Cvar_Get( "cm_recordTraces", "0", 0 );
+}
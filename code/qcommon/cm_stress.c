@@ -0,0 +1,460 @@
+/*
+===========================================================================
+Copyright (C) 1999-2010 id Software LLC, a ZeniMax Media company.
+
+This file is part of Spearmint Source Code.
+
+Spearmint Source Code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 3 of the License,
+or (at your option) any later version.
+
+Spearmint Source Code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Spearmint Source Code.  If not, see <http://www.gnu.org/licenses/>.
+
+In addition, Spearmint Source Code is also subject to certain additional terms.
+You should have received a copy of these additional terms immediately following
+the terms and conditions of the GNU General Public License.  If not, please
+request a copy in writing from id Software at the address below.
+
+If you have questions concerning this license or the applicable additional
+terms, you may contact in writing id Software LLC, c/o ZeniMax Media Inc.,
+Suite 120, Rockville, Maryland 20850 USA.
+===========================================================================
+*/
+// cm_stress.c -- checks that collision queries give the same results from any thread
+
+#include "cm_local.h"
+
+/*
+==============================================================================
+
+cm_traceStress runs batches of random queries against the loaded map, first
+on the main thread and then spread over a job pool, and compares the results.
+Every query is generated from its index alone, so both passes see the same
+inputs no matter which thread picks them up.
+
+==============================================================================
+*/
+
+#define STRESS_BATCH			8192
+#define STRESS_MAX_LEAFS		64
+#define STRESS_MAX_MISMATCHES	8
+#define STRESS_BATCH_TRACES		8
+#define STRESS_FAN_TRACES		16
+
+// contents bits are defined by the game, so hit everything
+#define STRESS_MASK				-1
+#define STRESS_BOX_CONTENTS		1
+
+typedef enum {
+	SQ_POINT,
+	SQ_BOX,
+	SQ_CAPSULE,
+	SQ_TEMPBOX,
+	SQ_TEMPCAPSULE,
+	SQ_INLINEMODEL,
+	SQ_BISPHERE,
+	SQ_CONTENTS,
+	SQ_TRACEBATCH,
+
+	SQ_NUM_QUERIES
+} stressQuery_t;
+
+typedef struct {
+	trace_t		trace;
+	int			contents;
+	int			numLeafs;
+	int			leafs[STRESS_MAX_LEAFS];
+	int			batchErrors;	// CM_TraceBatch results that differ from CM_BoxTrace
+} stressResult_t;
+
+typedef struct {
+	int				first;		// index of the first query in the batch
+	unsigned		seed;
+	stressResult_t	*results;
+} stressBatch_t;
+
+/*
+=================
+CM_StressRandom
+=================
+*/
+static unsigned CM_StressRandom( unsigned *state ) {
+	// xorshift32
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+/*
+=================
+CM_StressFloat
+
+Random float in [min, max]
+=================
+*/
+static float CM_StressFloat( unsigned *state, float min, float max ) {
+	return min + ( max - min ) * ( CM_StressRandom( state ) & 0xffff ) / 65535.0f;
+}
+
+/*
+=================
+CM_StressPoint
+=================
+*/
+static void CM_StressPoint( unsigned *state, vec3_t point ) {
+	cmodel_t	*world = &cm.cmodels[0];
+	int			i;
+
+	for ( i = 0; i < 3; i++ ) {
+		point[i] = CM_StressFloat( state, world->mins[i], world->maxs[i] );
+	}
+}
+
+/*
+=================
+CM_StressSize
+=================
+*/
+static void CM_StressSize( unsigned *state, vec3_t mins, vec3_t maxs ) {
+	int i;
+
+	for ( i = 0; i < 3; i++ ) {
+		maxs[i] = CM_StressFloat( state, 1, 48 );
+		mins[i] = -maxs[i];
+	}
+	mins[2] = -CM_StressFloat( state, 1, 32 );
+}
+
+/*
+=================
+CM_StressTracesEqual
+
+Compare field by field, trace_t may have padding
+=================
+*/
+static qboolean CM_StressTracesEqual( const trace_t *ta, const trace_t *tb ) {
+	if ( ta->allsolid != tb->allsolid || ta->startsolid != tb->startsolid
+		|| ta->fraction != tb->fraction || !VectorCompare( ta->endpos, tb->endpos )
+		|| ta->surfaceNum != tb->surfaceNum || ta->surfaceFlags != tb->surfaceFlags
+		|| ta->contents != tb->contents || ta->lateralFraction != tb->lateralFraction ) {
+		return qfalse;
+	}
+
+	if ( ta->fraction != 1.0f && !ta->allsolid && ( !VectorCompare( ta->plane.normal, tb->plane.normal )
+		|| ta->plane.dist != tb->plane.dist ) ) {
+		return qfalse;
+	}
+
+	return qtrue;
+}
+
+/*
+=================
+CM_StressQuery
+
+Run query number index, the inputs only depend on seed and index
+=================
+*/
+static void CM_StressQuery( unsigned seed, int index, stressResult_t *result ) {
+	unsigned		state;
+	stressQuery_t	query;
+	vec3_t			start, end, mins, maxs;
+	vec3_t			origin, angles;
+	vec3_t			starts[STRESS_BATCH_TRACES], ends[STRESS_BATCH_TRACES];
+	trace_t			traces[STRESS_BATCH_TRACES];
+	trace_t			single;
+	clipHandle_t	model;
+	int				lastLeaf;
+	int				i;
+
+	state = ( seed ^ ( (unsigned)index * 2654435761u ) ) | 1;
+	CM_StressRandom( &state );
+
+	Com_Memset( result, 0, sizeof( *result ) );
+
+	query = CM_StressRandom( &state ) % SQ_NUM_QUERIES;
+
+	CM_StressPoint( &state, start );
+	CM_StressSize( &state, mins, maxs );
+
+	// mostly short traces like movement, some long ones like weapons
+	if ( CM_StressRandom( &state ) & 3 ) {
+		for ( i = 0; i < 3; i++ ) {
+			end[i] = start[i] + CM_StressFloat( &state, -128, 128 );
+		}
+	} else {
+		CM_StressPoint( &state, end );
+	}
+
+	switch ( query ) {
+	case SQ_POINT:
+		CM_BoxTrace( &result->trace, start, end, NULL, NULL, 0, STRESS_MASK, TT_AABB );
+		break;
+
+	case SQ_BOX:
+		CM_BoxTrace( &result->trace, start, end, mins, maxs, 0, STRESS_MASK, TT_AABB );
+		break;
+
+	case SQ_CAPSULE:
+		CM_BoxTrace( &result->trace, start, end, mins, maxs, 0, STRESS_MASK, TT_CAPSULE );
+		break;
+
+	case SQ_TEMPBOX:
+	case SQ_TEMPCAPSULE:
+		// trace against an entity sized box or capsule somewhere near the start
+		for ( i = 0; i < 3; i++ ) {
+			origin[i] = start[i] + CM_StressFloat( &state, -64, 64 );
+		}
+		model = CM_TempBoxModel( mins, maxs, query == SQ_TEMPBOX ? CT_AABB : CT_CAPSULE, STRESS_BOX_CONTENTS );
+		CM_StressSize( &state, mins, maxs );
+		CM_TransformedBoxTrace( &result->trace, start, end, mins, maxs, model, STRESS_BOX_CONTENTS,
+				origin, vec3_origin, ( CM_StressRandom( &state ) & 1 ) ? TT_CAPSULE : TT_AABB );
+		break;
+
+	case SQ_INLINEMODEL:
+		if ( cm.numSubModels < 2 ) {
+			break;
+		}
+		model = CM_InlineModel( 1 + CM_StressRandom( &state ) % ( cm.numSubModels - 1 ) );
+		VectorSet( origin, CM_StressFloat( &state, -32, 32 ), CM_StressFloat( &state, -32, 32 ), 0 );
+		VectorSet( angles, 0, CM_StressFloat( &state, 0, 360 ), 0 );
+		CM_TransformedBoxTrace( &result->trace, start, end, mins, maxs, model, STRESS_MASK,
+				origin, angles, TT_AABB );
+		result->contents = CM_TransformedPointContents( end, model, origin, angles );
+		break;
+
+	case SQ_BISPHERE:
+		CM_BiSphereTrace( &result->trace, start, end, CM_StressFloat( &state, 1, 16 ),
+				CM_StressFloat( &state, 1, 32 ), 0, STRESS_MASK );
+		break;
+
+	case SQ_TRACEBATCH:
+		// a fan of shots from one point, each must match a single trace
+		for ( i = 0; i < STRESS_BATCH_TRACES; i++ ) {
+			VectorCopy( start, starts[i] );
+			VectorSet( ends[i], end[0] + CM_StressFloat( &state, -256, 256 ),
+					end[1] + CM_StressFloat( &state, -256, 256 ), end[2] + CM_StressFloat( &state, -256, 256 ) );
+		}
+		if ( CM_StressRandom( &state ) & 1 ) {
+			VectorClear( mins );
+			VectorClear( maxs );
+		}
+		CM_TraceBatch( traces, (const vec3_t *)starts, (const vec3_t *)ends, STRESS_BATCH_TRACES,
+				mins, maxs, 0, STRESS_MASK, TT_AABB );
+		result->trace = traces[CM_StressRandom( &state ) % STRESS_BATCH_TRACES];
+		for ( i = 0; i < STRESS_BATCH_TRACES; i++ ) {
+			CM_BoxTrace( &single, starts[i], ends[i], mins, maxs, 0, STRESS_MASK, TT_AABB );
+			if ( !CM_StressTracesEqual( &single, &traces[i] ) ) {
+				result->batchErrors++;
+			}
+			if ( traces[i].fraction < 1.0f ) {
+				result->contents++;
+			}
+		}
+		break;
+
+	case SQ_CONTENTS:
+	default:
+		VectorAdd( start, mins, mins );
+		VectorAdd( start, maxs, maxs );
+		result->contents = CM_PointContents( start, 0 );
+		result->numLeafs = CM_BoxLeafnums( mins, maxs, result->leafs, STRESS_MAX_LEAFS, &lastLeaf );
+		break;
+	}
+}
+
+/*
+=================
+CM_StressFans
+
+Times fans of shots from random points, as one CM_TraceBatch per fan and
+as one CM_BoxTrace per shot.  The two take turns going first so neither
+always finds the map data in the cache.  Returns the number of shots the
+two don't agree on.
+=================
+*/
+static int CM_StressFans( unsigned seed, int numFans, int64_t *batchedUsec, int64_t *singleUsec ) {
+	unsigned		state;
+	vec3_t			start, end;
+	vec3_t			starts[STRESS_FAN_TRACES], ends[STRESS_FAN_TRACES];
+	trace_t			batched[STRESS_FAN_TRACES], single[STRESS_FAN_TRACES];
+	int64_t			startTime;
+	int				fan, order, i, errors;
+
+	state = seed | 1;
+	errors = 0;
+	*batchedUsec = *singleUsec = 0;
+
+	for ( fan = 0; fan < numFans; fan++ ) {
+		CM_StressPoint( &state, start );
+		CM_StressPoint( &state, end );
+		for ( i = 0; i < STRESS_FAN_TRACES; i++ ) {
+			VectorCopy( start, starts[i] );
+			VectorSet( ends[i], end[0] + CM_StressFloat( &state, -256, 256 ),
+					end[1] + CM_StressFloat( &state, -256, 256 ), end[2] + CM_StressFloat( &state, -256, 256 ) );
+		}
+
+		for ( order = 0; order < 2; order++ ) {
+			startTime = Sys_Microseconds();
+			if ( order == ( fan & 1 ) ) {
+				CM_TraceBatch( batched, (const vec3_t *)starts, (const vec3_t *)ends, STRESS_FAN_TRACES,
+						NULL, NULL, 0, STRESS_MASK, TT_AABB );
+				*batchedUsec += Sys_Microseconds() - startTime;
+			} else {
+				for ( i = 0; i < STRESS_FAN_TRACES; i++ ) {
+					CM_BoxTrace( &single[i], starts[i], ends[i], NULL, NULL, 0, STRESS_MASK, TT_AABB );
+				}
+				*singleUsec += Sys_Microseconds() - startTime;
+			}
+		}
+
+		for ( i = 0; i < STRESS_FAN_TRACES; i++ ) {
+			if ( !CM_StressTracesEqual( &batched[i], &single[i] ) ) {
+				errors++;
+			}
+		}
+	}
+
+	return errors;
+}
+
+/*
+=================
+CM_StressResultsEqual
+=================
+*/
+static qboolean CM_StressResultsEqual( const stressResult_t *a, const stressResult_t *b ) {
+	if ( !CM_StressTracesEqual( &a->trace, &b->trace ) ) {
+		return qfalse;
+	}
+
+	if ( a->contents != b->contents || a->numLeafs != b->numLeafs || a->batchErrors != b->batchErrors ) {
+		return qfalse;
+	}
+
+	return !memcmp( a->leafs, b->leafs, a->numLeafs * sizeof( a->leafs[0] ) );
+}
+
+/*
+=================
+CM_StressJob
+=================
+*/
+static void CM_StressJob( void *data, int index, int threadNum ) {
+	stressBatch_t	*batch = data;
+
+	CM_StressQuery( batch->seed, batch->first + index, &batch->results[index] );
+}
+
+/*
+=================
+CM_TraceStress_f
+
+cm_traceStress [queries] [threads] [seed]
+=================
+*/
+static void CM_TraceStress_f( void ) {
+	int				numQueries, numThreads;
+	int				i, count, mismatches, batchErrors;
+	int				serialTime, parallelTime, start;
+	int				numFans, fanErrors;
+	int64_t			batchedTime, singleTime;
+	stressResult_t	*serial;
+	stressBatch_t	batch;
+	jobPool_t		*pool;
+
+	if ( !cm.numNodes ) {
+		Com_Printf( "No map loaded.\n" );
+		return;
+	}
+
+	numQueries = Cmd_Argc() > 1 ? atoi( Cmd_Argv( 1 ) ) : 1000000;
+	numThreads = Cmd_Argc() > 2 ? atoi( Cmd_Argv( 2 ) ) : Sys_ProcessorCount();
+	batch.seed = Cmd_Argc() > 3 ? atoi( Cmd_Argv( 3 ) ) : Sys_Milliseconds();
+
+	if ( numQueries < 1 ) {
+		numQueries = 1;
+	}
+	if ( numThreads < 2 ) {
+		numThreads = 2;
+	}
+
+	// the calling thread runs jobs too
+	pool = Job_CreatePool( "cm_traceStress", numThreads - 1 );
+
+	serial = Z_Malloc( STRESS_BATCH * sizeof( *serial ) );
+	batch.results = Z_Malloc( STRESS_BATCH * sizeof( *batch.results ) );
+
+	Com_Printf( "Running %d queries on %d threads, seed %u\n", numQueries, Job_NumThreads( pool ), batch.seed );
+
+	mismatches = batchErrors = 0;
+	serialTime = parallelTime = 0;
+
+	for ( batch.first = 0; batch.first < numQueries; batch.first += count ) {
+		count = MIN( STRESS_BATCH, numQueries - batch.first );
+
+		start = Sys_Milliseconds();
+		for ( i = 0; i < count; i++ ) {
+			CM_StressQuery( batch.seed, batch.first + i, &serial[i] );
+		}
+		serialTime += Sys_Milliseconds() - start;
+
+		start = Sys_Milliseconds();
+		Job_ParallelFor( pool, CM_StressJob, &batch, count );
+		parallelTime += Sys_Milliseconds() - start;
+
+		for ( i = 0; i < count; i++ ) {
+			batchErrors += serial[i].batchErrors;
+
+			if ( CM_StressResultsEqual( &serial[i], &batch.results[i] ) ) {
+				continue;
+			}
+
+			if ( mismatches < STRESS_MAX_MISMATCHES ) {
+				Com_Printf( S_COLOR_YELLOW "query %d: serial fraction %f contents %d, threaded fraction %f contents %d\n",
+						batch.first + i, serial[i].trace.fraction, serial[i].trace.contents,
+						batch.results[i].trace.fraction, batch.results[i].trace.contents );
+			}
+			mismatches++;
+		}
+	}
+
+	Z_Free( batch.results );
+	Z_Free( serial );
+	Job_DestroyPool( pool );
+
+	numFans = MAX( numQueries / STRESS_FAN_TRACES, 1 );
+	fanErrors = CM_StressFans( batch.seed, numFans, &batchedTime, &singleTime );
+
+	Com_Printf( "serial %d msec, threaded %d msec\n", serialTime, parallelTime );
+	Com_Printf( "%d fans of %d traces: batched %d msec, single %d msec\n",
+			numFans, STRESS_FAN_TRACES, (int)( batchedTime / 1000 ), (int)( singleTime / 1000 ) );
+	if ( fanErrors ) {
+		Com_Printf( S_COLOR_RED "%d batched shots differ from single traces\n", fanErrors );
+	}
+	if ( batchErrors ) {
+		Com_Printf( S_COLOR_RED "%d batched traces differ from single traces\n", batchErrors );
+	}
+	if ( mismatches ) {
+		Com_Printf( S_COLOR_RED "%d of %d queries differ\n", mismatches, numQueries );
+	} else {
+		Com_Printf( "All %d queries match\n", numQueries );
+	}
+}
+
+/*
+=================
+CM_InitCommands
+=================
+*/
+void CM_InitCommands( void ) {
+	Cmd_AddCommand( "cm_traceStress", CM_TraceStress_f );
+}
@@ -56,7 +56,7 @@ int CM_PointLeafnum_r( const vec3_t p, int num ) {
 			num = node->children[0];
 	}
 
-	c_pointcontents++;		// optimize counter
+	CM_GetThread()->c_pointcontents++;		// optimize counter
 
 	return -1 - num;
 }
@@ -101,6 +101,7 @@ void CM_StoreBrushes( leafList_t *ll, int nodenum ) {
 	int			brushnum;
 	cLeaf_t		*leaf;
 	cbrush_t	*b;
+	cmThread_t	*thread = ll->thread;
 
 	leafnum = -1 - nodenum;
 
@@ -108,11 +109,11 @@ void CM_StoreBrushes( leafList_t *ll, int nodenum ) {
 
 	for ( k = 0 ; k < leaf->numLeafBrushes ; k++ ) {
 		brushnum = cm.leafbrushes[leaf->firstLeafBrush+k];
-		b = &cm.brushes[brushnum];
-		if ( b->checkcount == cm.checkcount ) {
+		if ( thread->brushChecks[brushnum] == thread->checkcount ) {
 			continue;	// already checked this brush in another leaf
 		}
-		b->checkcount = cm.checkcount;
+		thread->brushChecks[brushnum] = thread->checkcount;
+		b = CM_LeafBrush( thread, brushnum );
 		for ( i = 0 ; i < 3 ; i++ ) {
 			if ( b->bounds[0][i] >= ll->bounds[1][i] || b->bounds[1][i] <= ll->bounds[0][i] ) {
 				break;
@@ -180,7 +181,8 @@ CM_BoxLeafnums
 int	CM_BoxLeafnums( const vec3_t mins, const vec3_t maxs, int *list, int listsize, int *lastLeaf) {
 	leafList_t	ll;
 
-	cm.checkcount++;
+	ll.thread = CM_GetThread();
+	ll.thread->checkcount++;
 
 	VectorCopy( mins, ll.bounds[0] );
 	VectorCopy( maxs, ll.bounds[1] );
@@ -205,7 +207,8 @@ CM_BoxBrushes
 int CM_BoxBrushes( const vec3_t mins, const vec3_t maxs, cbrush_t **list, int listsize ) {
 	leafList_t	ll;
 
-	cm.checkcount++;
+	ll.thread = CM_GetThread();
+	ll.thread->checkcount++;
 
 	VectorCopy( mins, ll.bounds[0] );
 	VectorCopy( maxs, ll.bounds[1] );
@@ -240,11 +243,14 @@ int CM_PointContents( const vec3_t p, clipHandle_t model ) {
 	int			contents;
 	float		d;
 	cmodel_t	*clipm;
+	cmThread_t	*thread;
 
 	if (!cm.numNodes) {	// map not loaded
 		return 0;
 	}
 
+	thread = CM_GetThread();
+
 	if ( model ) {
 		clipm = CM_ClipHandleToModel( model );
 		leaf = &clipm->leaf;
@@ -256,7 +262,7 @@ int CM_PointContents( const vec3_t p, clipHandle_t model ) {
 	contents = 0;
 	for (k=0 ; k<leaf->numLeafBrushes ; k++) {
 		brushnum = cm.leafbrushes[leaf->firstLeafBrush+k];
-		b = &cm.brushes[brushnum];
+		b = CM_LeafBrush( thread, brushnum );
 
 		if ( !CM_BoundsIntersectPoint( b->bounds[0], b->bounds[1], p ) ) {
 			continue;
@@ -29,6 +29,20 @@ Suite 120, Rockville, Maryland 20850 USA.
 */
 #include "cm_local.h"
 
+// brush sides are tested four at a time where SSE is always available
+#if idx64 || defined( __SSE__ ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 1 )
+#include <xmmintrin.h>
+#define CM_SIMD		1
+#else
+#define CM_SIMD		0
+#endif
+
+#define	MAX_SIMD_SIDES		64		// brushes with more sides are tested one at a time
+
+// traces in a CM_TraceBatch walk the tree in groups of this size,
+// at most one per bit of cmThread_t brushSlots
+#define	MAX_TRACE_BATCH		32
+
 // always use bbox vs. bbox collision and never capsule vs. bbox or vice versa
 //#define ALWAYS_BBOX_VS_BBOX
 // always use capsule vs. capsule collision and never capsule vs. bbox or vice versa
@@ -250,17 +264,19 @@ CM_TestInLeaf
 void CM_TestInLeaf( traceWork_t *tw, cLeaf_t *leaf ) {
 	int			k;
 	int			brushnum;
+	int			surfnum;
 	cbrush_t	*b;
 	cPatch_t	*patch;
+	cmThread_t	*thread = tw->thread;
 
 	// test box position against all brushes in the leaf
 	for (k=0 ; k<leaf->numLeafBrushes ; k++) {
 		brushnum = cm.leafbrushes[leaf->firstLeafBrush+k];
-		b = &cm.brushes[brushnum];
-		if (b->checkcount == cm.checkcount) {
+		if (thread->brushChecks[brushnum] == tw->checkcount) {
 			continue;	// already checked this brush in another leaf
 		}
-		b->checkcount = cm.checkcount;
+		thread->brushChecks[brushnum] = tw->checkcount;
+		b = CM_LeafBrush( thread, brushnum );
 
 		if ( !(b->contents & tw->contents)) {
 			continue;
@@ -279,14 +295,15 @@ void CM_TestInLeaf( traceWork_t *tw, cLeaf_t *leaf ) {
 	if ( !cm_noCurves->integer ) {
 #endif //BSPC
 		for ( k = 0 ; k < leaf->numLeafSurfaces ; k++ ) {
-			patch = cm.surfaces[ cm.leafsurfaces[ leaf->firstLeafSurface + k ] ];
+			surfnum = cm.leafsurfaces[ leaf->firstLeafSurface + k ];
+			patch = cm.surfaces[ surfnum ];
 			if ( !patch ) {
 				continue;
 			}
-			if ( patch->checkcount == cm.checkcount ) {
+			if ( thread->patchChecks[surfnum] == tw->checkcount ) {
 				continue;	// already checked this brush in another leaf
 			}
-			patch->checkcount = cm.checkcount;
+			thread->patchChecks[surfnum] = tw->checkcount;
 
 			if ( !(patch->contents & tw->contents)) {
 				continue;
@@ -339,14 +356,14 @@ void CM_TestCapsuleInCapsule( traceWork_t *tw, clipHandle_t model ) {
 	if ( VectorLengthSquared(tmp) < r ) {
 		tw->trace.startsolid = tw->trace.allsolid = qtrue;
 		tw->trace.fraction = 0;
-		tw->trace.contents = capsule_contents;
+		tw->trace.contents = tw->thread->capsuleContents;
 		return;
 	}
 	VectorSubtract(p1, bottom, tmp);
 	if ( VectorLengthSquared(tmp) < r ) {
 		tw->trace.startsolid = tw->trace.allsolid = qtrue;
 		tw->trace.fraction = 0;
-		tw->trace.contents = capsule_contents;
+		tw->trace.contents = tw->thread->capsuleContents;
 		return;
 	}
 	VectorCopy(offset, p2);
@@ -355,14 +372,14 @@ void CM_TestCapsuleInCapsule( traceWork_t *tw, clipHandle_t model ) {
 	if ( VectorLengthSquared(tmp) < r ) {
 		tw->trace.startsolid = tw->trace.allsolid = qtrue;
 		tw->trace.fraction = 0;
-		tw->trace.contents = capsule_contents;
+		tw->trace.contents = tw->thread->capsuleContents;
 		return;
 	}
 	VectorSubtract(p2, bottom, tmp);
 	if ( VectorLengthSquared(tmp) < r ) {
 		tw->trace.startsolid = tw->trace.allsolid = qtrue;
 		tw->trace.fraction = 0;
-		tw->trace.contents = capsule_contents;
+		tw->trace.contents = tw->thread->capsuleContents;
 		return;
 	}
 
@@ -380,7 +397,7 @@ void CM_TestCapsuleInCapsule( traceWork_t *tw, clipHandle_t model ) {
 		if ( VectorLengthSquared(tmp) < r ) {
 			tw->trace.startsolid = tw->trace.allsolid = qtrue;
 			tw->trace.fraction = 0;
-			tw->trace.contents = capsule_contents;
+			tw->trace.contents = tw->thread->capsuleContents;
 			return;
 		}
 	}
@@ -430,7 +447,7 @@ void CM_TestBoundingBoxInCapsule( traceWork_t *tw, clipHandle_t model ) {
 	VectorSet( tw->sphere.offset, 0, 0, tw->size[1][2] - tw->sphere.radius );
 
 	// replace the capsule with the bounding box
-	h = CM_TempBoxModel(bboxSize[0], bboxSize[1], CT_AABB, capsule_contents);
+	h = CM_TempBoxModel(bboxSize[0], bboxSize[1], CT_AABB, tw->thread->capsuleContents);
 	// calculate collision
 	cmod = CM_ClipHandleToModel( h );
 	CM_TestInLeaf( tw, &cmod->leaf );
@@ -462,13 +479,14 @@ void CM_PositionTest( traceWork_t *tw ) {
 	ll.storeLeafs = CM_StoreLeafs;
 	ll.lastLeaf = 0;
 	ll.overflowed = qfalse;
+	ll.thread = tw->thread;
 
-	cm.checkcount++;
+	tw->thread->checkcount++;
 
 	CM_BoxLeafnums_r( &ll, 0 );
 
 
-	cm.checkcount++;
+	tw->checkcount = ++tw->thread->checkcount;
 
 	// test the contents of the leafs
 	for (i=0 ; i < ll.count ; i++) {
@@ -497,7 +515,7 @@ CM_TraceThroughPatch
 void CM_TraceThroughPatch( traceWork_t *tw, cPatch_t *patch, int surfnum ) {
 	float		oldFrac;
 
-	c_patch_traces++;
+	tw->thread->c_patch_traces++;
 
 	oldFrac = tw->trace.fraction;
 
@@ -510,6 +528,75 @@ void CM_TraceThroughPatch( traceWork_t *tw, cPatch_t *patch, int surfnum ) {
 	}
 }
 
+/*
+================
+CM_BrushSideDistances
+
+Fills in the distances of the trace start and end from each side of
+the brush, pushed out by the box size like CM_TraceThroughBrush does
+for bounding boxes.  Returns qfalse if the sides have to be tested
+one at a time instead.
+================
+*/
+static qboolean CM_BrushSideDistances( const traceWork_t *tw, const cbrush_t *brush, float *d1s, float *d2s ) {
+#if CM_SIMD
+	const float	*soa;
+	int			g, numGroups;
+	__m128		zero, neg;
+	__m128		startx, starty, startz, endx, endy, endz;
+	__m128		minx, miny, minz, maxx, maxy, maxz;
+	__m128		nx, ny, nz, dist, ox, oy, oz;
+
+	if ( brush->numsides > MAX_SIMD_SIDES ) {
+		return qfalse;
+	}
+
+	zero = _mm_setzero_ps();
+	startx = _mm_set1_ps( tw->start[0] );
+	starty = _mm_set1_ps( tw->start[1] );
+	startz = _mm_set1_ps( tw->start[2] );
+	endx = _mm_set1_ps( tw->end[0] );
+	endy = _mm_set1_ps( tw->end[1] );
+	endz = _mm_set1_ps( tw->end[2] );
+	minx = _mm_set1_ps( tw->size[0][0] );
+	miny = _mm_set1_ps( tw->size[0][1] );
+	minz = _mm_set1_ps( tw->size[0][2] );
+	maxx = _mm_set1_ps( tw->size[1][0] );
+	maxy = _mm_set1_ps( tw->size[1][1] );
+	maxz = _mm_set1_ps( tw->size[1][2] );
+
+	numGroups = ( brush->numsides + 3 ) >> 2;
+	soa = brush->planeSoA;
+
+	for ( g = 0; g < numGroups; g++, soa += 16 ) {
+		nx = _mm_loadu_ps( soa );
+		ny = _mm_loadu_ps( soa + 4 );
+		nz = _mm_loadu_ps( soa + 8 );
+		dist = _mm_loadu_ps( soa + 12 );
+
+		// tw->offsets[ plane->signbits ], the maxs on axes the normal points down
+		neg = _mm_cmplt_ps( nx, zero );
+		ox = _mm_or_ps( _mm_and_ps( neg, maxx ), _mm_andnot_ps( neg, minx ) );
+		neg = _mm_cmplt_ps( ny, zero );
+		oy = _mm_or_ps( _mm_and_ps( neg, maxy ), _mm_andnot_ps( neg, miny ) );
+		neg = _mm_cmplt_ps( nz, zero );
+		oz = _mm_or_ps( _mm_and_ps( neg, maxz ), _mm_andnot_ps( neg, minz ) );
+
+		// same operation order as the scalar DotProducts
+		dist = _mm_sub_ps( dist, _mm_add_ps( _mm_add_ps( _mm_mul_ps( ox, nx ), _mm_mul_ps( oy, ny ) ), _mm_mul_ps( oz, nz ) ) );
+
+		_mm_storeu_ps( d1s + g * 4, _mm_sub_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( startx, nx ),
+				_mm_mul_ps( starty, ny ) ), _mm_mul_ps( startz, nz ) ), dist ) );
+		_mm_storeu_ps( d2s + g * 4, _mm_sub_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( endx, nx ),
+				_mm_mul_ps( endy, ny ) ), _mm_mul_ps( endz, nz ) ), dist ) );
+	}
+
+	return qtrue;
+#else
+	return qfalse;
+#endif
+}
+
 /*
 ================
 CM_TraceThroughBrush
@@ -527,6 +614,9 @@ void CM_TraceThroughBrush( traceWork_t *tw, cbrush_t *brush ) {
 	float		t;
 	vec3_t		startp;
 	vec3_t		endp;
+	float		sideD1[MAX_SIMD_SIDES];
+	float		sideD2[MAX_SIMD_SIDES];
+	qboolean	simd;
 
 	enterFrac = -1.0;
 	leaveFrac = 1.0;
@@ -536,7 +626,7 @@ void CM_TraceThroughBrush( traceWork_t *tw, cbrush_t *brush ) {
 		return;
 	}
 
-	c_brush_traces++;
+	tw->thread->c_brush_traces++;
 
 	getout = qfalse;
 	startout = qfalse;
@@ -575,7 +665,7 @@ void CM_TraceThroughBrush( traceWork_t *tw, cbrush_t *brush ) {
 			if( d1 <= 0 && d2 <= 0 )
 				continue;
 
-			brush->collided = qtrue;
+			tw->brushCollided = qtrue;
 
 			// crosses face
 			if( d1 > d2 )
@@ -652,7 +742,7 @@ void CM_TraceThroughBrush( traceWork_t *tw, cbrush_t *brush ) {
 				continue;
 			}
 
-			brush->collided = qtrue;
+			tw->brushCollided = qtrue;
 
 			// crosses face
 			if (d1 > d2) {	// enter
@@ -676,6 +766,8 @@ void CM_TraceThroughBrush( traceWork_t *tw, cbrush_t *brush ) {
 			}
 		}
 	} else {
+		simd = CM_BrushSideDistances( tw, brush, sideD1, sideD2 );
+
 		//
 		// compare the trace against all planes of the brush
 		// find the latest time the trace crosses a plane towards the interior
@@ -685,11 +777,16 @@ void CM_TraceThroughBrush( traceWork_t *tw, cbrush_t *brush ) {
 			side = brush->sides + i;
 			plane = side->plane;
 
-			// adjust the plane distance appropriately for mins/maxs
-			dist = plane->dist - DotProduct( tw->offsets[ plane->signbits ], plane->normal );
+			if ( simd ) {
+				d1 = sideD1[i];
+				d2 = sideD2[i];
+			} else {
+				// adjust the plane distance appropriately for mins/maxs
+				dist = plane->dist - DotProduct( tw->offsets[ plane->signbits ], plane->normal );
 
-			d1 = DotProduct( tw->start, plane->normal ) - dist;
-			d2 = DotProduct( tw->end, plane->normal ) - dist;
+				d1 = DotProduct( tw->start, plane->normal ) - dist;
+				d2 = DotProduct( tw->end, plane->normal ) - dist;
+			}
 
 			if (d2 > 0) {
 				getout = qtrue;	// endpoint is not in solid
@@ -708,7 +805,7 @@ void CM_TraceThroughBrush( traceWork_t *tw, cbrush_t *brush ) {
 				continue;
 			}
 
-			brush->collided = qtrue;
+			tw->brushCollided = qtrue;
 
 			// crosses face
 			if (d1 > d2) {	// enter
@@ -788,6 +885,7 @@ static void CM_ProximityToBrush( traceWork_t *tw, cbrush_t *brush )
 	VectorClear( tw2.sphere.offset );
 	VectorCopy( tw->start, tw2.start );
 	VectorCopy( tw->end, tw2.end );
+	tw2.thread = tw->thread;
 
 	CM_TraceThroughBrush( &tw2, brush );
 
@@ -847,6 +945,7 @@ static void CM_ProximityToPatch( traceWork_t *tw, cPatch_t *patch, int surfnum )
 	VectorClear( tw2.sphere.offset );
 	VectorCopy( tw->start, tw2.start );
 	VectorCopy( tw->end, tw2.end );
+	tw2.thread = tw->thread;
 
 	CM_TraceThroughPatch( &tw2, patch, surfnum );
 
@@ -858,6 +957,31 @@ static void CM_ProximityToPatch( traceWork_t *tw, cPatch_t *patch, int surfnum )
 		tw->trace.lateralFraction = 0.0f;
 }
 
+/*
+================
+CM_AlreadyChecked
+
+Stamps a brush or patch as tested by the trace, returns qtrue if it already
+was.  Traces walking the tree together in a CM_TraceBatch share a checkcount
+and keep a bit each, so one slot testing an item doesn't hide it from the
+others or make them test it twice.
+================
+*/
+static ID_INLINE qboolean CM_AlreadyChecked( const traceWork_t *tw, int *checks, unsigned *slots, int num ) {
+	if ( checks[num] != tw->checkcount ) {
+		checks[num] = tw->checkcount;
+		slots[num] = tw->slotBit;
+		return qfalse;
+	}
+
+	if ( !tw->slotBit || ( slots[num] & tw->slotBit ) ) {
+		return qtrue;
+	}
+
+	slots[num] |= tw->slotBit;
+	return qfalse;
+}
+
 /*
 ================
 CM_TraceThroughLeaf
@@ -869,29 +993,31 @@ void CM_TraceThroughLeaf( traceWork_t *tw, cLeaf_t *leaf ) {
 	int			surfnum;
 	cbrush_t	*b;
 	cPatch_t	*patch;
+	cmThread_t	*thread = tw->thread;
 
 	// trace line against all brushes in the leaf
 	for ( k = 0 ; k < leaf->numLeafBrushes ; k++ ) {
 		brushnum = cm.leafbrushes[leaf->firstLeafBrush+k];
 
-		b = &cm.brushes[brushnum];
-		if ( b->checkcount == cm.checkcount ) {
+		if ( CM_AlreadyChecked( tw, thread->brushChecks, thread->brushSlots, brushnum ) ) {
 			continue;	// already checked this brush in another leaf
 		}
-		b->checkcount = cm.checkcount;
 
+		b = CM_LeafBrush( thread, brushnum );
 		if ( !(b->contents & tw->contents) ) {
 			continue;
 		}
 
-		b->collided = qfalse;
+		thread->brushCollided[brushnum] = qfalse;
 
 		if ( !CM_BoundsIntersect( tw->bounds[0], tw->bounds[1],
 					b->bounds[0], b->bounds[1] ) ) {
 			continue;
 		}
 
+		tw->brushCollided = qfalse;
 		CM_TraceThroughBrush( tw, b );
+		thread->brushCollided[brushnum] = tw->brushCollided;
 		if ( !tw->trace.fraction ) {
 			tw->trace.lateralFraction = 0.0f;
 			return;
@@ -910,10 +1036,9 @@ void CM_TraceThroughLeaf( traceWork_t *tw, cLeaf_t *leaf ) {
 			if ( !patch ) {
 				continue;
 			}
-			if ( patch->checkcount == cm.checkcount ) {
+			if ( CM_AlreadyChecked( tw, thread->patchChecks, thread->patchSlots, surfnum ) ) {
 				continue;	// already checked this patch in another leaf
 			}
-			patch->checkcount = cm.checkcount;
 
 			if ( !(patch->contents & tw->contents) ) {
 				continue;
@@ -934,12 +1059,12 @@ void CM_TraceThroughLeaf( traceWork_t *tw, cLeaf_t *leaf ) {
 		{
 			brushnum = cm.leafbrushes[ leaf->firstLeafBrush + k ];
 
-			b = &cm.brushes[ brushnum ];
-
 			// This brush never collided, so don't bother
-			if( !b->collided )
+			if( !thread->brushCollided[ brushnum ] )
 				continue;
 
+			b = CM_LeafBrush( thread, brushnum );
+
 			if( !( b->contents & tw->contents ) )
 				continue;
 
@@ -1239,7 +1364,7 @@ void CM_TraceCapsuleThroughCapsule( traceWork_t *tw, clipHandle_t model ) {
 		// if the cylinder has a height
 		if ( h > 0 ) {
 			// test for collisions between the cylinders
-			CM_TraceThroughVerticalCylinder(tw, offset, radius, h, tw->start, tw->end, capsule_contents);
+			CM_TraceThroughVerticalCylinder(tw, offset, radius, h, tw->start, tw->end, tw->thread->capsuleContents);
 			if ( tw->trace.allsolid ) {
 				return;
 			}
@@ -1247,12 +1372,12 @@ void CM_TraceCapsuleThroughCapsule( traceWork_t *tw, clipHandle_t model ) {
 	}
 
 	// test for collision between the spheres
-	CM_TraceThroughSphere(tw, top, radius, startbottom, endbottom, capsule_contents);
+	CM_TraceThroughSphere(tw, top, radius, startbottom, endbottom, tw->thread->capsuleContents);
 	if ( tw->trace.allsolid ) {
 		return;
 	}
 
-	CM_TraceThroughSphere(tw, bottom, radius, starttop, endtop, capsule_contents);
+	CM_TraceThroughSphere(tw, bottom, radius, starttop, endtop, tw->thread->capsuleContents);
 }
 
 /*
@@ -1299,7 +1424,7 @@ void CM_TraceBoundingBoxThroughCapsule( traceWork_t *tw, clipHandle_t model ) {
 	VectorSet( tw->sphere.offset, 0, 0, tw->size[1][2] - tw->sphere.radius );
 
 	// replace the capsule with the bounding box
-	h = CM_TempBoxModel(bboxSize[0], bboxSize[1], CT_AABB, capsule_contents);
+	h = CM_TempBoxModel(bboxSize[0], bboxSize[1], CT_AABB, tw->thread->capsuleContents);
 	// calculate collision
 	cmod = CM_ClipHandleToModel( h );
 	CM_TraceThroughLeaf( tw, &cmod->leaf );
@@ -1427,128 +1552,187 @@ void CM_TraceThroughTree( traceWork_t *tw, int num, float p1f, float p2f, vec3_t
 
 /*
 ==================
-CM_Trace
+CM_SetupTrace
+
+Fills in a trace work for CM_Trace, everything but the point special case
 ==================
 */
-void CM_Trace( trace_t *results, const vec3_t start,
+static void CM_SetupTrace( traceWork_t *tw, cmThread_t *thread, const vec3_t start,
 		const vec3_t end, const vec3_t mins, const vec3_t maxs,
-		clipHandle_t model, const vec3_t origin, int brushmask,
-		traceType_t type, sphere_t *sphere ) {
+		const vec3_t origin, int brushmask, traceType_t type, sphere_t *sphere ) {
 	int			i;
-	traceWork_t	tw;
 	vec3_t		offset;
-	cmodel_t	*cmod;
-
-	cmod = CM_ClipHandleToModel( model );
-
-	cm.checkcount++;		// for multi-check avoidance
 
-	c_traces++;				// for statistics, may be zeroed
+	thread->c_traces++;		// for statistics, may be zeroed
 
 	// fill in a default trace
-	Com_Memset( &tw, 0, sizeof(tw) );
-	tw.trace.fraction = 1;	// assume it goes the entire distance until shown otherwise
-	VectorCopy(origin, tw.modelOrigin);
-	tw.type = type;
-
-	if (!cm.numNodes) {
-		*results = tw.trace;
-
-		return;	// map not loaded, shouldn't happen
-	}
-
-	// allow NULL to be passed in for 0,0,0
-	if ( !mins ) {
-		mins = vec3_origin;
-	}
-	if ( !maxs ) {
-		maxs = vec3_origin;
-	}
+	Com_Memset( tw, 0, sizeof(*tw) );
+	tw->thread = thread;
+	tw->checkcount = ++thread->checkcount;	// for multi-check avoidance
+	tw->trace.fraction = 1;	// assume it goes the entire distance until shown otherwise
+	VectorCopy(origin, tw->modelOrigin);
+	tw->type = type;
 
 	// set basic parms
-	tw.contents = brushmask;
+	tw->contents = brushmask;
 
 	// adjust so that mins and maxs are always symetric, which
 	// avoids some complications with plane expanding of rotated
 	// bmodels
 	for ( i = 0 ; i < 3 ; i++ ) {
 		offset[i] = ( mins[i] + maxs[i] ) * 0.5;
-		tw.size[0][i] = mins[i] - offset[i];
-		tw.size[1][i] = maxs[i] - offset[i];
-		tw.start[i] = start[i] + offset[i];
-		tw.end[i] = end[i] + offset[i];
+		tw->size[0][i] = mins[i] - offset[i];
+		tw->size[1][i] = maxs[i] - offset[i];
+		tw->start[i] = start[i] + offset[i];
+		tw->end[i] = end[i] + offset[i];
 	}
 
 	// if a sphere is already specified
 	if ( sphere ) {
-		tw.sphere = *sphere;
+		tw->sphere = *sphere;
 	}
 	else {
-		tw.sphere.radius = ( tw.size[1][0] > tw.size[1][2] ) ? tw.size[1][2]: tw.size[1][0];
-		tw.sphere.halfheight = tw.size[1][2];
-		VectorSet( tw.sphere.offset, 0, 0, tw.size[1][2] - tw.sphere.radius );
+		tw->sphere.radius = ( tw->size[1][0] > tw->size[1][2] ) ? tw->size[1][2]: tw->size[1][0];
+		tw->sphere.halfheight = tw->size[1][2];
+		VectorSet( tw->sphere.offset, 0, 0, tw->size[1][2] - tw->sphere.radius );
 	}
 
-	tw.maxOffset = tw.size[1][0] + tw.size[1][1] + tw.size[1][2];
+	tw->maxOffset = tw->size[1][0] + tw->size[1][1] + tw->size[1][2];
 
-	// tw.offsets[signbits] = vector to appropriate corner from origin
-	tw.offsets[0][0] = tw.size[0][0];
-	tw.offsets[0][1] = tw.size[0][1];
-	tw.offsets[0][2] = tw.size[0][2];
+	// tw->offsets[signbits] = vector to appropriate corner from origin
+	tw->offsets[0][0] = tw->size[0][0];
+	tw->offsets[0][1] = tw->size[0][1];
+	tw->offsets[0][2] = tw->size[0][2];
 
-	tw.offsets[1][0] = tw.size[1][0];
-	tw.offsets[1][1] = tw.size[0][1];
-	tw.offsets[1][2] = tw.size[0][2];
+	tw->offsets[1][0] = tw->size[1][0];
+	tw->offsets[1][1] = tw->size[0][1];
+	tw->offsets[1][2] = tw->size[0][2];
 
-	tw.offsets[2][0] = tw.size[0][0];
-	tw.offsets[2][1] = tw.size[1][1];
-	tw.offsets[2][2] = tw.size[0][2];
+	tw->offsets[2][0] = tw->size[0][0];
+	tw->offsets[2][1] = tw->size[1][1];
+	tw->offsets[2][2] = tw->size[0][2];
 
-	tw.offsets[3][0] = tw.size[1][0];
-	tw.offsets[3][1] = tw.size[1][1];
-	tw.offsets[3][2] = tw.size[0][2];
+	tw->offsets[3][0] = tw->size[1][0];
+	tw->offsets[3][1] = tw->size[1][1];
+	tw->offsets[3][2] = tw->size[0][2];
 
-	tw.offsets[4][0] = tw.size[0][0];
-	tw.offsets[4][1] = tw.size[0][1];
-	tw.offsets[4][2] = tw.size[1][2];
+	tw->offsets[4][0] = tw->size[0][0];
+	tw->offsets[4][1] = tw->size[0][1];
+	tw->offsets[4][2] = tw->size[1][2];
 
-	tw.offsets[5][0] = tw.size[1][0];
-	tw.offsets[5][1] = tw.size[0][1];
-	tw.offsets[5][2] = tw.size[1][2];
+	tw->offsets[5][0] = tw->size[1][0];
+	tw->offsets[5][1] = tw->size[0][1];
+	tw->offsets[5][2] = tw->size[1][2];
 
-	tw.offsets[6][0] = tw.size[0][0];
-	tw.offsets[6][1] = tw.size[1][1];
-	tw.offsets[6][2] = tw.size[1][2];
+	tw->offsets[6][0] = tw->size[0][0];
+	tw->offsets[6][1] = tw->size[1][1];
+	tw->offsets[6][2] = tw->size[1][2];
 
-	tw.offsets[7][0] = tw.size[1][0];
-	tw.offsets[7][1] = tw.size[1][1];
-	tw.offsets[7][2] = tw.size[1][2];
+	tw->offsets[7][0] = tw->size[1][0];
+	tw->offsets[7][1] = tw->size[1][1];
+	tw->offsets[7][2] = tw->size[1][2];
 
 	//
 	// calculate bounds
 	//
-	if ( tw.type == TT_CAPSULE ) {
+	if ( tw->type == TT_CAPSULE ) {
 		for ( i = 0 ; i < 3 ; i++ ) {
-			if ( tw.start[i] < tw.end[i] ) {
-				tw.bounds[0][i] = tw.start[i] - fabs(tw.sphere.offset[i]) - tw.sphere.radius;
-				tw.bounds[1][i] = tw.end[i] + fabs(tw.sphere.offset[i]) + tw.sphere.radius;
+			if ( tw->start[i] < tw->end[i] ) {
+				tw->bounds[0][i] = tw->start[i] - fabs(tw->sphere.offset[i]) - tw->sphere.radius;
+				tw->bounds[1][i] = tw->end[i] + fabs(tw->sphere.offset[i]) + tw->sphere.radius;
 			} else {
-				tw.bounds[0][i] = tw.end[i] - fabs(tw.sphere.offset[i]) - tw.sphere.radius;
-				tw.bounds[1][i] = tw.start[i] + fabs(tw.sphere.offset[i]) + tw.sphere.radius;
+				tw->bounds[0][i] = tw->end[i] - fabs(tw->sphere.offset[i]) - tw->sphere.radius;
+				tw->bounds[1][i] = tw->start[i] + fabs(tw->sphere.offset[i]) + tw->sphere.radius;
 			}
 		}
 	}
 	else {
 		for ( i = 0 ; i < 3 ; i++ ) {
-			if ( tw.start[i] < tw.end[i] ) {
-				tw.bounds[0][i] = tw.start[i] + tw.size[0][i];
-				tw.bounds[1][i] = tw.end[i] + tw.size[1][i];
+			if ( tw->start[i] < tw->end[i] ) {
+				tw->bounds[0][i] = tw->start[i] + tw->size[0][i];
+				tw->bounds[1][i] = tw->end[i] + tw->size[1][i];
 			} else {
-				tw.bounds[0][i] = tw.end[i] + tw.size[0][i];
-				tw.bounds[1][i] = tw.start[i] + tw.size[1][i];
+				tw->bounds[0][i] = tw->end[i] + tw->size[0][i];
+				tw->bounds[1][i] = tw->start[i] + tw->size[1][i];
 			}
 		}
 	}
+}
+
+/*
+==================
+CM_SetupSweep
+
+Point special case for traces that aren't position tests
+==================
+*/
+static void CM_SetupSweep( traceWork_t *tw ) {
+	if ( tw->size[0][0] == 0 && tw->size[0][1] == 0 && tw->size[0][2] == 0 ) {
+		tw->isPoint = qtrue;
+		VectorClear( tw->extents );
+	} else {
+		tw->isPoint = qfalse;
+		tw->extents[0] = tw->size[1][0];
+		tw->extents[1] = tw->size[1][1];
+		tw->extents[2] = tw->size[1][2];
+	}
+}
+
+/*
+==================
+CM_FinishTrace
+==================
+*/
+static void CM_FinishTrace( traceWork_t *tw, trace_t *results, const vec3_t start, const vec3_t end ) {
+	int			i;
+
+	// generate endpos from the original, unmodified start/end
+	if ( tw->trace.fraction == 1 ) {
+		VectorCopy (end, tw->trace.endpos);
+	} else {
+		for ( i=0 ; i<3 ; i++ ) {
+			tw->trace.endpos[i] = start[i] + tw->trace.fraction * (end[i] - start[i]);
+		}
+	}
+
+        // If allsolid is set (was entirely inside something solid), the plane is not valid.
+        // If fraction == 1.0, we never hit anything, and thus the plane is not valid.
+        // Otherwise, the normal on the plane should have unit length
+        assert(tw->trace.allsolid ||
+               tw->trace.fraction == 1.0 ||
+               VectorLengthSquared(tw->trace.plane.normal) > 0.9999);
+	*results = tw->trace;
+}
+
+/*
+==================
+CM_Trace
+==================
+*/
+void CM_Trace( trace_t *results, const vec3_t start,
+		const vec3_t end, const vec3_t mins, const vec3_t maxs,
+		clipHandle_t model, const vec3_t origin, int brushmask,
+		traceType_t type, sphere_t *sphere ) {
+	traceWork_t	tw;
+	cmodel_t	*cmod;
+
+	cmod = CM_ClipHandleToModel( model );
+
+	// allow NULL to be passed in for 0,0,0
+	if ( !mins ) {
+		mins = vec3_origin;
+	}
+	if ( !maxs ) {
+		maxs = vec3_origin;
+	}
+
+	CM_SetupTrace( &tw, CM_GetThread(), start, end, mins, maxs, origin, brushmask, type, sphere );
+
+	if (!cm.numNodes) {
+		*results = tw.trace;
+
+		return;	// map not loaded, shouldn't happen
+	}
 
 	//
 	// check for position test special case
@@ -1585,15 +1769,7 @@ void CM_Trace( trace_t *results, const vec3_t start,
 		//
 		// check for point special case
 		//
-		if ( tw.size[0][0] == 0 && tw.size[0][1] == 0 && tw.size[0][2] == 0 ) {
-			tw.isPoint = qtrue;
-			VectorClear( tw.extents );
-		} else {
-			tw.isPoint = qfalse;
-			tw.extents[0] = tw.size[1][0];
-			tw.extents[1] = tw.size[1][1];
-			tw.extents[2] = tw.size[1][2];
-		}
+		CM_SetupSweep( &tw );
 
 		//
 		// general sweeping through world
@@ -1627,22 +1803,356 @@ void CM_Trace( trace_t *results, const vec3_t start,
 		}
 	}
 
-	// generate endpos from the original, unmodified start/end
-	if ( tw.trace.fraction == 1 ) {
-		VectorCopy (end, tw.trace.endpos);
-	} else {
-		for ( i=0 ; i<3 ; i++ ) {
-			tw.trace.endpos[i] = start[i] + tw.trace.fraction * (end[i] - start[i]);
+	CM_FinishTrace( &tw, results, start, end );
+}
+
+// the part of a CM_TraceBatch trace inside the current node
+typedef struct {
+	traceWork_t	*tw;
+	float		p1f, p2f;
+	vec3_t		p1, p2;
+} traceSegment_t;
+
+/*
+==================
+CM_TraceBatchThroughLeaf
+
+CM_TraceThroughLeaf for the traces of a group that reached the leaf.  They
+share the brush mask, so each brush is fetched and checked against the
+bounds of the whole group once, and only the traces whose own bounds touch
+it test it.  Every trace still tests the leaf's brushes and then patches
+in order, so the results are the same.  Group traces never test lateral
+collision.
+==================
+*/
+static void CM_TraceBatchThroughLeaf( traceSegment_t **segs, int numSegs, cLeaf_t *leaf ) {
+	traceWork_t	*active[MAX_TRACE_BATCH];
+	vec3_t		bounds[2];
+	traceWork_t	*tw;
+	cmThread_t	*thread;
+	cbrush_t	*b;
+	cPatch_t	*patch;
+	int			i, k, numActive, brushnum, surfnum, contents;
+
+	numActive = 0;
+	ClearBounds( bounds[0], bounds[1] );
+
+	for ( i = 0 ; i < numSegs ; i++ ) {
+		tw = segs[i]->tw;
+		if ( tw->trace.fraction <= segs[i]->p1f ) {
+			continue;		// already hit something nearer
 		}
+		AddPointToBounds( tw->bounds[0], bounds[0], bounds[1] );
+		AddPointToBounds( tw->bounds[1], bounds[0], bounds[1] );
+		active[numActive++] = tw;
 	}
 
-        // If allsolid is set (was entirely inside something solid), the plane is not valid.
-        // If fraction == 1.0, we never hit anything, and thus the plane is not valid.
-        // Otherwise, the normal on the plane should have unit length
-        assert(tw.trace.allsolid ||
-               tw.trace.fraction == 1.0 ||
-               VectorLengthSquared(tw.trace.plane.normal) > 0.9999);
-	*results = tw.trace;
+	if ( !numActive ) {
+		return;
+	}
+
+	thread = active[0]->thread;
+	contents = active[0]->contents;
+
+	// trace lines against all brushes in the leaf
+	for ( k = 0 ; k < leaf->numLeafBrushes ; k++ ) {
+		brushnum = cm.leafbrushes[leaf->firstLeafBrush+k];
+
+		b = CM_LeafBrush( thread, brushnum );
+		if ( !(b->contents & contents) ) {
+			continue;
+		}
+
+		if ( !CM_BoundsIntersect( bounds[0], bounds[1], b->bounds[0], b->bounds[1] ) ) {
+			continue;	// misses all of them
+		}
+
+		for ( i = 0 ; i < numActive ; ) {
+			tw = active[i];
+
+			if ( CM_AlreadyChecked( tw, thread->brushChecks, thread->brushSlots, brushnum )
+				|| !CM_BoundsIntersect( tw->bounds[0], tw->bounds[1], b->bounds[0], b->bounds[1] ) ) {
+				i++;
+				continue;
+			}
+
+			CM_TraceThroughBrush( tw, b );
+			if ( !tw->trace.fraction ) {
+				tw->trace.lateralFraction = 0.0f;
+				active[i] = active[--numActive];
+				continue;
+			}
+			i++;
+		}
+
+		if ( !numActive ) {
+			return;
+		}
+	}
+
+	// trace lines against all patches in the leaf
+#ifdef BSPC
+	if (1) {
+#else
+	if ( !cm_noCurves->integer ) {
+#endif
+		for ( k = 0 ; k < leaf->numLeafSurfaces ; k++ ) {
+			surfnum = cm.leafsurfaces[ leaf->firstLeafSurface + k ];
+			patch = cm.surfaces[ surfnum ];
+			if ( !patch ) {
+				continue;
+			}
+			if ( !(patch->contents & contents) ) {
+				continue;
+			}
+
+			for ( i = 0 ; i < numActive ; ) {
+				tw = active[i];
+
+				if ( CM_AlreadyChecked( tw, thread->patchChecks, thread->patchSlots, surfnum ) ) {
+					i++;
+					continue;
+				}
+
+				CM_TraceThroughPatch( tw, patch, surfnum );
+				if ( !tw->trace.fraction ) {
+					tw->trace.lateralFraction = 0.0f;
+					active[i] = active[--numActive];
+					continue;
+				}
+				i++;
+			}
+
+			if ( !numActive ) {
+				return;
+			}
+		}
+	}
+}
+
+/*
+==================
+CM_TraceBatchThroughTree
+
+CM_TraceThroughTree for a group of traces.  Each trace is classified
+against the node once and goes straight into the lists for the children,
+each trace still visits its leafs in the same order as it would on its
+own, near side of a node first, so the results are the same.
+==================
+*/
+
+static void CM_TraceBatchThroughTree( traceSegment_t **segs, int numSegs, int num ) {
+	traceSegment_t	split[MAX_TRACE_BATCH * 2];	// near and far parts of traces that cross
+	traceSegment_t	*lists[3][MAX_TRACE_BATCH];	// child 0, then child 1, then child 0 again
+	int			counts[3];
+	traceSegment_t	*seg, *near, *far;
+	traceWork_t	*tw;
+	cNode_t		*node;
+	cplane_t	*plane;
+	float		t1, t2, offset, idist, frac, frac2;
+	int			i, pass, numSplit, side;
+
+	// once the traces have split up, walk on like CM_Trace does
+	if ( numSegs == 1 ) {
+		seg = segs[0];
+		CM_TraceThroughTree( seg->tw, num, seg->p1f, seg->p2f, seg->p1, seg->p2 );
+		return;
+	}
+
+	// if < 0, we are in a leaf node
+	if (num < 0) {
+		CM_TraceBatchThroughLeaf( segs, numSegs, &cm.leafs[-1-num] );
+		return;
+	}
+
+	node = cm.nodes + num;
+	plane = node->plane;
+
+	counts[0] = counts[1] = counts[2] = 0;
+	numSplit = 0;
+
+	for ( i = 0 ; i < numSegs ; i++ ) {
+		seg = segs[i];
+		tw = seg->tw;
+
+		if ( tw->trace.fraction <= seg->p1f ) {
+			continue;		// already hit something nearer
+		}
+
+		// adjust the plane distance appropriately for mins/maxs
+		if ( plane->type < 3 ) {
+			t1 = seg->p1[plane->type] - plane->dist;
+			t2 = seg->p2[plane->type] - plane->dist;
+			offset = tw->extents[plane->type];
+		} else {
+			t1 = DotProduct (plane->normal, seg->p1) - plane->dist;
+			t2 = DotProduct (plane->normal, seg->p2) - plane->dist;
+			if ( tw->isPoint ) {
+				offset = 0;
+			} else {
+				// this is silly
+				offset = 2048;
+			}
+		}
+
+		// see which sides we need to consider
+		if ( t1 >= offset + 1 && t2 >= offset + 1 ) {
+			lists[0][counts[0]++] = seg;
+			continue;
+		}
+		if ( t1 < -offset - 1 && t2 < -offset - 1 ) {
+			lists[1][counts[1]++] = seg;
+			continue;
+		}
+
+		// put the crosspoint SURFACE_CLIP_EPSILON pixels on the near side
+		if ( t1 < t2 ) {
+			idist = 1.0/(t1-t2);
+			side = 1;
+			frac2 = (t1 + offset + SURFACE_CLIP_EPSILON)*idist;
+			frac = (t1 - offset + SURFACE_CLIP_EPSILON)*idist;
+		} else if (t1 > t2) {
+			idist = 1.0/(t1-t2);
+			side = 0;
+			frac2 = (t1 - offset - SURFACE_CLIP_EPSILON)*idist;
+			frac = (t1 + offset + SURFACE_CLIP_EPSILON)*idist;
+		} else {
+			side = 0;
+			frac = 1;
+			frac2 = 0;
+		}
+
+		// move up to the node
+		if ( frac < 0 ) {
+			frac = 0;
+		}
+		if ( frac > 1 ) {
+			frac = 1;
+		}
+
+		// go past the node
+		if ( frac2 < 0 ) {
+			frac2 = 0;
+		}
+		if ( frac2 > 1 ) {
+			frac2 = 1;
+		}
+
+		near = &split[numSplit++];
+		near->tw = tw;
+		near->p1f = seg->p1f;
+		near->p2f = seg->p1f + (seg->p2f - seg->p1f)*frac;
+		VectorCopy( seg->p1, near->p1 );
+		near->p2[0] = seg->p1[0] + frac*(seg->p2[0] - seg->p1[0]);
+		near->p2[1] = seg->p1[1] + frac*(seg->p2[1] - seg->p1[1]);
+		near->p2[2] = seg->p1[2] + frac*(seg->p2[2] - seg->p1[2]);
+
+		far = &split[numSplit++];
+		far->tw = tw;
+		far->p1f = seg->p1f + (seg->p2f - seg->p1f)*frac2;
+		far->p2f = seg->p2f;
+		far->p1[0] = seg->p1[0] + frac2*(seg->p2[0] - seg->p1[0]);
+		far->p1[1] = seg->p1[1] + frac2*(seg->p2[1] - seg->p1[1]);
+		far->p1[2] = seg->p1[2] + frac2*(seg->p2[2] - seg->p1[2]);
+		VectorCopy( seg->p2, far->p2 );
+
+		// near side in its child's first visit, far side in the other child's next one
+		lists[side][counts[side]++] = near;
+		lists[side + 1][counts[side + 1]++] = far;
+	}
+
+	for ( pass = 0 ; pass < 3 ; pass++ ) {
+		if ( counts[pass] ) {
+			CM_TraceBatchThroughTree( lists[pass], counts[pass], node->children[ pass & 1 ] );
+		}
+	}
+}
+
+/*
+==================
+CM_TraceBatch
+
+Same results as calling CM_BoxTrace for each start and end, but world traces
+walk the tree together so every node is only classified once for the group.
+Used for shotgun pellets, line of sight fans and the like.
+==================
+*/
+void CM_TraceBatch( trace_t *results, const vec3_t *starts, const vec3_t *ends, int count,
+		const vec3_t mins, const vec3_t maxs,
+		clipHandle_t model, int brushmask, traceType_t type ) {
+	traceWork_t		tws[MAX_TRACE_BATCH];
+	traceSegment_t	segs[MAX_TRACE_BATCH];
+	traceSegment_t	*segPtrs[MAX_TRACE_BATCH];
+	cmThread_t		*thread;
+	int				i, first, num, numSegs, checkcount;
+
+	// only the world has a tree to share
+	if ( model || !cm.numNodes ) {
+		for ( i = 0 ; i < count ; i++ ) {
+			CM_BoxTrace( &results[i], starts[i], ends[i], mins, maxs, model, brushmask, type );
+		}
+		return;
+	}
+
+	if ( !mins ) {
+		mins = vec3_origin;
+	}
+	if ( !maxs ) {
+		maxs = vec3_origin;
+	}
+
+#ifndef BSPC
+	// replayed one at a time
+	if ( CM_RECORDING_TRACES() ) {
+		for ( i = 0 ; i < count ; i++ ) {
+			CM_RecordTrace( starts[i], ends[i], mins, maxs, model, brushmask, vec3_origin, vec3_origin, type );
+		}
+	}
+#endif
+
+	thread = CM_GetThread();
+
+	for ( first = 0 ; first < count ; first += num ) {
+		num = MIN( count - first, MAX_TRACE_BATCH );
+		numSegs = 0;
+
+		for ( i = 0 ; i < num ; i++ ) {
+			const float *start = starts[first + i];
+			const float *end = ends[first + i];
+
+			CM_SetupTrace( &tws[i], thread, start, end, mins, maxs, vec3_origin, brushmask, type, NULL );
+
+			if ( start[0] == end[0] && start[1] == end[1] && start[2] == end[2] ) {
+				CM_PositionTest( &tws[i] );
+				continue;
+			}
+
+			CM_SetupSweep( &tws[i] );
+
+			segs[numSegs].tw = &tws[i];
+			segs[numSegs].p1f = 0;
+			segs[numSegs].p2f = 1;
+			VectorCopy( tws[i].start, segs[numSegs].p1 );
+			VectorCopy( tws[i].end, segs[numSegs].p2 );
+			numSegs++;
+		}
+
+		if ( numSegs ) {
+			// position tests above took their own checkcounts
+			checkcount = ++thread->checkcount;
+			for ( i = 0 ; i < numSegs ; i++ ) {
+				segs[i].tw->checkcount = checkcount;
+				segs[i].tw->slotBit = 1u << i;
+				segPtrs[i] = &segs[i];
+			}
+
+			CM_TraceBatchThroughTree( segPtrs, numSegs, 0 );
+		}
+
+		for ( i = 0 ; i < num ; i++ ) {
+			CM_FinishTrace( &tws[i], &results[first + i], starts[first + i], ends[first + i] );
+		}
+	}
 }
 
 /*
@@ -1653,6 +2163,11 @@ CM_BoxTrace
 void CM_BoxTrace( trace_t *results, const vec3_t start, const vec3_t end,
 						  const vec3_t mins, const vec3_t maxs,
 						  clipHandle_t model, int brushmask, traceType_t type ) {
+#ifndef BSPC
+	if ( CM_RECORDING_TRACES() ) {
+		CM_RecordTrace( start, end, mins, maxs, model, brushmask, vec3_origin, vec3_origin, type );
+	}
+#endif
 	CM_Trace( results, start, end, mins, maxs, model, vec3_origin, brushmask, type, NULL );
 }
 
@@ -1680,6 +2195,12 @@ void CM_TransformedBoxTrace( trace_t *results, const vec3_t start, const vec3_t
 	float		t;
 	sphere_t	sphere;
 
+#ifndef BSPC
+	if ( CM_RECORDING_TRACES() ) {
+		CM_RecordTrace( start, end, mins, maxs, model, brushmask, origin, angles, type );
+	}
+#endif
+
 	if ( !mins ) {
 		mins = vec3_origin;
 	}
@@ -1770,15 +2291,18 @@ void CM_BiSphereTrace( trace_t *results, const vec3_t start,
 	traceWork_t	tw;
 	float				largestRadius = startRad > endRad ? startRad : endRad;
 	cmodel_t		*cmod;
+	cmThread_t		*thread;
 
 	cmod = CM_ClipHandleToModel( model );
 
-	cm.checkcount++;		// for multi-check avoidance
+	thread = CM_GetThread();
 
-	c_traces++;				// for statistics, may be zeroed
+	thread->c_traces++;		// for statistics, may be zeroed
 
 	// fill in a default trace
 	Com_Memset( &tw, 0, sizeof( tw ) );
+	tw.thread = thread;
+	tw.checkcount = ++thread->checkcount;	// for multi-check avoidance
 	tw.trace.fraction = 1.0f; // assume it goes the entire distance until shown otherwise
 	VectorCopy( vec3_origin, tw.modelOrigin );
 	tw.type = TT_BISPHERE;
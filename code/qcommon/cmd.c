@@ -367,6 +367,7 @@ void Cmd_Echo_f (void)
 typedef struct cmd_function_s
 {
 	struct cmd_function_s	*next;
+	struct cmd_function_s	*hashNext;
 	char					*name;
 	xcommand_t				function;
 	completionFunc_t	complete;
@@ -385,6 +386,50 @@ static cmdContext_t		cmd;
 static cmdContext_t		savedCmd;
 static	cmd_function_t	*cmd_functions;		// possible commands to execute
 
+// commands are also hashed by name so executing one doesn't walk the list
+#define CMD_HASH_SIZE		512
+static	cmd_function_t	*cmd_hashTable[CMD_HASH_SIZE];
+
+/*
+============
+Cmd_HashValue
+============
+*/
+static int Cmd_HashValue( const char *name ) {
+	unsigned int	hash;
+
+	// FNV-1a, case insensitive
+	hash = 2166136261u;
+	while ( *name ) {
+		hash ^= (unsigned char)tolower( *name++ );
+		hash *= 16777619u;
+	}
+	return hash & ( CMD_HASH_SIZE - 1 );
+}
+
+/*
+============
+Cmd_FreeCommand
+
+Unlinks a command from the hash table and frees it, the caller
+unlinks it from cmd_functions
+============
+*/
+static void Cmd_FreeCommand( cmd_function_t *cmd ) {
+	cmd_function_t	**back;
+
+	if ( cmd->name ) {
+		for ( back = &cmd_hashTable[Cmd_HashValue( cmd->name )]; *back; back = &(*back)->hashNext ) {
+			if ( *back == cmd ) {
+				*back = cmd->hashNext;
+				break;
+			}
+		}
+		Z_Free( cmd->name );
+	}
+	Z_Free( cmd );
+}
+
 /*
 ============
 Cmd_SaveCmdContext
@@ -662,7 +707,7 @@ Cmd_FindCommand
 cmd_function_t *Cmd_FindCommand( const char *cmd_name )
 {
 	cmd_function_t *cmd;
-	for( cmd = cmd_functions; cmd; cmd = cmd->next )
+	for( cmd = cmd_hashTable[Cmd_HashValue( cmd_name )]; cmd; cmd = cmd->hashNext )
 		if( !Q_stricmp( cmd_name, cmd->name ) )
 			return cmd;
 	return NULL;
@@ -675,6 +720,7 @@ Cmd_AddCommandWithCompletion
 */
 void	Cmd_AddCommandWithCompletion( const char *cmd_name, xcommand_t function, completionFunc_t complete ) {
 	cmd_function_t	*cmd;
+	int				hash;
 	
 	// fail if the command already exists
 	if( Cmd_FindCommand( cmd_name ) )
@@ -690,6 +736,10 @@ void	Cmd_AddCommandWithCompletion( const char *cmd_name, xcommand_t function, co
 	cmd->complete = complete;
 	cmd->next = cmd_functions;
 	cmd_functions = cmd;
+
+	hash = Cmd_HashValue( cmd_name );
+	cmd->hashNext = cmd_hashTable[hash];
+	cmd_hashTable[hash] = cmd;
 }
 
 /*
@@ -728,11 +778,9 @@ Cmd_SetCommandCompletionFunc
 void Cmd_SetCommandCompletionFunc( const char *command, completionFunc_t complete ) {
 	cmd_function_t	*cmd;
 
-	for( cmd = cmd_functions; cmd; cmd = cmd->next ) {
-		if( !Q_stricmp( command, cmd->name ) ) {
-			cmd->complete = complete;
-			return;
-		}
+	cmd = Cmd_FindCommand( command );
+	if( cmd ) {
+		cmd->complete = complete;
 	}
 }
 
@@ -753,8 +801,7 @@ void	Cmd_RemoveCommand( const char *cmd_name ) {
 		}
 		if ( !strcmp( cmd_name, cmd->name ) ) {
 			*back = cmd->next;
-			Z_Free (cmd->name);
-			Z_Free (cmd);
+			Cmd_FreeCommand( cmd );
 			return;
 		}
 		back = &cmd->next;
@@ -780,10 +827,7 @@ void	Cmd_RemoveCommandsByFunc( xcommand_t function ) {
 		}
 		if ( cmd->function == function ) {
 			*back = cmd->next;
-			if (cmd->name) {
-				Z_Free(cmd->name);
-			}
-			Z_Free (cmd);
+			Cmd_FreeCommand( cmd );
 			continue;
 		}
 		back = &cmd->next;
@@ -834,13 +878,9 @@ Cmd_CompleteArgument
 void Cmd_CompleteArgument( const char *command, char *args, int argNum ) {
 	cmd_function_t	*cmd;
 
-	for( cmd = cmd_functions; cmd; cmd = cmd->next ) {
-		if( !Q_stricmp( command, cmd->name ) ) {
-			if ( cmd->complete ) {
-				cmd->complete( args, argNum );
-			}
-			return;
-		}
+	cmd = Cmd_FindCommand( command );
+	if( cmd && cmd->complete ) {
+		cmd->complete( args, argNum );
 	}
 }
 
@@ -853,7 +893,7 @@ A complete command line has been parsed, so try to execute it
 ============
 */
 void	Cmd_ExecuteString( const char *text ) {	
-	cmd_function_t	*cmdFunc, **prev;
+	cmd_function_t	*cmdFunc;
 
 	// execute the command line
 	Cmd_TokenizeString( text );		
@@ -862,19 +902,11 @@ void	Cmd_ExecuteString( const char *text ) {
 	}
 
 	// check registered command functions	
-	for ( prev = &cmd_functions ; *prev ; prev = &cmdFunc->next ) {
-		cmdFunc = *prev;
-		if ( !Q_stricmp( cmd.argv[0], cmdFunc->name ) ) {
-			// rearrange the links so that the command will be
-			// near the head of the list next time it is used
-			*prev = cmdFunc->next;
-			cmdFunc->next = cmd_functions;
-			cmd_functions = cmdFunc;
-
-			// perform the action
-			cmdFunc->function ();
-			return;
-		}
+	cmdFunc = Cmd_FindCommand( cmd.argv[0] );
+	if ( cmdFunc ) {
+		// perform the action
+		cmdFunc->function ();
+		return;
 	}
 
 	// check cvars
@@ -782,7 +782,12 @@ int Com_RealTime(qtime_t *qtime) {
 There is never any space between memblocks, and there will never be two
 contiguous free memblocks.
 
-The rover can be left pointing at a non-empty block
+Free blocks are kept on segregated free lists instead of being found by a
+first-fit scan of the block list.  Blocks smaller than ZONE_SMALL_LIMIT get
+an exact size class every ZONE_SMALL_STEP bytes, larger blocks are binned
+by power of two and then split linearly into ZONE_SL_BINS sub-bins (TLSF).
+A bitmap of non-empty bins finds a fitting block in constant time.  The
+free list links are stored in the unused payload of free blocks.
 
 The zone calls are pretty much only used for small strings and structures,
 all big things are allocated on the hunk.
@@ -792,6 +797,19 @@ all big things are allocated on the hunk.
 #define	ZONEID	0x1d4a11
 #define MINFRAGMENT	64
 
+#define ZONE_SMALL_LIMIT	512
+#define ZONE_SMALL_STEP		8
+#define ZONE_SMALL_BINS		( ZONE_SMALL_LIMIT / ZONE_SMALL_STEP )
+#define ZONE_FL_SHIFT		9		// log2( ZONE_SMALL_LIMIT )
+#define ZONE_SL_LOG2		3
+#define ZONE_SL_BINS		( 1 << ZONE_SL_LOG2 )
+#define ZONE_FL_BINS		( 32 - ZONE_FL_SHIFT )
+#define ZONE_BINS			( ZONE_SMALL_BINS + ZONE_FL_BINS * ZONE_SL_BINS )
+#define ZONE_BINMAP_WORDS	( ( ZONE_BINS + 31 ) / 32 )
+
+// only every Nth malloc / free is timed for meminfo
+#define ZONE_TIMING_INTERVAL	16
+
 typedef struct zonedebug_s {
 	char *label;
 	char *file;
@@ -809,11 +827,29 @@ typedef struct memblock_s {
 #endif
 } memblock_t;
 
+// free list links, stored right after the header of a free block
+typedef struct {
+	memblock_t	*next, *prev;
+} zonefree_t;
+
+#define Z_FREELINKS( block )	( (zonefree_t *)( (block) + 1 ) )
+#define ZONE_MINBLOCK			PAD( sizeof( memblock_t ) + sizeof( zonefree_t ), sizeof( intptr_t ) )
+
+typedef struct {
+	unsigned int	count;		// total calls
+	int			samples;		// calls that were timed
+	int64_t		time;			// usec spent in timed calls
+	int			maxTime;		// slowest timed call in usec
+} zonetiming_t;
+
 typedef struct {
 	int		size;			// total bytes malloced, including header
 	int		used;			// total bytes used
 	memblock_t	blocklist;	// start / end cap for linked list
-	memblock_t	*rover;
+	unsigned int	binMap[ZONE_BINMAP_WORDS];	// bit set for each non-empty bin
+	memblock_t	*bins[ZONE_BINS];		// segregated free lists
+	zonetiming_t	mallocTiming;
+	zonetiming_t	freeTiming;
 } memzone_t;
 
 // main zone for all "dynamic" memory allocation
@@ -887,6 +923,177 @@ const char *Z_CvarNameForZone( memzone_t *zone ) {
 	}
 }
 
+/*
+========================
+Z_HighBit / Z_LowBit
+========================
+*/
+static int Z_HighBit( unsigned int x ) {
+#ifdef __GNUC__
+	return 31 - __builtin_clz( x );
+#else
+	int		bit;
+
+	for ( bit = 0; x >>= 1; bit++ ) {
+	}
+	return bit;
+#endif
+}
+
+static int Z_LowBit( unsigned int x ) {
+#ifdef __GNUC__
+	return __builtin_ctz( x );
+#else
+	int		bit;
+
+	for ( bit = 0; !( x & 1 ); x >>= 1, bit++ ) {
+	}
+	return bit;
+#endif
+}
+
+/*
+========================
+Z_BinForSize
+
+Returns the free list a block of the given size is kept on
+========================
+*/
+static int Z_BinForSize( unsigned int size ) {
+	int		fl;
+
+	if ( size < ZONE_SMALL_LIMIT ) {
+		return size / ZONE_SMALL_STEP;
+	}
+
+	fl = Z_HighBit( size );
+	return ZONE_SMALL_BINS + ( fl - ZONE_FL_SHIFT ) * ZONE_SL_BINS
+		+ ( ( size >> ( fl - ZONE_SL_LOG2 ) ) & ( ZONE_SL_BINS - 1 ) );
+}
+
+/*
+========================
+Z_SearchBinForSize
+
+Returns the first free list where every block is at least size bytes
+========================
+*/
+static int Z_SearchBinForSize( unsigned int size ) {
+	if ( size < ZONE_SMALL_LIMIT ) {
+		return ( size + ZONE_SMALL_STEP - 1 ) / ZONE_SMALL_STEP;
+	}
+
+	size += ( 1u << ( Z_HighBit( size ) - ZONE_SL_LOG2 ) ) - 1;
+	return Z_BinForSize( size );
+}
+
+/*
+========================
+Z_InsertFree
+========================
+*/
+static void Z_InsertFree( memzone_t *zone, memblock_t *block ) {
+	zonefree_t	*links;
+	int			bin;
+
+	bin = Z_BinForSize( block->size );
+	links = Z_FREELINKS( block );
+	links->prev = NULL;
+	links->next = zone->bins[bin];
+	if ( links->next ) {
+		Z_FREELINKS( links->next )->prev = block;
+	}
+	zone->bins[bin] = block;
+	zone->binMap[bin >> 5] |= 1u << ( bin & 31 );
+}
+
+/*
+========================
+Z_RemoveFree
+========================
+*/
+static void Z_RemoveFree( memzone_t *zone, memblock_t *block ) {
+	zonefree_t	*links;
+	int			bin;
+
+	links = Z_FREELINKS( block );
+	if ( links->prev ) {
+		Z_FREELINKS( links->prev )->next = links->next;
+	} else {
+		bin = Z_BinForSize( block->size );
+		zone->bins[bin] = links->next;
+		if ( !links->next ) {
+			zone->binMap[bin >> 5] &= ~( 1u << ( bin & 31 ) );
+		}
+	}
+	if ( links->next ) {
+		Z_FREELINKS( links->next )->prev = links->prev;
+	}
+}
+
+/*
+========================
+Z_FindFree
+
+Returns a free block of at least size bytes, or NULL if there is none
+========================
+*/
+static memblock_t *Z_FindFree( memzone_t *zone, int size ) {
+	memblock_t	*block;
+	unsigned int	bits;
+	int			bin, word;
+
+	bin = Z_SearchBinForSize( size );
+	if ( bin < ZONE_BINS ) {
+		word = bin >> 5;
+		bits = zone->binMap[word] & ( ~0u << ( bin & 31 ) );
+		while ( !bits && ++word < ZONE_BINMAP_WORDS ) {
+			bits = zone->binMap[word];
+		}
+		if ( bits ) {
+			return zone->bins[( word << 5 ) + Z_LowBit( bits )];
+		}
+	}
+
+	// the bin holding size may still have a large enough block
+	for ( block = zone->bins[Z_BinForSize( size )]; block; block = Z_FREELINKS( block )->next ) {
+		if ( block->size >= size ) {
+			return block;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+========================
+Z_TimingStart / Z_TimingEnd
+========================
+*/
+static int64_t Z_TimingStart( zonetiming_t *timing ) {
+	if ( ++timing->count % ZONE_TIMING_INTERVAL ) {
+		return 0;
+	}
+	return Sys_Microseconds();
+}
+
+static void Z_TimingEnd( zonetiming_t *timing, int64_t start ) {
+	int		usec;
+
+	if ( !start ) {
+		return;
+	}
+
+	// microsecond ticks are coarse, but the start phase is random so
+	// the average over many samples still converges on the real latency
+	usec = Sys_Microseconds() - start;
+	timing->samples++;
+	timing->time += usec;
+	if ( usec > timing->maxTime ) {
+		timing->maxTime = usec;
+	}
+}
+
 /*
 ========================
 Z_ClearZone
@@ -902,14 +1109,18 @@ static void Z_ClearZone( memzone_t *zone, int size ) {
 	zone->blocklist.tag = 1;	// in use block
 	zone->blocklist.id = 0;
 	zone->blocklist.size = 0;
-	zone->rover = block;
 	zone->size = size;
 	zone->used = 0;
+	Com_Memset( zone->binMap, 0, sizeof( zone->binMap ) );
+	Com_Memset( zone->bins, 0, sizeof( zone->bins ) );
+	Com_Memset( &zone->mallocTiming, 0, sizeof( zone->mallocTiming ) );
+	Com_Memset( &zone->freeTiming, 0, sizeof( zone->freeTiming ) );
 	
 	block->prev = block->next = &zone->blocklist;
 	block->tag = 0;			// free block
 	block->id = ZONEID;
 	block->size = size - sizeof(memzone_t);
+	Z_InsertFree( zone, block );
 }
 
 /*
@@ -943,6 +1154,7 @@ void Z_Free( void *ptr )
 {
 	memblock_t	*block, *other;
 	memzone_t *zone;
+	int64_t		start;
 	
 	if (!ptr) {
 #ifdef ZONE_DEBUG
@@ -982,6 +1194,7 @@ void Z_Free( void *ptr )
 	}
 
 	zone = Z_ZoneForTag( block->tag );
+	start = Z_TimingStart( &zone->freeTiming );
 
 	zone->used -= block->size;
 	// set the block to something that should cause problems
@@ -993,24 +1206,25 @@ void Z_Free( void *ptr )
 	other = block->prev;
 	if (!other->tag) {
 		// merge with previous free block
+		Z_RemoveFree( zone, other );
 		other->size += block->size;
 		other->next = block->next;
 		other->next->prev = other;
-		if (block == zone->rover) {
-			zone->rover = other;
-		}
 		block = other;
 	}
 
-	zone->rover = block;
-
 	other = block->next;
 	if ( !other->tag ) {
 		// merge the next free block onto the end
+		Z_RemoveFree( zone, other );
 		block->size += other->size;
 		block->next = other->next;
 		block->next->prev = block;
 	}
+
+	Z_InsertFree( zone, block );
+
+	Z_TimingEnd( &zone->freeTiming, start );
 }
 
 
@@ -1022,20 +1236,22 @@ Z_FreeTags
 int Z_FreeTags( int tag ) {
 	int			count;
 	memzone_t	*zone;
+	memblock_t	*block, *next;
 
 	zone = Z_ZoneForTag( tag );
 	count = 0;
-	// use the rover as our pointer, because
-	// Z_Free automatically adjusts it
-	zone->rover = zone->blocklist.next;
-	do {
-		if ( zone->rover->tag == tag ) {
+	for ( block = zone->blocklist.next; block != &zone->blocklist; block = next ) {
+		next = block->next;
+		if ( block->tag == tag ) {
+			// Z_Free merges a free next block, the one after
+			// that is in use and will stay put
+			if ( !next->tag ) {
+				next = next->next;
+			}
 			count++;
-			Z_Free( (void *)(zone->rover + 1) );
-			continue;
+			Z_Free( (void *)(block + 1) );
 		}
-		zone->rover = zone->rover->next;
-	} while ( zone->rover != &zone->blocklist );
+	}
 
 	return count;
 }
@@ -1053,60 +1269,55 @@ void *Z_TagMallocDebug( int size, int tag, char *label, char *file, int line ) {
 void *Z_TagMalloc( int size, int tag ) {
 #endif
 	int		extra;
-	memblock_t	*start, *rover, *new, *base;
+	memblock_t	*new, *base;
 	memzone_t *zone;
+	int64_t		start;
 
 	if (!tag) {
 		Com_Error( ERR_FATAL, "Z_TagMalloc: tried to use a 0 tag" );
 	}
 
 	zone = Z_ZoneForTag( tag );
+	start = Z_TimingStart( &zone->mallocTiming );
 
 #ifdef ZONE_DEBUG
 	allocSize = size;
 #endif
 	//
-	// scan through the block list looking for the first free block
-	// of sufficient size
+	// find a free block of sufficient size in the segregated free lists
 	//
 	size += sizeof(memblock_t);	// account for size of block header
 	size += 4;					// space for memory trash tester
 	size = PAD(size, sizeof(intptr_t));		// align to 32/64 bit boundary
-	
-	base = rover = zone->rover;
-	start = base->prev;
-	
-	do {
-		if (rover == start)	{
-			// scaned all the way around the list
-			char cvarMessage[128];
-			const char *cvarName;
-
-			// display user friendly message for overly common error
-			cvarName = Z_CvarNameForZone(zone);
-			if (cvarName) {
-				Com_sprintf(cvarMessage, sizeof(cvarMessage), " (increase %s cvar value, current value %s)", cvarName, Cvar_VariableString(cvarName));
-			} else {
-				cvarMessage[0] = '\0';
-			}
+	if ( size < ZONE_MINBLOCK ) {
+		size = ZONE_MINBLOCK;	// room for the free list links once freed
+	}
+
+	base = Z_FindFree( zone, size );
+	if ( !base ) {
+		char cvarMessage[128];
+		const char *cvarName;
+
+		// display user friendly message for overly common error
+		cvarName = Z_CvarNameForZone(zone);
+		if (cvarName) {
+			Com_sprintf(cvarMessage, sizeof(cvarMessage), " (increase %s cvar value, current value %s)", cvarName, Cvar_VariableString(cvarName));
+		} else {
+			cvarMessage[0] = '\0';
+		}
 
 #ifdef ZONE_DEBUG
-			Z_LogHeap();
+		Z_LogHeap();
 
-			Com_Error(ERR_FATAL, "Z_Malloc: failed on allocation of %i bytes from the %s zone%s: %s, line: %d (%s)",
-								size, Z_NameForZone(zone), cvarMessage, file, line, label);
+		Com_Error(ERR_FATAL, "Z_Malloc: failed on allocation of %i bytes from the %s zone%s: %s, line: %d (%s)",
+							size, Z_NameForZone(zone), cvarMessage, file, line, label);
 #else
-			Com_Error(ERR_FATAL, "Z_Malloc: failed on allocation of %i bytes from the %s zone%s",
-								size, Z_NameForZone(zone), cvarMessage);
+		Com_Error(ERR_FATAL, "Z_Malloc: failed on allocation of %i bytes from the %s zone%s",
+							size, Z_NameForZone(zone), cvarMessage);
 #endif
-			return NULL;
-		}
-		if (rover->tag) {
-			base = rover = rover->next;
-		} else {
-			rover = rover->next;
-		}
-	} while (base->tag || base->size < size);
+		return NULL;
+	}
+	Z_RemoveFree( zone, base );
 	
 	//
 	// found a block big enough
@@ -1123,11 +1334,11 @@ void *Z_TagMalloc( int size, int tag ) {
 		new->next->prev = new;
 		base->next = new;
 		base->size = size;
+		Z_InsertFree( zone, new );
 	}
 	
 	base->tag = tag;			// no longer a free block
 	
-	zone->rover = base->next;	// next allocation will start looking here
 	zone->used += base->size;	//
 	
 	base->id = ZONEID;
@@ -1142,6 +1353,8 @@ void *Z_TagMalloc( int size, int tag ) {
 	// marker for memory trash testing
 	*(int *)((byte *)base + base->size - 4) = ZONEID;
 
+	Z_TimingEnd( &zone->mallocTiming, start );
+
 	return (void *) ((byte *)base + sizeof(memblock_t));
 }
 
@@ -1186,6 +1399,7 @@ Z_CheckHeap
 */
 static void Z_CheckHeap( void ) {
 	memblock_t	*block;
+	int			bin;
 	
 	for (block = mainzone->blocklist.next ; ; block = block->next) {
 		if (block->next == &mainzone->blocklist) {
@@ -1199,6 +1413,12 @@ static void Z_CheckHeap( void ) {
 		if ( !block->tag && !block->next->tag ) {
 			Com_Error( ERR_FATAL, "Z_CheckHeap: two consecutive free blocks" );
 		}
+		if ( !block->tag ) {
+			bin = Z_BinForSize( block->size );
+			if ( !( mainzone->binMap[bin >> 5] & ( 1u << ( bin & 31 ) ) ) ) {
+				Com_Error( ERR_FATAL, "Z_CheckHeap: free block in an empty bin" );
+			}
+		}
 	}
 }
 
@@ -1268,6 +1488,41 @@ void Z_LogHeap( void ) {
 	Z_LogZoneHeap( smallzone, "SMALL" );
 }
 
+/*
+========================
+Z_PrintTiming / Z_PrintZoneStats
+
+Prints fragmentation and allocation latency for meminfo
+========================
+*/
+static void Z_PrintTiming( const char *name, zonetiming_t *timing ) {
+	Com_Printf( "        %-6s %10u calls, %6.0f ns average, %5i usec max\n", name, timing->count,
+		timing->samples ? timing->time * 1000.0 / timing->samples : 0.0, timing->maxTime );
+}
+
+static void Z_PrintZoneStats( memzone_t *zone ) {
+	memblock_t	*block;
+	int			freeBytes, freeBlocks, largest;
+
+	freeBytes = freeBlocks = largest = 0;
+	for ( block = zone->blocklist.next; block != &zone->blocklist; block = block->next ) {
+		if ( !block->tag ) {
+			freeBytes += block->size;
+			freeBlocks++;
+			if ( block->size > largest ) {
+				largest = block->size;
+			}
+		}
+	}
+
+	// fragmentation is the share of free memory outside the largest free block
+	Com_Printf( "%-8s zone: %8i bytes free in %i blocks, largest %i, %.1f%% fragmented\n",
+		Z_NameForZone( zone ), freeBytes, freeBlocks, largest,
+		freeBytes ? 100.0 * ( freeBytes - largest ) / freeBytes : 0.0 );
+	Z_PrintTiming( "malloc", &zone->mallocTiming );
+	Z_PrintTiming( "free", &zone->freeTiming );
+}
+
 // static mem blocks to reduce a lot of small zone overhead
 typedef struct memstatic_s {
 	memblock_t b;
@@ -1473,6 +1728,17 @@ void Com_Meminfo_f( void ) {
 	Com_Printf( "        %8i bytes in dynamic renderer\n", rendererBytes );
 	Com_Printf( "        %8i bytes in dynamic other\n", zoneBytes - rendererBytes );
 	Com_Printf( "        %8i bytes in small Zone memory\n", smallZoneBytes );
+	Com_Printf( "\n" );
+	Arena_Info();
+	Com_Printf( "\n" );
+	Z_PrintZoneStats( mainzone );
+	Z_PrintZoneStats( smallzone );
+	if ( vm_gamezone ) {
+		Z_PrintZoneStats( vm_gamezone );
+	}
+	if ( vm_cgamezone ) {
+		Z_PrintZoneStats( vm_cgamezone );
+	}
 }
 
 /*
@@ -2937,6 +3203,7 @@ void Com_Init( char *commandLine ) {
 	Com_StartupVariable( NULL );
 
 	Com_InitZoneMemory();
+	Com_InitFrameArena();
 	Cmd_Init ();
 
 	// get the developer cvar set as early as possible
@@ -2970,6 +3237,8 @@ void Com_Init( char *commandLine ) {
 	Cmd_AddCommand ("writeconfig", Com_WriteConfig_f );
 	Cmd_SetCommandCompletionFunc( "writeconfig", Cmd_CompleteCfgName );
 	Cmd_AddCommand("game_restart", Com_GameRestart_f);
+	CM_InitCommands();
+	CM_InitReplay();
 
 	Com_ExecuteCfg();
 
@@ -3317,6 +3586,7 @@ void Com_InitRef( refimport_t *ri ) {
 #endif
 	ri->Hunk_AllocateTempMemory = Hunk_AllocateTempMemory;
 	ri->Hunk_FreeTempMemory = Hunk_FreeTempMemory;
+	ri->FrameAlloc = Com_FrameAlloc;
 
 	ri->CM_ClusterPVS = CM_ClusterPVS;
 	ri->CM_DrawDebugSurface = CM_DrawDebugSurface;
@@ -3324,6 +3594,8 @@ void Com_InitRef( refimport_t *ri ) {
 
 	ri->FS_ReadFile = FS_ReadFile;
 	ri->FS_FreeFile = FS_FreeFile;
+	ri->FS_MapFile = FS_MapFile;
+	ri->FS_UnmapFile = FS_UnmapFile;
 	ri->FS_WriteFile = FS_WriteFile;
 	ri->FS_FreeFileList = FS_FreeFileList;
 	ri->FS_ListFiles = FS_ListFiles;
@@ -3519,6 +3791,9 @@ void Com_Frame( void ) {
 		return;			// an ERR_DROP was thrown
 	}
 
+	// release last frame's scratch memory
+	Arena_ResetAll();
+
 	timeBeforeFirstEvents =0;
 	timeBeforeServer =0;
 	timeBeforeEvents =0;
@@ -3687,16 +3962,12 @@ void Com_Frame( void ) {
 	// trace optimization tracking
 	//
 	if ( com_showtrace->integer ) {
-	
-		extern	int c_traces, c_brush_traces, c_patch_traces;
-		extern	int	c_pointcontents;
-
-		Com_Printf ("%4i traces  (%ib %ip) %4i points\n", c_traces,
-			c_brush_traces, c_patch_traces, c_pointcontents);
-		c_traces = 0;
-		c_brush_traces = 0;
-		c_patch_traces = 0;
-		c_pointcontents = 0;
+		cmStats_t	stats;
+
+		CM_GetStats( &stats );
+		Com_Printf ("%4i traces  (%ib %ip) %4i points\n", stats.traces,
+			stats.brushTraces, stats.patchTraces, stats.pointContents);
+		CM_ClearStats();
 	}
 
 	Com_ReadFromPipe( );
@@ -40,25 +40,27 @@ int			cvar_modifiedFlags;
 cvar_t		cvar_indexes[MAX_CVARS];
 int			cvar_numIndexes;
 
-#define FILE_HASH_SIZE		256
+#define FILE_HASH_SIZE		1024
 static	cvar_t	*hashTable[FILE_HASH_SIZE];
 
+// modification counts are handed out from a single generation counter, so a
+// cvar slot reused after Cvar_Unset or cvar_restart never repeats a count a
+// vmCvar_t has already seen and Cvar_Update only has to compare them
+static int		cvar_generation;
+
 /*
 ================
 return a hash value for the filename
 ================
 */
 static long generateHashValue( const char *fname ) {
-	int		i;
-	long	hash;
-	char	letter;
+	unsigned int	hash;
 
-	hash = 0;
-	i = 0;
-	while (fname[i] != '\0') {
-		letter = tolower(fname[i]);
-		hash+=(long)(letter)*(i+119);
-		i++;
+	// FNV-1a, case insensitive
+	hash = 2166136261u;
+	while (*fname != '\0') {
+		hash ^= (unsigned char)tolower(*fname++);
+		hash *= 16777619u;
 	}
 	hash &= (FILE_HASH_SIZE-1);
 	return hash;
@@ -486,7 +488,7 @@ cvar_t *Cvar_Get( const char *var_name, const char *var_value, int flags ) {
 	var->string = CopyString (var_value);
 	var->explicitSet = qfalse;
 	var->modified = qtrue;
-	var->modificationCount = 1;
+	var->modificationCount = ++cvar_generation;
 	var->value = atof (var->string);
 	var->integer = atoi(var->string);
 	var->resetString = CopyString( var_value );
@@ -747,7 +749,7 @@ cvar_t *Cvar_Set2( const char *var_name, const char *value, int defaultFlags, qb
 			Com_Printf ("%s will be changed upon restarting.\n", var_name);
 			var->latchedString = CopyString(value);
 			var->modified = qtrue;
-			var->modificationCount++;
+			var->modificationCount = ++cvar_generation;
 			return var;
 		}
 	}
@@ -764,7 +766,7 @@ cvar_t *Cvar_Set2( const char *var_name, const char *value, int defaultFlags, qb
 		return var;		// not changed
 
 	var->modified = qtrue;
-	var->modificationCount++;
+	var->modificationCount = ++cvar_generation;
 	
 	Z_Free (var->string);	// free the old value string
 	
@@ -260,12 +260,17 @@ static	cvar_t		*fs_apppath;
 static	cvar_t		*fs_basepath;
 static	cvar_t		*fs_cdpath;
 static	cvar_t		*fs_gamedirvar;
+static	cvar_t		*fs_pakIndex;
+static	cvar_t		*fs_mapFiles;
+static	cvar_t		*fs_prefetchThreads;
+static	cvar_t		*fs_prefetchMegs;
 static	searchpath_t	*fs_searchpaths;
 static	searchpath_t	*fs_stashedPath = NULL;
 static	int			fs_readCount;			// total bytes read
 static	int			fs_loadCount;			// total files read
 static	int			fs_loadStack;			// total files in memory
 static	int			fs_packFiles = 0;		// total number of files in packs
+static	qboolean	fs_probing;				// opened files don't mark their pak as referenced
 
 typedef union qfile_gus {
 	FILE*		o;
@@ -283,12 +288,51 @@ typedef struct {
 	int			fileSize;
 	int			zipFilePos;
 	int			zipFileLen;
+	pack_t		*zipPak;
 	qboolean	zipFile;
 	char		name[MAX_ZPATH];
 } fileHandleData_t;
 
 static fileHandleData_t	fsh[MAX_FILE_HANDLES];
 
+// global index of the files in all paks, so FS_FOpenFileRead doesn't have to
+// look in every pak. Every occurrence of a name is kept in search path order
+// because impure paks are skipped at lookup time.
+typedef struct {
+	fileInPack_t	*file;
+	int				search;		// index in fs_fileIndex.searches
+	int				next;		// next occurrence of the same name, or -1
+} fileIndexEntry_t;
+
+typedef struct {
+	qboolean			valid;
+
+	searchpath_t		**searches;		// in search path order
+	int					numSearches;
+	int					*dirs;			// indexes of the directories in searches
+	int					numDirs;
+
+	int					*slots;			// first entry of a name + 1, 0 if empty
+	int					numSlots;		// power of 2
+	fileIndexEntry_t	*entries;
+	int					numEntries;
+} fileIndex_t;
+
+static fileIndex_t		fs_fileIndex;
+
+// files FS_FOpenFileRead didn't find, cleared whenever a file might appear
+#define NEGATIVE_CACHE_SLOTS	8192
+#define NEGATIVE_CACHE_CHARS	( 128 * 1024 )
+
+typedef struct {
+	int				slots[NEGATIVE_CACHE_SLOTS];	// offset in names + 1, 0 if empty
+	int				numNames;
+	char			names[NEGATIVE_CACHE_CHARS];
+	int				namesUsed;
+} negativeCache_t;
+
+static negativeCache_t	fs_negativeCache;
+
 // TTimo - https://zerowing.idsoftware.com/bugzilla/show_bug.cgi?id=540
 // wether we did a reorder on the current search path when joining the server
 static qboolean fs_reordered;
@@ -436,6 +480,68 @@ static long FS_HashFileName( const char *fname, int hashSize ) {
 	return hash;
 }
 
+/*
+================
+FS_HashFullFileName
+
+Hash of the whole name, matching FS_FilenameCompare
+================
+*/
+static unsigned FS_HashFullFileName( const char *fname ) {
+	unsigned	hash;
+	int			c;
+
+	hash = 2166136261u;
+	while ( ( c = *fname++ ) != '\0' ) {
+		if ( c >= 'a' && c <= 'z' ) {
+			c -= ( 'a' - 'A' );
+		}
+		if ( c == '\\' || c == ':' ) {
+			c = '/';
+		}
+		hash = ( hash ^ (unsigned)c ) * 16777619u;
+	}
+	return hash;
+}
+
+/*
+================
+FS_ClearNegativeCache
+================
+*/
+static void FS_ClearNegativeCache( void ) {
+	if ( fs_negativeCache.numNames ) {
+		Com_Memset( fs_negativeCache.slots, 0, sizeof( fs_negativeCache.slots ) );
+	}
+	fs_negativeCache.numNames = 0;
+	fs_negativeCache.namesUsed = 0;
+}
+
+/*
+================
+FS_SearchPathsChanged
+
+Call whenever search paths are added, removed or reordered
+================
+*/
+static void FS_SearchPathsChanged( void ) {
+	if ( fs_fileIndex.searches ) {
+		Z_Free( fs_fileIndex.searches );
+	}
+	if ( fs_fileIndex.dirs ) {
+		Z_Free( fs_fileIndex.dirs );
+	}
+	if ( fs_fileIndex.slots ) {
+		Z_Free( fs_fileIndex.slots );
+	}
+	if ( fs_fileIndex.entries ) {
+		Z_Free( fs_fileIndex.entries );
+	}
+	Com_Memset( &fs_fileIndex, 0, sizeof( fs_fileIndex ) );
+
+	FS_ClearNegativeCache();
+}
+
 static fileHandle_t	FS_HandleForFile(void) {
 	int		i;
 
@@ -578,6 +684,9 @@ Creates any directories needed to store the given filename
 qboolean FS_CreatePath (char *OSPath) {
 	char	*ofs;
 	char	path[MAX_OSPATH];
+
+	// a new file is about to be written
+	FS_ClearNegativeCache();
 	
 	// make absolutely sure that it can't back up the path
 	// FIXME: is c: allowed???
@@ -610,11 +719,33 @@ qboolean FS_CreatePath (char *OSPath) {
 	return qfalse;
 }
 
+/*
+=================
+FS_IsVMCachePath
+
+Returns qtrue if a directory in the path is the compiled QVM cache
+=================
+ */
+static qboolean FS_IsVMCachePath( const char *filename )
+{
+	const char *s;
+
+	for( s = filename; ( s = Q_stristr( s, "vmcache" ) ) != NULL; s++ )
+	{
+		if( ( s == filename || s[-1] == '/' || s[-1] == '\\' )
+			&& ( s[7] == '/' || s[7] == '\\' ) )
+			return qtrue;
+	}
+
+	return qfalse;
+}
+
 /*
 =================
 FS_CheckFilenameIsMutable
 
-ERR_FATAL if trying to maniuplate a file with the platform library, QVM, or pk3 extension
+ERR_FATAL if trying to maniuplate a file with the platform library, QVM, pk3,
+or compiled QVM extension, or anything in the compiled QVM cache
 =================
  */
 static void FS_CheckFilenameIsMutable( const char *filename,
@@ -623,11 +754,19 @@ static void FS_CheckFilenameIsMutable( const char *filename,
 	// Check if the filename ends with the library, QVM, or pk3 extension
 	if( Sys_DllExtension( filename )
 		|| COM_CompareExtension( filename, ".qvm" )
-		|| COM_CompareExtension( filename, ".pk3" ) )
+		|| COM_CompareExtension( filename, ".pk3" )
+		|| COM_CompareExtension( filename, ".jit" ) )
 	{
 		Com_Error( ERR_FATAL, "%s: Not allowed to manipulate '%s' due "
 			"to %s extension", function, filename, COM_GetExtension( filename ) );
 	}
+
+	// the cache holds native code
+	if( FS_IsVMCachePath( filename ) )
+	{
+		Com_Error( ERR_FATAL, "%s: Not allowed to manipulate '%s' in "
+			"the compiled QVM cache", function, filename );
+	}
 }
 
 /*
@@ -924,6 +1063,8 @@ void FS_SV_Rename( const char *from, const char *to, qboolean safe ) {
 		FS_CheckFilenameIsMutable( to_ospath, __func__ );
 	}
 
+	FS_ClearNegativeCache();
+
 	rename(from_ospath, to_ospath);
 }
 
@@ -1371,7 +1512,7 @@ long FS_FOpenFileReadDir(const char *filename, searchpath_t *search, fileHandle_
 					// from every pk3 file.. 
 					len = strlen(filename);
 
-					if (!pak->referenced)
+					if (!pak->referenced && !fs_probing)
 					{
 						if(!FS_IsExt(filename, ".shader", len) &&
 						   !FS_IsExt(filename, ".txt", len) &&
@@ -1401,7 +1542,18 @@ long FS_FOpenFileReadDir(const char *filename, searchpath_t *search, fileHandle_
 							Com_Error(ERR_FATAL, "Couldn't open %s", pak->pakFilename);
 					}
 					else
+					{
+						// pk3s mounted from the index are opened on first use
+						if(!pak->handle)
+						{
+							pak->handle = unzOpen(pak->pakFilename);
+
+							if(pak->handle == NULL)
+								Com_Error(ERR_FATAL, "Couldn't open %s", pak->pakFilename);
+						}
+
 						fsh[*file].handleFiles.file.z = pak->handle;
+					}
 
 					Q_strncpyz(fsh[*file].name, filename, sizeof(fsh[*file].name));
 					fsh[*file].zipFile = qtrue;
@@ -1412,6 +1564,7 @@ long FS_FOpenFileReadDir(const char *filename, searchpath_t *search, fileHandle_
 					// open the file in the zip
 					unzOpenCurrentFile(fsh[*file].handleFiles.file.z);
 					fsh[*file].zipFilePos = pakFile->pos;
+					fsh[*file].zipPak = pak;
 					fsh[*file].zipFileLen = pakFile->len;
 
 					if(fs_debug->integer)
@@ -1489,6 +1642,203 @@ long FS_FOpenFileReadDir(const char *filename, searchpath_t *search, fileHandle_
 	return -1;
 }
 
+/*
+===========
+FS_BuildFileIndex
+===========
+*/
+static void FS_BuildFileIndex( void ) {
+	searchpath_t		*search;
+	fileIndexEntry_t	*entry;
+	pack_t				*pak;
+	int					numFiles;
+	int					i, j, slot, last;
+	unsigned			hash;
+
+	FS_SearchPathsChanged();
+
+	fs_fileIndex.numSearches = 0;
+	numFiles = 0;
+	for ( search = fs_searchpaths; search; search = search->next ) {
+		fs_fileIndex.numSearches++;
+		if ( search->pack ) {
+			numFiles += search->pack->numfiles;
+		}
+	}
+
+	for ( fs_fileIndex.numSlots = 1024; fs_fileIndex.numSlots < numFiles * 2; fs_fileIndex.numSlots <<= 1 ) {
+	}
+
+	fs_fileIndex.searches = Z_Malloc( fs_fileIndex.numSearches * sizeof( *fs_fileIndex.searches ) );
+	fs_fileIndex.dirs = Z_Malloc( fs_fileIndex.numSearches * sizeof( *fs_fileIndex.dirs ) );
+	fs_fileIndex.slots = Z_Malloc( fs_fileIndex.numSlots * sizeof( *fs_fileIndex.slots ) );
+	fs_fileIndex.entries = Z_Malloc( MAX( numFiles, 1 ) * sizeof( *fs_fileIndex.entries ) );
+
+	for ( i = 0, search = fs_searchpaths; search; i++, search = search->next ) {
+		fs_fileIndex.searches[i] = search;
+
+		if ( search->dir ) {
+			fs_fileIndex.dirs[fs_fileIndex.numDirs++] = i;
+			continue;
+		}
+
+		pak = search->pack;
+		for ( j = 0; j < pak->numfiles; j++ ) {
+			entry = &fs_fileIndex.entries[fs_fileIndex.numEntries];
+			entry->file = &pak->buildBuffer[j];
+			entry->search = i;
+			entry->next = -1;
+
+			hash = FS_HashFullFileName( entry->file->name );
+			for ( slot = hash & ( fs_fileIndex.numSlots - 1 ); fs_fileIndex.slots[slot];
+				slot = ( slot + 1 ) & ( fs_fileIndex.numSlots - 1 ) ) {
+				if ( !FS_FilenameCompare( fs_fileIndex.entries[fs_fileIndex.slots[slot] - 1].file->name, entry->file->name ) ) {
+					break;
+				}
+			}
+
+			if ( !fs_fileIndex.slots[slot] ) {
+				fs_fileIndex.slots[slot] = fs_fileIndex.numEntries + 1;
+			} else {
+				// search paths are walked in order, so append
+				for ( last = fs_fileIndex.slots[slot] - 1; fs_fileIndex.entries[last].next != -1; last = fs_fileIndex.entries[last].next ) {
+				}
+
+				// a pak listing the same name twice only uses the first
+				if ( fs_fileIndex.entries[last].search == i ) {
+					continue;
+				}
+
+				fs_fileIndex.entries[last].next = fs_fileIndex.numEntries;
+			}
+
+			fs_fileIndex.numEntries++;
+		}
+	}
+
+	fs_fileIndex.valid = qtrue;
+}
+
+/*
+===========
+FS_FileIndexLookup
+
+Returns the first entry for filename, or -1
+===========
+*/
+static int FS_FileIndexLookup( const char *filename ) {
+	int slot;
+
+	for ( slot = FS_HashFullFileName( filename ) & ( fs_fileIndex.numSlots - 1 ); fs_fileIndex.slots[slot];
+		slot = ( slot + 1 ) & ( fs_fileIndex.numSlots - 1 ) ) {
+		if ( !FS_FilenameCompare( fs_fileIndex.entries[fs_fileIndex.slots[slot] - 1].file->name, filename ) ) {
+			return fs_fileIndex.slots[slot] - 1;
+		}
+	}
+
+	return -1;
+}
+
+/*
+===========
+FS_NegativeCacheSlot
+
+Returns the slot of filename, or the empty slot where it would go.
+Existence checks skip the pure checks, so they are cached separately.
+===========
+*/
+static int FS_NegativeCacheSlot( const char *filename, qboolean exists ) {
+	const char	*name;
+	int			slot;
+
+	for ( slot = FS_HashFullFileName( filename ) & ( NEGATIVE_CACHE_SLOTS - 1 ); fs_negativeCache.slots[slot];
+		slot = ( slot + 1 ) & ( NEGATIVE_CACHE_SLOTS - 1 ) ) {
+		name = fs_negativeCache.names + fs_negativeCache.slots[slot] - 1;
+		if ( name[0] == exists && !FS_FilenameCompare( name + 1, filename ) ) {
+			break;
+		}
+	}
+
+	return slot;
+}
+
+/*
+===========
+FS_AddNegativeCache
+===========
+*/
+static void FS_AddNegativeCache( const char *filename, qboolean exists ) {
+	int slot, len;
+
+	len = strlen( filename ) + 2;
+
+	if ( fs_negativeCache.numNames >= NEGATIVE_CACHE_SLOTS / 2
+		|| fs_negativeCache.namesUsed + len > NEGATIVE_CACHE_CHARS ) {
+		FS_ClearNegativeCache();
+	}
+
+	slot = FS_NegativeCacheSlot( filename, exists );
+	if ( fs_negativeCache.slots[slot] ) {
+		return;
+	}
+
+	fs_negativeCache.names[fs_negativeCache.namesUsed] = exists;
+	Com_Memcpy( fs_negativeCache.names + fs_negativeCache.namesUsed + 1, filename, len - 1 );
+	fs_negativeCache.slots[slot] = fs_negativeCache.namesUsed + 1;
+	fs_negativeCache.namesUsed += len;
+	fs_negativeCache.numNames++;
+}
+
+/*
+===========
+FS_FOpenFileReadIndexed
+
+Same as looking through every search path in order, but only the paks that
+contain the file and the directories are tried
+===========
+*/
+static long FS_FOpenFileReadIndexed( const char *filename, fileHandle_t *file, qboolean uniqueFILE, qboolean isLocalConfig ) {
+	searchpath_t	*search;
+	int				entry, dir;
+	long			len;
+
+	if ( !fs_fileIndex.valid ) {
+		FS_BuildFileIndex();
+	}
+
+	if ( fs_negativeCache.numNames && fs_negativeCache.slots[FS_NegativeCacheSlot( filename, file == NULL )] ) {
+		return -1;
+	}
+
+	entry = isLocalConfig ? -1 : FS_FileIndexLookup( filename );
+	dir = 0;
+
+	while ( entry != -1 || dir < fs_fileIndex.numDirs ) {
+		if ( dir < fs_fileIndex.numDirs && ( entry == -1 || fs_fileIndex.dirs[dir] < fs_fileIndex.entries[entry].search ) ) {
+			search = fs_fileIndex.searches[fs_fileIndex.dirs[dir]];
+			dir++;
+		} else {
+			search = fs_fileIndex.searches[fs_fileIndex.entries[entry].search];
+			entry = fs_fileIndex.entries[entry].next;
+		}
+
+		len = FS_FOpenFileReadDir( filename, search, file, uniqueFILE, qfalse );
+
+		if ( file == NULL ) {
+			if ( len > 0 ) {
+				return len;
+			}
+		} else {
+			if ( len >= 0 && *file ) {
+				return len;
+			}
+		}
+	}
+
+	FS_AddNegativeCache( filename, file == NULL );
+	return -1;
+}
+
 /*
 ===========
 FS_FOpenFileRead
@@ -1509,25 +1859,36 @@ long FS_FOpenFileRead(const char *filename, fileHandle_t *file, qboolean uniqueF
 		Com_Error(ERR_FATAL, "Filesystem call made without initialization");
 
 	isLocalConfig = !strcmp(filename, "autoexec.cfg") || !strcmp(filename, Q3CONFIG_CFG);
-	for(search = fs_searchpaths; search; search = search->next)
-	{
-		// autoexec.cfg and q3config.cfg can only be loaded outside of pk3 files.
-		if (isLocalConfig && search->pack)
-			continue;
 
-		len = FS_FOpenFileReadDir(filename, search, file, uniqueFILE, qfalse);
+	// names FS_FOpenFileReadDir treats specially take the slow path
+	if(filename[0] != '/' && filename[0] != '\\' && !strstr(filename, "..") && !strstr(filename, "::"))
+	{
+		len = FS_FOpenFileReadIndexed(filename, file, uniqueFILE, isLocalConfig);
 
-		if(file == NULL)
-		{
-			if(len > 0)
-				return len;
-		}
-		else
+		if(len >= 0)
+			return len;
+	}
+	else
+	{
+		for(search = fs_searchpaths; search; search = search->next)
 		{
-			if(len >= 0 && *file)
-				return len;
-		}
+			// autoexec.cfg and q3config.cfg can only be loaded outside of pk3 files.
+			if (isLocalConfig && search->pack)
+				continue;
 
+			len = FS_FOpenFileReadDir(filename, search, file, uniqueFILE, qfalse);
+
+			if(file == NULL)
+			{
+				if(len > 0)
+					return len;
+			}
+			else
+			{
+				if(len >= 0 && *file)
+					return len;
+			}
+		}
 	}
 	
 #ifdef FS_MISSING
@@ -1780,10 +2141,7 @@ Properly handles partial reads
 =================
 */
 int FS_Read( void *buffer, int len, fileHandle_t f ) {
-	int		block, remaining;
 	int		read;
-	byte	*buf;
-	int		tries;
 
 	if ( !fs_searchpaths ) {
 		Com_Error( ERR_FATAL, "Filesystem call made without initialization" );
@@ -1797,9 +2155,42 @@ int FS_Read( void *buffer, int len, fileHandle_t f ) {
 		return 0;
 	}
 
-	buf = (byte *)buffer;
 	fs_readCount += len;
 
+	read = FS_ThreadRead( buffer, len, f );
+
+	if ( read == -1 && fsh[f].zipFile == qfalse ) {
+		Com_Error (ERR_FATAL, "FS_Read: -1 bytes read");
+	}
+
+	return read;
+}
+
+/*
+=================
+FS_ThreadRead
+
+FS_Read for a thread that owns the handle while the main thread keeps
+running. Doesn't print or touch the read statistics, the main thread adds
+the bytes with FS_CountRead. Returns -1 if a loose file can't be read.
+=================
+*/
+int FS_ThreadRead( void *buffer, int len, fileHandle_t f ) {
+	int		block, remaining;
+	int		read;
+	byte	*buf;
+	int		tries;
+
+	if ( f < 1 || f >= MAX_FILE_HANDLES ) {
+		return 0;
+	}
+
+	if ( !buffer || len < 1 ) {
+		return 0;
+	}
+
+	buf = (byte *)buffer;
+
 	if (fsh[f].zipFile == qfalse) {
 		remaining = len;
 		tries = 0;
@@ -1817,7 +2208,7 @@ int FS_Read( void *buffer, int len, fileHandle_t f ) {
 			}
 
 			if (read == -1) {
-				Com_Error (ERR_FATAL, "FS_Read: -1 bytes read");
+				return -1;
 			}
 
 			remaining -= read;
@@ -1829,6 +2220,17 @@ int FS_Read( void *buffer, int len, fileHandle_t f ) {
 	}
 }
 
+/*
+=================
+FS_CountRead
+
+Add bytes read by FS_ThreadRead to the read statistics
+=================
+*/
+void FS_CountRead( int len ) {
+	fs_readCount += len;
+}
+
 /*
 =================
 FS_Write
@@ -1837,16 +2239,37 @@ Properly handles partial writes
 =================
 */
 int FS_Write( const void *buffer, int len, fileHandle_t h ) {
-	int		block, remaining;
 	int		written;
-	byte	*buf;
-	int		tries;
-	FILE	*f;
 
 	if ( !fs_searchpaths ) {
 		Com_Error( ERR_FATAL, "Filesystem call made without initialization" );
 	}
 
+	written = FS_ThreadWrite( buffer, len, h );
+
+	if ( written == -1 ) {
+		Com_Printf( "FS_Write: 0 bytes written\n" );
+		return 0;
+	}
+
+	return written;
+}
+
+/*
+=================
+FS_ThreadWrite
+
+FS_Write for a thread that owns the handle while the main thread keeps
+running. Doesn't print, returns -1 if the data couldn't be written.
+=================
+*/
+int FS_ThreadWrite( const void *buffer, int len, fileHandle_t h ) {
+	int		block, remaining;
+	int		written;
+	byte	*buf;
+	int		tries;
+	FILE	*f;
+
 	if ( h < 1 || h >= MAX_FILE_HANDLES ) {
 		return 0;
 	}
@@ -1867,14 +2290,12 @@ int FS_Write( const void *buffer, int len, fileHandle_t h ) {
 			if (!tries) {
 				tries = 1;
 			} else {
-				Com_Printf( "FS_Write: 0 bytes written\n" );
-				return 0;
+				return -1;
 			}
 		}
 
 		if (written == -1) {
-			Com_Printf( "FS_Write: -1 bytes written\n" );
-			return 0;
+			return -1;
 		}
 
 		remaining -= written;
@@ -1897,8 +2318,6 @@ void QDECL FS_Printf( fileHandle_t h, const char *fmt, ... ) {
 	FS_Write(msg, strlen(msg), h);
 }
 
-#define PK3_SEEK_BUFFER_SIZE 65536
-
 /*
 =================
 FS_Seek
@@ -1919,64 +2338,36 @@ int FS_Seek( fileHandle_t f, long offset, int origin ) {
 	}
 
 	if (fsh[f].zipFile == qtrue) {
-		//FIXME: this is really, really crappy
-		//(but better than what was here before)
-		byte	buffer[PK3_SEEK_BUFFER_SIZE];
-		int		remainder;
-		int		currentPosition = FS_FTell( f );
-
-		// change negative offsets into FS_SEEK_SET
-		if ( offset < 0 ) {
-			switch( origin ) {
-				case FS_SEEK_END:
-					remainder = fsh[f].zipFileLen + offset;
-					break;
-
-				case FS_SEEK_CUR:
-					remainder = currentPosition + offset;
-					break;
-
-				case FS_SEEK_SET:
-				default:
-					remainder = 0;
-					break;
-			}
-
-			if ( remainder < 0 ) {
-				remainder = 0;
-			}
-
-			origin = FS_SEEK_SET;
-		} else {
-			if ( origin == FS_SEEK_END ) {
-				remainder = fsh[f].zipFileLen - currentPosition + offset;
-			} else {
-				remainder = offset;
-			}
-		}
+		long	position;
 
 		switch( origin ) {
 			case FS_SEEK_SET:
-				if ( remainder == currentPosition ) {
-					return 0;
-				}
-				unzSetOffset(fsh[f].handleFiles.file.z, fsh[f].zipFilePos);
-				unzOpenCurrentFile(fsh[f].handleFiles.file.z);
-				//fallthrough
+				position = offset;
+				break;
 
-			case FS_SEEK_END:
 			case FS_SEEK_CUR:
-				while( remainder > PK3_SEEK_BUFFER_SIZE ) {
-					FS_Read( buffer, PK3_SEEK_BUFFER_SIZE, f );
-					remainder -= PK3_SEEK_BUFFER_SIZE;
-				}
-				FS_Read( buffer, remainder, f );
-				return 0;
+				position = FS_FTell( f ) + offset;
+				break;
+
+			case FS_SEEK_END:
+				position = fsh[f].zipFileLen + offset;
+				break;
 
 			default:
 				Com_Error( ERR_FATAL, "Bad origin in FS_Seek" );
 				return -1;
 		}
+
+		if ( position < 0 ) {
+			position = 0;
+		}
+
+		// stored files seek directly, deflated files resume from the nearest
+		// inflate checkpoint recorded since the first seek
+		if ( unzSeekCurrentFile( fsh[f].handleFiles.file.z, position ) != UNZ_OK ) {
+			return -1;
+		}
+		return 0;
 	} else {
 		FILE *file;
 		file = FS_FileForHandle(f);
@@ -2000,6 +2391,371 @@ int FS_Seek( fileHandle_t f, long offset, int origin ) {
 }
 
 
+/*
+======================================================================================
+
+ASSET PREFETCH
+
+While a level loads, the files it is going to need are inflated on worker
+threads ahead of time. The list is built on the main thread with
+FS_PrefetchFile, which only queues deflated pk3 files and ignores everything
+else. FS_PrefetchStart runs a job pool over the list from a separate thread
+so the main thread can keep loading. FS_ReadFileDir takes prefetched files
+from the cache instead of inflating them, and files the workers haven't
+started yet are simply read by the main thread as usual.
+
+Workers open the pk3 themselves and only use the C library and zlib, so
+they don't touch any engine state. Everything is released and the stats are
+printed by FS_PrefetchEnd.
+
+======================================================================================
+*/
+
+#define MAX_PREFETCH_FILES	1024
+
+typedef enum {
+	PREFETCH_QUEUED,
+	PREFETCH_RUNNING,
+	PREFETCH_DONE,
+	PREFETCH_FAILED,
+	PREFETCH_USED		// taken by the main thread, workers must skip it
+} prefetchState_t;
+
+typedef struct {
+	pack_t			*pak;
+	int				pos;			// position of the file in the pak's central directory
+	unsigned long	offset;			// compressed data
+	unsigned long	compressedSize;
+	unsigned long	crc;
+	int				length;
+	byte			*data;			// malloc'd by the worker
+	prefetchState_t	state;
+} prefetchFile_t;
+
+typedef struct {
+	prefetchFile_t	files[MAX_PREFETCH_FILES];
+	int				numFiles;
+	int				queuedBytes;
+
+	void			*thread;
+	void			*mutex;
+	void			*doneSemaphore;		// posted whenever a file is finished
+	jobPool_t		*pool;
+	qboolean		cancel;
+
+	// stats, the first three are only updated under the mutex
+	int				compressedBytes;
+	int				inflatedBytes;
+	int				inflateMsec;
+	int				hits;
+	int				misses;
+	int				startTime;
+	int				startReadCount;
+} prefetch_t;
+
+static prefetch_t	fs_prefetch;
+
+/*
+=================
+FS_PrefetchInflate
+
+Runs on a worker thread
+=================
+*/
+static qboolean FS_PrefetchInflate( prefetchFile_t *file ) {
+	FILE		*f;
+	byte		*compressed;
+	z_stream	stream;
+	int			err;
+
+	f = Sys_FOpen( file->pak->pakFilename, "rb" );
+	if ( !f ) {
+		return qfalse;
+	}
+
+	// inflate needs a dummy byte after raw deflate data to report the end
+	compressed = malloc( file->compressedSize + 1 );
+	file->data = malloc( file->length + 1 );
+
+	if ( !compressed || !file->data || fseek( f, file->offset, SEEK_SET ) != 0
+		|| fread( compressed, 1, file->compressedSize, f ) != file->compressedSize ) {
+		free( compressed );
+		fclose( f );
+		return qfalse;
+	}
+
+	fclose( f );
+	compressed[file->compressedSize] = 0;
+
+	Com_Memset( &stream, 0, sizeof( stream ) );
+	if ( inflateInit2( &stream, -MAX_WBITS ) != Z_OK ) {
+		free( compressed );
+		return qfalse;
+	}
+
+	stream.next_in = compressed;
+	stream.avail_in = file->compressedSize + 1;
+	stream.next_out = file->data;
+	stream.avail_out = file->length;
+
+	err = inflate( &stream, Z_FINISH );
+	inflateEnd( &stream );
+	free( compressed );
+
+	if ( ( err != Z_STREAM_END && err != Z_BUF_ERROR ) || stream.total_out != file->length ) {
+		return qfalse;
+	}
+
+	return crc32( 0, file->data, file->length ) == file->crc;
+}
+
+/*
+=================
+FS_PrefetchJob
+=================
+*/
+static void FS_PrefetchJob( void *data, int index, int threadNum ) {
+	prefetchFile_t	*file = &fs_prefetch.files[index];
+	qboolean		ok;
+	int				start;
+
+	Sys_LockMutex( fs_prefetch.mutex );
+	if ( file->state != PREFETCH_QUEUED || fs_prefetch.cancel ) {
+		Sys_UnlockMutex( fs_prefetch.mutex );
+		return;
+	}
+	file->state = PREFETCH_RUNNING;
+	Sys_UnlockMutex( fs_prefetch.mutex );
+
+	start = Sys_Milliseconds();
+	ok = FS_PrefetchInflate( file );
+
+	Sys_LockMutex( fs_prefetch.mutex );
+	if ( ok ) {
+		file->state = PREFETCH_DONE;
+		fs_prefetch.compressedBytes += file->compressedSize;
+		fs_prefetch.inflatedBytes += file->length;
+	} else {
+		file->state = PREFETCH_FAILED;
+		free( file->data );
+		file->data = NULL;
+	}
+	fs_prefetch.inflateMsec += Sys_Milliseconds() - start;
+	Sys_UnlockMutex( fs_prefetch.mutex );
+
+	Sys_SemaphorePost( fs_prefetch.doneSemaphore );
+}
+
+/*
+=================
+FS_PrefetchThread
+=================
+*/
+static void FS_PrefetchThread( void *arg ) {
+	Job_ParallelFor( fs_prefetch.pool, FS_PrefetchJob, NULL, fs_prefetch.numFiles );
+}
+
+/*
+=================
+FS_PrefetchFile
+
+Queue a file to be inflated by FS_PrefetchStart.
+Returns qfalse if the file doesn't exist.
+=================
+*/
+qboolean FS_PrefetchFile( const char *qpath ) {
+	prefetchFile_t	*file;
+	unz_file_info	info;
+	uLong			offset;
+	fileHandle_t	h;
+	long			len;
+	int				i;
+
+	if ( !fs_searchpaths ) {
+		Com_Error( ERR_FATAL, "Filesystem call made without initialization" );
+	}
+
+	// a previous load didn't finish
+	if ( fs_prefetch.thread ) {
+		FS_PrefetchEnd();
+	}
+
+	// the file may never be loaded, only the real load may reference the pak
+	fs_probing = qtrue;
+	len = FS_FOpenFileRead( qpath, &h, qfalse );
+	fs_probing = qfalse;
+
+	if ( !h ) {
+		return qfalse;
+	}
+
+	if ( fs_prefetchThreads->integer <= 0 || !fsh[h].zipFile || !fsh[h].zipPak
+		|| fs_prefetch.numFiles == MAX_PREFETCH_FILES
+		|| fs_prefetch.queuedBytes + len > fs_prefetchMegs->integer * 1024 * 1024 ) {
+		FS_FCloseFile( h );
+		return qtrue;
+	}
+
+	// stored files are mapped or read directly, there is nothing to gain
+	if ( unzGetCurrentFileInfo( fsh[h].handleFiles.file.z, &info, NULL, 0, NULL, 0, NULL, 0 ) != UNZ_OK
+		|| info.compression_method != Z_DEFLATED
+		|| unzGetCurrentFileDataOffset( fsh[h].handleFiles.file.z, &offset ) != UNZ_OK ) {
+		FS_FCloseFile( h );
+		return qtrue;
+	}
+
+	for ( i = 0; i < fs_prefetch.numFiles; i++ ) {
+		if ( fs_prefetch.files[i].pak == fsh[h].zipPak && fs_prefetch.files[i].pos == fsh[h].zipFilePos ) {
+			FS_FCloseFile( h );
+			return qtrue;
+		}
+	}
+
+	file = &fs_prefetch.files[fs_prefetch.numFiles++];
+	file->pak = fsh[h].zipPak;
+	file->pos = fsh[h].zipFilePos;
+	file->offset = offset;
+	file->compressedSize = info.compressed_size;
+	file->crc = info.crc;
+	file->length = len;
+	file->data = NULL;
+	file->state = PREFETCH_QUEUED;
+
+	fs_prefetch.queuedBytes += len;
+
+	FS_FCloseFile( h );
+	return qtrue;
+}
+
+/*
+=================
+FS_PrefetchStart
+
+Start inflating the queued files
+=================
+*/
+void FS_PrefetchStart( void ) {
+	if ( !fs_prefetch.numFiles || fs_prefetch.thread ) {
+		return;
+	}
+
+	fs_prefetch.mutex = Sys_CreateMutex();
+	fs_prefetch.doneSemaphore = Sys_CreateSemaphore( 0 );
+
+	if ( fs_prefetch.mutex && fs_prefetch.doneSemaphore ) {
+		// the prefetch thread runs jobs too
+		fs_prefetch.pool = Job_CreatePool( "prefetch", fs_prefetchThreads->integer - 1 );
+		fs_prefetch.thread = Sys_CreateThread( FS_PrefetchThread, NULL );
+	}
+
+	if ( !fs_prefetch.thread ) {
+		Com_DPrintf( "Prefetch thread not available, not prefetching\n" );
+		FS_PrefetchEnd();
+		return;
+	}
+
+	fs_prefetch.startTime = Sys_Milliseconds();
+	fs_prefetch.startReadCount = fs_readCount;
+
+	Com_DPrintf( "Prefetching %d files (%d KB) on %d threads\n", fs_prefetch.numFiles,
+		fs_prefetch.queuedBytes / 1024, Job_NumThreads( fs_prefetch.pool ) );
+}
+
+/*
+=================
+FS_PrefetchEnd
+
+Stop the workers, free the files that weren't used and print the stats
+=================
+*/
+void FS_PrefetchEnd( void ) {
+	int i;
+
+	if ( fs_prefetch.thread ) {
+		Sys_LockMutex( fs_prefetch.mutex );
+		fs_prefetch.cancel = qtrue;
+		Sys_UnlockMutex( fs_prefetch.mutex );
+
+		Sys_JoinThread( fs_prefetch.thread );
+
+		Com_Printf( "Prefetch: %d of %d files used, %d%% cache hits, %d KB inflated from %d KB in %d msec, "
+			"%d KB read in %d msec\n", fs_prefetch.hits, fs_prefetch.numFiles,
+			fs_prefetch.hits + fs_prefetch.misses ? fs_prefetch.hits * 100 / ( fs_prefetch.hits + fs_prefetch.misses ) : 0,
+			fs_prefetch.inflatedBytes / 1024, fs_prefetch.compressedBytes / 1024, fs_prefetch.inflateMsec,
+			( fs_readCount - fs_prefetch.startReadCount ) / 1024, Sys_Milliseconds() - fs_prefetch.startTime );
+	}
+
+	for ( i = 0; i < fs_prefetch.numFiles; i++ ) {
+		free( fs_prefetch.files[i].data );
+	}
+
+	Job_DestroyPool( fs_prefetch.pool );
+
+	if ( fs_prefetch.doneSemaphore ) {
+		Sys_DestroySemaphore( fs_prefetch.doneSemaphore );
+	}
+	if ( fs_prefetch.mutex ) {
+		Sys_DestroyMutex( fs_prefetch.mutex );
+	}
+
+	Com_Memset( &fs_prefetch, 0, sizeof( fs_prefetch ) );
+}
+
+/*
+=================
+FS_ReadPrefetched
+
+Copy a file opened by FS_ReadFileDir from the prefetch cache, waiting for it
+if a worker is inflating it. Returns qfalse if the caller has to read it.
+=================
+*/
+static qboolean FS_ReadPrefetched( fileHandle_t h, void *buffer, int len ) {
+	prefetchFile_t	*file;
+	byte			*data;
+	int				i;
+
+	if ( !fs_prefetch.thread || !fsh[h].zipFile ) {
+		return qfalse;
+	}
+
+	file = NULL;
+	for ( i = 0; i < fs_prefetch.numFiles; i++ ) {
+		if ( fs_prefetch.files[i].pak == fsh[h].zipPak && fs_prefetch.files[i].pos == fsh[h].zipFilePos ) {
+			file = &fs_prefetch.files[i];
+			break;
+		}
+	}
+
+	if ( !file || file->length != len ) {
+		fs_prefetch.misses++;
+		return qfalse;
+	}
+
+	Sys_LockMutex( fs_prefetch.mutex );
+	while ( file->state == PREFETCH_RUNNING ) {
+		Sys_UnlockMutex( fs_prefetch.mutex );
+		Sys_SemaphoreWait( fs_prefetch.doneSemaphore );
+		Sys_LockMutex( fs_prefetch.mutex );
+	}
+
+	data = ( file->state == PREFETCH_DONE ) ? file->data : NULL;
+	file->data = NULL;
+	file->state = PREFETCH_USED;
+	Sys_UnlockMutex( fs_prefetch.mutex );
+
+	if ( !data ) {
+		fs_prefetch.misses++;
+		return qfalse;
+	}
+
+	Com_Memcpy( buffer, data, len );
+	free( data );
+
+	fs_prefetch.hits++;
+	fs_readCount += len;
+	return qtrue;
+}
+
 /*
 ======================================================================================
 
@@ -2008,6 +2764,33 @@ CONVENIENCE FUNCTIONS FOR ENTIRE FILES
 ======================================================================================
 */
 
+/*
+============
+FS_ReadOpenFile
+
+Reads all of an opened file into temp memory with a trailing 0 and closes it
+============
+*/
+static byte *FS_ReadOpenFile( fileHandle_t h, long len )
+{
+	byte	*buf;
+
+	fs_loadCount++;
+	fs_loadStack++;
+
+	buf = Hunk_AllocateTempMemory(len+1);
+
+	if ( !FS_ReadPrefetched( h, buf, len ) ) {
+		FS_Read (buf, len, h);
+	}
+
+	// guarantee that it will have a trailing 0 for string operations
+	buf[len] = 0;
+	FS_FCloseFile( h );
+
+	return buf;
+}
+
 /*
 ============
 FS_ReadFileDir
@@ -2060,200 +2843,823 @@ long FS_ReadFileDir(const char *qpath, void *searchPath, qboolean unpure, void *
 				return len;
 			}
 
-			buf = Hunk_AllocateTempMemory(len+1);
-			*buffer = buf;
+			buf = Hunk_AllocateTempMemory(len+1);
+			*buffer = buf;
+
+			r = FS_Read( buf, len, com_journalDataFile );
+			if ( r != len ) {
+				Com_Error( ERR_FATAL, "Read from journalDataFile failed" );
+			}
+
+			fs_loadCount++;
+			fs_loadStack++;
+
+			// guarantee that it will have a trailing 0 for string operations
+			buf[len] = 0;
+
+			return len;
+		}
+	} else {
+		isConfig = qfalse;
+	}
+
+	search = searchPath;
+
+	if(search == NULL)
+	{
+		// look for it in the filesystem or pack files
+		len = FS_FOpenFileRead(qpath, &h, qfalse);
+	}
+	else
+	{
+		// look for it in a specific search path only
+		len = FS_FOpenFileReadDir(qpath, search, &h, qfalse, unpure);
+	}
+
+	if ( h == 0 ) {
+		if ( buffer ) {
+			*buffer = NULL;
+		}
+		// if we are journalling and it is a config file, write a zero to the journal file
+		if ( isConfig && com_journal && com_journal->integer == 1 ) {
+			Com_DPrintf( "Writing zero for %s to journal file.\n", qpath );
+			len = 0;
+			FS_Write( &len, sizeof( len ), com_journalDataFile );
+			FS_Flush( com_journalDataFile );
+		}
+		return -1;
+	}
+
+	if ( !buffer ) {
+		if ( isConfig && com_journal && com_journal->integer == 1 ) {
+			Com_DPrintf( "Writing len for %s to journal file.\n", qpath );
+			FS_Write( &len, sizeof( len ), com_journalDataFile );
+			FS_Flush( com_journalDataFile );
+		}
+		FS_FCloseFile( h);
+		return len;
+	}
+
+	buf = FS_ReadOpenFile( h, len );
+	*buffer = buf;
+
+	// if we are journalling and it is a config file, write it to the journal file
+	if ( isConfig && com_journal && com_journal->integer == 1 ) {
+		Com_DPrintf( "Writing %s to journal file.\n", qpath );
+		FS_Write( &len, sizeof( len ), com_journalDataFile );
+		FS_Write( buf, len, com_journalDataFile );
+		FS_Flush( com_journalDataFile );
+	}
+	return len;
+}
+
+/*
+============
+FS_ReadFileFromGameDir
+
+Filename are relative to the quake search path
+a null buffer will just return the file length without loading
+============
+*/
+long FS_ReadFileFromGameDir(const char *qpath, void **buffer, const char *gameDir)
+{
+	searchpath_t *search;
+	const char *dirname;
+	long len;
+
+	if(!fs_searchpaths)
+		Com_Error(ERR_FATAL, "Filesystem call made without initialization");
+
+	for(search = fs_searchpaths; search; search = search->next)
+	{
+		if(search->pack) {
+			dirname = search->pack->pakGamename;
+		} else {
+			dirname = search->dir->gamedir;
+		}
+
+		if(Q_stricmp(gameDir, dirname)) {
+			continue;
+		}
+
+		len = FS_ReadFileDir(qpath, search, qfalse, buffer);
+
+		if(len >= 0) {
+			return len;
+		}
+	}
+
+	if (buffer) {
+		*buffer = NULL;
+	}
+	return -1;
+}
+
+/*
+============
+FS_ReadFile
+
+Filename are relative to the quake search path
+a null buffer will just return the file length without loading
+============
+*/
+long FS_ReadFile(const char *qpath, void **buffer)
+{
+	return FS_ReadFileDir(qpath, NULL, qfalse, buffer);
+}
+
+/*
+=============
+FS_FreeFile
+=============
+*/
+void FS_FreeFile( void *buffer ) {
+	if ( !fs_searchpaths ) {
+		Com_Error( ERR_FATAL, "Filesystem call made without initialization" );
+	}
+	if ( !buffer ) {
+		Com_Error( ERR_FATAL, "FS_FreeFile( NULL )" );
+	}
+	fs_loadStack--;
+
+	Hunk_FreeTempMemory( buffer );
+
+	// if all of our temp files are free, clear all of our space
+	if ( fs_loadStack == 0 ) {
+		Hunk_ClearTempMemory();
+	}
+}
+
+#define MAX_MAPPED_FILES	64
+
+static sysFileMapping_t	fs_mappedFiles[MAX_MAPPED_FILES];
+
+/*
+============
+FS_MapFileDir
+
+Like FS_ReadFileDir, but loose files and stored pk3 files are mapped into
+memory instead of being copied. Deflated files, pk3 members that aren't
+4 byte aligned and files that can't be mapped are read instead.
+The view is copy on write and is NOT guaranteed to have a trailing 0.
+Release it with FS_UnmapFile.
+============
+*/
+long FS_MapFileDir( const char *qpath, void *searchPath, qboolean unpure, void **buffer )
+{
+	sysFileMapping_t	*view;
+	fileHandle_t		h;
+	FILE				*file;
+	long				offset;
+	long				len;
+	int					i;
+
+	if ( !fs_searchpaths ) {
+		Com_Error( ERR_FATAL, "Filesystem call made without initialization" );
+	}
+
+	if ( !qpath || !qpath[0] ) {
+		Com_Error( ERR_FATAL, "FS_MapFile with empty name" );
+	}
+
+	if ( !buffer ) {
+		return FS_ReadFileDir( qpath, searchPath, unpure, NULL );
+	}
+
+	view = NULL;
+	for ( i = 0; i < MAX_MAPPED_FILES; i++ ) {
+		if ( !fs_mappedFiles[i].data ) {
+			view = &fs_mappedFiles[i];
+			break;
+		}
+	}
+
+	// journaled config files have to go through FS_ReadFileDir
+	if ( view && fs_mapFiles->integer && !( com_journal && com_journal->integer ) ) {
+		if ( searchPath == NULL ) {
+			len = FS_FOpenFileRead( qpath, &h, qfalse );
+		} else {
+			len = FS_FOpenFileReadDir( qpath, searchPath, &h, qfalse, unpure );
+		}
+
+		if ( h == 0 ) {
+			*buffer = NULL;
+			return -1;
+		}
+
+		file = NULL;
+		offset = 0;
+
+		if ( fsh[h].zipFile ) {
+			voidpf	stream;
+			uLong	dataOffset;
+
+			if ( unzGetCurrentFileStoredData( fsh[h].handleFiles.file.z, &stream, &dataOffset ) == UNZ_OK ) {
+				file = (FILE *)stream;
+				offset = dataOffset;
+			}
+		} else {
+			file = fsh[h].handleFiles.file.o;
+		}
+
+		// the view has the same alignment as the offset, and the loaders
+		// cast the data to int *, so unaligned pk3 members are copied.
+		// A pk3 that was truncated since it was opened would fault when
+		// the view is touched, so the data also has to fit in the file
+		if ( file && !( offset & 3 ) && offset + len <= FS_fplength( file )
+			&& Sys_MapFile( file, offset, len, view ) ) {
+			FS_FCloseFile( h );
+
+			fs_loadCount++;
+			fs_loadStack++;
+
+			*buffer = view->data;
+			return len;
+		}
+
+		// deflated, unaligned or truncated, read it through the handle
+		// that is already open
+		*buffer = FS_ReadOpenFile( h, len );
+		return len;
+	}
+
+	return FS_ReadFileDir( qpath, searchPath, unpure, buffer );
+}
+
+/*
+============
+FS_MapFile
+============
+*/
+long FS_MapFile( const char *qpath, void **buffer )
+{
+	return FS_MapFileDir( qpath, NULL, qfalse, buffer );
+}
+
+/*
+=============
+FS_UnmapFile
+
+Releases a buffer returned by FS_MapFile, whether it was mapped or read
+=============
+*/
+void FS_UnmapFile( void *buffer ) {
+	int i;
+
+	if ( !fs_searchpaths ) {
+		Com_Error( ERR_FATAL, "Filesystem call made without initialization" );
+	}
+	if ( !buffer ) {
+		Com_Error( ERR_FATAL, "FS_UnmapFile( NULL )" );
+	}
+
+	for ( i = 0; i < MAX_MAPPED_FILES; i++ ) {
+		if ( fs_mappedFiles[i].data == buffer ) {
+			Sys_UnmapFile( &fs_mappedFiles[i] );
+
+			fs_loadStack--;
+
+			// if all of our temp files are free, clear all of our space
+			if ( fs_loadStack == 0 ) {
+				Hunk_ClearTempMemory();
+			}
+			return;
+		}
+	}
+
+	FS_FreeFile( buffer );
+}
+
+/*
+============
+FS_WriteFile
+
+Filename are relative to the quake search path
+============
+*/
+void FS_WriteFile( const char *qpath, const void *buffer, int size ) {
+	fileHandle_t f;
+
+	if ( !fs_searchpaths ) {
+		Com_Error( ERR_FATAL, "Filesystem call made without initialization" );
+	}
+
+	if ( !qpath || !buffer ) {
+		Com_Error( ERR_FATAL, "FS_WriteFile: NULL parameter" );
+	}
+
+	f = FS_FOpenFileWrite( qpath );
+	if ( !f ) {
+		Com_Printf( "Failed to open %s\n", qpath );
+		return;
+	}
+
+	FS_Write( buffer, size, f );
+
+	FS_FCloseFile( f );
+}
+
+
+
+/*
+==========================================================================
+
+ZIP FILE LOADING
+
+==========================================================================
+*/
+
+/*
+=================
+FS_AllocPack
+
+Allocate a pack_t with an empty hash table.
+=================
+*/
+static pack_t *FS_AllocPack( const char *zipfile, const char *basename, int hashSize )
+{
+	pack_t	*pack;
+	int		i;
+
+	pack = Z_Malloc( sizeof( pack_t ) + hashSize * sizeof(fileInPack_t *) );
+	pack->hashSize = hashSize;
+	pack->hashTable = (fileInPack_t **) (((char *) pack) + sizeof( pack_t ));
+	for(i = 0; i < pack->hashSize; i++) {
+		pack->hashTable[i] = NULL;
+	}
+
+	Q_strncpyz( pack->pakFilename, zipfile, sizeof( pack->pakFilename ) );
+	Q_strncpyz( pack->pakBasename, basename, sizeof( pack->pakBasename ) );
+
+	// strip .pk3 if needed
+	if ( strlen( pack->pakBasename ) > 4 && !Q_stricmp( pack->pakBasename + strlen( pack->pakBasename ) - 4, ".pk3" ) ) {
+		pack->pakBasename[strlen( pack->pakBasename ) - 4] = 0;
+	}
+
+	return pack;
+}
+
+/*
+==========================================================================
+
+PK3 INDEX CACHE
+
+The file list and checksum of every pk3 are kept in PAKINDEX_FILENAME in
+fs_homepath, keyed by the pk3's path, size and modification time, so an
+unchanged pk3 is mounted without reading its central directory. The zip
+itself is only opened when a file is read from it.
+
+Index file:
+4	PAKINDEX_IDENT
+4	PAKINDEX_VERSION
+4	number of entries
+	4	path length including the null byte
+		<path>
+	4	pk3 size
+	4	pk3 modification time
+	4	data length
+		<data>
+
+Entry data:
+4	checksum
+4	number of files
+4	hash size
+4	names length
+	<hash size> first file index in each hash chain or -1
+	<number of files>
+		4	position in zip
+		4	uncompressed size
+		4	name offset
+		4	next file index in the hash chain or -1
+	<names>
+
+==========================================================================
+*/
+
+#define PAKINDEX_FILENAME	"pakindex.dat"
+#define PAKINDEX_IDENT		(('X'<<24)+('I'<<16)+('K'<<8)+'P')
+#define PAKINDEX_VERSION	1
+#define PAKINDEX_HASH_SIZE	1024
+
+typedef struct pakIndexEntry_s {
+	char					*path;
+	int						size;
+	int						mtime;
+	byte					*data;
+	int						dataLength;
+	qboolean				allocated;		// path and data aren't in fs_pakIndexFile
+	struct pakIndexEntry_s	*next;
+	struct pakIndexEntry_s	*hashNext;
+} pakIndexEntry_t;
+
+static pakIndexEntry_t	*fs_pakIndexEntries;
+static pakIndexEntry_t	*fs_pakIndexHash[PAKINDEX_HASH_SIZE];
+static byte				*fs_pakIndexFile;		// loaded index, entries point into it
+static qboolean			fs_pakIndexLoaded;
+static qboolean			fs_pakIndexModified;
+static int				fs_pakIndexHits;
+static int				fs_pakIndexMisses;
+
+/*
+=================
+FS_PakIndexLong
+=================
+*/
+static int FS_PakIndexLong( const byte *data, int offset )
+{
+	int		value;
+
+	Com_Memcpy( &value, data + offset, 4 );
+	return LittleLong( value );
+}
+
+/*
+=================
+FS_FindPakIndexEntry
+=================
+*/
+static pakIndexEntry_t *FS_FindPakIndexEntry( const char *path )
+{
+	pakIndexEntry_t	*entry;
+
+	for ( entry = fs_pakIndexHash[FS_HashFileName( path, PAKINDEX_HASH_SIZE )]; entry; entry = entry->hashNext ) {
+		if ( !strcmp( entry->path, path ) ) {
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+=================
+FS_AddPakIndexEntry
+
+Adds an entry or replaces the data of an existing one. If allocated is
+qtrue the entry takes ownership of the Z_Malloc'd data, otherwise path
+and data point into fs_pakIndexFile.
+=================
+*/
+static void FS_AddPakIndexEntry( const char *path, int size, int mtime, byte *data, int dataLength, qboolean allocated )
+{
+	pakIndexEntry_t	*entry;
+	long			hash;
+
+	entry = FS_FindPakIndexEntry( path );
+
+	if ( entry ) {
+		if ( entry->allocated ) {
+			Z_Free( entry->data );
+		}
+		if ( allocated && !entry->allocated ) {
+			entry->path = CopyString( entry->path );
+		}
+	} else {
+		entry = Z_Malloc( sizeof( *entry ) );
+		entry->path = allocated ? CopyString( path ) : (char *)path;
+		entry->next = fs_pakIndexEntries;
+		fs_pakIndexEntries = entry;
+
+		hash = FS_HashFileName( path, PAKINDEX_HASH_SIZE );
+		entry->hashNext = fs_pakIndexHash[hash];
+		fs_pakIndexHash[hash] = entry;
+	}
 
-			r = FS_Read( buf, len, com_journalDataFile );
-			if ( r != len ) {
-				Com_Error( ERR_FATAL, "Read from journalDataFile failed" );
-			}
+	entry->size = size;
+	entry->mtime = mtime;
+	entry->data = data;
+	entry->dataLength = dataLength;
+	entry->allocated = allocated;
+}
 
-			fs_loadCount++;
-			fs_loadStack++;
+/*
+=================
+FS_FreePakIndex
+=================
+*/
+static void FS_FreePakIndex( void )
+{
+	pakIndexEntry_t	*entry, *next;
 
-			// guarantee that it will have a trailing 0 for string operations
-			buf[len] = 0;
+	for ( entry = fs_pakIndexEntries; entry; entry = next ) {
+		next = entry->next;
 
-			return len;
+		if ( entry->allocated ) {
+			Z_Free( entry->path );
+			Z_Free( entry->data );
 		}
-	} else {
-		isConfig = qfalse;
-	}
 
-	search = searchPath;
+		Z_Free( entry );
+	}
 
-	if(search == NULL)
-	{
-		// look for it in the filesystem or pack files
-		len = FS_FOpenFileRead(qpath, &h, qfalse);
+	if ( fs_pakIndexFile ) {
+		Z_Free( fs_pakIndexFile );
+		fs_pakIndexFile = NULL;
 	}
-	else
-	{
-		// look for it in a specific search path only
-		len = FS_FOpenFileReadDir(qpath, search, &h, qfalse, unpure);
+
+	fs_pakIndexEntries = NULL;
+	Com_Memset( fs_pakIndexHash, 0, sizeof( fs_pakIndexHash ) );
+	fs_pakIndexLoaded = qfalse;
+	fs_pakIndexModified = qfalse;
+}
+/*
+=================
+FS_PakIndexPath
+=================
+*/
+static char *FS_PakIndexPath( void )
+{
+	return FS_BuildOSPath( fs_homepath->string, NULL, PAKINDEX_FILENAME );
+}
+
+/*
+=================
+FS_LoadPakIndex
+
+Read the index file, entries that don't fit in the file are ignored.
+=================
+*/
+static void FS_LoadPakIndex( void )
+{
+	FILE	*f;
+	int		length, numEntries, offset;
+	int		pathLength, dataLength;
+	int		i;
+	char	*path;
+
+	FS_FreePakIndex();
+
+	fs_pakIndexLoaded = qtrue;
+	fs_pakIndexHits = fs_pakIndexMisses = 0;
+
+	f = Sys_FOpen( FS_PakIndexPath(), "rb" );
+	if ( !f ) {
+		return;
 	}
 
-	if ( h == 0 ) {
-		if ( buffer ) {
-			*buffer = NULL;
-		}
-		// if we are journalling and it is a config file, write a zero to the journal file
-		if ( isConfig && com_journal && com_journal->integer == 1 ) {
-			Com_DPrintf( "Writing zero for %s to journal file.\n", qpath );
-			len = 0;
-			FS_Write( &len, sizeof( len ), com_journalDataFile );
-			FS_Flush( com_journalDataFile );
-		}
-		return -1;
+	fseek( f, 0, SEEK_END );
+	length = ftell( f );
+	fseek( f, 0, SEEK_SET );
+
+	if ( length < 12 ) {
+		fclose( f );
+		return;
 	}
 
-	if ( !buffer ) {
-		if ( isConfig && com_journal && com_journal->integer == 1 ) {
-			Com_DPrintf( "Writing len for %s to journal file.\n", qpath );
-			FS_Write( &len, sizeof( len ), com_journalDataFile );
-			FS_Flush( com_journalDataFile );
-		}
-		FS_FCloseFile( h);
-		return len;
+	fs_pakIndexFile = Z_Malloc( length );
+
+	if ( fread( fs_pakIndexFile, 1, length, f ) != length
+		|| FS_PakIndexLong( fs_pakIndexFile, 0 ) != PAKINDEX_IDENT
+		|| FS_PakIndexLong( fs_pakIndexFile, 4 ) != PAKINDEX_VERSION ) {
+		fclose( f );
+		Z_Free( fs_pakIndexFile );
+		fs_pakIndexFile = NULL;
+		return;
 	}
 
-	fs_loadCount++;
-	fs_loadStack++;
+	fclose( f );
 
-	buf = Hunk_AllocateTempMemory(len+1);
-	*buffer = buf;
+	numEntries = FS_PakIndexLong( fs_pakIndexFile, 8 );
+	offset = 12;
 
-	FS_Read (buf, len, h);
+	for ( i = 0; i < numEntries; i++ ) {
+		if ( offset + 4 > length ) {
+			break;
+		}
+		pathLength = FS_PakIndexLong( fs_pakIndexFile, offset );
+		offset += 4;
 
-	// guarantee that it will have a trailing 0 for string operations
-	buf[len] = 0;
-	FS_FCloseFile( h );
+		if ( pathLength < 1 || pathLength > length - offset - 12 ) {
+			break;
+		}
+		path = (char *)fs_pakIndexFile + offset;
+		offset += pathLength;
 
-	// if we are journalling and it is a config file, write it to the journal file
-	if ( isConfig && com_journal && com_journal->integer == 1 ) {
-		Com_DPrintf( "Writing %s to journal file.\n", qpath );
-		FS_Write( &len, sizeof( len ), com_journalDataFile );
-		FS_Write( buf, len, com_journalDataFile );
-		FS_Flush( com_journalDataFile );
+		if ( path[pathLength-1] != '\0' ) {
+			break;
+		}
+
+		dataLength = FS_PakIndexLong( fs_pakIndexFile, offset + 8 );
+		if ( dataLength < 16 || dataLength > length - offset - 12 ) {
+			break;
+		}
+
+		FS_AddPakIndexEntry( path, FS_PakIndexLong( fs_pakIndexFile, offset ), FS_PakIndexLong( fs_pakIndexFile, offset + 4 ),
+							fs_pakIndexFile + offset + 12, dataLength, qfalse );
+		offset += 12 + dataLength;
 	}
-	return len;
 }
 
 /*
-============
-FS_ReadFileFromGameDir
+=================
+FS_WritePakIndex
 
-Filename are relative to the quake search path
-a null buffer will just return the file length without loading
-============
+Save the index if pk3s were added or changed, dropping pk3s that no longer exist.
+=================
 */
-long FS_ReadFileFromGameDir(const char *qpath, void **buffer, const char *gameDir)
+static void FS_WritePakIndex( void )
 {
-	searchpath_t *search;
-	const char *dirname;
-	long len;
+	pakIndexEntry_t	*entry;
+	FILE			*f;
+	int				numEntries, size, mtime;
+	int				header[3], values[4];
+	char			ospath[MAX_OSPATH], tmppath[MAX_OSPATH];
+	qboolean		ok;
 
-	if(!fs_searchpaths)
-		Com_Error(ERR_FATAL, "Filesystem call made without initialization");
+	if ( fs_debug->integer ) {
+		Com_Printf( "pk3 index: %d cached, %d read\n", fs_pakIndexHits, fs_pakIndexMisses );
+	}
 
-	for(search = fs_searchpaths; search; search = search->next)
-	{
-		if(search->pack) {
-			dirname = search->pack->pakGamename;
-		} else {
-			dirname = search->dir->gamedir;
-		}
+	if ( !fs_pakIndexModified ) {
+		return;
+	}
 
-		if(Q_stricmp(gameDir, dirname)) {
+	numEntries = 0;
+	for ( entry = fs_pakIndexEntries; entry; entry = entry->next ) {
+		if ( !Sys_FileInfo( entry->path, &size, &mtime ) || size != entry->size || mtime != entry->mtime ) {
+			entry->dataLength = 0;
 			continue;
 		}
+		numEntries++;
+	}
 
-		len = FS_ReadFileDir(qpath, search, qfalse, buffer);
+	Q_strncpyz( ospath, FS_PakIndexPath(), sizeof( ospath ) );
+	Com_sprintf( tmppath, sizeof( tmppath ), "%s.tmp", ospath );
 
-		if(len >= 0) {
-			return len;
+	FS_CreatePath( ospath );
+
+	// write to a temporary file and rename it, so a failed write
+	// doesn't leave a truncated index behind
+	f = Sys_FOpen( tmppath, "wb" );
+	if ( !f ) {
+		Com_Printf( "Couldn't write %s\n", ospath );
+		return;
+	}
+
+	header[0] = LittleLong( PAKINDEX_IDENT );
+	header[1] = LittleLong( PAKINDEX_VERSION );
+	header[2] = LittleLong( numEntries );
+	ok = fwrite( header, sizeof( header ), 1, f ) == 1;
+
+	for ( entry = fs_pakIndexEntries; ok && entry; entry = entry->next ) {
+		if ( !entry->dataLength ) {
+			continue;
 		}
+
+		values[0] = LittleLong( strlen( entry->path ) + 1 );
+		ok = fwrite( values, 4, 1, f ) == 1
+			&& fwrite( entry->path, strlen( entry->path ) + 1, 1, f ) == 1;
+
+		values[0] = LittleLong( entry->size );
+		values[1] = LittleLong( entry->mtime );
+		values[2] = LittleLong( entry->dataLength );
+		ok = ok && fwrite( values, 4, 3, f ) == 3
+			&& fwrite( entry->data, entry->dataLength, 1, f ) == 1;
 	}
 
-	if (buffer) {
-		*buffer = NULL;
+	ok = !fclose( f ) && ok;
+
+	if ( ok ) {
+		remove( ospath );
+		ok = !rename( tmppath, ospath );
+	}
+
+	if ( !ok ) {
+		remove( tmppath );
+		Com_Printf( "Couldn't write %s\n", ospath );
 	}
-	return -1;
 }
 
 /*
-============
-FS_ReadFile
+=================
+FS_PakIndexData
 
-Filename are relative to the quake search path
-a null buffer will just return the file length without loading
-============
+Serialize the file list of a pack for the index.
+=================
 */
-long FS_ReadFile(const char *qpath, void **buffer)
+static byte *FS_PakIndexData( const pack_t *pack, int *dataLength )
 {
-	return FS_ReadFileDir(qpath, NULL, qfalse, buffer);
-}
+	const fileInPack_t	*file;
+	const char			*names;
+	byte				*data;
+	int					*out;
+	int					namesLength;
+	int					i;
 
-/*
-=============
-FS_FreeFile
-=============
-*/
-void FS_FreeFile( void *buffer ) {
-	if ( !fs_searchpaths ) {
-		Com_Error( ERR_FATAL, "Filesystem call made without initialization" );
-	}
-	if ( !buffer ) {
-		Com_Error( ERR_FATAL, "FS_FreeFile( NULL )" );
+	names = (const char *)( pack->buildBuffer + pack->numfiles );
+
+	namesLength = 0;
+	for ( i = 0, file = pack->buildBuffer; i < pack->numfiles; i++, file++ ) {
+		if ( !file->name ) {
+			// the central directory couldn't be fully read
+			return NULL;
+		}
+		namesLength = MAX( namesLength, file->name - names + (int)strlen( file->name ) + 1 );
 	}
-	fs_loadStack--;
 
-	Hunk_FreeTempMemory( buffer );
+	*dataLength = ( 4 + pack->hashSize + pack->numfiles * 4 ) * 4 + namesLength;
+	data = Z_Malloc( *dataLength );
+	out = (int *)data;
 
-	// if all of our temp files are free, clear all of our space
-	if ( fs_loadStack == 0 ) {
-		Hunk_ClearTempMemory();
+	*out++ = LittleLong( pack->checksum );
+	*out++ = LittleLong( pack->numfiles );
+	*out++ = LittleLong( pack->hashSize );
+	*out++ = LittleLong( namesLength );
+
+	for ( i = 0; i < pack->hashSize; i++ ) {
+		*out++ = LittleLong( pack->hashTable[i] ? pack->hashTable[i] - pack->buildBuffer : -1 );
+	}
+
+	for ( i = 0, file = pack->buildBuffer; i < pack->numfiles; i++, file++ ) {
+		*out++ = LittleLong( file->pos );
+		*out++ = LittleLong( file->len );
+		*out++ = LittleLong( file->name - names );
+		*out++ = LittleLong( file->next ? file->next - pack->buildBuffer : -1 );
 	}
+
+	Com_Memcpy( out, names, namesLength );
+
+	return data;
 }
 
 /*
-============
-FS_WriteFile
+=================
+FS_PackFromPakIndex
 
-Filename are relative to the quake search path
-============
+Builds a pack from index data, returns NULL if the data isn't valid.
+=================
 */
-void FS_WriteFile( const char *qpath, const void *buffer, int size ) {
-	fileHandle_t f;
-
-	if ( !fs_searchpaths ) {
-		Com_Error( ERR_FATAL, "Filesystem call made without initialization" );
+static pack_t *FS_PackFromPakIndex( const char *zipfile, const char *basename, const byte *data, int dataLength )
+{
+	pack_t			*pack;
+	fileInPack_t	*buildBuffer;
+	const char		*indexNames;
+	char			*names;
+	int				checksum, numfiles, hashSize, namesLength;
+	int				i, index, offset;
+
+	checksum = FS_PakIndexLong( data, 0 );
+	numfiles = FS_PakIndexLong( data, 4 );
+	hashSize = FS_PakIndexLong( data, 8 );
+	namesLength = FS_PakIndexLong( data, 12 );
+
+	if ( numfiles < 0 || hashSize < 1 || hashSize > MAX_FILEHASH_SIZE || ( hashSize & ( hashSize - 1 ) )
+		|| namesLength < 0 || numfiles > dataLength / 16
+		|| dataLength != ( 4 + hashSize + numfiles * 4 ) * 4 + namesLength ) {
+		return NULL;
 	}
 
-	if ( !qpath || !buffer ) {
-		Com_Error( ERR_FATAL, "FS_WriteFile: NULL parameter" );
+	// check the indexes before building anything
+	for ( i = 0; i < hashSize; i++ ) {
+		index = FS_PakIndexLong( data, 16 + i * 4 );
+		if ( index < -1 || index >= numfiles ) {
+			return NULL;
+		}
 	}
 
-	f = FS_FOpenFileWrite( qpath );
-	if ( !f ) {
-		Com_Printf( "Failed to open %s\n", qpath );
-		return;
+	indexNames = (const char *)data + dataLength - namesLength;
+
+	for ( i = 0; i < numfiles; i++ ) {
+		offset = 16 + ( hashSize + i * 4 ) * 4;
+
+		index = FS_PakIndexLong( data, offset + 8 );
+		if ( index < 0 || index >= namesLength || !memchr( indexNames + index, '\0', namesLength - index ) ) {
+			return NULL;
+		}
+
+		index = FS_PakIndexLong( data, offset + 12 );
+		if ( index < -1 || index >= numfiles ) {
+			return NULL;
+		}
 	}
 
-	FS_Write( buffer, size, f );
+	buildBuffer = Z_Malloc( numfiles * sizeof( fileInPack_t ) + namesLength );
+	names = (char *)( buildBuffer + numfiles );
+	Com_Memcpy( names, indexNames, namesLength );
 
-	FS_FCloseFile( f );
-}
+	pack = FS_AllocPack( zipfile, basename, hashSize );
+	pack->buildBuffer = buildBuffer;
+	pack->numfiles = numfiles;
+	pack->checksum = checksum;
 
+	for ( i = 0; i < hashSize; i++ ) {
+		index = FS_PakIndexLong( data, 16 + i * 4 );
+		pack->hashTable[i] = ( index == -1 ) ? NULL : &buildBuffer[index];
+	}
 
+	for ( i = 0; i < numfiles; i++ ) {
+		offset = 16 + ( hashSize + i * 4 ) * 4;
 
-/*
-==========================================================================
+		buildBuffer[i].pos = (unsigned int)FS_PakIndexLong( data, offset );
+		buildBuffer[i].len = (unsigned int)FS_PakIndexLong( data, offset + 4 );
+		buildBuffer[i].name = names + FS_PakIndexLong( data, offset + 8 );
 
-ZIP FILE LOADING
+		index = FS_PakIndexLong( data, offset + 12 );
+		buildBuffer[i].next = ( index == -1 ) ? NULL : &buildBuffer[index];
+	}
 
-==========================================================================
-*/
+	return pack;
+}
 
 /*
 =================
@@ -2277,6 +3683,28 @@ static pack_t *FS_LoadZipFile(const char *zipfile, const char *basename)
 	int				fs_numHeaderLongs;
 	int				*fs_headerLongs;
 	char			*namePtr;
+	pakIndexEntry_t	*entry;
+	int				size, mtime;
+	byte			*data;
+	int				dataLength;
+	qboolean		useIndex;
+
+	useIndex = ( fs_pakIndexLoaded && Sys_FileInfo( zipfile, &size, &mtime ) );
+
+	if ( useIndex ) {
+		entry = FS_FindPakIndexEntry( zipfile );
+
+		if ( entry && entry->size == size && entry->mtime == mtime && entry->dataLength ) {
+			pack = FS_PackFromPakIndex( zipfile, basename, entry->data, entry->dataLength );
+
+			if ( pack ) {
+				fs_pakIndexHits++;
+				return pack;
+			}
+		}
+
+		fs_pakIndexMisses++;
+	}
 
 	fs_numHeaderLongs = 0;
 
@@ -2310,20 +3738,7 @@ static pack_t *FS_LoadZipFile(const char *zipfile, const char *basename)
 		}
 	}
 
-	pack = Z_Malloc( sizeof( pack_t ) + i * sizeof(fileInPack_t *) );
-	pack->hashSize = i;
-	pack->hashTable = (fileInPack_t **) (((char *) pack) + sizeof( pack_t ));
-	for(i = 0; i < pack->hashSize; i++) {
-		pack->hashTable[i] = NULL;
-	}
-
-	Q_strncpyz( pack->pakFilename, zipfile, sizeof( pack->pakFilename ) );
-	Q_strncpyz( pack->pakBasename, basename, sizeof( pack->pakBasename ) );
-
-	// strip .pk3 if needed
-	if ( strlen( pack->pakBasename ) > 4 && !Q_stricmp( pack->pakBasename + strlen( pack->pakBasename ) - 4, ".pk3" ) ) {
-		pack->pakBasename[strlen( pack->pakBasename ) - 4] = 0;
-	}
+	pack = FS_AllocPack( zipfile, basename, i );
 
 	pack->handle = uf;
 	pack->numfiles = gi.number_entry;
@@ -2357,6 +3772,16 @@ static pack_t *FS_LoadZipFile(const char *zipfile, const char *basename)
 	Z_Free(fs_headerLongs);
 
 	pack->buildBuffer = buildBuffer;
+
+	if ( useIndex ) {
+		data = FS_PakIndexData( pack, &dataLength );
+
+		if ( data ) {
+			FS_AddPakIndexEntry( zipfile, size, mtime, data, dataLength, qtrue );
+			fs_pakIndexModified = qtrue;
+		}
+	}
+
 	return pack;
 }
 
@@ -2370,7 +3795,8 @@ Frees a pak structure and releases all associated resources
 
 static void FS_FreePak(pack_t *thepak)
 {
-	unzClose(thepak->handle);
+	if (thepak->handle)
+		unzClose(thepak->handle);
 	Z_Free(thepak->buildBuffer);
 	Z_Free(thepak);
 }
@@ -3537,6 +4963,8 @@ void FS_AddGameDirectory( const char *path, const char *dir ) {
 
 	search->next = fs_searchpaths;
 	fs_searchpaths = search;
+
+	FS_SearchPathsChanged();
 }
 
 /*
@@ -3817,6 +5245,9 @@ void FS_Shutdown( qboolean closemfp ) {
 	searchpath_t	*p, *next;
 	int	i;
 
+	// prefetched files refer to the paks
+	FS_PrefetchEnd();
+
 	for(i = 0; i < MAX_FILE_HANDLES; i++) {
 		if (fsh[i].fileSize) {
 			FS_FCloseFile(i);
@@ -3839,6 +5270,8 @@ void FS_Shutdown( qboolean closemfp ) {
 	// any FS_ calls will now be an error until reinitialized
 	fs_searchpaths = NULL;
 
+	FS_SearchPathsChanged();
+
 	Cmd_RemoveCommand( "path" );
 	Cmd_RemoveCommand( "dir" );
 	Cmd_RemoveCommand( "fdir" );
@@ -3863,6 +5296,8 @@ void FS_StashSearchPath(void) {
 	}
 	fs_stashedPath = fs_searchpaths;
 	fs_searchpaths = NULL;
+
+	FS_SearchPathsChanged();
 }
 
 /*
@@ -3888,6 +5323,8 @@ void FS_UnstashSearchPath(void) {
 
 	fs_searchpaths = fs_stashedPath;
 	fs_stashedPath = NULL;
+
+	FS_SearchPathsChanged();
 }
 
 /*
@@ -3910,6 +5347,8 @@ static void FS_ReorderPurePaks( void )
 	if ( !fs_numServerPaks )
 		return;
 
+	FS_SearchPathsChanged();
+
 	p_insert_index = &fs_searchpaths; // we insert in order at the beginning of the list
 	for ( i = 0 ; i < fs_numServerPaks ; i++ ) {
 		p_previous = p_insert_index; // track the pointer-to-current-item
@@ -4249,6 +5688,8 @@ void FS_AddQPathDirectory( const char *path, const char *qpath ) {
 
 	search->next = fs_searchpaths;
 	fs_searchpaths = search;
+
+	FS_SearchPathsChanged();
 }
 
 /*
@@ -4353,6 +5794,14 @@ static void FS_Startup( qboolean quiet )
 	FS_ClearPakChecksums();
 	Com_Memset( &com_gameConfig, 0, sizeof (com_gameConfig) );
 
+	fs_pakIndex = Cvar_Get( "fs_pakIndex", "1", CVAR_ARCHIVE );
+	fs_mapFiles = Cvar_Get( "fs_mapFiles", "1", CVAR_ARCHIVE );
+	fs_prefetchThreads = Cvar_Get( "fs_prefetchThreads", "4", CVAR_ARCHIVE );
+	fs_prefetchMegs = Cvar_Get( "fs_prefetchMegs", "64", CVAR_ARCHIVE );
+	if ( fs_pakIndex->integer && fs_homepath->string[0] ) {
+		FS_LoadPakIndex();
+	}
+
 	FS_AddGame( fs_gamedirvar->string );
 
 	if ( com_gameConfig.numGameDirs > 0 ) {
@@ -4378,6 +5827,11 @@ static void FS_Startup( qboolean quiet )
 	// add game paths to beginning of list
 	FS_UnstashSearchPath();
 
+	if ( fs_pakIndexLoaded ) {
+		FS_WritePakIndex();
+		FS_FreePakIndex();
+	}
+
 	Q_strncpyz( fs_gamedir, fs_gamedirvar->string, sizeof( fs_gamedir ) );
 
 	FS_GetModDescription( fs_gamedir, description, sizeof ( description ) );
@@ -4894,6 +6348,9 @@ exception of .cfg and .dat files.
 void FS_PureServerSetLoadedPaks( const char *pakSums, const char *pakNames ) {
 	int		i, c, d;
 
+	// pure checks decide which files are found
+	FS_ClearNegativeCache();
+
 	Cmd_TokenizeString( pakSums );
 
 	c = Cmd_Argc();
@@ -37,14 +37,15 @@ Suite 120, Rockville, Maryland 20850 USA.
 
 static int			bloc = 0;
 
+// the write functions don't touch bloc so messages can be written from
+// multiple threads at once
 void	Huff_putBit( int bit, byte *fout, int *offset) {
-	bloc = *offset;
-	if ((bloc&7) == 0) {
-		fout[(bloc>>3)] = 0;
+	int pos = *offset;
+	if ((pos&7) == 0) {
+		fout[(pos>>3)] = 0;
 	}
-	fout[(bloc>>3)] |= bit << (bloc&7);
-	bloc++;
-	*offset = bloc;
+	fout[(pos>>3)] |= bit << (pos&7);
+	*offset = pos + 1;
 }
 
 int		Huff_getBloc(void)
@@ -67,12 +68,13 @@ int		Huff_getBit( byte *fin, int *offset) {
 }
 
 /* Add a bit to the output file (buffered) */
-static void add_bit (char bit, byte *fout) {
-	if ((bloc&7) == 0) {
-		fout[(bloc>>3)] = 0;
+static void add_bit (char bit, byte *fout, int *offset) {
+	int pos = *offset;
+	if ((pos&7) == 0) {
+		fout[(pos>>3)] = 0;
 	}
-	fout[(bloc>>3)] |= bit << (bloc&7);
-	bloc++;
+	fout[(pos>>3)] |= bit << (pos&7);
+	*offset = pos + 1;
 }
 
 /* Receive one bit from the input file (buffered) */
@@ -311,19 +313,19 @@ void Huff_offsetReceive (node_t *node, int *ch, byte *fin, int *offset, int maxo
 }
 
 /* Send the prefix code for this node */
-static void send(node_t *node, node_t *child, byte *fout, int maxoffset) {
+static void send(node_t *node, node_t *child, byte *fout, int *offset, int maxoffset) {
 	if (node->parent) {
-		send(node->parent, node, fout, maxoffset);
+		send(node->parent, node, fout, offset, maxoffset);
 	}
 	if (child) {
-		if (bloc >= maxoffset) {
-			bloc = maxoffset + 1;
+		if (*offset >= maxoffset) {
+			*offset = maxoffset + 1;
 			return;
 		}
 		if (node->right == child) {
-			add_bit(1, fout);
+			add_bit(1, fout, offset);
 		} else {
-			add_bit(0, fout);
+			add_bit(0, fout, offset);
 		}
 	}
 }
@@ -335,17 +337,15 @@ void Huff_transmit (huff_t *huff, int ch, byte *fout, int maxoffset) {
 		/* node_t hasn't been transmitted, send a NYT, then the symbol */
 		Huff_transmit(huff, NYT, fout, maxoffset);
 		for (i = 7; i >= 0; i--) {
-			add_bit((char)((ch >> i) & 0x1), fout);
+			add_bit((char)((ch >> i) & 0x1), fout, &bloc);
 		}
 	} else {
-		send(huff->loc[ch], NULL, fout, maxoffset);
+		send(huff->loc[ch], NULL, fout, &bloc, maxoffset);
 	}
 }
 
 void Huff_offsetTransmit (huff_t *huff, int ch, byte *fout, int *offset, int maxoffset) {
-	bloc = *offset;
-	send(huff->loc[ch], NULL, fout, maxoffset);
-	*offset = bloc;
+	send(huff->loc[ch], NULL, fout, offset, maxoffset);
 }
 
 void Huff_Decompress(msg_t *mbuf, int offset) {
@@ -460,3 +460,160 @@ void Huff_Init(huffman_t *huff) {
 	huff->compressor.tree->parent = huff->compressor.tree->left = huff->compressor.tree->right = NULL;
 }
 
+
+/*
+==============================================================================
+
+A fixed tree, like the one used for msg_t bitstreams, can be turned into a
+table of codes and a lookup table for decoding, so symbols don't have to be
+sent and received by walking the tree one bit at a time. The bitstream is
+identical to Huff_offsetTransmit and Huff_offsetReceive.
+
+==============================================================================
+*/
+
+/* Write count (at most 32) bits, first bit in bit 0. The bits are assembled
+ * in a word and stored a byte at a time, with the same result as calling
+ * Huff_putBit for each of them */
+void Huff_putBits( unsigned int bits, int count, byte *fout, int *offset ) {
+	int			pos = *offset;
+	int			shift = pos & 7;
+	int			left;
+	byte		*out = fout + ( pos >> 3 );
+	uint64_t	word;
+
+	if ( count <= 0 ) {
+		return;
+	}
+
+	// a new byte is cleared, a partial one keeps its bits
+	word = (uint64_t)( bits & ( 0xffffffffu >> ( 32 - count ) ) ) << shift;
+	if ( shift ) {
+		word |= out[0];
+	}
+
+	for ( left = count + shift; left > 0; left -= 8 ) {
+		*out++ = (byte)word;
+		word >>= 8;
+	}
+
+	*offset = pos + count;
+}
+
+/* Read count (at most 32) bits, first bit in bit 0 */
+unsigned int Huff_getBits( byte *fin, int *offset, int count ) {
+	int			pos = *offset;
+	int			shift = pos & 7;
+	int			left;
+	byte		*in = fin + ( pos >> 3 );
+	uint64_t	word;
+
+	word = 0;
+	for ( left = 0; left < count + shift; left += 8 ) {
+		word |= (uint64_t)*in++ << left;
+	}
+
+	bloc = pos + count;
+	*offset = bloc;
+
+	return (unsigned int)( ( word >> shift ) & ( 0xffffffffu >> ( 32 - count ) ) );
+}
+
+/* Fill in the lookup entries of all codes that fit in HUFF_LOOKUP_BITS */
+static void Huff_BuildLookup_r( huffTable_t *table, node_t *node, unsigned int code, int length ) {
+	int i;
+
+	if ( !node ) {
+		return;
+	}
+
+	if ( node->symbol == INTERNAL_NODE ) {
+		if ( length < HUFF_LOOKUP_BITS ) {
+			Huff_BuildLookup_r( table, node->left, code, length + 1 );
+			Huff_BuildLookup_r( table, node->right, code | ( 1 << length ), length + 1 );
+		}
+		return;
+	}
+
+	// every index starting with this code decodes to the symbol
+	for ( i = code; i < ( 1 << HUFF_LOOKUP_BITS ); i += ( 1 << length ) ) {
+		table->lookup[i] = node->symbol | ( length << HUFF_LOOKUP_SHIFT );
+	}
+}
+
+/* Build the code and lookup tables of a tree that won't change anymore */
+void Huff_BuildTable( huffTable_t *table, huff_t *huff ) {
+	node_t			*node;
+	unsigned int	code;
+	int				ch, length;
+
+	Com_Memset( table, 0, sizeof( *table ) );
+
+	for ( ch = 0; ch <= HMAX; ch++ ) {
+		if ( !huff->loc[ch] ) {
+			continue;
+		}
+
+		// walk up to the root, the bit nearest to the root is sent first
+		code = 0;
+		length = 0;
+		for ( node = huff->loc[ch]; node->parent; node = node->parent ) {
+			if ( length == 32 ) {
+				break;
+			}
+			code = ( code << 1 ) | ( node->parent->right == node );
+			length++;
+		}
+
+		// leave codes that don't fit to send()
+		if ( node->parent ) {
+			continue;
+		}
+
+		table->codes[ch] = code;
+		table->lengths[ch] = length;
+	}
+
+	Huff_BuildLookup_r( table, huff->tree, 0, 0 );
+}
+
+/* Send a symbol using the code table */
+void Huff_tableTransmit( const huffTable_t *table, huff_t *huff, int ch, byte *fout, int *offset, int maxoffset ) {
+	int length = table->lengths[ch];
+
+	if ( !length ) {
+		send(huff->loc[ch], NULL, fout, offset, maxoffset);
+		return;
+	}
+
+	if ( *offset + length > maxoffset ) {
+		// send() stops at maxoffset
+		if ( *offset < maxoffset ) {
+			Huff_putBits( table->codes[ch], maxoffset - *offset, fout, offset );
+		}
+		*offset = maxoffset + 1;
+		return;
+	}
+
+	Huff_putBits( table->codes[ch], length, fout, offset );
+}
+
+/* Get a symbol using the lookup table */
+void Huff_tableReceive( const huffTable_t *table, node_t *node, int *ch, byte *fin, int *offset, int maxoffset ) {
+	int entry;
+	int pos = *offset;
+
+	// the lookup reads HUFF_LOOKUP_BITS, near the end of the
+	// message or for long codes walk the tree
+	if ( pos + HUFF_LOOKUP_BITS <= maxoffset ) {
+		entry = table->lookup[ Huff_getBits( fin, &pos, HUFF_LOOKUP_BITS ) ];
+		if ( entry ) {
+			*ch = entry & ( ( 1 << HUFF_LOOKUP_SHIFT ) - 1 );
+			bloc = *offset + ( entry >> HUFF_LOOKUP_SHIFT );
+			*offset = bloc;
+			return;
+		}
+	}
+
+	Huff_offsetReceive( node, ch, fin, offset, maxoffset );
+}
@@ -0,0 +1,269 @@
+/*
+===========================================================================
+Copyright (C) 1999-2010 id Software LLC, a ZeniMax Media company.
+
+This file is part of Spearmint Source Code.
+
+Spearmint Source Code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 3 of the License,
+or (at your option) any later version.
+
+Spearmint Source Code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Spearmint Source Code.  If not, see <http://www.gnu.org/licenses/>.
+
+In addition, Spearmint Source Code is also subject to certain additional terms.
+You should have received a copy of these additional terms immediately following
+the terms and conditions of the GNU General Public License.  If not, please
+request a copy in writing from id Software at the address below.
+
+If you have questions concerning this license or the applicable additional
+terms, you may contact in writing id Software LLC, c/o ZeniMax Media Inc.,
+Suite 120, Rockville, Maryland 20850 USA.
+===========================================================================
+*/
+// jobs.c -- worker thread pools
+
+#include "q_shared.h"
+#include "qcommon.h"
+
+/*
+==============================================================================
+
+A job pool runs the indices of a Job_ParallelFor on its worker threads and
+the calling thread. The caller blocks until every index has been run, so job
+functions may only use the data passed to them and thread-safe engine code.
+Anything that prints, allocates or calls into a VM has to stay on the main
+thread.  Scratch memory for the rest of the frame can be taken from the
+thread's frame arena with Job_FrameAlloc.
+
+If the threads couldn't be created everything runs on the calling thread.
+
+==============================================================================
+*/
+
+#define MAX_JOB_THREADS		32
+#define JOB_ARENA_SIZE		( 512 * 1024 )
+
+typedef struct {
+	jobPool_t	*pool;
+	int			threadNum;
+	void		*thread;
+	frameArena_t	*arena;
+} jobThread_t;
+
+struct jobPool_s {
+	char		name[MAX_QPATH];
+
+	int			numThreads;
+	jobThread_t	threads[MAX_JOB_THREADS];
+
+	void		*mutex;
+	void		*startSemaphore;	// posted once per worker for each job
+	void		*doneSemaphore;		// posted by each worker when it runs out of work
+	qboolean	shutdown;
+
+	// current job
+	jobFunc_t	func;
+	void		*data;
+	int			count;
+	int			next;
+};
+
+/*
+=================
+Job_Work
+
+Run indices of the current job until there are none left
+=================
+*/
+static void Job_Work( jobPool_t *pool, int threadNum ) {
+	int index;
+
+	while ( 1 ) {
+		Sys_LockMutex( pool->mutex );
+		index = pool->next++;
+		Sys_UnlockMutex( pool->mutex );
+
+		if ( index >= pool->count ) {
+			break;
+		}
+
+		pool->func( pool->data, index, threadNum );
+	}
+}
+
+/*
+=================
+Job_ThreadMain
+=================
+*/
+static void Job_ThreadMain( void *arg ) {
+	jobThread_t	*thread = arg;
+	jobPool_t	*pool = thread->pool;
+
+	while ( 1 ) {
+		Sys_SemaphoreWait( pool->startSemaphore );
+
+		if ( pool->shutdown ) {
+			break;
+		}
+
+		Job_Work( pool, thread->threadNum );
+
+		Sys_SemaphorePost( pool->doneSemaphore );
+	}
+
+	// let a later thread reuse this one's collision query state
+	CM_ReleaseThread();
+}
+
+/*
+=================
+Job_CreatePool
+
+numThreads is the number of worker threads in addition to the calling thread
+=================
+*/
+jobPool_t *Job_CreatePool( const char *name, int numThreads ) {
+	jobPool_t	*pool;
+	int			i;
+
+	if ( numThreads < 0 ) {
+		numThreads = 0;
+	} else if ( numThreads > MAX_JOB_THREADS ) {
+		numThreads = MAX_JOB_THREADS;
+	}
+
+	pool = Z_Malloc( sizeof( *pool ) );
+	Q_strncpyz( pool->name, name, sizeof( pool->name ) );
+
+	pool->mutex = Sys_CreateMutex();
+	pool->startSemaphore = Sys_CreateSemaphore( 0 );
+	pool->doneSemaphore = Sys_CreateSemaphore( 0 );
+
+	for ( i = 0; i < numThreads; i++ ) {
+		pool->threads[i].pool = pool;
+		pool->threads[i].threadNum = i + 1;
+		pool->threads[i].thread = Sys_CreateThread( Job_ThreadMain, &pool->threads[i] );
+
+		if ( !pool->threads[i].thread ) {
+			Com_Printf( S_COLOR_YELLOW "WARNING: %s: could only start %d of %d worker threads\n", name, i, numThreads );
+			break;
+		}
+
+		pool->threads[i].arena = Arena_Create( va( "%s thread %d", name, i + 1 ), JOB_ARENA_SIZE );
+	}
+
+	pool->numThreads = i;
+
+	return pool;
+}
+
+/*
+=================
+Job_DestroyPool
+=================
+*/
+void Job_DestroyPool( jobPool_t *pool ) {
+	int i;
+
+	if ( !pool ) {
+		return;
+	}
+
+	pool->shutdown = qtrue;
+
+	for ( i = 0; i < pool->numThreads; i++ ) {
+		Sys_SemaphorePost( pool->startSemaphore );
+	}
+
+	for ( i = 0; i < pool->numThreads; i++ ) {
+		Sys_JoinThread( pool->threads[i].thread );
+		Arena_Destroy( pool->threads[i].arena );
+	}
+
+	Sys_DestroySemaphore( pool->doneSemaphore );
+	Sys_DestroySemaphore( pool->startSemaphore );
+	Sys_DestroyMutex( pool->mutex );
+
+	Z_Free( pool );
+}
+
+/*
+=================
+Job_NumThreads
+
+Number of threads running jobs including the calling thread
+=================
+*/
+int Job_NumThreads( const jobPool_t *pool ) {
+	if ( !pool ) {
+		return 1;
+	}
+
+	return pool->numThreads + 1;
+}
+
+/*
+=================
+Job_ParallelFor
+
+Call func( data, index, threadNum ) for index 0 to count-1 and wait for all
+of them to finish. threadNum is 0 for the calling thread and 1 to
+Job_NumThreads()-1 for the workers.
+=================
+*/
+void Job_ParallelFor( jobPool_t *pool, jobFunc_t func, void *data, int count ) {
+	int i, numWake;
+
+	if ( count <= 0 ) {
+		return;
+	}
+
+	if ( !pool || !pool->numThreads || count == 1 ) {
+		for ( i = 0; i < count; i++ ) {
+			func( data, i, 0 );
+		}
+		return;
+	}
+
+	pool->func = func;
+	pool->data = data;
+	pool->count = count;
+	pool->next = 0;
+
+	// the calling thread takes a share too
+	numWake = MIN( pool->numThreads, count - 1 );
+
+	for ( i = 0; i < numWake; i++ ) {
+		Sys_SemaphorePost( pool->startSemaphore );
+	}
+
+	Job_Work( pool, 0 );
+
+	for ( i = 0; i < numWake; i++ ) {
+		Sys_SemaphoreWait( pool->doneSemaphore );
+	}
+}
+
+/*
+=================
+Job_FrameAlloc
+
+Scratch memory for the thread running a job, valid until the end of the
+frame.  threadNum 0 is the calling thread which uses the main frame arena.
+=================
+*/
+void *Job_FrameAlloc( jobPool_t *pool, int threadNum, int size ) {
+	if ( !threadNum ) {
+		return Com_FrameAlloc( size );
+	}
+
+	return Arena_Alloc( pool->threads[threadNum - 1].arena, size );
+}
@@ -31,6 +31,7 @@ Suite 120, Rockville, Maryland 20850 USA.
 #include "qcommon.h"
 
 static huffman_t		msgHuff;
+static huffTable_t		msgHuffTable;
 
 static qboolean			msgInit = qfalse;
 
@@ -153,15 +154,13 @@ void MSG_WriteBits( msg_t *msg, int value, int bits ) {
 				msg->overflowed = qtrue;
 				return;
 			}
-			for( i = 0; i < nbits; i++ ) {
-				Huff_putBit( (value & 1), msg->data, &msg->bit );
-				value = (value >> 1);
-			}
+			Huff_putBits( value, nbits, msg->data, &msg->bit );
+			value = (value >> nbits);
 			bits = bits - nbits;
 		}
 		if ( bits ) {
 			for( i = 0; i < bits; i += 8 ) {
-				Huff_offsetTransmit( &msgHuff.compressor, (value & 0xff), msg->data, &msg->bit, msg->maxsize << 3 );
+				Huff_tableTransmit( &msgHuffTable, &msgHuff.compressor, (value & 0xff), msg->data, &msg->bit, msg->maxsize << 3 );
 				value = (value >> 8);
 
 				if ( msg->bit > msg->maxsize << 3 ) {
@@ -174,6 +173,47 @@ void MSG_WriteBits( msg_t *msg, int value, int bits ) {
 	}
 }
 
+/*
+==================
+MSG_WriteBitsFrom
+
+Appends numBits of a bitstream that was already written to another
+message, starting at the first bit of data. Huffman codes don't depend on
+where they start, so this gives the same result as repeating the writes.
+==================
+*/
+void MSG_WriteBitsFrom( msg_t *msg, const byte *data, int numBits ) {
+	int				bit, count, i;
+	unsigned int	word;
+
+	if ( msg->overflowed || numBits <= 0 ) {
+		return;
+	}
+
+	if ( msg->oob ) {
+		Com_Error( ERR_DROP, "MSG_WriteBitsFrom: oob message" );
+	}
+
+	if ( msg->bit + numBits > msg->maxsize << 3 ) {
+		msg->overflowed = qtrue;
+		return;
+	}
+
+	// data starts byte aligned, copy it a word at a time
+	for ( bit = 0; bit < numBits; bit += 32 ) {
+		count = MIN( numBits - bit, 32 );
+
+		word = 0;
+		for ( i = 0; i < ( count + 7 ) >> 3; i++ ) {
+			word |= (unsigned int)data[( bit >> 3 ) + i] << ( i << 3 );
+		}
+
+		Huff_putBits( word, count, msg->data, &msg->bit );
+	}
+
+	msg->cursize = (msg->bit >> 3) + 1;
+}
+
 int MSG_ReadBits( msg_t *msg, int bits ) {
 	int			value;
 	int			get;
@@ -231,15 +271,13 @@ int MSG_ReadBits( msg_t *msg, int bits ) {
 				msg->readcount = msg->cursize + 1;
 				return 0;
 			}
-			for(i=0;i<nbits;i++) {
-				value |= (Huff_getBit(msg->data, &msg->bit)<<i);
-			}
+			value = Huff_getBits(msg->data, &msg->bit, nbits);
 			bits = bits - nbits;
 		}
 		if (bits) {
 //			fp = fopen("c:\\netchan.bin", "a");
 			for(i=0;i<bits;i+=8) {
-				Huff_offsetReceive (msgHuff.decompressor.tree, &get, msg->data, &msg->bit, msg->cursize<<3);
+				Huff_tableReceive (&msgHuffTable, msgHuff.decompressor.tree, &get, msg->data, &msg->bit, msg->cursize<<3);
 //				fwrite(&get, 1, 1, fp);
 				value = (unsigned int)value | ((unsigned int)get<<(i+nbits));
 
@@ -683,45 +721,94 @@ netField_t communication
 #define MAX_NETF_ARRAY_BITS 32
 #define MAX_NETF_ELEMENTS (32 * MAX_NETF_ARRAY_BITS)
 
+// the number of changed fields is sent as a byte
 typedef struct {
 	int		offset;
 	int		numElements; // 1 to 1024 (MAX_NETF_ELEMENTS)
 	int		numElementArrays;
 	int		bits;		// 0 = float
-	int		pcount;
+	int		pcount;		// times read as changed
+	int		wcount;		// times written as changed
 } netField_t;
 
+// fields that are next to each other in the state are compared as one block
+typedef struct {
+	int		offset;
+	int		size;
+	int		firstField;
+	int		numFields;
+} netFieldRun_t;
+
 typedef struct {
 	char		*objectName;
+	int			statsNum;			// index into the msgStats_t arrays
 	int			objectSize;
 
 	int			numFields;
 	netField_t	*fields;
+
+	int				numRuns;
+	netFieldRun_t	*runs;
+	int				*noChangeBits;		// numFields + 1 running totals of numElementArrays
+	qboolean		rawNoChangeBits;	// all no change markers are sent without huffman
+	void			*zeroState;			// delta source for a NULL from
+	int				numDeltas;
 } netFields_t;
 
-static netFields_t msg_playerStateFields = { "playerState_t", 0, 0, NULL };
-static netFields_t msg_entityStateFields = { "entityState_t", 0, 0, NULL };
+static netFields_t msg_playerStateFields = { "playerState_t", MSG_STATS_PLAYERSTATE };
+static netFields_t msg_entityStateFields = { "entityState_t", MSG_STATS_ENTITYSTATE };
 
 /*
 =================
 MSG_ReportChangeVectors
 
-Prints out a table from the current statistics for copying to code
+Prints out a table from the current statistics for copying to code.
 =================
 */
 static void MSG_ReportChangeVectors( netFields_t *stateFields ) {
 	netField_t *field;
 	int i;
 
- 	Com_Printf( "%s (number of fields: %i, object size: %i)\n", stateFields->objectName, stateFields->numFields, stateFields->objectSize );
+ 	Com_Printf( "%s (number of fields: %i, object size: %i, deltas written: %i)\n", stateFields->objectName, stateFields->numFields, stateFields->objectSize, stateFields->numDeltas );
 
-	for ( i = 0, field = stateFields->fields; i < msg_entityStateFields.numFields; i++, field++ ) {
-		if ( field->pcount ) {
-			Com_Printf( "field %i used %i times\n", i, field->pcount );
+	for ( i = 0, field = stateFields->fields; i < stateFields->numFields; i++, field++ ) {
+		if ( field->pcount || field->wcount ) {
+			Com_Printf( "field %i (offset %i): used %i times, sent %i times (%.1f%%)\n", i, field->offset, field->pcount, field->wcount,
+						stateFields->numDeltas ? 100.0f * field->wcount / stateFields->numDeltas : 0.0f );
 		}
 	}
 }
 
+/*
+=================
+MSG_AddNetFieldStats
+=================
+*/
+static void MSG_AddNetFieldStats( netFields_t *stateFields, msgStats_t *stats ) {
+	int i;
+
+	stateFields->numDeltas += stats->numDeltas[stateFields->statsNum];
+
+	for ( i = 0; i < stateFields->numFields; i++ ) {
+		stateFields->fields[i].wcount += stats->wcount[stateFields->statsNum][i];
+	}
+}
+
+/*
+=================
+MSG_AddStats
+
+Adds the statistics a worker thread kept for the messages it wrote to the
+totals and clears them. Only call it while no thread is writing with them.
+=================
+*/
+void MSG_AddStats( msgStats_t *stats ) {
+	MSG_AddNetFieldStats( &msg_playerStateFields, stats );
+	MSG_AddNetFieldStats( &msg_entityStateFields, stats );
+
+	Com_Memset( stats, 0, sizeof( *stats ) );
+}
+
 /*
 =================
 MSG_ReportChangeVectors_f
@@ -744,6 +831,67 @@ static void MSG_FreeNetFields( netFields_t *stateFields ) {
 		Z_Free( stateFields->fields );
 		stateFields->fields = NULL;
 	}
+
+	if ( stateFields->runs ) {
+		Z_Free( stateFields->runs );
+		stateFields->runs = NULL;
+	}
+
+	if ( stateFields->noChangeBits ) {
+		Z_Free( stateFields->noChangeBits );
+		stateFields->noChangeBits = NULL;
+	}
+
+	if ( stateFields->zeroState ) {
+		Z_Free( stateFields->zeroState );
+		stateFields->zeroState = NULL;
+	}
+
+	stateFields->numFields = 0;
+	stateFields->numRuns = 0;
+	stateFields->numDeltas = 0;
+}
+
+/*
+==================
+MSG_BuildFieldLayout
+
+Merge fields that follow each other in memory into runs that can be
+compared as a single block and total up the no change bits so a span
+of unchanged fields can be written at once.
+==================
+*/
+static void MSG_BuildFieldLayout( netFields_t *stateFields ) {
+	netField_t		*field;
+	netFieldRun_t	*run;
+	int				i;
+
+	stateFields->runs = Z_Malloc( sizeof (netFieldRun_t) * stateFields->numFields );
+	stateFields->noChangeBits = Z_Malloc( sizeof (int) * ( stateFields->numFields + 1 ) );
+	stateFields->zeroState = Z_Malloc( stateFields->objectSize );
+	stateFields->rawNoChangeBits = qtrue;
+	stateFields->numRuns = 0;
+
+	run = NULL;
+	for ( i = 0, field = stateFields->fields ; i < stateFields->numFields ; i++, field++ ) {
+		if ( run && run->offset + run->size == field->offset ) {
+			run->size += field->numElements * 4;
+			run->numFields++;
+		} else {
+			run = &stateFields->runs[stateFields->numRuns++];
+			run->offset = field->offset;
+			run->size = field->numElements * 4;
+			run->firstField = i;
+			run->numFields = 1;
+		}
+
+		// MSG_WriteBits uses huffman for whole bytes
+		if ( field->numElementArrays >= 8 ) {
+			stateFields->rawNoChangeBits = qfalse;
+		}
+
+		stateFields->noChangeBits[i + 1] = stateFields->noChangeBits[i] + field->numElementArrays;
+	}
 }
 
 /*
@@ -766,6 +914,10 @@ static const char *MSG_InitNetFields( netFields_t *stateFields, const vmNetField
 		return "no fields";
 	}
 
+	if ( numFields > MAX_NETF_FIELDS ) {
+		return va("more than %d fields", MAX_NETF_FIELDS);
+	}
+
 	MSG_FreeNetFields( stateFields );
 
 	stateFields->objectSize = objectSize;
@@ -833,6 +985,8 @@ static const char *MSG_InitNetFields( netFields_t *stateFields, const vmNetField
 		}
 	}
 
+	MSG_BuildFieldLayout( stateFields );
+
 	return NULL;
 }
 
@@ -870,43 +1024,87 @@ void MSG_ShutdownNetFields( void ) {
 
 /*
 ==================
-MSG_LastChangedField
+MSG_ChangedFields
+
+Sets a bit in changeMask for each field that differs between from and to.
+A NULL from is treated as all zeros.
 
 Returns index of last changed field + 1, or 0 if no fields are different.
 ==================
 */
-static int MSG_LastChangedField( void *from, void *to, netFields_t *stateFields ) {
-	int			i, lc, n;
-	int			*fromF, *toF;
-	netField_t	*field;
+static int MSG_ChangedFields( const void *from, const void *to, const netFields_t *stateFields, unsigned int *changeMask ) {
+	const netFieldRun_t	*run;
+	const netField_t	*field;
+	const byte			*fromB, *toB;
+	int					i, r, lc;
+
+	if ( !from ) {
+		from = stateFields->zeroState;
+	}
+
+	Com_Memset( changeMask, 0, sizeof (unsigned int) * MAX_NETF_MASK_WORDS );
 
 	lc = 0;
-	// build the change vector as bytes so it is endien independent
-	for ( i = stateFields->numFields-1, field = &stateFields->fields[i] ; i >= 0 ; i--, field-- ) {
-		toF = (int *)( (byte *)to + field->offset );
+	for ( r = 0, run = stateFields->runs ; r < stateFields->numRuns ; r++, run++ ) {
+		fromB = (const byte *)from + run->offset;
+		toB = (const byte *)to + run->offset;
 
-		if ( from ) {
-			fromF = (int *)( (byte *)from + field->offset );
-			for (n=0 ; n<field->numElements ; n++) {
-				if (toF[n] != fromF[n]) {
-					break;
-				}
+		if ( !memcmp( fromB, toB, run->size ) ) {
+			continue;
+		}
+
+		for ( i = run->firstField, field = &stateFields->fields[i] ; i < run->firstField + run->numFields ; i++, field++ ) {
+			if ( run->numFields > 1 && !memcmp( (const byte *)from + field->offset, (const byte *)to + field->offset, field->numElements * 4 ) ) {
+				continue;
 			}
-		} else {
-			for (n=0 ; n<field->numElements ; n++) {
-				if (toF[n] != 0) {
-					break;
-				}
+
+			changeMask[i >> 5] |= 1u << ( i & 31 );
+
+			if ( i + 1 > lc ) {
+				lc = i + 1;
 			}
 		}
+	}
 
-		if ( n != field->numElements ) {
-			lc = i+1;
-			break;
+	return lc;
+}
+
+/*
+==================
+MSG_WriteNoChangeBits
+
+Write the no change markers for fields first to last - 1.
+==================
+*/
+static void MSG_WriteNoChangeBits( msg_t *msg, const netFields_t *stateFields, int first, int last ) {
+	int		bits, count;
+
+	if ( first >= last || msg->overflowed ) {
+		return;
+	}
+
+	if ( !stateFields->rawNoChangeBits ) {
+		for ( ; first < last ; first++ ) {
+			MSG_WriteBits( msg, 0, stateFields->fields[first].numElementArrays );
 		}
+		return;
 	}
 
-	return lc;
+	// each marker is less than a byte so MSG_WriteBits would send them
+	// as raw bits, which is the same as sending them all at once
+	bits = stateFields->noChangeBits[last] - stateFields->noChangeBits[first];
+
+	if ( msg->bit + bits > msg->maxsize << 3 ) {
+		msg->overflowed = qtrue;
+		return;
+	}
+
+	for ( ; bits > 0 ; bits -= count ) {
+		count = MIN( bits, 32 );
+		Huff_putBits( 0, count, msg->data, &msg->bit );
+	}
+
+	msg->cursize = (msg->bit >> 3) + 1;
 }
 
 // if (int)f == f and (int)f + ( 1<<(FLOAT_INT_BITS-1) ) < ( 1 << FLOAT_INT_BITS )
@@ -916,87 +1114,120 @@ static int MSG_LastChangedField( void *from, void *to, netFields_t *stateFields
 
 /*
 ==================
-MSG_WriteDeltaNetFields
+MSG_WriteDeltaNetField
 ==================
 */
-static void MSG_WriteDeltaNetFields( msg_t *msg, void *from, void *to,
-						   netFields_t *stateFields, int numSendFields ) {
-	int			i, n;
-	netField_t	*field;
+static void MSG_WriteDeltaNetField( msg_t *msg, const int *fromF, const int *toF, netField_t *field ) {
+	int			n;
 	int			trunc;
 	float		fullFloat;
-	int			*fromF, *toF;
 	int			elementsLeft;
 	int			arraysChanged;
 	int			bitsArray[MAX_NETF_ELEMENTS / MAX_NETF_ARRAY_BITS];
 
-	for ( i = 0, field = stateFields->fields ; i < numSendFields ; i++, field++ ) {
-		fromF = (int *)( (byte *)from + field->offset );
-		toF = (int *)( (byte *)to + field->offset );
+	arraysChanged = 0;
+	Com_Memset( bitsArray, 0, sizeof (bitsArray[0]) * field->numElementArrays );
 
-		arraysChanged = 0;
-		Com_Memset( bitsArray, 0, sizeof (bitsArray) );
+	for (n=0 ; n<field->numElements ; n++) {
+		if ( toF[n] != fromF[n] ) {
+			arraysChanged |= 1 << ( n / MAX_NETF_ARRAY_BITS );
+			bitsArray[ n / MAX_NETF_ARRAY_BITS ] |= 1 << ( n & ( MAX_NETF_ARRAY_BITS - 1 ) );
+		}
+	}
 
-		for (n=0 ; n<field->numElements ; n++) {
-			if ( ( from && toF[n] != fromF[n] ) || ( !from && toF[n] != 0 ) ) {
-				arraysChanged |= 1 << ( n / MAX_NETF_ARRAY_BITS );
-				bitsArray[ n / MAX_NETF_ARRAY_BITS ] |= 1 << ( n & ( MAX_NETF_ARRAY_BITS - 1 ) );
+	MSG_WriteBits( msg, arraysChanged, field->numElementArrays );	// changed
+
+	if ( field->numElements > 1 ) {
+		elementsLeft = field->numElements;
+		// write bits for changed arrays
+		for ( n = 0; n < field->numElementArrays; n++, elementsLeft -= MAX_NETF_ARRAY_BITS ) {
+			if ( arraysChanged & ( 1 << n ) ) {
+				MSG_WriteBits( msg, bitsArray[ n ], MIN( elementsLeft, MAX_NETF_ARRAY_BITS ) );
 			}
 		}
+	} else {
+		bitsArray[ 0 ] = 1;
+	}
 
-		if ( arraysChanged == 0 ) {
-			MSG_WriteBits( msg, 0, field->numElementArrays );	// no change
+	for ( n = 0; n < field->numElements; n++, toF++ ) {
+		if ( !( bitsArray[ n / MAX_NETF_ARRAY_BITS ] & ( 1 << ( n & ( MAX_NETF_ARRAY_BITS - 1 ) ) ) ) ) {
 			continue;
 		}
 
-		MSG_WriteBits( msg, arraysChanged, field->numElementArrays );	// changed
+		if ( field->bits == 0 ) {
+			// float
+			fullFloat = *(float *)toF;
+			trunc = (int)fullFloat;
 
-		if ( field->numElements > 1 ) {
-			elementsLeft = field->numElements;
-			// write bits for changed arrays
-			for ( n = 0; n < field->numElementArrays; n++, elementsLeft -= MAX_NETF_ARRAY_BITS ) {
-				if ( arraysChanged & ( 1 << n ) ) {
-					MSG_WriteBits( msg, bitsArray[ n ], MIN( elementsLeft, MAX_NETF_ARRAY_BITS ) );
+			if (fullFloat == 0.0f) {
+					MSG_WriteBits( msg, 0, 1 );
+			} else {
+				MSG_WriteBits( msg, 1, 1 );
+				if ( trunc == fullFloat && trunc + FLOAT_INT_BIAS >= 0 && 
+					trunc + FLOAT_INT_BIAS < ( 1 << FLOAT_INT_BITS ) ) {
+					// send as small integer
+					MSG_WriteBits( msg, 0, 1 );
+					MSG_WriteBits( msg, trunc + FLOAT_INT_BIAS, FLOAT_INT_BITS );
+				} else {
+					// send as full floating point value
+					MSG_WriteBits( msg, 1, 1 );
+					MSG_WriteBits( msg, *toF, 32 );
 				}
 			}
 		} else {
-			bitsArray[ 0 ] = 1;
+			if (*toF == 0) {
+				MSG_WriteBits( msg, 0, 1 );
+			} else {
+				MSG_WriteBits( msg, 1, 1 );
+				// integer
+				MSG_WriteBits( msg, *toF, field->bits );
+			}
 		}
+	}
+}
 
-		for ( n = 0; n < field->numElements; n++, toF++ ) {
-			if ( !( bitsArray[ n / MAX_NETF_ARRAY_BITS ] & ( 1 << ( n & ( MAX_NETF_ARRAY_BITS - 1 ) ) ) ) ) {
-				continue;
+/*
+==================
+MSG_WriteDeltaNetFields
+
+Only the fields set in changeMask are compared element by element,
+the rest get their no change markers written in spans.
+==================
+*/
+static void MSG_WriteDeltaNetFields( msg_t *msg, const void *from, const void *to,
+						   netFields_t *stateFields, int numSendFields, const unsigned int *changeMask ) {
+	netField_t		*field;
+	unsigned int	bits;
+	int				i, w, last;
+
+	if ( !from ) {
+		from = stateFields->zeroState;
+	}
+
+	if ( msg->stats ) {
+		msg->stats->numDeltas[stateFields->statsNum]++;
+	} else {
+		stateFields->numDeltas++;
+	}
+
+	last = 0;
+	for ( w = 0; w < ( numSendFields + 31 ) >> 5; w++ ) {
+		for ( bits = changeMask[w]; bits; bits &= bits - 1 ) {
+			for ( i = 0; !( bits & ( 1u << i ) ); i++ ) {
 			}
+			i += w << 5;
 
-			if ( field->bits == 0 ) {
-				// float
-				fullFloat = *(float *)toF;
-				trunc = (int)fullFloat;
+			MSG_WriteNoChangeBits( msg, stateFields, last, i );
 
-				if (fullFloat == 0.0f) {
-						MSG_WriteBits( msg, 0, 1 );
-				} else {
-					MSG_WriteBits( msg, 1, 1 );
-					if ( trunc == fullFloat && trunc + FLOAT_INT_BIAS >= 0 && 
-						trunc + FLOAT_INT_BIAS < ( 1 << FLOAT_INT_BITS ) ) {
-						// send as small integer
-						MSG_WriteBits( msg, 0, 1 );
-						MSG_WriteBits( msg, trunc + FLOAT_INT_BIAS, FLOAT_INT_BITS );
-					} else {
-						// send as full floating point value
-						MSG_WriteBits( msg, 1, 1 );
-						MSG_WriteBits( msg, *toF, 32 );
-					}
-				}
+			field = &stateFields->fields[i];
+			if ( msg->stats ) {
+				msg->stats->wcount[stateFields->statsNum][i]++;
 			} else {
-				if (*toF == 0) {
-					MSG_WriteBits( msg, 0, 1 );
-				} else {
-					MSG_WriteBits( msg, 1, 1 );
-					// integer
-					MSG_WriteBits( msg, *toF, field->bits );
-				}
+				field->wcount++;
 			}
+			MSG_WriteDeltaNetField( msg, (const int *)( (const byte *)from + field->offset ),
+									(const int *)( (const byte *)to + field->offset ), field );
+			last = i + 1;
 		}
 	}
 }
@@ -1167,7 +1398,23 @@ identical, under the assumption that the in-order delta code will catch it.
 */
 void MSG_WriteDeltaEntity( msg_t *msg, sharedEntityState_t *from, sharedEntityState_t *to,
 						   qboolean force ) {
-	int			lc;
+	unsigned int	changeMask[MAX_NETF_MASK_WORDS];
+
+	MSG_WriteDeltaEntityChanges( msg, from, to, force, changeMask );
+}
+
+/*
+==================
+MSG_WriteDeltaEntityChanges
+
+MSG_WriteDeltaEntity that also returns the number of fields sent and their
+changeMask, so a copy of the written bits can be counted with
+MSG_CountDeltaEntity. Returns 0 if no field delta was written.
+==================
+*/
+int MSG_WriteDeltaEntityChanges( msg_t *msg, sharedEntityState_t *from, sharedEntityState_t *to,
+						   qboolean force, unsigned int *changeMask ) {
+	int				lc;
 
 	if ( !msg_entityStateFields.fields ) {
 		Com_Error( ERR_DROP, "entityState_t missing netFields" );
@@ -1176,29 +1423,29 @@ void MSG_WriteDeltaEntity( msg_t *msg, sharedEntityState_t *from, sharedEntitySt
 	// a NULL to is a delta remove message
 	if ( to == NULL ) {
 		if ( from == NULL ) {
-			return;
+			return 0;
 		}
 		MSG_WriteBits( msg, from->number, GENTITYNUM_BITS );
 		MSG_WriteBits( msg, 1, 1 );
-		return;
+		return 0;
 	}
 
 	if ( to->number < 0 || to->number >= MAX_GENTITIES ) {
 		Com_Error (ERR_FATAL, "MSG_WriteDeltaEntity: Bad entity number: %i", to->number );
 	}
 
-	lc = MSG_LastChangedField( from, to, &msg_entityStateFields );
+	lc = MSG_ChangedFields( from, to, &msg_entityStateFields, changeMask );
 
 	if ( lc == 0 ) {
 		// nothing at all changed
 		if ( !force ) {
-			return;		// nothing at all
+			return 0;		// nothing at all
 		}
 		// write two bits for no change
 		MSG_WriteBits( msg, to->number, GENTITYNUM_BITS );
 		MSG_WriteBits( msg, 0, 1 );		// not removed
 		MSG_WriteBits( msg, 0, 1 );		// no delta
-		return;
+		return 0;
 	}
 
 	MSG_WriteBits( msg, to->number, GENTITYNUM_BITS );
@@ -1207,7 +1454,46 @@ void MSG_WriteDeltaEntity( msg_t *msg, sharedEntityState_t *from, sharedEntitySt
 
 	MSG_WriteByte( msg, lc );	// # of changes
 
-	MSG_WriteDeltaNetFields( msg, from, to, &msg_entityStateFields, lc );
+	MSG_WriteDeltaNetFields( msg, from, to, &msg_entityStateFields, lc, changeMask );
+
+	return lc;
+}
+
+/*
+==================
+MSG_CountDeltaEntity
+
+Adds an entity delta that was written by copying earlier encoded bits to
+the field statistics, the same as MSG_WriteDeltaNetFields would.
+==================
+*/
+void MSG_CountDeltaEntity( msg_t *msg, int numChangedFields, const unsigned int *changeMask ) {
+	unsigned int	bits;
+	int				i, w;
+
+	if ( !numChangedFields ) {
+		return;
+	}
+
+	if ( msg->stats ) {
+		msg->stats->numDeltas[MSG_STATS_ENTITYSTATE]++;
+	} else {
+		msg_entityStateFields.numDeltas++;
+	}
+
+	for ( w = 0; w < ( numChangedFields + 31 ) >> 5; w++ ) {
+		for ( bits = changeMask[w]; bits; bits &= bits - 1 ) {
+			for ( i = 0; !( bits & ( 1u << i ) ); i++ ) {
+			}
+			i += w << 5;
+
+			if ( msg->stats ) {
+				msg->stats->wcount[MSG_STATS_ENTITYSTATE][i]++;
+			} else {
+				msg_entityStateFields.fields[i].wcount++;
+			}
+		}
+	}
 }
 
 /*
@@ -1300,16 +1586,17 @@ MSG_WriteDeltaPlayerstate
 */
 void MSG_WriteDeltaPlayerstate( msg_t *msg, sharedPlayerState_t *from, sharedPlayerState_t *to ) {
 	int				lc;
+	unsigned int	changeMask[MAX_NETF_MASK_WORDS];
 
 	if ( !msg_playerStateFields.fields ) {
 		Com_Error( ERR_DROP, "playerState_t missing netFields" );
 	}
 
-	lc = MSG_LastChangedField( from, to, &msg_playerStateFields );
+	lc = MSG_ChangedFields( from, to, &msg_playerStateFields, changeMask );
 
 	MSG_WriteByte( msg, lc );	// # of changes
 
-	MSG_WriteDeltaNetFields( msg, from, to, &msg_playerStateFields, lc );
+	MSG_WriteDeltaNetFields( msg, from, to, &msg_playerStateFields, lc, changeMask );
 }
 
 
@@ -1621,6 +1908,9 @@ void MSG_initHuffman( void ) {
 			Huff_addRef(&msgHuff.decompressor,	(byte)i);			// Do update
 		}
 	}
+
+	// the tree doesn't change anymore, both sides have the same codes
+	Huff_BuildTable(&msgHuffTable, &msgHuff.compressor);
 }
 
 /*
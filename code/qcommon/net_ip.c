@@ -28,6 +28,10 @@ Suite 120, Rockville, Maryland 20850 USA.
 ===========================================================================
 */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE		// recvmmsg() and sendmmsg()
+#endif
+
 #include "../qcommon/q_shared.h"
 #include "../qcommon/qcommon.h"
 
@@ -89,6 +93,13 @@ static qboolean	winsockInitialized = qfalse;
 #		include <sys/filio.h>
 #	endif
 
+#	ifdef __linux__
+		// move datagrams in batches and wait on the sockets with epoll
+#		define USE_NET_MMSG
+#		define USE_NET_EPOLL
+#		include <sys/epoll.h>
+#	endif
+
 typedef int SOCKET;
 #	define INVALID_SOCKET		-1
 #	define SOCKET_ERROR			-1
@@ -119,6 +130,10 @@ static cvar_t	*net_mcast6iface;
 
 static cvar_t	*net_dropsim;
 
+#ifdef USE_NET_MMSG
+static cvar_t	*net_batch;
+#endif
+
 static struct sockaddr	socksRelayAddr;
 
 static SOCKET	ip_socket = INVALID_SOCKET;
@@ -521,6 +536,144 @@ qboolean	NET_IsLocalAddress( netadr_t adr ) {
 
 //=============================================================================
 
+#ifdef USE_NET_MMSG
+/*
+=============================================================================
+
+BATCHED DATAGRAM I/O
+
+recvmmsg() pulls up to NET_MMSG_RECV_BATCH datagrams from one socket per
+syscall into a ring that NET_GetPacket drains a packet at a time.
+
+While a send batch is open (NET_BeginPacketBatch) Sys_SendPacket copies
+outgoing datagrams into a queue that NET_EndPacketBatch hands to sendmmsg().
+
+=============================================================================
+*/
+
+#define NET_MMSG_RECV_BATCH		16
+#define NET_MMSG_SEND_BATCH		64
+#define NET_MMSG_PACKETLEN		1400	// same as netchan MAX_PACKETLEN, larger datagrams are sent directly
+
+typedef struct {
+	SOCKET					socket;
+	int						head;
+	int						count;
+
+	struct mmsghdr			hdr[NET_MMSG_RECV_BATCH];
+	struct iovec			iov[NET_MMSG_RECV_BATCH];
+	struct sockaddr_storage	from[NET_MMSG_RECV_BATCH];
+	byte					data[NET_MMSG_RECV_BATCH][MAX_MSGLEN + 1];
+} netRecvBatch_t;
+
+typedef struct {
+	SOCKET					socket;
+	netadrtype_t			type;
+	struct sockaddr_storage	to;
+	socklen_t				tolen;
+	int						length;
+	byte					data[NET_MMSG_PACKETLEN];
+} netSendPacket_t;
+
+static netRecvBatch_t	recvBatch;
+
+static qboolean			sendBatching;
+static int				numSendPackets;
+static netSendPacket_t	sendPackets[NET_MMSG_SEND_BATCH];
+
+/*
+==================
+NET_RecvBatch
+
+Fill the receive ring from sock. Returns the number of queued datagrams or
+SOCKET_ERROR.
+==================
+*/
+static int NET_RecvBatch( SOCKET sock )
+{
+	struct msghdr	*hdr;
+	int				i, ret;
+
+	for( i = 0; i < NET_MMSG_RECV_BATCH; i++ )
+	{
+		recvBatch.iov[i].iov_base = recvBatch.data[i];
+		recvBatch.iov[i].iov_len = sizeof( recvBatch.data[i] );
+
+		hdr = &recvBatch.hdr[i].msg_hdr;
+		memset( hdr, 0, sizeof( *hdr ) );
+		hdr->msg_name = &recvBatch.from[i];
+		hdr->msg_namelen = sizeof( recvBatch.from[i] );
+		hdr->msg_iov = &recvBatch.iov[i];
+		hdr->msg_iovlen = 1;
+	}
+
+	ret = recvmmsg( sock, recvBatch.hdr, NET_MMSG_RECV_BATCH, MSG_DONTWAIT, NULL );
+
+	if( ret == 0 )
+	{
+		errno = EAGAIN;
+		return SOCKET_ERROR;
+	}
+
+	if( ret > 0 )
+	{
+		recvBatch.socket = sock;
+		recvBatch.head = 0;
+		recvBatch.count = ret;
+	}
+
+	return ret;
+}
+#endif
+
+/*
+==================
+NET_RecvFrom
+
+recvfrom() replacement, pops the next datagram from the receive ring when
+batching is enabled.
+==================
+*/
+static int NET_RecvFrom( SOCKET sock, void *buf, int len, struct sockaddr *from, socklen_t *fromlen )
+{
+#ifdef USE_NET_MMSG
+	// the ring only ever holds datagrams from a single socket, and is
+	// drained even if net_batch was turned off after it was filled
+	if( recvBatch.count ? recvBatch.socket == sock : net_batch->integer )
+	{
+		struct mmsghdr	*hdr;
+		int				ret;
+
+		if( !recvBatch.count && NET_RecvBatch( sock ) == SOCKET_ERROR )
+			return SOCKET_ERROR;
+
+		hdr = &recvBatch.hdr[recvBatch.head];
+
+		// truncate like recvfrom() would
+		ret = hdr->msg_len;
+		if( ret > len )
+			ret = len;
+
+		memcpy( buf, recvBatch.data[recvBatch.head], ret );
+		memcpy( from, &recvBatch.from[recvBatch.head], MIN( *fromlen, hdr->msg_hdr.msg_namelen ) );
+		*fromlen = hdr->msg_hdr.msg_namelen;
+
+		recvBatch.head++;
+		recvBatch.count--;
+
+		return ret;
+	}
+#endif
+
+	return recvfrom( sock, buf, len, 0, from, fromlen );
+}
+
+typedef enum {
+	NETPACKET_NONE,			// nothing left to read on the sockets
+	NETPACKET_DROPPED,		// a datagram was read but discarded
+	NETPACKET_RECEIVED
+} netPacketResult_t;
+
 /*
 ==================
 NET_GetPacket
@@ -528,7 +681,7 @@ NET_GetPacket
 Receive one packet
 ==================
 */
-qboolean NET_GetPacket(netadr_t *net_from, msg_t *net_message, fd_set *fdr)
+static netPacketResult_t NET_GetPacket(netadr_t *net_from, msg_t *net_message, fd_set *fdr)
 {
 	int 	ret;
 	struct sockaddr_storage from;
@@ -538,7 +691,7 @@ qboolean NET_GetPacket(netadr_t *net_from, msg_t *net_message, fd_set *fdr)
 	if(ip_socket != INVALID_SOCKET && FD_ISSET(ip_socket, fdr))
 	{
 		fromlen = sizeof(from);
-		ret = recvfrom( ip_socket, (void *)net_message->data, net_message->maxsize, 0, (struct sockaddr *) &from, &fromlen );
+		ret = NET_RecvFrom( ip_socket, (void *)net_message->data, net_message->maxsize, (struct sockaddr *) &from, &fromlen );
 		
 		if (ret == SOCKET_ERROR)
 		{
@@ -554,7 +707,7 @@ qboolean NET_GetPacket(netadr_t *net_from, msg_t *net_message, fd_set *fdr)
 		
 			if ( usingSocks && memcmp( &from, &socksRelayAddr, fromlen ) == 0 ) {
 				if ( ret < 10 || net_message->data[0] != 0 || net_message->data[1] != 0 || net_message->data[2] != 0 || net_message->data[3] != 1 ) {
-					return qfalse;
+					return NETPACKET_DROPPED;
 				}
 				net_from->type = NA_IP;
 				net_from->ip[0] = net_message->data[4];
@@ -571,18 +724,18 @@ qboolean NET_GetPacket(netadr_t *net_from, msg_t *net_message, fd_set *fdr)
 		
 			if( ret >= net_message->maxsize ) {
 				Com_Printf( "Oversize packet from %s\n", NET_AdrToString (*net_from) );
-				return qfalse;
+				return NETPACKET_DROPPED;
 			}
 			
 			net_message->cursize = ret;
-			return qtrue;
+			return NETPACKET_RECEIVED;
 		}
 	}
 	
 	if(ip6_socket != INVALID_SOCKET && FD_ISSET(ip6_socket, fdr))
 	{
 		fromlen = sizeof(from);
-		ret = recvfrom(ip6_socket, (void *)net_message->data, net_message->maxsize, 0, (struct sockaddr *) &from, &fromlen);
+		ret = NET_RecvFrom(ip6_socket, (void *)net_message->data, net_message->maxsize, (struct sockaddr *) &from, &fromlen);
 		
 		if (ret == SOCKET_ERROR)
 		{
@@ -599,18 +752,18 @@ qboolean NET_GetPacket(netadr_t *net_from, msg_t *net_message, fd_set *fdr)
 			if(ret >= net_message->maxsize)
 			{
 				Com_Printf( "Oversize packet from %s\n", NET_AdrToString (*net_from) );
-				return qfalse;
+				return NETPACKET_DROPPED;
 			}
 			
 			net_message->cursize = ret;
-			return qtrue;
+			return NETPACKET_RECEIVED;
 		}
 	}
 
 	if(multicast6_socket != INVALID_SOCKET && multicast6_socket != ip6_socket && FD_ISSET(multicast6_socket, fdr))
 	{
 		fromlen = sizeof(from);
-		ret = recvfrom(multicast6_socket, (void *)net_message->data, net_message->maxsize, 0, (struct sockaddr *) &from, &fromlen);
+		ret = NET_RecvFrom(multicast6_socket, (void *)net_message->data, net_message->maxsize, (struct sockaddr *) &from, &fromlen);
 		
 		if (ret == SOCKET_ERROR)
 		{
@@ -627,22 +780,120 @@ qboolean NET_GetPacket(netadr_t *net_from, msg_t *net_message, fd_set *fdr)
 			if(ret >= net_message->maxsize)
 			{
 				Com_Printf( "Oversize packet from %s\n", NET_AdrToString (*net_from) );
-				return qfalse;
+				return NETPACKET_DROPPED;
 			}
 			
 			net_message->cursize = ret;
-			return qtrue;
+			return NETPACKET_RECEIVED;
 		}
 	}
 	
 	
-	return qfalse;
+	return NETPACKET_NONE;
 }
 
 //=============================================================================
 
 static char socksBuf[4096];
 
+/*
+==================
+NET_SendError
+
+Report a failed sendto() / sendmmsg()
+==================
+*/
+static void NET_SendError( netadrtype_t type ) {
+	int err = socketError;
+
+	// wouldblock is silent
+	if( err == EAGAIN ) {
+		return;
+	}
+
+	// some PPP links do not allow broadcasts and return an error
+	if( ( err == EADDRNOTAVAIL ) && ( ( type == NA_BROADCAST ) ) ) {
+		return;
+	}
+
+	Com_Printf( "Sys_SendPacket: %s\n", NET_ErrorString() );
+}
+
+/*
+==================
+NET_BeginPacketBatch
+
+Queue outgoing datagrams until NET_EndPacketBatch
+==================
+*/
+void NET_BeginPacketBatch( void ) {
+#ifdef USE_NET_MMSG
+	sendBatching = net_batch->integer ? qtrue : qfalse;
+#endif
+}
+
+/*
+==================
+NET_FlushPacketBatch
+==================
+*/
+static void NET_FlushPacketBatch( void ) {
+#ifdef USE_NET_MMSG
+	struct mmsghdr	hdr[NET_MMSG_SEND_BATCH];
+	struct iovec	iov[NET_MMSG_SEND_BATCH];
+	int				i, start, run, ret;
+
+	memset( hdr, 0, numSendPackets * sizeof( hdr[0] ) );
+
+	for( i = 0; i < numSendPackets; i++ ) {
+		iov[i].iov_base = sendPackets[i].data;
+		iov[i].iov_len = sendPackets[i].length;
+
+		hdr[i].msg_hdr.msg_name = &sendPackets[i].to;
+		hdr[i].msg_hdr.msg_namelen = sendPackets[i].tolen;
+		hdr[i].msg_hdr.msg_iov = &iov[i];
+		hdr[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	for( start = 0; start < numSendPackets; start += run ) {
+		// sendmmsg() takes a single socket, send each run of packets for the same one
+		for( run = 1; start + run < numSendPackets; run++ ) {
+			if( sendPackets[start + run].socket != sendPackets[start].socket ) {
+				break;
+			}
+		}
+
+		ret = sendmmsg( sendPackets[start].socket, &hdr[start], run, 0 );
+
+		if( ret == SOCKET_ERROR ) {
+			// drop the packet that failed like sendto() would and carry on
+			NET_SendError( sendPackets[start].type );
+			run = 1;
+		} else if( ret < run ) {
+			// the next call reports the error for the rest
+			run = ret;
+		}
+	}
+
+	numSendPackets = 0;
+#endif
+}
+
+/*
+==================
+NET_EndPacketBatch
+
+Send all datagrams queued since NET_BeginPacketBatch
+==================
+*/
+void NET_EndPacketBatch( void ) {
+	NET_FlushPacketBatch();
+
+#ifdef USE_NET_MMSG
+	sendBatching = qfalse;
+#endif
+}
+
 /*
 ==================
 Sys_SendPacket
@@ -670,6 +921,37 @@ void Sys_SendPacket( int length, const void *data, netadr_t to ) {
 	memset(&addr, 0, sizeof(addr));
 	NetadrToSockadr( &to, (struct sockaddr *) &addr );
 
+#ifdef USE_NET_MMSG
+	if( sendBatching && !( usingSocks && to.type == NA_IP ) && length <= NET_MMSG_PACKETLEN &&
+		( addr.ss_family == AF_INET || addr.ss_family == AF_INET6 ) )
+	{
+		netSendPacket_t *packet;
+
+		if( numSendPackets == NET_MMSG_SEND_BATCH ) {
+			NET_FlushPacketBatch();
+		}
+
+		packet = &sendPackets[numSendPackets++];
+
+		if( addr.ss_family == AF_INET ) {
+			packet->socket = ip_socket;
+			packet->tolen = sizeof(struct sockaddr_in);
+		} else {
+			packet->socket = ip6_socket;
+			packet->tolen = sizeof(struct sockaddr_in6);
+		}
+
+		packet->type = to.type;
+		packet->to = addr;
+		packet->length = length;
+		memcpy( packet->data, data, length );
+		return;
+	}
+
+	// keep packet order when something bypasses the queue
+	NET_FlushPacketBatch();
+#endif
+
 	if( usingSocks && to.type == NA_IP ) {
 		socksBuf[0] = 0;	// reserved
 		socksBuf[1] = 0;
@@ -687,19 +969,7 @@ void Sys_SendPacket( int length, const void *data, netadr_t to ) {
 			ret = sendto( ip6_socket, data, length, 0, (struct sockaddr *) &addr, sizeof(struct sockaddr_in6) );
 	}
 	if( ret == SOCKET_ERROR ) {
-		int err = socketError;
-
-		// wouldblock is silent
-		if( err == EAGAIN ) {
-			return;
-		}
-
-		// some PPP links do not allow broadcasts and return an error
-		if( ( err == EADDRNOTAVAIL ) && ( ( to.type == NA_BROADCAST ) ) ) {
-			return;
-		}
-
-		Com_Printf( "Sys_SendPacket: %s\n", NET_ErrorString() );
+		NET_SendError( to.type );
 	}
 }
 
@@ -1488,10 +1758,79 @@ static qboolean NET_GetCvars( void ) {
 
 	net_dropsim = Cvar_Get("net_dropsim", "", CVAR_TEMP);
 
+#ifdef USE_NET_MMSG
+	net_batch = Cvar_Get( "net_batch", "1", CVAR_ARCHIVE );
+#endif
+
 	return modified ? qtrue : qfalse;
 }
 
 
+#ifdef USE_NET_EPOLL
+static int		epollFd = -1;
+static SOCKET	epollSockets[2] = { INVALID_SOCKET, INVALID_SOCKET };
+
+/*
+====================
+NET_CloseEpoll
+====================
+*/
+static void NET_CloseEpoll( void ) {
+	if ( epollFd != -1 ) {
+		close( epollFd );
+		epollFd = -1;
+	}
+
+	epollSockets[0] = INVALID_SOCKET;
+	epollSockets[1] = INVALID_SOCKET;
+}
+
+/*
+====================
+NET_UpdateEpoll
+
+Make sure the epoll set watches the current sockets
+====================
+*/
+static qboolean NET_UpdateEpoll( void ) {
+	struct epoll_event	ev;
+	int					i;
+
+	if ( epollFd != -1 && epollSockets[0] == ip_socket && epollSockets[1] == ip6_socket ) {
+		return qtrue;
+	}
+
+	NET_CloseEpoll();
+
+	epollFd = epoll_create1( EPOLL_CLOEXEC );
+	if ( epollFd == -1 ) {
+		Com_Printf( "WARNING: NET_UpdateEpoll: epoll_create1: %s\n", NET_ErrorString() );
+		return qfalse;
+	}
+
+	epollSockets[0] = ip_socket;
+	epollSockets[1] = ip6_socket;
+
+	for ( i = 0; i < ARRAY_LEN( epollSockets ); i++ ) {
+		if ( epollSockets[i] == INVALID_SOCKET ) {
+			continue;
+		}
+
+		memset( &ev, 0, sizeof( ev ) );
+		ev.events = EPOLLIN;
+		ev.data.fd = epollSockets[i];
+
+		if ( epoll_ctl( epollFd, EPOLL_CTL_ADD, epollSockets[i], &ev ) == -1 ) {
+			Com_Printf( "WARNING: NET_UpdateEpoll: epoll_ctl: %s\n", NET_ErrorString() );
+			NET_CloseEpoll();
+			return qfalse;
+		}
+	}
+
+	return qtrue;
+}
+#endif
+
 /*
 ====================
 NET_Config
@@ -1537,6 +1876,15 @@ void NET_Config( qboolean enableNetworking ) {
 	}
 
 	if( stop ) {
+		NET_FlushPacketBatch();
+
+#ifdef USE_NET_MMSG
+		recvBatch.count = 0;
+#endif
+#ifdef USE_NET_EPOLL
+		NET_CloseEpoll();
+#endif
+
 		if ( ip_socket != INVALID_SOCKET ) {
 			closesocket( ip_socket );
 			ip_socket = INVALID_SOCKET;
@@ -1620,7 +1968,7 @@ void NET_Shutdown( void ) {
 ====================
 NET_Event
 
-Called from NET_Sleep which uses select() to determine which sockets have seen action.
+Called from NET_Sleep which uses select() (epoll on Linux) to determine which sockets have seen action.
 ====================
 */
 
@@ -1629,12 +1977,20 @@ void NET_Event(fd_set *fdr)
 	byte bufData[MAX_MSGLEN + 1];
 	netadr_t from = {0};
 	msg_t netmsg;
+	netPacketResult_t result;
 	
 	while(1)
 	{
 		MSG_Init(&netmsg, bufData, sizeof(bufData));
 
-		if(NET_GetPacket(&from, &netmsg, fdr))
+		result = NET_GetPacket(&from, &netmsg, fdr);
+
+		// keep reading past dropped datagrams, the receive ring may still
+		// hold packets the kernel will never signal again
+		if(result == NETPACKET_DROPPED)
+			continue;
+
+		if(result == NETPACKET_RECEIVED)
 		{
 			if(net_dropsim->value > 0.0f && net_dropsim->value <= 100.0f)
 			{
@@ -1670,6 +2026,34 @@ void NET_Sleep(int msec)
 	if(msec < 0)
 		msec = 0;
 
+#ifdef USE_NET_EPOLL
+	if(NET_UpdateEpoll())
+	{
+		struct epoll_event events[ARRAY_LEN(epollSockets)];
+		int i;
+
+		retval = epoll_wait(epollFd, events, ARRAY_LEN(events), msec);
+
+		if(retval == SOCKET_ERROR)
+		{
+			if(errno != EINTR)
+				Com_Printf("Warning: epoll_wait() syscall failed: %s\n", NET_ErrorString());
+		}
+		else if(retval > 0)
+		{
+			// NET_GetPacket still works on an fd_set
+			FD_ZERO(&fdr);
+
+			for(i = 0; i < retval; i++)
+				FD_SET(events[i].data.fd, &fdr);
+
+			NET_Event(&fdr);
+		}
+
+		return;
+	}
+#endif
+
 	FD_ZERO(&fdr);
 
 	if(ip_socket != INVALID_SOCKET)
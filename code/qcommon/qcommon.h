@@ -117,6 +117,7 @@ typedef struct {
 	int		cursize;
 	int		readcount;
 	int		bit;				// for bitwise reads and writes
+	struct msgStats_s	*stats;	// field statistics of the writing thread, NULL for the totals
 } msg_t;
 
 void MSG_Init (msg_t *buf, byte *data, int length);
@@ -136,6 +137,7 @@ struct entityState_s;
 struct playerState_s;
 
 void MSG_WriteBits( msg_t *msg, int value, int bits );
+void MSG_WriteBitsFrom( msg_t *msg, const byte *data, int numBits );
 
 void MSG_WriteChar (msg_t *sb, int c);
 void MSG_WriteByte (msg_t *sb, int c);
@@ -171,8 +173,26 @@ void MSG_SetNetFields( vmNetField_t *vmEntityFields, int numEntityFields, int en
 					   vmNetField_t *vmPlayerFields, int numPlayerFields, int playerStateSize, int playerNetworkSize );
 void MSG_ShutdownNetFields( void );
 
+#define MAX_NETF_FIELDS 255
+#define MAX_NETF_MASK_WORDS ((MAX_NETF_FIELDS + 31) / 32)
+
+// field statistics of messages written off the main thread, which are kept
+// apart and added to the totals with MSG_AddStats once the job is done
+#define MSG_STATS_PLAYERSTATE	0
+#define MSG_STATS_ENTITYSTATE	1
+
+typedef struct msgStats_s {
+	int		numDeltas[2];
+	int		wcount[2][MAX_NETF_FIELDS];
+} msgStats_t;
+
+void MSG_AddStats( msgStats_t *stats );
+
 void MSG_WriteDeltaEntity( msg_t *msg, sharedEntityState_t *from, sharedEntityState_t *to,
 						   qboolean force );
+int MSG_WriteDeltaEntityChanges( msg_t *msg, sharedEntityState_t *from, sharedEntityState_t *to,
+						   qboolean force, unsigned int *changeMask );
+void MSG_CountDeltaEntity( msg_t *msg, int numChangedFields, const unsigned int *changeMask );
 void MSG_ReadDeltaEntity( msg_t *msg, sharedEntityState_t *from, sharedEntityState_t *to, 
 						 int number );
 
@@ -244,6 +264,8 @@ void		NET_Shutdown( void );
 void		NET_Restart_f( void );
 void		NET_Config( qboolean enableNetworking );
 void		NET_FlushPacketQueue(void);
+void		NET_BeginPacketBatch(void);
+void		NET_EndPacketBatch(void);
 void		NET_SendPacket (netsrc_t sock, int length, const void *data, netadr_t to);
 void		QDECL NET_OutOfBandPrint( netsrc_t net_socket, netadr_t adr, const char *format, ...) __attribute__ ((format (printf, 3, 4)));
 void		QDECL NET_OutOfBandData( netsrc_t sock, netadr_t adr, byte *format, int len );
@@ -431,6 +453,7 @@ void	VM_Clear(void);
 void	VM_Forced_Unload_Start(void);
 void	VM_Forced_Unload_Done(void);
 vm_t	*VM_Restart(vm_t *vm, qboolean unpure);
+qboolean	VM_IsNative( vm_t *vm );
 
 intptr_t		QDECL VM_Call( vm_t *vm, int callNum, ... );
 intptr_t		QDECL VM_SafeCall( vm_t *vm, int callnum );
@@ -763,6 +786,13 @@ int		FS_Write( const void *buffer, int len, fileHandle_t f );
 int		FS_Read( void *buffer, int len, fileHandle_t f );
 // properly handles partial reads and reads from other dlls
 
+int		FS_ThreadRead( void *buffer, int len, fileHandle_t f );
+int		FS_ThreadWrite( const void *buffer, int len, fileHandle_t f );
+void	FS_CountRead( int len );
+// FS_Read and FS_Write for a thread that owns the handle, they don't print
+// or update shared state and return -1 on errors. The main thread adds the
+// bytes read to the statistics with FS_CountRead.
+
 void	FS_FCloseFile( fileHandle_t f );
 // note: you can't just fclose from another DLL, due to MS libc issues
 
@@ -781,6 +811,22 @@ void	FS_ForceFlush( fileHandle_t f );
 void	FS_FreeFile( void *buffer );
 // frees the memory returned by FS_ReadFile
 
+long	FS_MapFileDir(const char *qpath, void *searchPath, qboolean unpure, void **buffer);
+long	FS_MapFile(const char *qpath, void **buffer);
+// same as FS_ReadFile, but loose files and uncompressed pk3 files are
+// mapped into memory instead of copied. The buffer is copy on write and
+// has NO trailing 0, so it is only suited for binary files.
+
+void	FS_UnmapFile( void *buffer );
+// releases the buffer returned by FS_MapFile
+
+qboolean FS_PrefetchFile( const char *qpath );
+void	FS_PrefetchStart( void );
+void	FS_PrefetchEnd( void );
+// files queued with FS_PrefetchFile are inflated on worker threads between
+// FS_PrefetchStart and FS_PrefetchEnd and FS_ReadFile takes them from there.
+// FS_PrefetchFile returns qfalse if the file doesn't exist.
+
 void	FS_WriteFile( const char *qpath, const void *buffer, int size );
 // writes a complete file, creating any subdirectories needed
 
@@ -873,6 +919,23 @@ extern gameConfig_t com_gameConfig;
 /*
 ==============================================================
 
+JOBS
+
+==============================================================
+*/
+
+typedef struct jobPool_s jobPool_t;
+typedef void (*jobFunc_t)( void *data, int index, int threadNum );
+
+jobPool_t	*Job_CreatePool( const char *name, int numThreads );
+void		Job_DestroyPool( jobPool_t *pool );
+int			Job_NumThreads( const jobPool_t *pool );
+void		Job_ParallelFor( jobPool_t *pool, jobFunc_t func, void *data, int count );
+void		*Job_FrameAlloc( jobPool_t *pool, int threadNum, int size );
+
+/*
+==============================================================
+
 Edit fields and command line history/completion
 
 ==============================================================
@@ -1096,6 +1159,23 @@ void Hunk_FreeTempMemory( void *buf );
 int	Hunk_MemoryRemaining( void );
 void Hunk_Log( void);
 
+// frame arenas are emptied at the start of every Com_Frame, see arena.c
+typedef struct frameArena_s frameArena_t;
+
+frameArena_t *Arena_Create( const char *name, int size );
+void Arena_Destroy( frameArena_t *arena );
+void *Arena_Alloc( frameArena_t *arena, int size );	// NOT 0 filled memory
+int Arena_Mark( frameArena_t *arena );
+void Arena_ClearToMark( frameArena_t *arena, int mark );
+void Arena_Reset( frameArena_t *arena );
+void Arena_ResetAll( void );
+void Arena_Info( void );
+
+void Com_InitFrameArena( void );
+void *Com_FrameAlloc( int size );		// NOT 0 filled memory, valid until the next frame
+int Com_FrameMark( void );
+void Com_FrameClearToMark( int mark );
+
 typedef struct {
 	void *pointer;
 	int maxElements;
@@ -1266,6 +1346,7 @@ void	Sys_Print( const char *msg );
 // Sys_Milliseconds should only be used for profiling purposes,
 // any game related timing information should come from event timestamps
 int		Sys_Milliseconds (void);
+int64_t	Sys_Microseconds( void );
 
 qboolean Sys_RandomBytes( byte *string, int len );
 
@@ -1289,6 +1370,16 @@ qboolean Sys_Mkdir( const char *path );
 qboolean Sys_Rmdir( const char *path );
 FILE	*Sys_Mkfifo( const char *ospath );
 int		Sys_StatFile( char *ospath );
+qboolean Sys_FileInfo( const char *ospath, int *size, int *mtime );
+
+typedef struct {
+	void	*data;		// first requested byte
+	void	*base;		// start of the view, aligned for the OS
+	size_t	size;		// size of the view
+} sysFileMapping_t;
+
+qboolean Sys_MapFile( FILE *f, long offset, long length, sysFileMapping_t *mapping );
+void	Sys_UnmapFile( sysFileMapping_t *mapping );
 char	*Sys_Cwd( void );
 void	Sys_SetDefaultInstallPath(const char *path);
 char	*Sys_DefaultInstallPath(void);
@@ -1333,6 +1424,20 @@ dialogResult_t Sys_Dialog( dialogType_t type, const char *message, const char *t
 void Sys_RemovePIDFile( const char *gamedir );
 void Sys_InitPIDFile( const char *gamedir );
 
+// Sys_CreateThread returns NULL if threads aren't available, callers must be
+// able to do the work on the main thread instead
+void	*Sys_CreateThread( void (*function)( void *arg ), void *arg );
+void	Sys_JoinThread( void *thread );
+void	*Sys_CreateMutex( void );
+void	Sys_DestroyMutex( void *mutex );
+void	Sys_LockMutex( void *mutex );
+void	Sys_UnlockMutex( void *mutex );
+void	*Sys_CreateSemaphore( int value );
+void	Sys_DestroySemaphore( void *semaphore );
+void	Sys_SemaphoreWait( void *semaphore );
+void	Sys_SemaphorePost( void *semaphore );
+int		Sys_ProcessorCount( void );
+
 /*
 ==============================================================
 
@@ -1382,6 +1487,16 @@ typedef struct {
 	huff_t		decompressor;
 } huffman_t;
 
+#define HUFF_LOOKUP_BITS	11
+#define HUFF_LOOKUP_SHIFT	9		// lookup entries are symbol | length << HUFF_LOOKUP_SHIFT
+
+// codes of a fixed tree
+typedef struct {
+	unsigned int	codes[HMAX+1];		// first bit sent in bit 0
+	byte			lengths[HMAX+1];	// 0 if the code is longer than 32 bits
+	unsigned short	lookup[1<<HUFF_LOOKUP_BITS];	// indexed by the next bits, 0 if the code is longer
+} huffTable_t;
+
 void	Huff_Compress(msg_t *buf, int offset);
 void	Huff_Decompress(msg_t *buf, int offset);
 void	Huff_Init(huffman_t *huff);
@@ -1392,6 +1507,11 @@ void	Huff_offsetReceive (node_t *node, int *ch, byte *fin, int *offset, int maxo
 void	Huff_offsetTransmit (huff_t *huff, int ch, byte *fout, int *offset, int maxoffset);
 void	Huff_putBit( int bit, byte *fout, int *offset);
 int		Huff_getBit( byte *fout, int *offset);
+void	Huff_putBits( unsigned int bits, int count, byte *fout, int *offset );
+unsigned int Huff_getBits( byte *fin, int *offset, int count );
+void	Huff_BuildTable( huffTable_t *table, huff_t *huff );
+void	Huff_tableTransmit( const huffTable_t *table, huff_t *huff, int ch, byte *fout, int *offset, int maxoffset );
+void	Huff_tableReceive( const huffTable_t *table, node_t *node, int *ch, byte *fin, int *offset, int maxoffset );
 
 // don't use if you don't know what you're doing.
 int		Huff_getBloc(void);
@@ -62,6 +62,18 @@ woven in by Terry Thorsen 1/2003.
 #define UNZ_BUFSIZE (16384)
 #endif
 
+#ifndef UNZ_WINSIZE
+#define UNZ_WINSIZE (32768)         /* deflate window, must be a power of two */
+#endif
+
+#ifndef UNZ_SEEK_SPAN
+#define UNZ_SEEK_SPAN (256*1024)    /* minimum distance between seek points */
+#endif
+
+#ifndef UNZ_MAX_ACCESS
+#define UNZ_MAX_ACCESS (64)         /* maximum seek points per file */
+#endif
+
 #ifndef UNZ_MAXFILENAMEINZIP
 #define UNZ_MAXFILENAMEINZIP (256)
 #endif
@@ -89,6 +101,19 @@ typedef struct unz_file_info_internal_s
 } unz_file_info_internal;
 
 
+/* unz_access_point contain the inflate state needed to resume decompression
+    in the middle of a deflated file */
+typedef struct unz_access_point_s
+{
+    uLong out;                  /* offset in the uncompressed data */
+    uLong in;                   /* position of the next compressed byte */
+    uLong rest_read_compressed; /* compressed bytes left from in */
+    int   bits;                 /* bits of the byte before in still unused */
+    uInt  window_size;          /* number of valid bytes in window */
+    Bytef window[UNZ_WINSIZE];  /* uncompressed data preceding out */
+} unz_access_point;
+
+
 /* file_in_zip_read_info_s contain internal information about a file in zipfile,
     when reading and decompress it */
 typedef struct
@@ -112,6 +137,18 @@ typedef struct
     uLong compression_method;   /* compression method (0==store) */
     uLong byte_before_the_zipfile;/* byte before the zipfile, (>0 for sfx)*/
     int   raw;
+
+    uLong pos_data_start;       /* position of the file data in the zipfile */
+    uLong compressed_size;      /* compressed size of the file */
+    uLong uncompressed_size;    /* uncompressed size of the file */
+    int   crc_valid;            /* cleared when a seek skips part of the data */
+
+    Bytef* window;              /* ring of the last UNZ_WINSIZE bytes output,
+                                   allocated by the first seek */
+    uLong window_have;          /* number of valid bytes in window */
+    unz_access_point** access;  /* seek points recorded while inflating */
+    int   num_access;
+    uLong access_span;          /* minimum distance between seek points */
 } file_in_zip_read_info_s;
 
 
@@ -1172,6 +1209,17 @@ extern int ZEXPORT unzOpenCurrentFile3 (file, method, level, raw, password)
 
     pfile_in_zip_read_info->stream.avail_in = (uInt)0;
 
+    pfile_in_zip_read_info->compressed_size =
+            s->cur_file_info.compressed_size ;
+    pfile_in_zip_read_info->uncompressed_size =
+            s->cur_file_info.uncompressed_size ;
+    pfile_in_zip_read_info->crc_valid = 1;
+    pfile_in_zip_read_info->window = NULL;
+    pfile_in_zip_read_info->window_have = 0;
+    pfile_in_zip_read_info->access = NULL;
+    pfile_in_zip_read_info->num_access = 0;
+    pfile_in_zip_read_info->access_span = 0;
+
     s->pfile_in_zip_read = pfile_in_zip_read_info;
 
 #    ifndef NOUNCRYPT
@@ -1196,6 +1244,8 @@ extern int ZEXPORT unzOpenCurrentFile3 (file, method, level, raw, password)
     }
 #    endif
 
+    pfile_in_zip_read_info->pos_data_start =
+            pfile_in_zip_read_info->pos_in_zipfile;
 
     return err;
 }
@@ -1222,6 +1272,96 @@ extern int ZEXPORT unzOpenCurrentFile2 (file,method,level,raw)
     return unzOpenCurrentFile3(file, method, level, raw, NULL);
 }
 
+/*
+  Append the output just produced by inflate to the window ring.  Byte n of
+  the uncompressed data is kept at window[n % UNZ_WINSIZE].
+*/
+local void unzlocal_UpdateWindow OF((
+    file_in_zip_read_info_s* pfile_in_zip_read_info,
+    const Bytef* buf,
+    uLong len));
+
+local void unzlocal_UpdateWindow (pfile_in_zip_read_info, buf, len)
+    file_in_zip_read_info_s* pfile_in_zip_read_info;
+    const Bytef* buf;
+    uLong len;
+{
+    uLong pos,first;
+
+    pfile_in_zip_read_info->window_have += len;
+    if (pfile_in_zip_read_info->window_have > UNZ_WINSIZE)
+        pfile_in_zip_read_info->window_have = UNZ_WINSIZE;
+
+    if (len > UNZ_WINSIZE)
+    {
+        buf += len - UNZ_WINSIZE;
+        len = UNZ_WINSIZE;
+    }
+
+    pos = (pfile_in_zip_read_info->stream.total_out - len) & (UNZ_WINSIZE-1);
+    first = UNZ_WINSIZE - pos;
+    if (first > len)
+        first = len;
+
+    memcpy(pfile_in_zip_read_info->window + pos, buf, first);
+    memcpy(pfile_in_zip_read_info->window, buf + first, len - first);
+}
+
+/*
+  Record a seek point if inflate stopped at a block boundary far enough from
+  the previous one, and the window ring holds all the history it needs.
+*/
+local void unzlocal_AddAccessPoint OF((
+    file_in_zip_read_info_s* pfile_in_zip_read_info));
+
+local void unzlocal_AddAccessPoint (pfile_in_zip_read_info)
+    file_in_zip_read_info_s* pfile_in_zip_read_info;
+{
+    unz_access_point* ap;
+    uLong out = pfile_in_zip_read_info->stream.total_out;
+    uLong last = 0;
+    uLong pos,first;
+    uInt window_size;
+
+    /* bit 7 is set at the end of a block header, bit 6 after the last block */
+    if (((pfile_in_zip_read_info->stream.data_type & 128) == 0) ||
+        ((pfile_in_zip_read_info->stream.data_type & 64) != 0))
+        return;
+
+    if (pfile_in_zip_read_info->num_access >= UNZ_MAX_ACCESS)
+        return;
+
+    if (pfile_in_zip_read_info->num_access > 0)
+        last = pfile_in_zip_read_info->access[pfile_in_zip_read_info->num_access-1]->out;
+    if (out < last + pfile_in_zip_read_info->access_span)
+        return;
+
+    window_size = (out < UNZ_WINSIZE) ? (uInt)out : UNZ_WINSIZE;
+    if (pfile_in_zip_read_info->window_have < window_size)
+        return;
+
+    ap = (unz_access_point*)ALLOC(sizeof(unz_access_point));
+    if (ap == NULL)
+        return;
+
+    ap->out = out;
+    ap->in = pfile_in_zip_read_info->pos_in_zipfile -
+             pfile_in_zip_read_info->stream.avail_in;
+    ap->rest_read_compressed = pfile_in_zip_read_info->rest_read_compressed +
+                               pfile_in_zip_read_info->stream.avail_in;
+    ap->bits = pfile_in_zip_read_info->stream.data_type & 7;
+    ap->window_size = window_size;
+
+    pos = (out - window_size) & (UNZ_WINSIZE-1);
+    first = UNZ_WINSIZE - pos;
+    if (first > window_size)
+        first = window_size;
+    memcpy(ap->window, pfile_in_zip_read_info->window + pos, first);
+    memcpy(ap->window + first, pfile_in_zip_read_info->window, window_size - first);
+
+    pfile_in_zip_read_info->access[pfile_in_zip_read_info->num_access++] = ap;
+}
+
 /*
   Read bytes from the current file.
   buf contain buffer where data must be copied
@@ -1273,6 +1413,42 @@ extern int ZEXPORT unzReadCurrentFile  (file, buf, len)
 
     while (pfile_in_zip_read_info->stream.avail_out>0)
     {
+        if ((pfile_in_zip_read_info->compression_method==0) &&
+            (!pfile_in_zip_read_info->raw) && (!s->encrypted) &&
+            (pfile_in_zip_read_info->stream.avail_in==0) &&
+            (pfile_in_zip_read_info->stream.avail_out>=UNZ_BUFSIZE))
+        {
+            /* large reads of stored data go straight to the caller's buffer */
+            uInt uReadThis = pfile_in_zip_read_info->stream.avail_out;
+            if (pfile_in_zip_read_info->rest_read_compressed<uReadThis)
+                uReadThis = (uInt)pfile_in_zip_read_info->rest_read_compressed;
+            if (uReadThis == 0)
+                return (iRead==0) ? UNZ_EOF : iRead;
+            if (ZSEEK(pfile_in_zip_read_info->z_filefunc,
+                      pfile_in_zip_read_info->filestream,
+                      pfile_in_zip_read_info->pos_in_zipfile +
+                         pfile_in_zip_read_info->byte_before_the_zipfile,
+                         ZLIB_FILEFUNC_SEEK_SET)!=0)
+                return UNZ_ERRNO;
+            if (ZREAD(pfile_in_zip_read_info->z_filefunc,
+                      pfile_in_zip_read_info->filestream,
+                      pfile_in_zip_read_info->stream.next_out,
+                      uReadThis)!=uReadThis)
+                return UNZ_ERRNO;
+
+            pfile_in_zip_read_info->crc32 = crc32(pfile_in_zip_read_info->crc32,
+                                pfile_in_zip_read_info->stream.next_out,
+                                uReadThis);
+            pfile_in_zip_read_info->pos_in_zipfile += uReadThis;
+            pfile_in_zip_read_info->rest_read_compressed -= uReadThis;
+            pfile_in_zip_read_info->rest_read_uncompressed -= uReadThis;
+            pfile_in_zip_read_info->stream.avail_out -= uReadThis;
+            pfile_in_zip_read_info->stream.next_out += uReadThis;
+            pfile_in_zip_read_info->stream.total_out += uReadThis;
+            iRead += uReadThis;
+            continue;
+        }
+
         if ((pfile_in_zip_read_info->stream.avail_in==0) &&
             (pfile_in_zip_read_info->rest_read_compressed>0))
         {
@@ -1351,6 +1527,10 @@ extern int ZEXPORT unzReadCurrentFile  (file, buf, len)
             uLong uOutThis;
             int flush=Z_SYNC_FLUSH;
 
+            /* stop at deflate block boundaries so seek points can be taken */
+            if (pfile_in_zip_read_info->window != NULL)
+                flush = Z_BLOCK;
+
             uTotalOutBefore = pfile_in_zip_read_info->stream.total_out;
             bufBefore = pfile_in_zip_read_info->stream.next_out;
 
@@ -1375,6 +1555,13 @@ extern int ZEXPORT unzReadCurrentFile  (file, buf, len)
             pfile_in_zip_read_info->rest_read_uncompressed -=
                 uOutThis;
 
+            if (pfile_in_zip_read_info->window != NULL)
+            {
+                unzlocal_UpdateWindow(pfile_in_zip_read_info,bufBefore,uOutThis);
+                if (err==Z_OK)
+                    unzlocal_AddAccessPoint(pfile_in_zip_read_info);
+            }
+
             iRead += (uInt)(uTotalOutAfter - uTotalOutBefore);
 
             if (err==Z_STREAM_END)
@@ -1410,6 +1597,243 @@ extern z_off_t ZEXPORT unztell (file)
 }
 
 
+/*
+  Give the stream of the zipfile and the offset of the data of the current
+  file in it, so stored files can be accessed without going through unzip
+*/
+extern int ZEXPORT unzGetCurrentFileStoredData (file, stream, offset)
+    unzFile file;
+    voidpf* stream;
+    uLong* offset;
+{
+    unz_s* s;
+    file_in_zip_read_info_s* pfile_in_zip_read_info;
+    if (file==NULL)
+        return UNZ_PARAMERROR;
+    s=(unz_s*)file;
+    pfile_in_zip_read_info=s->pfile_in_zip_read;
+
+    if (pfile_in_zip_read_info==NULL)
+        return UNZ_PARAMERROR;
+    if ((pfile_in_zip_read_info->compression_method!=0) ||
+        (pfile_in_zip_read_info->raw) || (s->encrypted))
+        return UNZ_PARAMERROR;
+
+    *stream = pfile_in_zip_read_info->filestream;
+    *offset = pfile_in_zip_read_info->pos_data_start +
+              pfile_in_zip_read_info->byte_before_the_zipfile;
+    return UNZ_OK;
+}
+
+/*
+  Give the offset of the compressed data of the current file in the zipfile
+*/
+extern int ZEXPORT unzGetCurrentFileDataOffset (file, offset)
+    unzFile file;
+    uLong* offset;
+{
+    unz_s* s;
+    file_in_zip_read_info_s* pfile_in_zip_read_info;
+    if (file==NULL)
+        return UNZ_PARAMERROR;
+    s=(unz_s*)file;
+    pfile_in_zip_read_info=s->pfile_in_zip_read;
+
+    if (pfile_in_zip_read_info==NULL)
+        return UNZ_PARAMERROR;
+    if ((pfile_in_zip_read_info->raw) || (s->encrypted))
+        return UNZ_PARAMERROR;
+
+    *offset = pfile_in_zip_read_info->pos_data_start +
+              pfile_in_zip_read_info->byte_before_the_zipfile;
+    return UNZ_OK;
+}
+
+/*
+  Restart inflating the current file at its first byte
+*/
+local int unzlocal_RewindCurrentFile OF((
+    file_in_zip_read_info_s* pfile_in_zip_read_info));
+
+local int unzlocal_RewindCurrentFile (pfile_in_zip_read_info)
+    file_in_zip_read_info_s* pfile_in_zip_read_info;
+{
+    if (inflateReset(&pfile_in_zip_read_info->stream) != Z_OK)
+        return UNZ_INTERNALERROR;
+
+    pfile_in_zip_read_info->pos_in_zipfile = pfile_in_zip_read_info->pos_data_start;
+    pfile_in_zip_read_info->rest_read_compressed = pfile_in_zip_read_info->compressed_size;
+    pfile_in_zip_read_info->rest_read_uncompressed = pfile_in_zip_read_info->uncompressed_size;
+    pfile_in_zip_read_info->stream.avail_in = 0;
+    pfile_in_zip_read_info->stream.total_out = 0;
+    pfile_in_zip_read_info->crc32 = 0;
+    pfile_in_zip_read_info->crc_valid = 1;
+    pfile_in_zip_read_info->window_have = 0;
+
+    return UNZ_OK;
+}
+
+/*
+  Restart inflating the current file at a recorded seek point
+*/
+local int unzlocal_ResumeAccessPoint OF((
+    file_in_zip_read_info_s* pfile_in_zip_read_info,
+    const unz_access_point* ap));
+
+local int unzlocal_ResumeAccessPoint (pfile_in_zip_read_info, ap)
+    file_in_zip_read_info_s* pfile_in_zip_read_info;
+    const unz_access_point* ap;
+{
+    if (inflateReset(&pfile_in_zip_read_info->stream) != Z_OK)
+        return UNZ_INTERNALERROR;
+
+    /* the seek point may start in the middle of a byte */
+    if (ap->bits)
+    {
+        unsigned char c;
+
+        if (ZSEEK(pfile_in_zip_read_info->z_filefunc,
+                  pfile_in_zip_read_info->filestream,
+                  ap->in - 1 + pfile_in_zip_read_info->byte_before_the_zipfile,
+                  ZLIB_FILEFUNC_SEEK_SET)!=0)
+            return UNZ_ERRNO;
+        if (ZREAD(pfile_in_zip_read_info->z_filefunc,
+                  pfile_in_zip_read_info->filestream,&c,1)!=1)
+            return UNZ_ERRNO;
+
+        if (inflatePrime(&pfile_in_zip_read_info->stream, ap->bits,
+                         c >> (8 - ap->bits)) != Z_OK)
+            return UNZ_INTERNALERROR;
+    }
+
+    if (inflateSetDictionary(&pfile_in_zip_read_info->stream,
+                             ap->window, ap->window_size) != Z_OK)
+        return UNZ_INTERNALERROR;
+
+    pfile_in_zip_read_info->pos_in_zipfile = ap->in;
+    pfile_in_zip_read_info->rest_read_compressed = ap->rest_read_compressed;
+    pfile_in_zip_read_info->rest_read_uncompressed =
+            pfile_in_zip_read_info->uncompressed_size - ap->out;
+    pfile_in_zip_read_info->stream.avail_in = 0;
+    pfile_in_zip_read_info->stream.total_out = ap->out;
+    pfile_in_zip_read_info->crc_valid = 0;
+
+    pfile_in_zip_read_info->window_have = 0;
+    unzlocal_UpdateWindow(pfile_in_zip_read_info, ap->window, ap->window_size);
+
+    return UNZ_OK;
+}
+
+/*
+  Set the position in the uncompressed data of the current file.
+  Stored files seek directly.  Deflated files record a seek point every
+  UNZ_SEEK_SPAN bytes or so from the first seek on, so only the data
+  between the nearest seek point and pos has to be inflated again.
+*/
+extern int ZEXPORT unzSeekCurrentFile (file, pos)
+    unzFile file;
+    uLong pos;
+{
+    unz_s* s;
+    file_in_zip_read_info_s* pfile_in_zip_read_info;
+    unz_access_point* ap;
+    char buf[UNZ_BUFSIZE];
+    int err;
+    int i;
+
+    if (file==NULL)
+        return UNZ_PARAMERROR;
+    s=(unz_s*)file;
+    pfile_in_zip_read_info=s->pfile_in_zip_read;
+
+    if (pfile_in_zip_read_info==NULL)
+        return UNZ_PARAMERROR;
+    if (pfile_in_zip_read_info->read_buffer == NULL)
+        return UNZ_END_OF_LIST_OF_FILE;
+    if (pfile_in_zip_read_info->raw || s->encrypted)
+        return UNZ_PARAMERROR;
+
+    if (pos > pfile_in_zip_read_info->uncompressed_size)
+        pos = pfile_in_zip_read_info->uncompressed_size;
+    if (pos == pfile_in_zip_read_info->stream.total_out)
+        return UNZ_OK;
+
+    if (pfile_in_zip_read_info->compression_method==0)
+    {
+        pfile_in_zip_read_info->pos_in_zipfile =
+                pfile_in_zip_read_info->pos_data_start + pos;
+        pfile_in_zip_read_info->rest_read_compressed =
+                pfile_in_zip_read_info->compressed_size - pos;
+        pfile_in_zip_read_info->rest_read_uncompressed =
+                pfile_in_zip_read_info->uncompressed_size - pos;
+        pfile_in_zip_read_info->stream.avail_in = 0;
+        pfile_in_zip_read_info->stream.total_out = pos;
+        pfile_in_zip_read_info->crc32 = 0;
+        pfile_in_zip_read_info->crc_valid = (pos == 0);
+        return UNZ_OK;
+    }
+
+    if (pfile_in_zip_read_info->window == NULL)
+    {
+        pfile_in_zip_read_info->window = (Bytef*)ALLOC(UNZ_WINSIZE);
+        pfile_in_zip_read_info->access = (unz_access_point**)
+                ALLOC(UNZ_MAX_ACCESS * sizeof(unz_access_point*));
+        if (pfile_in_zip_read_info->window == NULL ||
+            pfile_in_zip_read_info->access == NULL)
+        {
+            /* free whichever one was allocated, so the next seek starts over */
+            TRYFREE(pfile_in_zip_read_info->window);
+            TRYFREE(pfile_in_zip_read_info->access);
+            pfile_in_zip_read_info->window = NULL;
+            pfile_in_zip_read_info->access = NULL;
+            return UNZ_INTERNALERROR;
+        }
+
+        pfile_in_zip_read_info->window_have = 0;
+        pfile_in_zip_read_info->num_access = 0;
+        pfile_in_zip_read_info->access_span =
+                pfile_in_zip_read_info->uncompressed_size / UNZ_MAX_ACCESS;
+        if (pfile_in_zip_read_info->access_span < UNZ_SEEK_SPAN)
+            pfile_in_zip_read_info->access_span = UNZ_SEEK_SPAN;
+    }
+
+    /* find the last seek point before pos */
+    ap = NULL;
+    for (i=0;i<pfile_in_zip_read_info->num_access;i++)
+    {
+        if (pfile_in_zip_read_info->access[i]->out > pos)
+            break;
+        ap = pfile_in_zip_read_info->access[i];
+    }
+
+    /* restart only if reading forward from here would be slower */
+    if ((pos < pfile_in_zip_read_info->stream.total_out) ||
+        ((ap != NULL) && (ap->out > pfile_in_zip_read_info->stream.total_out)))
+    {
+        if (ap != NULL)
+            err = unzlocal_ResumeAccessPoint(pfile_in_zip_read_info, ap);
+        else
+            err = unzlocal_RewindCurrentFile(pfile_in_zip_read_info);
+        if (err != UNZ_OK)
+            return err;
+    }
+
+    while (pfile_in_zip_read_info->stream.total_out < pos)
+    {
+        uLong len = pos - pfile_in_zip_read_info->stream.total_out;
+        if (len > sizeof(buf))
+            len = sizeof(buf);
+
+        err = unzReadCurrentFile(file, buf, (unsigned)len);
+        if (err == 0)
+            return UNZ_EOF;
+        if (err < 0)
+            return err;
+    }
+
+    return UNZ_OK;
+}
+
 /*
   return 1 if the end of file was reached, 0 elsewhere
 */
@@ -1514,6 +1938,7 @@ extern int ZEXPORT unzCloseCurrentFile (file)
 
 
     if ((pfile_in_zip_read_info->rest_read_uncompressed == 0) &&
+        (pfile_in_zip_read_info->crc_valid) &&
         (!pfile_in_zip_read_info->raw))
     {
         if (pfile_in_zip_read_info->crc32 != pfile_in_zip_read_info->crc32_wait)
@@ -1527,6 +1952,15 @@ extern int ZEXPORT unzCloseCurrentFile (file)
         inflateEnd(&pfile_in_zip_read_info->stream);
 
     pfile_in_zip_read_info->stream_initialised = 0;
+
+    if (pfile_in_zip_read_info->access != NULL)
+    {
+        int i;
+        for (i=0;i<pfile_in_zip_read_info->num_access;i++)
+            TRYFREE(pfile_in_zip_read_info->access[i]);
+        TRYFREE(pfile_in_zip_read_info->access);
+    }
+    TRYFREE(pfile_in_zip_read_info->window);
     TRYFREE(pfile_in_zip_read_info);
 
     s->pfile_in_zip_read=NULL;
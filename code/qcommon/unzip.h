@@ -317,6 +317,31 @@ extern z_off_t ZEXPORT unztell OF((unzFile file));
   Give the current position in uncompressed data
 */
 
+extern int ZEXPORT unzSeekCurrentFile OF((unzFile file, uLong pos));
+/*
+  Set the position in the uncompressed data of the current file.
+  Stored files seek directly; deflated files resume from the nearest seek
+  point recorded since the first seek instead of inflating from the start.
+  return UNZ_OK if success, UNZ_EOF if the file ended early
+*/
+
+extern int ZEXPORT unzGetCurrentFileStoredData OF((unzFile file,
+                                                   voidpf* stream,
+                                                   uLong* offset));
+/*
+  Give the stream of the zipfile (as returned by the zopen_file function)
+  and the offset of the data of the current file in it
+  return UNZ_OK if success, UNZ_PARAMERROR if the file is compressed
+*/
+
+extern int ZEXPORT unzGetCurrentFileDataOffset OF((unzFile file,
+                                                   uLong* offset));
+/*
+  Give the offset of the (compressed) data of the current file in the
+  zipfile, so it can be read and inflated without going through unzip
+  return UNZ_OK if success, UNZ_PARAMERROR if the file is encrypted
+*/
+
 extern int ZEXPORT unzeof OF((unzFile file));
 /*
   return 1 if the end of file was reached, 0 elsewhere
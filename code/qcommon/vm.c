@@ -59,6 +59,9 @@ vm_t	vmTable[MAX_VM];
 
 void VM_VmInfo_f( void );
 void VM_VmProfile_f( void );
+#ifndef NO_VM_COMPILED
+static void VM_Check_f( void );
+#endif
 
 
 
@@ -82,6 +85,8 @@ VM_Init
 void VM_Init( void ) {
 	Cvar_Get( "vm_cgame", "0", CVAR_ARCHIVE );
 	Cvar_Get( "vm_game", "0", CVAR_ARCHIVE );
+	Cvar_Get( "vm_optimize", "1", CVAR_ARCHIVE );
+	Cvar_Get( "vm_cache", "1", CVAR_ARCHIVE );
 
 	vm_cgameHeapMegs = Cvar_Get( "vm_cgameHeapMegs", "2", CVAR_ARCHIVE );
 	vm_gameHeapMegs = Cvar_Get( "vm_gameHeapMegs", "24", CVAR_ARCHIVE );
@@ -90,6 +95,11 @@ void VM_Init( void ) {
 
 	Cmd_AddCommand ("vmprofile", VM_VmProfile_f );
 	Cmd_AddCommand ("vminfo", VM_VmInfo_f );
+#ifndef NO_VM_COMPILED
+	Cmd_AddCommand ("vm_check", VM_Check_f );
+#endif
+
+	VM_ProfileInit();
 
 	Com_Memset( vmTable, 0, sizeof( vmTable ) );
 }
@@ -377,6 +387,19 @@ QVM bytecode interpreters call this when QVM makes a system call
 ============
 */
 intptr_t VM_QvmSyscall( intptr_t *args ) {
+	if ( vm_profiling ) {
+		return VM_ProfileSyscall( args );
+	}
+
+	return VM_DispatchSyscall( args );
+}
+
+/*
+============
+VM_DispatchSyscall
+============
+*/
+intptr_t VM_DispatchSyscall( intptr_t *args ) {
 	switch (args[0]) {
 	case TRAP_MEMSET:
 		Com_Memset( VMA(1), args[2], args[3] );
@@ -445,7 +468,7 @@ vmHeader_t *VM_LoadQVM( vm_t *vm, qboolean alloc, qboolean unpure, int heapReque
 	Com_sprintf( filename, sizeof(filename), "vm/%s.qvm", vm->name );
 	Com_DPrintf( "Loading vm file %s...\n", filename );
 
-	FS_ReadFileDir(filename, vm->searchPath, unpure, &header.v);
+	FS_MapFileDir(filename, vm->searchPath, unpure, &header.v);
 
 	if ( !header.h ) {
 		Com_Printf("Loading vm file %s failed.\n", filename);
@@ -475,7 +498,7 @@ vmHeader_t *VM_LoadQVM( vm_t *vm, qboolean alloc, qboolean unpure, int heapReque
 			|| header.h->codeLength <= 0 )
 		{
 			VM_Free(vm);
-			FS_FreeFile(header.v);
+			FS_UnmapFile(header.v);
 			
 			Com_Printf(S_COLOR_YELLOW "Warning: %s has bad header\n", filename);
 			return NULL;
@@ -487,12 +510,12 @@ vmHeader_t *VM_LoadQVM( vm_t *vm, qboolean alloc, qboolean unpure, int heapReque
 		FS_Which(filename, vm->searchPath);
 
 		VM_Free( vm );
-		FS_FreeFile( header.v );
+		FS_UnmapFile( header.v );
 
 		return NULL;
 	} else {
 		VM_Free( vm );
-		FS_FreeFile(header.v);
+		FS_UnmapFile(header.v);
 
 		Com_Printf(S_COLOR_YELLOW "Warning: %s does not have a recognisable "
 				"magic number in its header\n", filename);
@@ -539,7 +562,7 @@ vmHeader_t *VM_LoadQVM( vm_t *vm, qboolean alloc, qboolean unpure, int heapReque
 		if(vm->dataAlloc != hunkLength + 4)
 		{
 			VM_Free(vm);
-			FS_FreeFile(header.v);
+			FS_UnmapFile(header.v);
 
 			Com_Printf(S_COLOR_YELLOW "Warning: Data region size of %s not matching after "
 					"VM_Restart()\n", filename);
@@ -576,7 +599,7 @@ vmHeader_t *VM_LoadQVM( vm_t *vm, qboolean alloc, qboolean unpure, int heapReque
 			if(vm->numJumpTableTargets != previousNumJumpTableTargets)
 			{
 				VM_Free(vm);
-				FS_FreeFile(header.v);
+				FS_UnmapFile(header.v);
 
 				Com_Printf(S_COLOR_YELLOW "Warning: Jump table size of %s not matching after "
 						"VM_Restart()\n", filename);
@@ -633,7 +656,7 @@ vm_t *VM_Restart(vm_t *vm, qboolean unpure)
 		}
 
 		// free the original file
-		FS_FreeFile(header);
+		FS_UnmapFile(header);
 	}
 
 	// clear the zone to a single free block
@@ -644,47 +667,20 @@ vm_t *VM_Restart(vm_t *vm, qboolean unpure)
 
 /*
 ================
-VM_Create
+VM_Load
 
-If image ends in .qvm it will be interpreted, otherwise
-it will attempt to load as a system dll
+Loads module into an unused vm_t, returns NULL if it couldn't be loaded
 ================
 */
-vm_t *VM_Create( const char *module, intptr_t (*systemCalls)(intptr_t *), 
+static vm_t *VM_Load( vm_t *vm, const char *module, intptr_t (*systemCalls)(intptr_t *),
 				vmInterpret_t interpret, int zoneTag, int heapRequestedSize ) {
-	vm_t		*vm;
 	vmHeader_t	*header;
-	int			i, remaining, retval;
+	int			remaining, retval;
 	char filename[MAX_OSPATH];
 	void *startSearch = NULL;
 
-	if ( !module || !module[0] || !systemCalls ) {
-		Com_Error( ERR_FATAL, "VM_Create: bad parms" );
-	}
-
 	remaining = Hunk_MemoryRemaining();
 
-	// see if we already have the VM
-	for ( i = 0 ; i < MAX_VM ; i++ ) {
-		if (!Q_stricmp(vmTable[i].name, module)) {
-			vm = &vmTable[i];
-			return vm;
-		}
-	}
-
-	// find a free vm
-	for ( i = 0 ; i < MAX_VM ; i++ ) {
-		if ( !vmTable[i].name[0] ) {
-			break;
-		}
-	}
-
-	if ( i == MAX_VM ) {
-		Com_Error( ERR_FATAL, "VM_Create: no free vm_t" );
-	}
-
-	vm = &vmTable[i];
-
 	Q_strncpyz(vm->name, module, sizeof(vm->name));
 	vm->zoneTag = zoneTag;
 	vm->heapRequestedSize = heapRequestedSize;
@@ -755,8 +751,10 @@ vm_t *VM_Create( const char *module, intptr_t (*systemCalls)(intptr_t *),
 		VM_PrepareInterpreter( vm, header );
 	}
 
+	VM_FindFunctions( vm, header );
+
 	// free the original file
-	FS_FreeFile( header );
+	FS_UnmapFile( header );
 
 	// load the map file
 	VM_LoadSymbols( vm );
@@ -770,6 +768,43 @@ vm_t *VM_Create( const char *module, intptr_t (*systemCalls)(intptr_t *),
 	return vm;
 }
 
+/*
+================
+VM_Create
+
+If image ends in .qvm it will be interpreted, otherwise
+it will attempt to load as a system dll
+================
+*/
+vm_t *VM_Create( const char *module, intptr_t (*systemCalls)(intptr_t *), 
+				vmInterpret_t interpret, int zoneTag, int heapRequestedSize ) {
+	int			i;
+
+	if ( !module || !module[0] || !systemCalls ) {
+		Com_Error( ERR_FATAL, "VM_Create: bad parms" );
+	}
+
+	// see if we already have the VM
+	for ( i = 0 ; i < MAX_VM ; i++ ) {
+		if (!Q_stricmp(vmTable[i].name, module)) {
+			return &vmTable[i];
+		}
+	}
+
+	// find a free vm
+	for ( i = 0 ; i < MAX_VM ; i++ ) {
+		if ( !vmTable[i].name[0] ) {
+			break;
+		}
+	}
+
+	if ( i == MAX_VM ) {
+		Com_Error( ERR_FATAL, "VM_Create: no free vm_t" );
+	}
+
+	return VM_Load( &vmTable[i], module, systemCalls, interpret, zoneTag, heapRequestedSize );
+}
+
 /*
 ==============
 VM_Free
@@ -830,6 +865,17 @@ void VM_Clear(void) {
 	}
 }
 
+/*
+============
+VM_IsNative
+
+Only native libraries can have the engine call their functions
+============
+*/
+qboolean VM_IsNative( vm_t *vm ) {
+	return vm->dllHandle != NULL;
+}
+
 void VM_Forced_Unload_Start(void) {
 	forced_unload = 1;
 }
@@ -960,6 +1006,10 @@ intptr_t QDECL VM_Call( vm_t *vm, int callnum, ... )
 	}
 	--vm->callLevel;
 
+	if ( vm_profileArmed ) {
+		VM_ProfileLeave( vm );
+	}
+
 	if ( oldVM != NULL )
 	  currentVM = oldVM;
 	return r;
@@ -1137,6 +1187,186 @@ void VM_VmInfo_f( void ) {
 	}
 }
 
+#ifndef NO_VM_COMPILED
+/*
+==============================================================================
+
+vm_check runs a QVM interpreted, compiled and compiled with vm_optimize and
+compares each tier with the one before it. Every tier makes the same calls
+with the same random arguments and the system calls only depend on their
+arguments, so a return value or data segment that differs is a compiler bug.
+
+It is meant for test programs that don't need the engine. The VMs are kept
+out of vmTable, but their data stays on the hunk until it is cleared.
+
+==============================================================================
+*/
+
+#define CHECK_TIERS				3
+#define CHECK_MAX_MISMATCHES	10
+
+static const char *vm_checkTierNames[CHECK_TIERS] = { "interpreted", "compiled", "optimized" };
+
+static vm_t		vm_checkVMs[CHECK_TIERS];
+
+/*
+==============
+VM_CheckSystemCalls
+==============
+*/
+static intptr_t VM_CheckSystemCalls( intptr_t *args ) {
+	return args[0] * 3 + args[1] - args[2];
+}
+
+/*
+==============
+VM_CheckRun
+
+Makes numCalls calls with arguments from seed, returns the time taken in usec
+==============
+*/
+static int64_t VM_CheckRun( vm_t *vm, int seed, int numCalls, intptr_t *results ) {
+	int		args[MAX_VMMAIN_ARGS];
+	int		i, j;
+	int64_t	start;
+
+	start = Sys_Microseconds();
+
+	for ( i = 0; i < numCalls; i++ ) {
+		for ( j = 0; j < MAX_VMMAIN_ARGS; j++ ) {
+			args[j] = Q_rand( &seed );
+		}
+
+		results[i] = VM_Call( vm, args[0], args[1], args[2], args[3], args[4], args[5], args[6],
+							args[7], args[8], args[9], args[10], args[11], args[12] );
+	}
+
+	return Sys_Microseconds() - start;
+}
+
+/*
+==============
+VM_Check_f
+
+vm_check <module> [calls] [seed]
+==============
+*/
+static void VM_Check_f( void ) {
+	char		module[MAX_QPATH];
+	char		optimize[MAX_CVAR_VALUE_STRING], cache[MAX_CVAR_VALUE_STRING];
+	int			numCalls, seed;
+	int			t, i, mismatches, failed;
+	int64_t		usec[CHECK_TIERS];
+	intptr_t	*results[CHECK_TIERS];
+	vm_t		*vm, *ref, *oldVM;
+
+	if ( Cmd_Argc() < 2 ) {
+		Com_Printf( "usage: vm_check <module> [calls] [seed]\n" );
+		return;
+	}
+
+	Q_strncpyz( module, Cmd_Argv( 1 ), sizeof( module ) );
+	numCalls = Cmd_Argc() > 2 ? atoi( Cmd_Argv( 2 ) ) : 10000;
+	seed = Cmd_Argc() > 3 ? atoi( Cmd_Argv( 3 ) ) : Sys_Milliseconds();
+
+	if ( numCalls < 1 ) {
+		numCalls = 1;
+	}
+
+	// the code cache would hand back earlier output instead of compiling
+	Cvar_VariableStringBuffer( "vm_optimize", optimize, sizeof( optimize ) );
+	Cvar_VariableStringBuffer( "vm_cache", cache, sizeof( cache ) );
+	Cvar_Set( "vm_cache", "0" );
+
+	// VM_Free clears these
+	oldVM = currentVM;
+
+	failed = 0;
+	for ( t = 0; t < CHECK_TIERS; t++ ) {
+		vm = &vm_checkVMs[t];
+		Com_Memset( vm, 0, sizeof( *vm ) );
+
+		Cvar_Set( "vm_optimize", t == 2 ? "1" : "0" );
+		if ( !VM_Load( vm, module, VM_CheckSystemCalls, t ? VMI_COMPILED : VMI_BYTECODE, 0, 0 ) ) {
+			Com_Memset( vm, 0, sizeof( *vm ) );
+			failed = 1;
+		}
+	}
+
+	Cvar_Set( "vm_optimize", optimize );
+	Cvar_Set( "vm_cache", cache );
+
+	if ( failed ) {
+		Com_Printf( "Couldn't load %s as a QVM\n", module );
+		for ( t = 0; t < CHECK_TIERS; t++ ) {
+			VM_Free( &vm_checkVMs[t] );
+		}
+		currentVM = lastVM = oldVM;
+		return;
+	}
+
+	Com_Printf( "Running %d calls of %s, seed %d\n", numCalls, module, seed );
+
+	for ( t = 0; t < CHECK_TIERS; t++ ) {
+		results[t] = Z_Malloc( numCalls * sizeof( *results[t] ) );
+		usec[t] = VM_CheckRun( &vm_checkVMs[t], seed, numCalls, results[t] );
+	}
+
+	Com_Printf( "interpreted %d msec, compiled %d msec, optimized %d msec\n",
+			(int)( usec[0] / 1000 ), (int)( usec[1] / 1000 ), (int)( usec[2] / 1000 ) );
+
+	// the optimizer is compared with the basic compiler, as the
+	// interpreter converts out of range floats to int differently
+	for ( t = 1; t < CHECK_TIERS; t++ ) {
+		vm = &vm_checkVMs[t];
+		ref = &vm_checkVMs[t - 1];
+
+		if ( !vm->compiled ) {
+			Com_Printf( S_COLOR_YELLOW "%s: fell back to the interpreter\n", vm_checkTierNames[t] );
+		}
+
+		mismatches = 0;
+		for ( i = 0; i < numCalls; i++ ) {
+			if ( results[t][i] == results[t - 1][i] ) {
+				continue;
+			}
+
+			if ( mismatches < CHECK_MAX_MISMATCHES ) {
+				Com_Printf( S_COLOR_YELLOW "call %d: %s %d, %s %d\n", i, vm_checkTierNames[t - 1],
+						(int)results[t - 1][i], vm_checkTierNames[t], (int)results[t][i] );
+			}
+			mismatches++;
+		}
+
+		// the stack holds return addresses, which differ between tiers
+		for ( i = 0; i < vm->stackBottom; i++ ) {
+			if ( vm->dataBase[i] != ref->dataBase[i] ) {
+				break;
+			}
+		}
+
+		if ( mismatches ) {
+			Com_Printf( S_COLOR_RED "%s: %d of %d results differ from %s\n", vm_checkTierNames[t],
+					mismatches, numCalls, vm_checkTierNames[t - 1] );
+		}
+		if ( i < vm->stackBottom ) {
+			Com_Printf( S_COLOR_RED "%s: data differs from %s at 0x%x\n", vm_checkTierNames[t],
+					vm_checkTierNames[t - 1], i );
+		}
+		if ( !mismatches && i == vm->stackBottom ) {
+			Com_Printf( "%s: all %d calls match %s\n", vm_checkTierNames[t], numCalls, vm_checkTierNames[t - 1] );
+		}
+	}
+
+	for ( t = 0; t < CHECK_TIERS; t++ ) {
+		Z_Free( results[t] );
+		VM_Free( &vm_checkVMs[t] );
+	}
+
+	currentVM = lastVM = oldVM;
+}
+#endif
+
 /*
 ===============
 VM_LogSyscalls
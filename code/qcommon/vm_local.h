@@ -197,6 +197,11 @@ struct vm_s {
 
 	byte		*jumpTableTargets;
 	int			numJumpTableTargets;
+
+	// for the sampling profiler
+	int			*functions;			// instruction numbers of all OP_ENTERs
+	int			numFunctions;
+	int			(*sampleStack)(vm_t *self, intptr_t *pcs, int maxDepth);	// compiled code return addresses, innermost first
 };
 
 
@@ -217,3 +222,13 @@ void VM_LogSyscalls( int *args );
 void VM_BlockCopy(unsigned int dest, unsigned int src, size_t n);
 
 intptr_t VM_QvmSyscall( intptr_t *args );
+intptr_t VM_DispatchSyscall( intptr_t *args );
+
+// vm_profile.c
+extern	qboolean	vm_profiling;
+extern	qboolean	vm_profileArmed;
+
+void VM_ProfileInit( void );
+void VM_FindFunctions( vm_t *vm, vmHeader_t *header );
+intptr_t VM_ProfileSyscall( intptr_t *args );
+void VM_ProfileLeave( vm_t *vm );
@@ -0,0 +1,769 @@
+/*
+===========================================================================
+Copyright (C) 1999-2010 id Software LLC, a ZeniMax Media company.
+
+This file is part of Spearmint Source Code.
+
+Spearmint Source Code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 3 of the License,
+or (at your option) any later version.
+
+Spearmint Source Code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Spearmint Source Code.  If not, see <http://www.gnu.org/licenses/>.
+
+In addition, Spearmint Source Code is also subject to certain additional terms.
+You should have received a copy of these additional terms immediately following
+the terms and conditions of the GNU General Public License.  If not, please
+request a copy in writing from id Software at the address below.
+
+If you have questions concerning this license or the applicable additional
+terms, you may contact in writing id Software LLC, c/o ZeniMax Media Inc.,
+Suite 120, Rockville, Maryland 20850 USA.
+===========================================================================
+*/
+// vm_profile.c -- sampling profiler for QVM code
+
+#include "vm_local.h"
+
+/*
+==============================================================================
+
+On average every vm_sampleInterval'th system call a QVM makes is timed and charged to
+the QVM call stack it was made from. The time the QVM then runs until its
+next system call, or until it returns to the engine, is charged to the same
+stack as time spent in the QVM itself. Between samples VM_QvmSyscall only
+tests vm_profiling, so this can be left running during real matches.
+
+The interpreter's stack is walked through the return addresses it keeps on
+the program stack, compilers that can walk theirs set vm->sampleStack.
+Stacks are written in the folded format read by flame graph tools, one
+line per stack with the sampled time in microseconds:
+
+  game;vmMain;G_RunFrame;G_RunThink;syscall_42 1234
+
+==============================================================================
+*/
+
+#define MAX_PROFILE_DEPTH	32
+#define MAX_PROFILE_STACKS	8192
+#define MAX_PROFILE_VMS		8
+#define PROFILE_HASH_SIZE	4096
+
+#define PROFILE_VM_CODE		-1		// leaf of stacks that were running QVM code
+
+typedef struct profileStack_s {
+	struct profileStack_s	*next;		// in the hash chain
+	int			vm;						// index in profile.vms
+	int			leaf;					// PROFILE_VM_CODE or a TRAP_*
+	int			syscall;				// engine system call number for TRAP_SYSCALL
+	int			depth;
+	int			frames[MAX_PROFILE_DEPTH];	// function instruction numbers, outermost first
+	int			samples;
+	int64_t		usec;
+} profileStack_t;
+
+typedef struct {
+	vm_t		*vm;					// may be gone by the time the profile is written
+	char		name[MAX_QPATH];
+	int			instructionCount;
+	const char	**names;				// function names, filled in when writing
+} profileVM_t;
+
+static struct {
+	int				interval;
+	int				countdown;
+	unsigned		seed;
+
+	// the last sampled system call, its QVM time is charged on the next one
+	vm_t			*armedVM;
+	int				armedLevel;
+	int64_t			armedTime;
+	int				armedFrames[MAX_PROFILE_DEPTH];
+	int				armedDepth;
+
+	int64_t			startTime;
+	int64_t			runTime;
+
+	profileVM_t		vms[MAX_PROFILE_VMS];
+	int				numVMs;
+
+	profileStack_t	*stacks;
+	int				numStacks;
+	int				dropped;
+	profileStack_t	*hash[PROFILE_HASH_SIZE];
+} profile;
+
+qboolean	vm_profiling;
+qboolean	vm_profileArmed;
+
+static cvar_t	*vm_sampleInterval;
+
+static const char *profileTrapNames[TRAP_SYSCALL] = {
+	"memset", "memcpy", "strncpy", "sin", "cos", "atan2", "sqrt", "floor", "ceil",
+	"acos", "asin", "tan", "atan", "pow", "exp", "log", "log10"
+};
+
+/*
+=================
+VM_FindFunctions
+
+Lists the function entry points the profiler maps addresses to
+=================
+*/
+void VM_FindFunctions( vm_t *vm, vmHeader_t *header ) {
+	byte	*code;
+	int		pass;
+	int		pc;
+	int		instruction;
+	int		count;
+	int		op;
+
+	vm->functions = NULL;
+	vm->numFunctions = 0;
+
+	code = (byte *)header + header->codeOffset;
+
+	for ( pass = 0; pass < 2; pass++ ) {
+		count = 0;
+		pc = 0;
+
+		for ( instruction = 0; instruction < header->instructionCount && pc < header->codeLength; instruction++ ) {
+			op = code[ pc++ ];
+
+			if ( op == OP_ENTER ) {
+				if ( pass ) {
+					vm->functions[ count ] = instruction;
+				}
+				count++;
+			}
+
+			// these are the only opcodes that aren't a single byte
+			switch ( op ) {
+			case OP_ENTER:
+			case OP_CONST:
+			case OP_LOCAL:
+			case OP_LEAVE:
+			case OP_EQ:
+			case OP_NE:
+			case OP_LTI:
+			case OP_LEI:
+			case OP_GTI:
+			case OP_GEI:
+			case OP_LTU:
+			case OP_LEU:
+			case OP_GTU:
+			case OP_GEU:
+			case OP_EQF:
+			case OP_NEF:
+			case OP_LTF:
+			case OP_LEF:
+			case OP_GTF:
+			case OP_GEF:
+			case OP_BLOCK_COPY:
+				pc += 4;
+				break;
+			case OP_ARG:
+				pc += 1;
+				break;
+			default:
+				break;
+			}
+		}
+
+		if ( !count ) {
+			return;
+		}
+
+		if ( !pass ) {
+			vm->functions = Hunk_Alloc( count * sizeof( *vm->functions ), h_high );
+		}
+	}
+
+	vm->numFunctions = count;
+}
+
+/*
+=================
+VM_ProfileFunction
+
+Returns the index in vm->functions of the function containing a code
+address, or -1
+=================
+*/
+static int VM_ProfileFunction( vm_t *vm, intptr_t pc ) {
+	int		low, high, mid;
+
+	low = 0;
+	high = vm->numFunctions - 1;
+
+	if ( high < 0 || pc < vm->instructionPointers[ vm->functions[ 0 ] ] ) {
+		return -1;
+	}
+
+	while ( low < high ) {
+		mid = ( low + high + 1 ) / 2;
+		if ( vm->instructionPointers[ vm->functions[ mid ] ] <= pc ) {
+			low = mid;
+		} else {
+			high = mid - 1;
+		}
+	}
+
+	return low;
+}
+
+/*
+=================
+VM_InterpretedStack
+
+VM_CallInterpreted stores the return address of every call at the bottom
+of the caller's frame, and the frame size is the operand of the OP_ENTER
+the function starts with
+=================
+*/
+static int VM_InterpretedStack( vm_t *vm, intptr_t *pcs, int maxDepth ) {
+	int		*code;
+	int		programStack;
+	int		frameSize;
+	int		func;
+	int		depth;
+	int		pc;
+
+	code = (int *)vm->codeBase;
+
+	// skip the system call number
+	programStack = vm->programStack + 4;
+
+	for ( depth = 0; depth < maxDepth; depth++ ) {
+		if ( programStack < vm->stackBottom || programStack > vm->dataMask - 3 ) {
+			break;
+		}
+
+		// -1 when returning to the engine
+		pc = *(int *)&vm->dataBase[ programStack ];
+		if ( pc <= 0 || pc > vm->codeLength ) {
+			break;
+		}
+
+		func = VM_ProfileFunction( vm, pc - 1 );
+		if ( func < 0 ) {
+			break;
+		}
+
+		frameSize = code[ vm->instructionPointers[ vm->functions[ func ] ] + 1 ];
+		if ( frameSize <= 0 ) {
+			break;
+		}
+
+		pcs[ depth ] = pc;
+		programStack += frameSize;
+	}
+
+	return depth;
+}
+
+/*
+=================
+VM_ProfileStack
+
+Fills frames with the instruction numbers of the functions on the stack of
+the current system call, outermost first
+=================
+*/
+static int VM_ProfileStack( vm_t *vm, int *frames ) {
+	intptr_t	pcs[ MAX_PROFILE_DEPTH ];
+	int			depth;
+	int			func;
+	int			count;
+	int			i;
+
+	if ( vm->compiled ) {
+		depth = vm->sampleStack ? vm->sampleStack( vm, pcs, MAX_PROFILE_DEPTH ) : 0;
+	} else {
+		depth = VM_InterpretedStack( vm, pcs, MAX_PROFILE_DEPTH );
+	}
+
+	count = 0;
+	for ( i = depth - 1; i >= 0; i-- ) {
+		// return addresses, step back into the call
+		func = VM_ProfileFunction( vm, pcs[ i ] - 1 );
+		if ( func >= 0 ) {
+			frames[ count++ ] = vm->functions[ func ];
+		}
+	}
+
+	return count;
+}
+
+/*
+=================
+VM_ProfileAdd
+=================
+*/
+static void VM_ProfileAdd( vm_t *vm, const int *frames, int depth, int leaf, int syscall, int64_t usec ) {
+	profileStack_t	*stack;
+	profileVM_t		*pvm;
+	unsigned		hash;
+	int				slot;
+	int				i;
+
+	for ( slot = 0; slot < profile.numVMs; slot++ ) {
+		pvm = &profile.vms[ slot ];
+		if ( pvm->vm == vm && pvm->instructionCount == vm->instructionCount && !strcmp( pvm->name, vm->name ) ) {
+			break;
+		}
+	}
+
+	if ( slot == profile.numVMs ) {
+		if ( slot == MAX_PROFILE_VMS ) {
+			profile.dropped++;
+			return;
+		}
+
+		pvm = &profile.vms[ profile.numVMs++ ];
+		pvm->vm = vm;
+		pvm->instructionCount = vm->instructionCount;
+		pvm->names = NULL;
+		Q_strncpyz( pvm->name, vm->name, sizeof( pvm->name ) );
+	}
+
+	hash = ( slot * 31 + leaf ) * 33 + syscall;
+	for ( i = 0; i < depth; i++ ) {
+		hash = hash * 33 + frames[ i ];
+	}
+	hash &= PROFILE_HASH_SIZE - 1;
+
+	for ( stack = profile.hash[ hash ]; stack; stack = stack->next ) {
+		if ( stack->vm == slot && stack->leaf == leaf && stack->syscall == syscall && stack->depth == depth
+			&& !memcmp( stack->frames, frames, depth * sizeof( *frames ) ) ) {
+			break;
+		}
+	}
+
+	if ( !stack ) {
+		if ( profile.numStacks == MAX_PROFILE_STACKS ) {
+			profile.dropped++;
+			return;
+		}
+
+		stack = &profile.stacks[ profile.numStacks++ ];
+		stack->vm = slot;
+		stack->leaf = leaf;
+		stack->syscall = syscall;
+		stack->depth = depth;
+		Com_Memcpy( stack->frames, frames, depth * sizeof( *frames ) );
+		stack->samples = 0;
+		stack->usec = 0;
+		stack->next = profile.hash[ hash ];
+		profile.hash[ hash ] = stack;
+	}
+
+	stack->samples++;
+	stack->usec += usec;
+}
+
+/*
+=================
+VM_ProfileSyscall
+
+VM_QvmSyscall calls this instead of VM_DispatchSyscall while profiling
+=================
+*/
+intptr_t VM_ProfileSyscall( intptr_t *args ) {
+	vm_t		*vm;
+	int			frames[ MAX_PROFILE_DEPTH ];
+	int			depth;
+	int			leaf;
+	int			syscall;
+	int64_t		start;
+	intptr_t	r;
+
+	vm = currentVM;
+
+	if ( vm_profileArmed ) {
+		// the QVM has been running since the sampled call returned
+		vm_profileArmed = qfalse;
+
+		if ( vm == profile.armedVM && vm->callLevel == profile.armedLevel ) {
+			depth = VM_ProfileStack( vm, frames );
+			VM_ProfileAdd( vm, frames, depth, PROFILE_VM_CODE, 0, Sys_Microseconds() - profile.armedTime );
+		}
+	}
+
+	if ( --profile.countdown > 0 ) {
+		return VM_DispatchSyscall( args );
+	}
+
+	// vary the interval so QVM code making calls in a fixed pattern
+	// doesn't always get sampled at the same call
+	profile.seed = profile.seed * 1103515245 + 12345;
+	profile.countdown = 1 + ( profile.seed >> 16 ) % ( 2 * profile.interval - 1 );
+
+	depth = VM_ProfileStack( vm, frames );
+	leaf = args[0];
+	syscall = leaf == TRAP_SYSCALL ? args[1] : 0;
+
+	start = Sys_Microseconds();
+	r = VM_DispatchSyscall( args );
+
+	// the call may have stopped the profiler
+	if ( !vm_profiling ) {
+		return r;
+	}
+
+	profile.armedTime = Sys_Microseconds();
+	VM_ProfileAdd( vm, frames, depth, leaf, syscall, profile.armedTime - start );
+
+	vm_profileArmed = qtrue;
+	profile.armedVM = vm;
+	profile.armedLevel = vm->callLevel;
+	profile.armedDepth = depth;
+	Com_Memcpy( profile.armedFrames, frames, depth * sizeof( *frames ) );
+
+	return r;
+}
+
+/*
+=================
+VM_ProfileLeave
+
+Called by VM_Call when a QVM returns after a sampled system call
+=================
+*/
+void VM_ProfileLeave( vm_t *vm ) {
+	vm_profileArmed = qfalse;
+
+	// VM_Call has already decremented callLevel
+	if ( vm_profiling && vm == profile.armedVM && vm->callLevel == profile.armedLevel - 1 ) {
+		// the stack has unwound, charge the stack of the sampled call
+		VM_ProfileAdd( vm, profile.armedFrames, profile.armedDepth, PROFILE_VM_CODE, 0,
+			Sys_Microseconds() - profile.armedTime );
+	}
+}
+
+/*
+=================
+VM_ProfileFunctionName
+=================
+*/
+static const char *VM_ProfileFunctionName( profileVM_t *pvm, int instruction ) {
+	vm_t		*vm;
+	vmSymbol_t	*sym;
+	int			func;
+	int			value;
+
+	vm = pvm->vm;
+
+	// only use the symbols if the same qvm is still loaded
+	if ( vm->instructionCount != pvm->instructionCount || strcmp( vm->name, pvm->name ) || !vm->symbols ) {
+		return va( "func_%i", instruction );
+	}
+
+	for ( func = 0; func < vm->numFunctions && vm->functions[ func ] != instruction; func++ ) {
+	}
+
+	if ( func == vm->numFunctions ) {
+		return va( "func_%i", instruction );
+	}
+
+	if ( !pvm->names ) {
+		pvm->names = Z_Malloc( vm->numFunctions * sizeof( *pvm->names ) );
+	}
+
+	if ( !pvm->names[ func ] ) {
+		// VM_LoadSymbols stores the address of the instruction
+		value = (int)vm->instructionPointers[ instruction ];
+
+		for ( sym = vm->symbols; sym && sym->symValue != value; sym = sym->next ) {
+		}
+
+		pvm->names[ func ] = sym ? sym->symName : "";
+	}
+
+	if ( !pvm->names[ func ][0] ) {
+		return va( "func_%i", instruction );
+	}
+
+	return pvm->names[ func ];
+}
+
+/*
+=================
+VM_ProfileLeafName
+=================
+*/
+static const char *VM_ProfileLeafName( const profileStack_t *stack ) {
+	if ( stack->leaf == TRAP_SYSCALL ) {
+		return va( "syscall_%i", stack->syscall );
+	}
+	if ( stack->leaf >= 0 && stack->leaf < TRAP_SYSCALL ) {
+		return va( "trap_%s", profileTrapNames[ stack->leaf ] );
+	}
+	return "<unknown>";
+}
+
+/*
+=================
+VM_ProfileFreeNames
+=================
+*/
+static void VM_ProfileFreeNames( void ) {
+	int		i;
+
+	for ( i = 0; i < profile.numVMs; i++ ) {
+		if ( profile.vms[ i ].names ) {
+			Z_Free( (void *)profile.vms[ i ].names );
+			profile.vms[ i ].names = NULL;
+		}
+	}
+}
+
+/*
+=================
+VM_ProfileStart
+=================
+*/
+static void VM_ProfileStart( void ) {
+	VM_ProfileFreeNames();
+
+	if ( !profile.stacks ) {
+		profile.stacks = Z_Malloc( MAX_PROFILE_STACKS * sizeof( *profile.stacks ) );
+	}
+
+	profile.numStacks = 0;
+	profile.numVMs = 0;
+	profile.dropped = 0;
+	profile.runTime = 0;
+	Com_Memset( profile.hash, 0, sizeof( profile.hash ) );
+
+	profile.interval = MAX( vm_sampleInterval->integer, 1 );
+	profile.countdown = profile.interval;
+	profile.startTime = Sys_Microseconds();
+
+	vm_profileArmed = qfalse;
+	vm_profiling = qtrue;
+
+	Com_Printf( "Sampling every %i QVM system calls\n", profile.interval );
+}
+
+/*
+=================
+VM_ProfileStop
+=================
+*/
+static void VM_ProfileStop( void ) {
+	if ( !vm_profiling ) {
+		return;
+	}
+
+	vm_profiling = qfalse;
+	vm_profileArmed = qfalse;
+	profile.runTime += Sys_Microseconds() - profile.startTime;
+}
+
+typedef struct {
+	int			vm;
+	int			id;						// function, or leaf and syscall
+	int			syscall;
+	const profileStack_t	*stack;		// one of the stacks, for the leaf name
+	int			samples;
+	int64_t		usec;
+} profileTotal_t;
+
+static int QDECL VM_ProfileTotalSort( const void *a, const void *b ) {
+	const profileTotal_t	*ta = a, *tb = b;
+
+	if ( ta->usec > tb->usec ) {
+		return -1;
+	}
+	if ( ta->usec < tb->usec ) {
+		return 1;
+	}
+	return 0;
+}
+
+/*
+=================
+VM_ProfileReport
+
+Prints the functions with the most QVM time and the system calls with the
+most engine time
+=================
+*/
+static void VM_ProfileReport( void ) {
+	profileTotal_t	*totals;
+	profileStack_t	*stack;
+	int64_t			vmTime, syscallTime;
+	int				numTotals;
+	int				type;
+	int				id, syscall;
+	int				i, j;
+
+	if ( !profile.numStacks ) {
+		Com_Printf( "No QVM samples\n" );
+		return;
+	}
+
+	totals = Z_Malloc( profile.numStacks * sizeof( *totals ) );
+
+	for ( type = 0; type < 2; type++ ) {
+		numTotals = 0;
+		vmTime = syscallTime = 0;
+
+		for ( i = 0; i < profile.numStacks; i++ ) {
+			stack = &profile.stacks[ i ];
+
+			if ( stack->leaf == PROFILE_VM_CODE ) {
+				vmTime += stack->usec;
+				if ( type ) {
+					continue;
+				}
+				id = stack->depth ? stack->frames[ stack->depth - 1 ] : -1;
+				syscall = 0;
+			} else {
+				syscallTime += stack->usec;
+				if ( !type ) {
+					continue;
+				}
+				id = stack->leaf;
+				syscall = stack->syscall;
+			}
+
+			for ( j = 0; j < numTotals; j++ ) {
+				if ( totals[ j ].vm == stack->vm && totals[ j ].id == id && totals[ j ].syscall == syscall ) {
+					break;
+				}
+			}
+
+			if ( j == numTotals ) {
+				totals[ j ].vm = stack->vm;
+				totals[ j ].id = id;
+				totals[ j ].syscall = syscall;
+				totals[ j ].stack = stack;
+				totals[ j ].samples = 0;
+				totals[ j ].usec = 0;
+				numTotals++;
+			}
+
+			totals[ j ].samples += stack->samples;
+			totals[ j ].usec += stack->usec;
+		}
+
+		qsort( totals, numTotals, sizeof( *totals ), VM_ProfileTotalSort );
+
+		if ( !type ) {
+			Com_Printf( "QVM code, %.1f ms sampled:\n", vmTime / 1000.0 );
+		} else {
+			Com_Printf( "System calls, %.1f ms sampled:\n", syscallTime / 1000.0 );
+		}
+
+		for ( i = 0; i < numTotals && i < 20; i++ ) {
+			const char *name;
+
+			if ( type ) {
+				name = VM_ProfileLeafName( totals[ i ].stack );
+			} else if ( totals[ i ].id < 0 ) {
+				name = "<unknown>";
+			} else {
+				name = VM_ProfileFunctionName( &profile.vms[ totals[ i ].vm ], totals[ i ].id );
+			}
+
+			Com_Printf( "%5.1f%% %9.1f ms %7i %s:%s\n",
+				100.0 * totals[ i ].usec / MAX( type ? syscallTime : vmTime, 1 ),
+				totals[ i ].usec / 1000.0, totals[ i ].samples,
+				profile.vms[ totals[ i ].vm ].name, name );
+		}
+	}
+
+	Z_Free( totals );
+
+	if ( profile.dropped ) {
+		Com_Printf( "%i samples dropped, too many different stacks\n", profile.dropped );
+	}
+}
+
+/*
+=================
+VM_ProfileWrite
+=================
+*/
+static void VM_ProfileWrite( const char *name ) {
+	profileStack_t	*stack;
+	fileHandle_t	f;
+	char			filename[MAX_QPATH];
+	int				i, j;
+
+	if ( !profile.numStacks ) {
+		Com_Printf( "No QVM samples\n" );
+		return;
+	}
+
+	Com_sprintf( filename, sizeof( filename ), "profiles/%s", name );
+	COM_DefaultExtension( filename, sizeof( filename ), ".folded" );
+
+	f = FS_FOpenFileWrite( filename );
+	if ( !f ) {
+		Com_Printf( "Couldn't open %s for writing\n", filename );
+		return;
+	}
+
+	for ( i = 0; i < profile.numStacks; i++ ) {
+		stack = &profile.stacks[ i ];
+
+		FS_Printf( f, "%s", profile.vms[ stack->vm ].name );
+
+		for ( j = 0; j < stack->depth; j++ ) {
+			FS_Printf( f, ";%s", VM_ProfileFunctionName( &profile.vms[ stack->vm ], stack->frames[ j ] ) );
+		}
+
+		if ( stack->leaf != PROFILE_VM_CODE ) {
+			FS_Printf( f, ";%s", VM_ProfileLeafName( stack ) );
+		}
+
+		FS_Printf( f, " %lld\n", (long long)stack->usec );
+	}
+
+	FS_FCloseFile( f );
+
+	Com_Printf( "Wrote %i stacks to %s\n", profile.numStacks, filename );
+}
+
+/*
+=================
+VM_Sample_f
+=================
+*/
+static void VM_Sample_f( void ) {
+	const char	*cmd;
+
+	cmd = Cmd_Argv( 1 );
+
+	if ( !Q_stricmp( cmd, "start" ) ) {
+		VM_ProfileStart();
+	} else if ( !Q_stricmp( cmd, "stop" ) ) {
+		VM_ProfileStop();
+	} else if ( !Q_stricmp( cmd, "report" ) ) {
+		VM_ProfileReport();
+	} else if ( !Q_stricmp( cmd, "write" ) ) {
+		VM_ProfileWrite( Cmd_Argc() > 2 ? Cmd_Argv( 2 ) : "vmprofile" );
+	} else {
+		Com_Printf( "usage: vmsample <start|stop|report|write [name]>\n" );
+	}
+}
+
+/*
+=================
+VM_ProfileInit
+=================
+*/
+void VM_ProfileInit( void ) {
+	vm_sampleInterval = Cvar_Get( "vm_sampleInterval", "16", CVAR_ARCHIVE );
+
+	Cmd_AddCommand( "vmsample", VM_Sample_f );
+}
@@ -93,7 +93,8 @@ typedef enum
 typedef enum
 {
 	VM_JMP_VIOLATION = 0,
-	VM_BLOCK_COPY = 1
+	VM_BLOCK_COPY = 1,
+	VM_STACK_VIOLATION = 2
 } ESysCallType;
 
 static	ELastCommand	LastCommand;
@@ -415,6 +416,7 @@ int vm_programStack;
 int *vm_opStackBase;
 uint8_t vm_opStackOfs;
 intptr_t vm_arg;
+intptr_t *vm_nativeFrame;
 
 static void DoSyscall(void)
 {
@@ -460,6 +462,9 @@ static void DoSyscall(void)
 			
 			VM_BlockCopy(vm_opStackBase[(vm_opStackOfs - 1)], vm_opStackBase[vm_opStackOfs], vm_arg);
 		break;
+		case VM_STACK_VIOLATION:
+			Com_Error(ERR_DROP, "VM stack overflow");
+		break;
 		default:
 			Com_Error(ERR_DROP, "Unknown VM operation %d", vm_syscallNum);
 		break;
@@ -469,6 +474,109 @@ static void DoSyscall(void)
 	currentVM = savedVM;
 }
 
+/*
+=================
+VM_SampleStackCompiled
+
+Called by the profiler from a system call. Generated code never pushes
+anything but return addresses, so everything above the frame of the
+DoSyscall helper up to the caller of VM_CallCompiled is return addresses
+into the VM
+=================
+*/
+
+static int VM_SampleStackCompiled(vm_t *vm, intptr_t *pcs, int maxDepth)
+{
+	intptr_t	*frame;
+	intptr_t	codeStart, entry, codeEnd;
+	int			depth;
+
+	codeStart = (intptr_t) vm->codeBase;
+	entry = codeStart + vm->entryOfs;
+	codeEnd = codeStart + vm->codeLength;
+
+	// skip ebp and the registers saved by EmitCallDoSyscall
+	frame = vm_nativeFrame + (idx64 ? 6 : 4);
+
+	for(depth = 0; depth < maxDepth && *frame >= codeStart && *frame < codeEnd; frame++)
+	{
+		// returns into the helpers don't belong to any function
+		if(*frame >= entry)
+			pcs[depth++] = *frame;
+	}
+
+	return depth;
+}
+
+/*
+=================
+EmitRelocPtr
+
+Emits the absolute address of one of the helpers above and remembers where
+it went, so VM_LoadCodeCache can patch it in code compiled by another run
+=================
+*/
+
+typedef enum
+{
+	VM_RELOC_DOSYSCALL,
+	VM_RELOC_SYSCALLNUM,
+	VM_RELOC_PROGRAMSTACK,
+	VM_RELOC_OPSTACKOFS,
+	VM_RELOC_OPSTACKBASE,
+	VM_RELOC_ARG,
+	VM_RELOC_NATIVEFRAME,
+	VM_RELOC_FTOL,
+
+	VM_RELOC_COUNT
+} ERelocTarget;
+
+#define MAX_VM_RELOCS	16
+
+typedef struct
+{
+	int		ofs;
+	int		target;
+} vmReloc_t;
+
+static	vmReloc_t	relocs[MAX_VM_RELOCS];
+static	int			numRelocs;
+
+static void *VM_RelocTarget(int target)
+{
+	switch(target)
+	{
+	case VM_RELOC_DOSYSCALL:
+		return (void *) DoSyscall;
+	case VM_RELOC_SYSCALLNUM:
+		return &vm_syscallNum;
+	case VM_RELOC_PROGRAMSTACK:
+		return &vm_programStack;
+	case VM_RELOC_OPSTACKOFS:
+		return &vm_opStackOfs;
+	case VM_RELOC_OPSTACKBASE:
+		return &vm_opStackBase;
+	case VM_RELOC_ARG:
+		return &vm_arg;
+	case VM_RELOC_FTOL:
+		return (void *) Q_VMftol;
+	default:
+		return &vm_nativeFrame;
+	}
+}
+
+static void EmitRelocPtr(int target)
+{
+	if(numRelocs == MAX_VM_RELOCS)
+		Com_Error(ERR_FATAL, "VM_CompileX86: too many relocations");
+
+	relocs[numRelocs].ofs = compiledOfs;
+	relocs[numRelocs].target = target;
+	numRelocs++;
+
+	EmitPtr(VM_RelocTarget(target));
+}
+
 /*
 =================
 EmitCallRel
@@ -482,6 +590,24 @@ void EmitCallRel(vm_t *vm, int callOfs)
 	Emit4(callOfs - compiledOfs - 4);
 }
 
+/*
+=================
+EmitFtolThunk
+Jump to Q_VMftol, so every OP_CVFI shares one relocated pointer
+=================
+*/
+
+int EmitFtolThunk(vm_t *vm)
+{
+	int retval = compiledOfs;
+
+	EmitRexString(0x48, "BA");		// mov edx, Q_VMftol
+	EmitRelocPtr(VM_RELOC_FTOL);
+	EmitString("FF E2");			// jmp edx
+
+	return retval;
+}
+
 /*
 =================
 EmitCallDoSyscall
@@ -493,7 +619,7 @@ int EmitCallDoSyscall(vm_t *vm)
 {
 	// use edx register to store DoSyscall address
 	EmitRexString(0x48, "BA");		// mov edx, DoSyscall
-	EmitPtr(DoSyscall);
+	EmitRelocPtr(VM_RELOC_DOSYSCALL);
 
 	// Push important registers to stack as we can't really make
 	// any assumptions about calling conventions.
@@ -508,27 +634,31 @@ int EmitCallDoSyscall(vm_t *vm)
 	// write arguments to global vars
 	// syscall number
 	EmitString("A3");			// mov [0x12345678], eax
-	EmitPtr(&vm_syscallNum);
+	EmitRelocPtr(VM_RELOC_SYSCALLNUM);
 	// vm_programStack value
 	EmitString("89 F0");			// mov eax, esi
 	EmitString("A3");			// mov [0x12345678], eax
-	EmitPtr(&vm_programStack);
+	EmitRelocPtr(VM_RELOC_PROGRAMSTACK);
 	// vm_opStackOfs 
 	EmitString("88 D8");			// mov al, bl
 	EmitString("A2");			// mov [0x12345678], al
-	EmitPtr(&vm_opStackOfs);
+	EmitRelocPtr(VM_RELOC_OPSTACKOFS);
 	// vm_opStackBase
 	EmitRexString(0x48, "89 F8");		// mov eax, edi
 	EmitRexString(0x48, "A3");		// mov [0x12345678], eax
-	EmitPtr(&vm_opStackBase);
+	EmitRelocPtr(VM_RELOC_OPSTACKBASE);
 	// vm_arg
 	EmitString("89 C8");			// mov eax, ecx
 	EmitString("A3");			// mov [0x12345678], eax
-	EmitPtr(&vm_arg);
+	EmitRelocPtr(VM_RELOC_ARG);
 	
 	// align the stack pointer to a 16-byte-boundary
 	EmitString("55");			// push ebp
 	EmitRexString(0x48, "89 E5");		// mov ebp, esp
+	// vm_nativeFrame, for VM_SampleStackCompiled
+	EmitRexString(0x48, "89 E8");		// mov eax, ebp
+	EmitRexString(0x48, "A3");		// mov [0x12345678], eax
+	EmitRelocPtr(VM_RELOC_NATIVEFRAME);
 	EmitRexString(0x48, "83 E4 F0");	// and esp, 0xFFFFFFF0
 			
 	// call the syscall wrapper function DoSyscall()
@@ -882,194 +1012,2022 @@ qboolean ConstOptimize(vm_t *vm, int callProcOfsSyscall)
 		}
 		EmitCommand(LAST_COMMAND_MOV_STACK_EAX);
 
-		pc++;						// OP_SUB
-		instruction += 1;
-		return qtrue;
+		pc++;						// OP_SUB
+		instruction += 1;
+		return qtrue;
+
+	case OP_MULI:
+		v = Constant4();
+
+		EmitMovEAXStack(vm, 0);
+		if(iss8(v))
+		{
+			EmitString("6B C0");			// imul eax, 0x7F
+			Emit1(v);
+		}
+		else
+		{
+			EmitString("69 C0");			// imul eax, 0x12345678
+			Emit4(v);
+		}
+		EmitCommand(LAST_COMMAND_MOV_STACK_EAX);
+		pc++;						// OP_MULI
+		instruction += 1;
+
+		return qtrue;
+
+	case OP_LSH:
+		v = NextConstant4();
+		if(v < 0 || v > 31)
+			break;
+
+		EmitMovEAXStack(vm, 0);
+		EmitString("C1 E0");				// shl eax, 0x12
+		Emit1(v);
+		EmitCommand(LAST_COMMAND_MOV_STACK_EAX);
+
+		pc += 5;					// CONST + OP_LSH
+		instruction += 1;
+		return qtrue;
+
+	case OP_RSHI:
+		v = NextConstant4();
+		if(v < 0 || v > 31)
+			break;
+			
+		EmitMovEAXStack(vm, 0);
+		EmitString("C1 F8");				// sar eax, 0x12
+		Emit1(v);
+		EmitCommand(LAST_COMMAND_MOV_STACK_EAX);
+
+		pc += 5;					// CONST + OP_RSHI
+		instruction += 1;
+		return qtrue;
+
+	case OP_RSHU:
+		v = NextConstant4();
+		if(v < 0 || v > 31)
+			break;
+			
+		EmitMovEAXStack(vm, 0);
+		EmitString("C1 E8");				// shr eax, 0x12
+		Emit1(v);
+		EmitCommand(LAST_COMMAND_MOV_STACK_EAX);
+
+		pc += 5;					// CONST + OP_RSHU
+		instruction += 1;
+		return qtrue;
+	
+	case OP_BAND:
+		v = Constant4();
+
+		EmitMovEAXStack(vm, 0);
+		if(iss8(v))
+		{
+			EmitString("83 E0");			// and eax, 0x7F
+			Emit1(v);
+		}
+		else
+		{
+			EmitString("25");			// and eax, 0x12345678
+			Emit4(v);
+		}
+		EmitCommand(LAST_COMMAND_MOV_STACK_EAX);
+		
+		pc += 1;					// OP_BAND
+		instruction += 1;
+		return qtrue;
+
+	case OP_BOR:
+		v = Constant4();
+
+		EmitMovEAXStack(vm, 0);
+		if(iss8(v))
+		{
+			EmitString("83 C8");			// or eax, 0x7F
+			Emit1(v);
+		}
+		else
+		{
+			EmitString("0D");			// or eax, 0x12345678
+			Emit4(v);
+		}
+		EmitCommand(LAST_COMMAND_MOV_STACK_EAX);
+		
+		pc += 1;				 	// OP_BOR
+		instruction += 1;
+		return qtrue;
+
+	case OP_BXOR:
+		v = Constant4();
+		
+		EmitMovEAXStack(vm, 0);
+		if(iss8(v))
+		{
+			EmitString("83 F0");			// xor eax, 0x7F
+			Emit1(v);
+		}
+		else
+		{
+			EmitString("35");			// xor eax, 0x12345678
+			Emit4(v);
+		}
+		EmitCommand(LAST_COMMAND_MOV_STACK_EAX);
+		
+		pc += 1;					// OP_BXOR
+		instruction += 1;
+		return qtrue;
+
+	case OP_EQ:
+	case OP_NE:
+	case OP_LTI:
+	case OP_LEI:
+	case OP_GTI:
+	case OP_GEI:
+	case OP_LTU:
+	case OP_LEU:
+	case OP_GTU:
+	case OP_GEU:
+		EmitMovEAXStack(vm, 0);
+		EmitCommand(LAST_COMMAND_SUB_BL_1);
+		EmitString("3D");				// cmp eax, 0x12345678
+		Emit4(Constant4());
+
+		pc++;						// OP_*
+		EmitBranchConditions(vm, op1);
+		instruction++;
+
+		return qtrue;
+
+	case OP_EQF:
+	case OP_NEF:
+		if(NextConstant4())
+			break;
+		pc += 5;					// CONST + OP_EQF|OP_NEF
+
+		EmitMovEAXStack(vm, 0);
+		EmitCommand(LAST_COMMAND_SUB_BL_1);
+		// floating point hack :)
+		EmitString("25");				// and eax, 0x7FFFFFFF
+		Emit4(0x7FFFFFFF);
+		if(op1 == OP_EQF)
+			EmitJumpIns(vm, "0F 84", Constant4());	// jz 0x12345678
+		else
+			EmitJumpIns(vm, "0F 85", Constant4());	// jnz 0x12345678
+		
+		instruction += 1;
+		return qtrue;
+
+
+	case OP_JUMP:
+		EmitJumpIns(vm, "E9", Constant4());		// jmp 0x12345678
+
+		pc += 1;                  // OP_JUMP
+		instruction += 1;
+		return qtrue;
+
+	case OP_CALL:
+		v = Constant4();
+		EmitCallConst(vm, v, callProcOfsSyscall);
+
+		pc += 1;                  // OP_CALL
+		instruction += 1;
+		return qtrue;
+
+	default:
+		break;
+	}
+
+	return qfalse;
+}
+
+/*
+=================
+VM_InstallCode
+
+Copy the code in buf to an exact sized buffer with the appropriate permission bits
+=================
+*/
+static void VM_InstallCode(vm_t *vm, int length)
+{
+	vm->codeLength = length;
+#ifdef VM_X86_MMAP
+	vm->codeBase = mmap(NULL, length, PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if(vm->codeBase == MAP_FAILED)
+		Com_Error(ERR_FATAL, "VM_CompileX86: can't mmap memory");
+#elif _WIN32
+	// allocate memory with EXECUTE permissions under windows.
+	vm->codeBase = VirtualAlloc(NULL, length, MEM_COMMIT, PAGE_EXECUTE_READWRITE);
+	if(!vm->codeBase)
+		Com_Error(ERR_FATAL, "VM_CompileX86: VirtualAlloc failed");
+#else
+	vm->codeBase = malloc(length);
+	if(!vm->codeBase)
+	        Com_Error(ERR_FATAL, "VM_CompileX86: malloc failed");
+#endif
+
+	Com_Memcpy( vm->codeBase, buf, length );
+
+#ifdef VM_X86_MMAP
+	if(mprotect(vm->codeBase, length, PROT_READ|PROT_EXEC))
+		Com_Error(ERR_FATAL, "VM_CompileX86: mprotect failed");
+#elif _WIN32
+	{
+		DWORD oldProtect = 0;
+		
+		// remove write permissions.
+		if(!VirtualProtect(vm->codeBase, length, PAGE_EXECUTE_READ, &oldProtect))
+			Com_Error(ERR_FATAL, "VM_CompileX86: VirtualProtect failed");
+	}
+#endif
+
+	vm->destroy = VM_Destroy_Compiled;
+	vm->sampleStack = VM_SampleStackCompiled;
+}
+
+#if idx64
+/*
+==============================================================================
+
+Optimizing compiler for x86_64
+
+The compiler above keeps the whole opStack in memory. This one keeps the
+entries pushed inside a basic block in registers, floats in xmm registers
+and constants and local addresses as immediates, and only writes them to the
+opStack at the end of the block or when it runs out of registers. Between
+blocks the registers are the same as above, so the helpers are shared:
+
+  ebx/bl	opStack offset, points at the top entry between blocks
+  esi		program stack
+  edi		opStack base
+  r8		vm->instructionPointers
+  r9		vm->dataBase
+  r10-r15	opStack entries
+  xmm0-xmm5	float opStack entries
+  eax, ecx, edx	scratch
+
+Only function entries and jump targets can be reached through
+instructionPointers, every other instruction points at the jump violation
+handler, so a block is always entered with nothing in registers. Functions
+whose locals fit below the end of the data segment check esi on entry and
+after each call and then access their locals without masking.
+
+Anything this compiler doesn't handle makes VM_Compile fall back to the one
+above.
+
+==============================================================================
+*/
+
+#define OPT_MAX_ITEMS		16		// opStack entries kept out of memory
+#define OPT_MAX_DEPTH		24		// opStack slots addressed relative to ebx
+
+// nop dword ptr [rax + rax + 0x004D5651], starts every function so
+// computed calls can't land anywhere else
+#define OPT_ENTRY_MARKER	"0F 1F 84 00 51 56 4D 00"
+
+// instruction flags
+#define OPT_ENTRY			1
+#define OPT_TARGET			2
+
+typedef enum {
+	OPT_CONST,
+	OPT_LOCAL,		// value is an offset from the program stack
+	OPT_REG,
+	OPT_XMM
+} optItemType_t;
+
+typedef struct {
+	optItemType_t	type;
+	int				value;
+} optItem_t;
+
+typedef enum {
+	OPND_REG,		// reg
+	OPND_OPSTACK,	// [rdi + rbx * 4 + disp]
+	OPND_DATA,		// [r9 + disp]
+	OPND_DATA_INDEX,	// [r9 + reg]
+	OPND_DATA_LOCAL,	// [r9 + rsi + disp]
+	OPND_PSTACK		// [rsi + disp]
+} optOperandMode_t;
+
+typedef struct {
+	optOperandMode_t	mode;
+	int					reg;
+	int					disp;
+} optOperand_t;
+
+#define R_EAX	0
+#define R_ECX	1
+#define R_EDX	2
+
+static const int optRegs[] = { 10, 11, 12, 13, 14, 15 };
+#define OPT_NUM_XMM		6
+
+static struct {
+	int			instructionCount;
+	byte		*ops;
+	int			*values;
+	byte		*flags;
+	int			*insOfs;
+
+	// current function
+	int			funcStart, funcEnd;
+	int			funcMaxOfs;
+	qboolean	funcBounded;
+	int			stackLow, stackHigh;
+
+	// opStack entries not written to memory yet, items[0] is at memTop + 1
+	optItem_t	items[OPT_MAX_ITEMS];
+	int			numItems;
+	int			memTop;
+
+	qboolean	regUsed[16];
+	qboolean	xmmUsed[OPT_NUM_XMM];
+
+	int			doSyscallOfs, syscallOfs;
+	int			errJumpOfs, errStackOfs, callProcOfs;
+
+	const char	*error;
+} opt;
+
+/*
+=================
+Opt_Fail
+
+Give up, the rest of the pass only keeps emitting so the callers stay simple
+=================
+*/
+static void Opt_Fail( const char *error )
+{
+	if ( !opt.error )
+		opt.error = error;
+}
+
+static optOperand_t Opt_Operand( optOperandMode_t mode, int reg, int disp )
+{
+	optOperand_t operand;
+
+	operand.mode = mode;
+	operand.reg = reg;
+	operand.disp = disp;
+
+	return operand;
+}
+
+/*
+=================
+Opt_EmitRM
+
+Emit an instruction with a ModRM byte, reg is the register or opcode extension
+=================
+*/
+static void Opt_EmitRM( int prefix, qboolean rexW, const char *opcode, int reg, optOperand_t rm )
+{
+	int rex;
+
+	rex = 0x40 | ( rexW ? 0x08 : 0 ) | ( ( reg & 8 ) >> 1 );
+
+	switch ( rm.mode ) {
+	case OPND_REG:
+		rex |= ( rm.reg & 8 ) >> 3;
+		break;
+	case OPND_DATA:
+	case OPND_DATA_LOCAL:
+		rex |= 0x01;
+		break;
+	case OPND_DATA_INDEX:
+		rex |= 0x01 | ( ( rm.reg & 8 ) >> 2 );
+		break;
+	default:
+		break;
+	}
+
+	if ( prefix )
+		Emit1( prefix );
+	if ( rex != 0x40 )
+		Emit1( rex );
+
+	EmitString( opcode );
+
+	reg = ( reg & 7 ) << 3;
+
+	switch ( rm.mode ) {
+	case OPND_REG:
+		Emit1( 0xC0 | reg | ( rm.reg & 7 ) );
+		break;
+	case OPND_OPSTACK:
+		if ( !rm.disp ) {
+			Emit1( 0x04 | reg );
+			Emit1( 0x9F );
+		} else if ( iss8( rm.disp ) ) {
+			Emit1( 0x44 | reg );
+			Emit1( 0x9F );
+			Emit1( rm.disp );
+		} else {
+			Emit1( 0x84 | reg );
+			Emit1( 0x9F );
+			Emit4( rm.disp );
+		}
+		break;
+	case OPND_DATA:
+		Emit1( 0x81 | reg );
+		Emit4( rm.disp );
+		break;
+	case OPND_DATA_INDEX:
+		Emit1( 0x04 | reg );
+		Emit1( ( ( rm.reg & 7 ) << 3 ) | 0x01 );
+		break;
+	case OPND_DATA_LOCAL:
+		Emit1( 0x84 | reg );
+		Emit1( 0x31 );
+		Emit4( rm.disp );
+		break;
+	case OPND_PSTACK:
+		Emit1( 0x86 | reg );
+		Emit4( rm.disp );
+		break;
+	}
+}
+
+/*
+=================
+Opt_EmitImm
+
+Emit an 81/83 group instruction, ext selects add, or, and, sub, xor or cmp
+=================
+*/
+static void Opt_EmitImm( int ext, int reg, int v )
+{
+	if ( iss8( v ) ) {
+		Opt_EmitRM( 0, qfalse, "83", ext, Opt_Operand( OPND_REG, reg, 0 ) );
+		Emit1( v );
+	} else {
+		Opt_EmitRM( 0, qfalse, "81", ext, Opt_Operand( OPND_REG, reg, 0 ) );
+		Emit4( v );
+	}
+}
+
+/*
+=================
+Opt_EmitJump
+
+Jump or call with a 32 bit displacement, the target offset is only known in
+the second pass
+=================
+*/
+static void Opt_EmitJump( const char *opcode, int targetOfs )
+{
+	EmitString( opcode );
+
+	if ( pass )
+		Emit4( targetOfs - compiledOfs - 4 );
+	else
+		Emit4( 0 );
+}
+
+static void Opt_EmitMovImm( int reg, int v )
+{
+	if ( !v ) {
+		Opt_EmitRM( 0, qfalse, "31", reg, Opt_Operand( OPND_REG, reg, 0 ) );	// xor reg, reg
+		return;
+	}
+
+	if ( reg & 8 )
+		Emit1( 0x41 );
+	Emit1( 0xB8 | ( reg & 7 ) );					// mov reg, 0x12345678
+	Emit4( v );
+}
+
+/*
+=================
+Opt_AllocReg
+=================
+*/
+static void Opt_SpillBottom( void );
+
+static int Opt_AllocReg( void )
+{
+	int i;
+
+	while ( 1 ) {
+		for ( i = 0; i < ARRAY_LEN( optRegs ); i++ ) {
+			if ( !opt.regUsed[optRegs[i]] ) {
+				opt.regUsed[optRegs[i]] = qtrue;
+				return optRegs[i];
+			}
+		}
+
+		if ( !opt.numItems ) {
+			Opt_Fail( "out of registers" );
+			return optRegs[0];
+		}
+
+		Opt_SpillBottom();
+	}
+}
+
+static int Opt_AllocXmm( void )
+{
+	int i;
+
+	while ( 1 ) {
+		for ( i = 0; i < OPT_NUM_XMM; i++ ) {
+			if ( !opt.xmmUsed[i] ) {
+				opt.xmmUsed[i] = qtrue;
+				return i;
+			}
+		}
+
+		if ( !opt.numItems ) {
+			Opt_Fail( "out of xmm registers" );
+			return 0;
+		}
+
+		Opt_SpillBottom();
+	}
+}
+
+static void Opt_FreeItem( const optItem_t *item )
+{
+	if ( item->type == OPT_REG )
+		opt.regUsed[item->value] = qfalse;
+	else if ( item->type == OPT_XMM )
+		opt.xmmUsed[item->value] = qfalse;
+}
+
+/*
+=================
+Opt_StoreItem
+
+Write an entry to memory, clobbers eax
+=================
+*/
+static void Opt_StoreItem( const optItem_t *item, optOperand_t dst )
+{
+	switch ( item->type ) {
+	case OPT_CONST:
+		Opt_EmitRM( 0, qfalse, "C7", 0, dst );		// mov dword ptr [dst], 0x12345678
+		Emit4( item->value );
+		break;
+	case OPT_LOCAL:
+		Opt_EmitRM( 0, qfalse, "8D", R_EAX, Opt_Operand( OPND_PSTACK, 0, item->value ) );	// lea eax, [esi + 0x12345678]
+		Opt_EmitRM( 0, qfalse, "89", R_EAX, dst );	// mov dword ptr [dst], eax
+		break;
+	case OPT_REG:
+		Opt_EmitRM( 0, qfalse, "89", item->value, dst );	// mov dword ptr [dst], reg
+		break;
+	case OPT_XMM:
+		Opt_EmitRM( 0xF3, qfalse, "0F 11", item->value, dst );	// movss dword ptr [dst], xmm
+		break;
+	}
+}
+
+static optOperand_t Opt_OpStack( int slot )
+{
+	return Opt_Operand( OPND_OPSTACK, 0, slot * 4 );
+}
+
+/*
+=================
+Opt_SpillBottom
+
+Write the lowest entry kept out of memory to the opStack
+=================
+*/
+static void Opt_SpillBottom( void )
+{
+	opt.memTop++;
+	Opt_StoreItem( &opt.items[0], Opt_OpStack( opt.memTop ) );
+	Opt_FreeItem( &opt.items[0] );
+
+	opt.numItems--;
+	memmove( opt.items, opt.items + 1, opt.numItems * sizeof( opt.items[0] ) );
+}
+
+/*
+=================
+Opt_Flush
+
+Write all entries to the opStack and point ebx at the top one, which is the
+state expected between blocks. Clobbers eax and the flags.
+=================
+*/
+static void Opt_Flush( void )
+{
+	while ( opt.numItems )
+		Opt_SpillBottom();
+
+	if ( opt.memTop ) {
+		STACK_PUSH( opt.memTop );				// add bl, memTop
+		opt.memTop = 0;
+	}
+}
+
+static void Opt_Push( optItemType_t type, int value )
+{
+	int slot;
+
+	if ( opt.numItems == OPT_MAX_ITEMS )
+		Opt_SpillBottom();
+
+	// keep the slots addressed relative to ebx inside the opStack guard
+	slot = opt.memTop + opt.numItems + 1;
+	if ( slot > OPT_MAX_DEPTH || slot < -OPT_MAX_DEPTH )
+		Opt_Flush();
+
+	opt.items[opt.numItems].type = type;
+	opt.items[opt.numItems].value = value;
+	opt.numItems++;
+}
+
+/*
+=================
+Opt_Pop
+
+Entries that are already in memory are loaded into a register right away,
+xmm selects the register type
+=================
+*/
+static optItem_t Opt_Pop( qboolean xmm )
+{
+	optItem_t item;
+
+	if ( opt.numItems )
+		return opt.items[--opt.numItems];
+
+	if ( opt.memTop < -OPT_MAX_DEPTH )
+		Opt_Flush();
+
+	if ( xmm ) {
+		item.type = OPT_XMM;
+		item.value = Opt_AllocXmm();
+		Opt_EmitRM( 0xF3, qfalse, "0F 10", item.value, Opt_OpStack( opt.memTop ) );	// movss xmm, dword ptr [opStack]
+	} else {
+		item.type = OPT_REG;
+		item.value = Opt_AllocReg();
+		Opt_EmitRM( 0, qfalse, "8B", item.value, Opt_OpStack( opt.memTop ) );		// mov reg, dword ptr [opStack]
+	}
+
+	opt.memTop--;
+
+	return item;
+}
+
+static void Opt_Drop( void )
+{
+	if ( opt.numItems ) {
+		Opt_FreeItem( &opt.items[--opt.numItems] );
+		return;
+	}
+
+	opt.memTop--;
+	if ( opt.memTop < -OPT_MAX_DEPTH )
+		Opt_Flush();
+}
+
+/*
+=================
+Opt_IntReg
+
+Move an entry to a general purpose register owned by the caller
+=================
+*/
+static int Opt_IntReg( optItem_t *item )
+{
+	int reg;
+
+	switch ( item->type ) {
+	case OPT_CONST:
+		reg = Opt_AllocReg();
+		Opt_EmitMovImm( reg, item->value );
+		break;
+	case OPT_LOCAL:
+		reg = Opt_AllocReg();
+		Opt_EmitRM( 0, qfalse, "8D", reg, Opt_Operand( OPND_PSTACK, 0, item->value ) );	// lea reg, [esi + 0x12345678]
+		break;
+	case OPT_XMM:
+		reg = Opt_AllocReg();
+		Opt_EmitRM( 0x66, qfalse, "0F 7E", item->value, Opt_Operand( OPND_REG, reg, 0 ) );	// movd reg, xmm
+		opt.xmmUsed[item->value] = qfalse;
+		break;
+	default:
+		return item->value;
+	}
+
+	item->type = OPT_REG;
+	item->value = reg;
+
+	return reg;
+}
+
+/*
+=================
+Opt_XmmReg
+
+Move an entry to an xmm register owned by the caller
+=================
+*/
+static int Opt_XmmReg( optItem_t *item )
+{
+	int xmm;
+
+	if ( item->type == OPT_XMM )
+		return item->value;
+
+	xmm = Opt_AllocXmm();
+
+	if ( item->type == OPT_CONST && !item->value ) {
+		EmitString( "0F 57" );				// xorps xmm, xmm
+		Emit1( 0xC0 | ( xmm << 3 ) | xmm );
+	} else {
+		Opt_IntReg( item );
+		Opt_EmitRM( 0x66, qfalse, "0F 6E", xmm, Opt_Operand( OPND_REG, item->value, 0 ) );	// movd xmm, reg
+		opt.regUsed[item->value] = qfalse;
+	}
+
+	item->type = OPT_XMM;
+	item->value = xmm;
+
+	return xmm;
+}
+
+/*
+=================
+Opt_Address
+
+Memory operand for an address entry. Constant addresses are masked here and
+locals of bounded functions don't need masking at all.
+=================
+*/
+static optOperand_t Opt_Address( vm_t *vm, optItem_t *item )
+{
+	int reg;
+
+	if ( item->type == OPT_CONST )
+		return Opt_Operand( OPND_DATA, 0, item->value & vm->dataMask );
+
+	if ( item->type == OPT_LOCAL && opt.funcBounded && (unsigned)item->value <= (unsigned)opt.funcMaxOfs )
+		return Opt_Operand( OPND_DATA_LOCAL, 0, item->value );
+
+	reg = Opt_IntReg( item );
+	Opt_EmitImm( 4, reg, vm->dataMask );			// and reg, 0x12345678
+
+	return Opt_Operand( OPND_DATA_INDEX, reg, 0 );
+}
+
+/*
+=================
+Opt_CheckStack
+
+Make sure locals can be accessed without masking
+=================
+*/
+static void Opt_CheckStack( void )
+{
+	if ( !opt.funcBounded )
+		return;
+
+	Opt_EmitRM( 0, qfalse, "8D", R_EAX, Opt_Operand( OPND_PSTACK, 0, -opt.stackLow ) );	// lea eax, [esi - stackLow]
+	EmitString( "3D" );						// cmp eax, 0x12345678
+	Emit4( opt.stackHigh - opt.stackLow );
+	Opt_EmitJump( "0F 87", opt.errStackOfs );			// ja errStack
+}
+
+/*
+=================
+Opt_BeginFunction
+
+Find the extent of the function starting at instruction and decide whether
+its locals can be accessed without masking
+=================
+*/
+static void Opt_BeginFunction( vm_t *vm, int instruction )
+{
+	unsigned int	maxOfs;
+	int				i;
+
+	maxOfs = 0;
+	for ( i = instruction + 1; i < opt.instructionCount && opt.ops[i] != OP_ENTER; i++ ) {
+		if ( opt.ops[i] == OP_LOCAL || opt.ops[i] == OP_ARG ) {
+			if ( (unsigned)opt.values[i] > maxOfs )
+				maxOfs = opt.values[i];
+		}
+	}
+
+	opt.funcStart = instruction;
+	opt.funcEnd = i;
+
+	// the interpreter treats anything at or below stackBottom as overflow
+	opt.stackLow = MAX( vm->dataMask + 1 - PROGRAM_STACK_SIZE + 1, 0 );
+
+	if ( maxOfs <= (unsigned)vm->dataMask + 1 && vm->dataMask + 1 - (int)maxOfs >= opt.stackLow ) {
+		opt.funcBounded = qtrue;
+		opt.funcMaxOfs = maxOfs;
+		opt.stackHigh = vm->dataMask + 1 - maxOfs;
+	} else {
+		opt.funcBounded = qfalse;
+	}
+}
+
+/*
+=================
+Opt_BranchTarget
+=================
+*/
+static int Opt_BranchTarget( int target )
+{
+	if ( target < opt.funcStart || target >= opt.funcEnd ) {
+		Opt_Fail( "branch out of function" );
+		return compiledOfs;
+	}
+
+	return opt.insOfs[target];
+}
+
+/*
+=================
+Opt_IsFloatOp
+
+Whether the instruction reads its operands as floats
+=================
+*/
+static qboolean Opt_IsFloatOp( int instruction )
+{
+	if ( instruction >= opt.instructionCount || opt.flags[instruction] )
+		return qfalse;
+
+	switch ( opt.ops[instruction] ) {
+	case OP_EQF:
+	case OP_NEF:
+	case OP_LTF:
+	case OP_LEF:
+	case OP_GTF:
+	case OP_GEF:
+	case OP_ADDF:
+	case OP_SUBF:
+	case OP_DIVF:
+	case OP_MULF:
+	case OP_CVFI:
+		return qtrue;
+	default:
+		return qfalse;
+	}
+}
+
+/*
+=================
+Opt_FoldConst
+
+Evaluate integer ops on two constants at compile time
+=================
+*/
+static qboolean Opt_FoldConst( int op, int a, int b, int *result )
+{
+	switch ( op ) {
+	case OP_ADD:	*result = a + b; return qtrue;
+	case OP_SUB:	*result = a - b; return qtrue;
+	case OP_MULI:
+	case OP_MULU:	*result = (unsigned)a * (unsigned)b; return qtrue;
+	case OP_BAND:	*result = a & b; return qtrue;
+	case OP_BOR:	*result = a | b; return qtrue;
+	case OP_BXOR:	*result = a ^ b; return qtrue;
+	case OP_LSH:	*result = (unsigned)a << ( b & 31 ); return qtrue;
+	case OP_RSHI:	*result = a >> ( b & 31 ); return qtrue;
+	case OP_RSHU:	*result = (unsigned)a >> ( b & 31 ); return qtrue;
+	default:		return qfalse;
+	}
+}
+
+/*
+=================
+Opt_EmitIntOp
+
+ADD, SUB, MULI, MULU, BAND, BOR, BXOR and the shifts
+=================
+*/
+static void Opt_EmitIntOp( int op )
+{
+	optItem_t	a, b;
+	int			ra, rb, v, ext;
+
+	b = Opt_Pop( qfalse );
+	a = Opt_Pop( qfalse );
+
+	if ( a.type == OPT_CONST && b.type == OPT_CONST && Opt_FoldConst( op, a.value, b.value, &v ) ) {
+		Opt_Push( OPT_CONST, v );
+		return;
+	}
+
+	// commutative ops take the constant as immediate
+	if ( a.type == OPT_CONST && op != OP_SUB && op != OP_LSH && op != OP_RSHI && op != OP_RSHU ) {
+		optItem_t t = a;
+		a = b;
+		b = t;
+	}
+
+	// local + constant is still a local
+	if ( op == OP_ADD && b.type == OPT_CONST && a.type == OPT_LOCAL ) {
+		Opt_Push( OPT_LOCAL, a.value + b.value );
+		return;
+	}
+	if ( op == OP_SUB && b.type == OPT_CONST && a.type == OPT_LOCAL ) {
+		Opt_Push( OPT_LOCAL, a.value - b.value );
+		return;
+	}
+
+	ra = Opt_IntReg( &a );
+
+	switch ( op ) {
+	case OP_ADD:	ext = 0; break;
+	case OP_BOR:	ext = 1; break;
+	case OP_BAND:	ext = 4; break;
+	case OP_SUB:	ext = 5; break;
+	case OP_BXOR:	ext = 6; break;
+	case OP_LSH:	ext = 4; break;
+	case OP_RSHU:	ext = 5; break;
+	case OP_RSHI:	ext = 7; break;
+	default:		ext = 0; break;
+	}
+
+	if ( op == OP_LSH || op == OP_RSHI || op == OP_RSHU ) {
+		if ( b.type == OPT_CONST ) {
+			Opt_EmitRM( 0, qfalse, "C1", ext, Opt_Operand( OPND_REG, ra, 0 ) );	// shl/sar/shr reg, 0x12
+			Emit1( b.value & 31 );
+		} else {
+			rb = Opt_IntReg( &b );
+			Opt_EmitRM( 0, qfalse, "89", rb, Opt_Operand( OPND_REG, R_ECX, 0 ) );	// mov ecx, rb
+			Opt_EmitRM( 0, qfalse, "D3", ext, Opt_Operand( OPND_REG, ra, 0 ) );	// shl/sar/shr reg, cl
+			Opt_FreeItem( &b );
+		}
+	} else if ( op == OP_MULI || op == OP_MULU ) {
+		// the low 32 bits are the same for signed and unsigned
+		if ( b.type == OPT_CONST ) {
+			if ( iss8( b.value ) ) {
+				Opt_EmitRM( 0, qfalse, "6B", ra, Opt_Operand( OPND_REG, ra, 0 ) );	// imul ra, ra, 0x12
+				Emit1( b.value );
+			} else {
+				Opt_EmitRM( 0, qfalse, "69", ra, Opt_Operand( OPND_REG, ra, 0 ) );	// imul ra, ra, 0x12345678
+				Emit4( b.value );
+			}
+		} else {
+			rb = Opt_IntReg( &b );
+			Opt_EmitRM( 0, qfalse, "0F AF", ra, Opt_Operand( OPND_REG, rb, 0 ) );	// imul ra, rb
+			Opt_FreeItem( &b );
+		}
+	} else {
+		if ( b.type == OPT_CONST ) {
+			Opt_EmitImm( ext, ra, b.value );			// op ra, 0x12345678
+		} else {
+			char opcode[3];
+
+			rb = Opt_IntReg( &b );
+			Com_sprintf( opcode, sizeof( opcode ), "%02X", ( ext << 3 ) | 0x01 );
+			Opt_EmitRM( 0, qfalse, opcode, rb, Opt_Operand( OPND_REG, ra, 0 ) );	// op ra, rb
+			Opt_FreeItem( &b );
+		}
+	}
+
+	Opt_Push( OPT_REG, ra );
+}
+
+/*
+=================
+Opt_EmitDivOp
+
+DIVI, DIVU, MODI and MODU
+=================
+*/
+static void Opt_EmitDivOp( int op )
+{
+	optItem_t	a, b;
+	int			ra, rb;
+
+	b = Opt_Pop( qfalse );
+	a = Opt_Pop( qfalse );
+
+	ra = Opt_IntReg( &a );
+	rb = Opt_IntReg( &b );
+
+	Opt_EmitRM( 0, qfalse, "89", ra, Opt_Operand( OPND_REG, R_EAX, 0 ) );		// mov eax, ra
+
+	if ( op == OP_DIVI || op == OP_MODI ) {
+		EmitString( "99" );						// cdq
+		Opt_EmitRM( 0, qfalse, "F7", 7, Opt_Operand( OPND_REG, rb, 0 ) );	// idiv rb
+	} else {
+		EmitString( "31 D2" );						// xor edx, edx
+		Opt_EmitRM( 0, qfalse, "F7", 6, Opt_Operand( OPND_REG, rb, 0 ) );	// div rb
+	}
+
+	if ( op == OP_DIVI || op == OP_DIVU )
+		Opt_EmitRM( 0, qfalse, "89", R_EAX, Opt_Operand( OPND_REG, ra, 0 ) );	// mov ra, eax
+	else
+		Opt_EmitRM( 0, qfalse, "89", R_EDX, Opt_Operand( OPND_REG, ra, 0 ) );	// mov ra, edx
+
+	Opt_FreeItem( &b );
+	Opt_Push( OPT_REG, ra );
+}
+
+/*
+=================
+Opt_EmitFloatOp
+
+ADDF, SUBF, MULF and DIVF
+=================
+*/
+static void Opt_EmitFloatOp( int op )
+{
+	optItem_t	a, b;
+	int			xa, xb;
+	const char	*opcode;
+
+	b = Opt_Pop( qtrue );
+	a = Opt_Pop( qtrue );
+
+	xa = Opt_XmmReg( &a );
+	xb = Opt_XmmReg( &b );
+
+	switch ( op ) {
+	case OP_ADDF:	opcode = "0F 58"; break;	// addss xa, xb
+	case OP_SUBF:	opcode = "0F 5C"; break;	// subss xa, xb
+	case OP_MULF:	opcode = "0F 59"; break;	// mulss xa, xb
+	default:		opcode = "0F 5E"; break;	// divss xa, xb
+	}
+
+	Opt_EmitRM( 0xF3, qfalse, opcode, xa, Opt_Operand( OPND_REG, xb, 0 ) );
+
+	Opt_FreeItem( &b );
+	Opt_Push( OPT_XMM, xa );
+}
+
+/*
+=================
+Opt_EmitBranch
+
+Integer and float conditional branches, which end the block
+=================
+*/
+static void Opt_EmitBranch( int op, int target )
+{
+	optItem_t	a, b;
+	int			ra, rb, xa, xb, targetOfs;
+
+	targetOfs = Opt_BranchTarget( target );
+
+	if ( op >= OP_EQF ) {
+		b = Opt_Pop( qtrue );
+		a = Opt_Pop( qtrue );
+		xa = Opt_XmmReg( &a );
+		xb = Opt_XmmReg( &b );
+
+		Opt_Flush();
+
+		// unordered compares are false like in the interpreter, except for NEF
+		switch ( op ) {
+		case OP_EQF:
+			Opt_EmitRM( 0, qfalse, "0F 2E", xa, Opt_Operand( OPND_REG, xb, 0 ) );	// ucomiss xa, xb
+			EmitString( "7A 06" );						// jp +6
+			Opt_EmitJump( "0F 84", targetOfs );				// je target
+			break;
+		case OP_NEF:
+			Opt_EmitRM( 0, qfalse, "0F 2E", xa, Opt_Operand( OPND_REG, xb, 0 ) );	// ucomiss xa, xb
+			Opt_EmitJump( "0F 8A", targetOfs );				// jp target
+			Opt_EmitJump( "0F 85", targetOfs );				// jne target
+			break;
+		case OP_LTF:
+			Opt_EmitRM( 0, qfalse, "0F 2E", xb, Opt_Operand( OPND_REG, xa, 0 ) );	// ucomiss xb, xa
+			Opt_EmitJump( "0F 87", targetOfs );				// ja target
+			break;
+		case OP_LEF:
+			Opt_EmitRM( 0, qfalse, "0F 2E", xb, Opt_Operand( OPND_REG, xa, 0 ) );	// ucomiss xb, xa
+			Opt_EmitJump( "0F 83", targetOfs );				// jae target
+			break;
+		case OP_GTF:
+			Opt_EmitRM( 0, qfalse, "0F 2E", xa, Opt_Operand( OPND_REG, xb, 0 ) );	// ucomiss xa, xb
+			Opt_EmitJump( "0F 87", targetOfs );				// ja target
+			break;
+		default:
+			Opt_EmitRM( 0, qfalse, "0F 2E", xa, Opt_Operand( OPND_REG, xb, 0 ) );	// ucomiss xa, xb
+			Opt_EmitJump( "0F 83", targetOfs );				// jae target
+			break;
+		}
+
+		Opt_FreeItem( &a );
+		Opt_FreeItem( &b );
+		return;
+	}
+
+	b = Opt_Pop( qfalse );
+	a = Opt_Pop( qfalse );
+	ra = Opt_IntReg( &a );
+	rb = ( b.type == OPT_CONST ) ? -1 : Opt_IntReg( &b );
+
+	Opt_Flush();
+
+	if ( rb >= 0 )
+		Opt_EmitRM( 0, qfalse, "39", rb, Opt_Operand( OPND_REG, ra, 0 ) );		// cmp ra, rb
+	else if ( !b.value )
+		Opt_EmitRM( 0, qfalse, "85", ra, Opt_Operand( OPND_REG, ra, 0 ) );		// test ra, ra
+	else
+		Opt_EmitImm( 7, ra, b.value );							// cmp ra, 0x12345678
+
+	switch ( op ) {
+	case OP_EQ:		Opt_EmitJump( "0F 84", targetOfs ); break;	// je target
+	case OP_NE:		Opt_EmitJump( "0F 85", targetOfs ); break;	// jne target
+	case OP_LTI:	Opt_EmitJump( "0F 8C", targetOfs ); break;	// jl target
+	case OP_LEI:	Opt_EmitJump( "0F 8E", targetOfs ); break;	// jle target
+	case OP_GTI:	Opt_EmitJump( "0F 8F", targetOfs ); break;	// jg target
+	case OP_GEI:	Opt_EmitJump( "0F 8D", targetOfs ); break;	// jge target
+	case OP_LTU:	Opt_EmitJump( "0F 82", targetOfs ); break;	// jb target
+	case OP_LEU:	Opt_EmitJump( "0F 86", targetOfs ); break;	// jbe target
+	case OP_GTU:	Opt_EmitJump( "0F 87", targetOfs ); break;	// ja target
+	default:		Opt_EmitJump( "0F 83", targetOfs ); break;	// jae target
+	}
+
+	Opt_FreeItem( &a );
+	Opt_FreeItem( &b );
+}
+
+/*
+=================
+Opt_EmitLoad
+=================
+*/
+static void Opt_EmitLoad( vm_t *vm, int op, int instruction )
+{
+	optItem_t		addr;
+	optOperand_t	src;
+	int				reg;
+
+	addr = Opt_Pop( qfalse );
+	src = Opt_Address( vm, &addr );
+	Opt_FreeItem( &addr );
+
+	// floats go straight to an xmm register if the next op wants one
+	if ( op == OP_LOAD4 && Opt_IsFloatOp( instruction + 1 ) ) {
+		reg = Opt_AllocXmm();
+		Opt_EmitRM( 0xF3, qfalse, "0F 10", reg, src );			// movss xmm, dword ptr [src]
+		Opt_Push( OPT_XMM, reg );
+		return;
+	}
+
+	reg = Opt_AllocReg();
+
+	if ( op == OP_LOAD4 )
+		Opt_EmitRM( 0, qfalse, "8B", reg, src );			// mov reg, dword ptr [src]
+	else if ( op == OP_LOAD2 )
+		Opt_EmitRM( 0, qfalse, "0F B7", reg, src );			// movzx reg, word ptr [src]
+	else
+		Opt_EmitRM( 0, qfalse, "0F B6", reg, src );			// movzx reg, byte ptr [src]
+
+	Opt_Push( OPT_REG, reg );
+}
+
+/*
+=================
+Opt_EmitStore
+
+STORE1, STORE2, STORE4 and ARG
+=================
+*/
+static void Opt_EmitStore( vm_t *vm, int op, int argOfs )
+{
+	optItem_t		value, addr;
+	optOperand_t	dst;
+
+	value = Opt_Pop( qfalse );
+
+	if ( op == OP_ARG ) {
+		addr.type = OPT_LOCAL;
+		addr.value = argOfs;
+	} else {
+		addr = Opt_Pop( qfalse );
+	}
+
+	if ( value.type == OPT_LOCAL || ( value.type == OPT_XMM && op != OP_STORE4 && op != OP_ARG ) )
+		Opt_IntReg( &value );
+
+	dst = Opt_Address( vm, &addr );
+
+	if ( op == OP_STORE4 || op == OP_ARG ) {
+		Opt_StoreItem( &value, dst );
+	} else if ( op == OP_STORE2 ) {
+		if ( value.type == OPT_CONST ) {
+			Opt_EmitRM( 0x66, qfalse, "C7", 0, dst );		// mov word ptr [dst], 0x1234
+			Emit2( value.value );
+		} else {
+			Opt_EmitRM( 0x66, qfalse, "89", value.value, dst );	// mov word ptr [dst], reg
+		}
+	} else {
+		if ( value.type == OPT_CONST ) {
+			Opt_EmitRM( 0, qfalse, "C6", 0, dst );			// mov byte ptr [dst], 0x12
+			Emit1( value.value );
+		} else {
+			Opt_EmitRM( 0, qfalse, "88", value.value, dst );	// mov byte ptr [dst], reg
+		}
+	}
+
+	Opt_FreeItem( &value );
+	Opt_FreeItem( &addr );
+}
+
+/*
+=================
+Opt_EmitCall
+=================
+*/
+static void Opt_EmitCall( void )
+{
+	optItem_t	target;
+	int			reg;
+
+	target = Opt_Pop( qfalse );
+
+	if ( target.type == OPT_CONST && target.value < 0 ) {
+		Opt_Flush();
+		EmitString( "B8" );					// mov eax, 0x12345678
+		Emit4( target.value );
+		Opt_EmitJump( "E8", opt.syscallOfs );			// call syscall
+		return;
+	}
+
+	if ( target.type == OPT_CONST ) {
+		if ( target.value >= opt.instructionCount || opt.ops[target.value] != OP_ENTER ) {
+			Opt_Fail( "call to a non-function" );
+			return;
+		}
+
+		Opt_Flush();
+		Opt_EmitJump( "E8", opt.insOfs[target.value] );	// call function
+	} else {
+		reg = Opt_IntReg( &target );
+		Opt_Flush();
+		Opt_EmitRM( 0, qfalse, "89", reg, Opt_Operand( OPND_REG, R_EAX, 0 ) );	// mov eax, reg
+		Opt_FreeItem( &target );
+		Opt_EmitJump( "E8", opt.callProcOfs );			// call callProc
+	}
+
+	// the callee may have left esi anywhere
+	Opt_CheckStack();
+}
+
+/*
+=================
+Opt_EmitJumpOp
+=================
+*/
+static void Opt_EmitJumpOp( void )
+{
+	optItem_t	target;
+	int			reg, targetOfs;
+
+	target = Opt_Pop( qfalse );
+
+	if ( target.type == OPT_CONST ) {
+		targetOfs = Opt_BranchTarget( target.value );
+		Opt_Flush();
+		Opt_EmitJump( "E9", targetOfs );			// jmp target
+		return;
+	}
+
+	// jump tables may only lead to labels in the same function
+	reg = Opt_IntReg( &target );
+	Opt_Flush();
+	Opt_EmitRM( 0, qfalse, "89", reg, Opt_Operand( OPND_REG, R_EAX, 0 ) );	// mov eax, reg
+	Opt_FreeItem( &target );
+	EmitString( "2D" );						// sub eax, funcStart
+	Emit4( opt.funcStart );
+	EmitString( "3D" );						// cmp eax, funcEnd - funcStart
+	Emit4( opt.funcEnd - opt.funcStart );
+	Opt_EmitJump( "0F 83", opt.errJumpOfs );			// jae errJump
+	EmitString( "41 FF A4 C0" );					// jmp qword ptr [r8 + rax * 8 + funcStart * 8]
+	Emit4( opt.funcStart * 8 );
+}
+
+/*
+=================
+Opt_EmitInstruction
+=================
+*/
+static void Opt_EmitInstruction( vm_t *vm, int instruction )
+{
+	optItem_t	a;
+	int			op, v, reg;
+
+	op = opt.ops[instruction];
+	v = opt.values[instruction];
+
+	switch ( op ) {
+	case OP_UNDEF:
+		break;
+	case OP_BREAK:
+		EmitString( "CC" );					// int 3
+		break;
+	case OP_ENTER:
+		EmitString( OPT_ENTRY_MARKER );
+		EmitString( "81 EE" );					// sub esi, 0x12345678
+		Emit4( v );
+		Opt_CheckStack();
+		break;
+	case OP_LEAVE:
+		Opt_Flush();
+		EmitString( "81 C6" );					// add esi, 0x12345678
+		Emit4( v );
+		EmitString( "C3" );					// ret
+		break;
+	case OP_CALL:
+		Opt_EmitCall();
+		break;
+	case OP_PUSH:
+		Opt_Push( OPT_CONST, 0 );
+		break;
+	case OP_POP:
+		Opt_Drop();
+		break;
+	case OP_CONST:
+		Opt_Push( OPT_CONST, v );
+		break;
+	case OP_LOCAL:
+		Opt_Push( OPT_LOCAL, v );
+		break;
+	case OP_JUMP:
+		Opt_EmitJumpOp();
+		break;
+
+	case OP_EQ:
+	case OP_NE:
+	case OP_LTI:
+	case OP_LEI:
+	case OP_GTI:
+	case OP_GEI:
+	case OP_LTU:
+	case OP_LEU:
+	case OP_GTU:
+	case OP_GEU:
+	case OP_EQF:
+	case OP_NEF:
+	case OP_LTF:
+	case OP_LEF:
+	case OP_GTF:
+	case OP_GEF:
+		Opt_EmitBranch( op, v );
+		break;
+
+	case OP_LOAD1:
+	case OP_LOAD2:
+	case OP_LOAD4:
+		Opt_EmitLoad( vm, op, instruction );
+		break;
+	case OP_STORE1:
+	case OP_STORE2:
+	case OP_STORE4:
+	case OP_ARG:
+		Opt_EmitStore( vm, op, v );
+		break;
+
+	case OP_BLOCK_COPY:
+		Opt_Flush();
+		EmitString( "B8" );					// mov eax, 0x12345678
+		Emit4( VM_BLOCK_COPY );
+		EmitString( "B9" );					// mov ecx, 0x12345678
+		Emit4( v );
+		Opt_EmitJump( "E8", opt.doSyscallOfs );			// call doSyscall
+		STACK_POP( 2 );						// sub bl, 2
+		break;
+
+	case OP_SEX8:
+	case OP_SEX16:
+	case OP_NEGI:
+	case OP_BCOM:
+		a = Opt_Pop( qfalse );
+
+		if ( a.type == OPT_CONST ) {
+			if ( op == OP_SEX8 )
+				v = (signed char)a.value;
+			else if ( op == OP_SEX16 )
+				v = (short)a.value;
+			else if ( op == OP_NEGI )
+				v = -(unsigned)a.value;
+			else
+				v = ~a.value;
+
+			Opt_Push( OPT_CONST, v );
+			break;
+		}
+
+		reg = Opt_IntReg( &a );
+
+		if ( op == OP_SEX8 )
+			Opt_EmitRM( 0, qfalse, "0F BE", reg, Opt_Operand( OPND_REG, reg, 0 ) );	// movsx reg, reg8
+		else if ( op == OP_SEX16 )
+			Opt_EmitRM( 0, qfalse, "0F BF", reg, Opt_Operand( OPND_REG, reg, 0 ) );	// movsx reg, reg16
+		else
+			Opt_EmitRM( 0, qfalse, "F7", op == OP_NEGI ? 3 : 2, Opt_Operand( OPND_REG, reg, 0 ) );	// neg/not reg
+
+		Opt_Push( OPT_REG, reg );
+		break;
+
+	case OP_ADD:
+	case OP_SUB:
+	case OP_MULI:
+	case OP_MULU:
+	case OP_BAND:
+	case OP_BOR:
+	case OP_BXOR:
+	case OP_LSH:
+	case OP_RSHI:
+	case OP_RSHU:
+		Opt_EmitIntOp( op );
+		break;
+
+	case OP_DIVI:
+	case OP_DIVU:
+	case OP_MODI:
+	case OP_MODU:
+		Opt_EmitDivOp( op );
+		break;
+
+	case OP_NEGF:
+		a = Opt_Pop( qfalse );
+
+		if ( a.type == OPT_CONST ) {
+			Opt_Push( OPT_CONST, a.value ^ 0x80000000 );
+			break;
+		}
+
+		reg = Opt_IntReg( &a );
+		Opt_EmitRM( 0, qfalse, "81", 6, Opt_Operand( OPND_REG, reg, 0 ) );	// xor reg, 0x80000000
+		Emit4( 0x80000000 );
+		Opt_Push( OPT_REG, reg );
+		break;
+
+	case OP_ADDF:
+	case OP_SUBF:
+	case OP_MULF:
+	case OP_DIVF:
+		Opt_EmitFloatOp( op );
+		break;
+
+	case OP_CVIF:
+		a = Opt_Pop( qfalse );
+
+		if ( a.type == OPT_CONST ) {
+			floatint_t fi;
+
+			fi.f = a.value;
+			Opt_Push( OPT_CONST, fi.i );
+			break;
+		}
+
+		reg = Opt_IntReg( &a );
+		v = Opt_AllocXmm();
+		Opt_EmitRM( 0xF3, qfalse, "0F 2A", v, Opt_Operand( OPND_REG, reg, 0 ) );	// cvtsi2ss xmm, reg
+		Opt_FreeItem( &a );
+		Opt_Push( OPT_XMM, v );
+		break;
+
+	case OP_CVFI:
+		a = Opt_Pop( qtrue );
+		v = Opt_XmmReg( &a );
+		reg = Opt_AllocReg();
+		Opt_EmitRM( 0xF3, qfalse, "0F 2C", reg, Opt_Operand( OPND_REG, v, 0 ) );	// cvttss2si reg, xmm
+		Opt_FreeItem( &a );
+		Opt_Push( OPT_REG, reg );
+		break;
+
+	default:
+		Opt_Fail( "unsupported opcode" );
+		break;
+	}
+}
+
+/*
+=================
+Opt_Decode
+
+Split the bytecode into instructions and mark function entries and jump
+targets, which start new blocks
+=================
+*/
+static qboolean Opt_Decode( vm_t *vm, vmHeader_t *header )
+{
+	byte	*code;
+	int		i, pc, op, target;
+
+	code = (byte *)header + header->codeOffset;
+
+	for ( i = 0, pc = 0; i < opt.instructionCount; i++ ) {
+		if ( pc >= header->codeLength )
+			return qfalse;
+
+		op = code[pc++];
+		opt.ops[i] = op;
+
+		switch ( op ) {
+		case OP_ENTER:
+		case OP_LEAVE:
+		case OP_CONST:
+		case OP_LOCAL:
+		case OP_EQ:
+		case OP_NE:
+		case OP_LTI:
+		case OP_LEI:
+		case OP_GTI:
+		case OP_GEI:
+		case OP_LTU:
+		case OP_LEU:
+		case OP_GTU:
+		case OP_GEU:
+		case OP_EQF:
+		case OP_NEF:
+		case OP_LTF:
+		case OP_LEF:
+		case OP_GTF:
+		case OP_GEF:
+		case OP_BLOCK_COPY:
+			if ( pc + 4 > header->codeLength )
+				return qfalse;
+			opt.values[i] = code[pc] | ( code[pc+1] << 8 ) | ( code[pc+2] << 16 ) | ( (unsigned)code[pc+3] << 24 );
+			pc += 4;
+			break;
+		case OP_ARG:
+			if ( pc + 1 > header->codeLength )
+				return qfalse;
+			opt.values[i] = code[pc++];
+			break;
+		default:
+			if ( op > OP_CVFI )
+				return qfalse;
+			opt.values[i] = 0;
+			break;
+		}
+	}
+
+	if ( opt.ops[0] != OP_ENTER )
+		return qfalse;
+
+	for ( i = 0; i < opt.instructionCount; i++ ) {
+		op = opt.ops[i];
+
+		if ( op == OP_ENTER ) {
+			opt.flags[i] |= OPT_ENTRY;
+			continue;
+		}
+
+		if ( op >= OP_EQ && op <= OP_GEF )
+			target = opt.values[i];
+		else if ( op == OP_CONST && i + 1 < opt.instructionCount && opt.ops[i + 1] == OP_JUMP )
+			target = opt.values[i];
+		else
+			continue;
+
+		if ( target < 0 || target >= opt.instructionCount )
+			return qfalse;
+		opt.flags[target] |= OPT_TARGET;
+	}
+
+	for ( i = 0; i < vm->numJumpTableTargets; i++ ) {
+		target = *(int *)( vm->jumpTableTargets + i * sizeof( int ) );
+
+		if ( target < 0 || target >= opt.instructionCount )
+			return qfalse;
+		opt.flags[target] |= OPT_TARGET;
+	}
+
+	return qtrue;
+}
+
+/*
+=================
+VM_CompileOptimized
+
+Returns qfalse if the bytecode uses something this compiler doesn't handle
+=================
+*/
+static qboolean VM_CompileOptimized( vm_t *vm, vmHeader_t *header )
+{
+	int		maxLength;
+	int		i, jmpSystemCall;
+
+	if ( !vm->jumpTableTargets ) {
+		Com_DPrintf( "VM file %s has no jump table targets, not optimizing\n", vm->name );
+		return qfalse;
+	}
+
+	Com_Memset( &opt, 0, sizeof( opt ) );
+	opt.instructionCount = header->instructionCount;
+	opt.ops = Z_Malloc( opt.instructionCount );
+	opt.values = Z_Malloc( opt.instructionCount * sizeof( *opt.values ) );
+	opt.flags = Z_Malloc( opt.instructionCount );
+	opt.insOfs = Z_Malloc( opt.instructionCount * sizeof( *opt.insOfs ) );
+
+	maxLength = header->codeLength * 8 + 4096;
+	buf = Z_Malloc( maxLength );
+
+	if ( !Opt_Decode( vm, header ) )
+		Opt_Fail( "bad bytecode" );
+
+	// helpers shared with the basic compiler
+	compiledOfs = 0;
+	numRelocs = 0;
+	opt.doSyscallOfs = compiledOfs;
+	EmitCallDoSyscall( vm );
+	opt.syscallOfs = EmitCallProcedure( vm, opt.doSyscallOfs );
+
+	opt.errJumpOfs = compiledOfs;
+	EmitCallErrJump( vm, opt.doSyscallOfs );
+
+	opt.errStackOfs = compiledOfs;
+	EmitString( "B8" );						// mov eax, 0x12345678
+	Emit4( VM_STACK_VIOLATION );
+	EmitCallRel( vm, opt.doSyscallOfs );
+
+	// computed calls, eax is the instruction number or syscall
+	opt.callProcOfs = compiledOfs;
+	EmitString( "85 C0" );						// test eax, eax
+	EmitString( "7C" );						// jl systemCall
+	jmpSystemCall = compiledOfs++;
+	EmitString( "3D" );						// cmp eax, vm->instructionCount
+	Emit4( vm->instructionCount );
+	EmitString( "0F 83" );						// jae errJump
+	Emit4( opt.errJumpOfs - compiledOfs - 4 );
+	EmitString( "49 8B 04 C0" );					// mov rax, qword ptr [r8 + rax * 8]
+	EmitString( "48 BA" );						// mov rdx, entry marker
+	EmitString( OPT_ENTRY_MARKER );
+	EmitString( "48 39 10" );					// cmp qword ptr [rax], rdx
+	EmitString( "0F 85" );						// jne errJump
+	Emit4( opt.errJumpOfs - compiledOfs - 4 );
+	EmitString( "FF E0" );						// jmp rax
+	SET_JMPOFS( jmpSystemCall );
+	EmitString( "E9" );						// jmp syscall
+	Emit4( opt.syscallOfs - compiledOfs - 4 );
+
+	vm->entryOfs = compiledOfs;
+
+	for ( pass = 0; pass < 2 && !opt.error; pass++ ) {
+		compiledOfs = vm->entryOfs;
+
+		opt.numItems = 0;
+		opt.memTop = 0;
+		Com_Memset( opt.regUsed, 0, sizeof( opt.regUsed ) );
+		Com_Memset( opt.xmmUsed, 0, sizeof( opt.xmmUsed ) );
+
+		for ( i = 0; i < opt.instructionCount && !opt.error; i++ ) {
+			if ( compiledOfs > maxLength - 1024 ) {
+				Opt_Fail( "code buffer too small" );
+				break;
+			}
+
+			// blocks start with everything in memory
+			if ( opt.flags[i] )
+				Opt_Flush();
+
+			if ( pass && opt.insOfs[i] != compiledOfs ) {
+				Opt_Fail( "code size changed between passes" );
+				break;
+			}
+			opt.insOfs[i] = compiledOfs;
+
+			if ( opt.ops[i] == OP_ENTER )
+				Opt_BeginFunction( vm, i );
+
+			Opt_EmitInstruction( vm, i );
+		}
+
+		Opt_Flush();
+	}
+
+	if ( !opt.error ) {
+		VM_InstallCode( vm, compiledOfs );
+
+		// only blocks can be entered from outside
+		for ( i = 0; i < opt.instructionCount; i++ ) {
+			if ( opt.flags[i] )
+				vm->instructionPointers[i] = (intptr_t)vm->codeBase + opt.insOfs[i];
+			else
+				vm->instructionPointers[i] = (intptr_t)vm->codeBase + opt.errJumpOfs;
+		}
+
+		Com_DPrintf( "VM file %s compiled to %i bytes of optimized code\n", vm->name, compiledOfs );
+	} else {
+		Com_DPrintf( "VM file %s not optimized: %s\n", vm->name, opt.error );
+	}
+
+	Z_Free( buf );
+	Z_Free( opt.insOfs );
+	Z_Free( opt.flags );
+	Z_Free( opt.values );
+	Z_Free( opt.ops );
+
+	return !opt.error;
+}
+#endif
+
+#if idx64
+/*
+==============================================================================
+
+Compiled code cache
+
+The output of VM_Compile is saved to vmcache/<gamedir>/<name>.jit in the
+homepath, outside of the game directory a QVM can write to, together with
+the instruction pointers and the relocations, and the next VM_Create of
+the same qvm by the same build maps it back instead of compiling again.
+x86_64 code reaches the data segment and the instruction pointers through
+r8 and r9, so only the addresses emitted by EmitCallDoSyscall and
+EmitFtolThunk have to be patched.
+
+==============================================================================
+*/
+
+#define VM_CACHE_IDENT		(('T'<<24)+('I'<<16)+('J'<<8)+'Q')
+#define VM_CACHE_VERSION	2
+#define VM_CACHE_BUILD		Q3_VERSION " " PLATFORM_STRING " " __DATE__ " " __TIME__
+#define VM_CACHE_ALIGN		4096	// code starts on a page so it can be mapped
+
+// everything the generated code depends on
+typedef struct
+{
+	int			ident;
+	int			version;
+	char		build[64];
+	int			cpuFeatures;
+	int			optimize;
+	unsigned	qvmChecksum;
+	int			qvmLength;
+	int			instructionCount;
+	int			dataMask;
+} vmCacheKey_t;
+
+typedef struct
+{
+	vmCacheKey_t	key;
+
+	int			entryOfs;
+	int			codeOffset;		// in the file
+	int			codeLength;
+	int			numRelocs;
+	unsigned	tableChecksum;	// relocations and instruction pointers
+	unsigned	codeChecksum;
+} vmCacheHeader_t;
+
+/*
+=================
+VM_CacheKey
+=================
+*/
+static void VM_CacheKey(vm_t *vm, vmHeader_t *header, vmCacheKey_t *key)
+{
+	// key is compared with memcmp, clear the padding
+	Com_Memset(key, 0, sizeof(*key));
+
+	key->ident = VM_CACHE_IDENT;
+	key->version = VM_CACHE_VERSION;
+	Q_strncpyz(key->build, VM_CACHE_BUILD, sizeof(key->build));
+	key->cpuFeatures = Sys_GetProcessorFeatures();
+	key->optimize = Cvar_VariableIntegerValue("vm_optimize") != 0;
+	key->qvmLength = header->dataOffset + header->dataLength + header->litLength + header->jtrgLength;
+	key->qvmChecksum = Com_BlockChecksum(header, key->qvmLength);
+	key->instructionCount = header->instructionCount;
+	key->dataMask = vm->dataMask;
+}
+
+/*
+=================
+VM_CachePath
+=================
+*/
+static char *VM_CachePath(vm_t *vm)
+{
+	return FS_BuildOSPath(Cvar_VariableString("fs_homepath"), "vmcache",
+		va("%s/%s.jit", FS_GetCurrentGameDir(), vm->name));
+}
+
+/*
+=================
+VM_LoadCodeCache
+
+Returns qfalse if there is no usable cache entry for the vm
+=================
+*/
+static qboolean VM_LoadCodeCache(vm_t *vm, const vmCacheKey_t *key)
+{
+	vmCacheHeader_t		header;
+	FILE				*f;
+	int					*table, *ips;
+	int					tableLength;
+	long				fileLength;
+	qboolean			valid;
+	int					i;
+#ifdef VM_X86_MMAP
+	sysFileMapping_t	view;
+#endif
+
+	f = Sys_FOpen(VM_CachePath(vm), "rb");
+	if(!f)
+		return qfalse;
 
-	case OP_MULI:
-		v = Constant4();
+	fseek(f, 0, SEEK_END);
+	fileLength = ftell(f);
+	fseek(f, 0, SEEK_SET);
 
-		EmitMovEAXStack(vm, 0);
-		if(iss8(v))
-		{
-			EmitString("6B C0");			// imul eax, 0x7F
-			Emit1(v);
-		}
-		else
-		{
-			EmitString("69 C0");			// imul eax, 0x12345678
-			Emit4(v);
-		}
-		EmitCommand(LAST_COMMAND_MOV_STACK_EAX);
-		pc++;						// OP_MULI
-		instruction += 1;
+	if(fread(&header, sizeof(header), 1, f) != 1
+	|| memcmp(&header.key, key, sizeof(*key))
+	|| header.numRelocs < 0 || header.numRelocs > MAX_VM_RELOCS
+	|| header.codeLength <= 0 || header.entryOfs < 0 || header.entryOfs >= header.codeLength)
+	{
+		fclose(f);
+		return qfalse;
+	}
 
-		return qtrue;
+	tableLength = (header.numRelocs * 2 + key->instructionCount) * sizeof(int);
 
-	case OP_LSH:
-		v = NextConstant4();
-		if(v < 0 || v > 31)
-			break;
+	if(header.codeOffset != PAD(sizeof(header) + tableLength, VM_CACHE_ALIGN)
+	|| fileLength != (long) header.codeOffset + header.codeLength)
+	{
+		fclose(f);
+		return qfalse;
+	}
 
-		EmitMovEAXStack(vm, 0);
-		EmitString("C1 E0");				// shl eax, 0x12
-		Emit1(v);
-		EmitCommand(LAST_COMMAND_MOV_STACK_EAX);
+	table = Z_Malloc(tableLength);
 
-		pc += 5;					// CONST + OP_LSH
-		instruction += 1;
-		return qtrue;
+	if(fread(table, tableLength, 1, f) != 1 || Com_BlockChecksum(table, tableLength) != header.tableChecksum)
+	{
+		Z_Free(table);
+		fclose(f);
+		return qfalse;
+	}
 
-	case OP_RSHI:
-		v = NextConstant4();
-		if(v < 0 || v > 31)
-			break;
-			
-		EmitMovEAXStack(vm, 0);
-		EmitString("C1 F8");				// sar eax, 0x12
-		Emit1(v);
-		EmitCommand(LAST_COMMAND_MOV_STACK_EAX);
+	valid = qtrue;
+	for(i = 0; i < header.numRelocs; i++)
+	{
+		relocs[i].ofs = table[i * 2];
+		relocs[i].target = table[i * 2 + 1];
 
-		pc += 5;					// CONST + OP_RSHI
-		instruction += 1;
-		return qtrue;
+		if(relocs[i].ofs < 0 || relocs[i].ofs > header.codeLength - (int) sizeof(void *)
+		|| relocs[i].target < 0 || relocs[i].target >= VM_RELOC_COUNT)
+			valid = qfalse;
+	}
 
-	case OP_RSHU:
-		v = NextConstant4();
-		if(v < 0 || v > 31)
-			break;
-			
-		EmitMovEAXStack(vm, 0);
-		EmitString("C1 E8");				// shr eax, 0x12
-		Emit1(v);
-		EmitCommand(LAST_COMMAND_MOV_STACK_EAX);
+	ips = table + header.numRelocs * 2;
+	for(i = 0; i < key->instructionCount; i++)
+	{
+		if(ips[i] < 0 || ips[i] >= header.codeLength)
+			valid = qfalse;
+	}
 
-		pc += 5;					// CONST + OP_RSHU
-		instruction += 1;
-		return qtrue;
-	
-	case OP_BAND:
-		v = Constant4();
+	if(!valid)
+	{
+		Z_Free(table);
+		fclose(f);
+		return qfalse;
+	}
 
-		EmitMovEAXStack(vm, 0);
-		if(iss8(v))
-		{
-			EmitString("83 E0");			// and eax, 0x7F
-			Emit1(v);
-		}
-		else
+	vm->codeBase = NULL;
+
+#ifdef VM_X86_MMAP
+	// map the code straight from the file, the view is copy on write so
+	// the relocations can be patched in place
+	if(Sys_MapFile(f, header.codeOffset, header.codeLength, &view))
+	{
+		if(view.base == view.data && Com_BlockChecksum(view.data, header.codeLength) == header.codeChecksum)
 		{
-			EmitString("25");			// and eax, 0x12345678
-			Emit4(v);
-		}
-		EmitCommand(LAST_COMMAND_MOV_STACK_EAX);
-		
-		pc += 1;					// OP_BAND
-		instruction += 1;
-		return qtrue;
+			vm->codeBase = view.data;
+			vm->codeLength = header.codeLength;
 
-	case OP_BOR:
-		v = Constant4();
+			for(i = 0; i < header.numRelocs; i++)
+			{
+				void *ptr = VM_RelocTarget(relocs[i].target);
+				Com_Memcpy(vm->codeBase + relocs[i].ofs, &ptr, sizeof(ptr));
+			}
 
-		EmitMovEAXStack(vm, 0);
-		if(iss8(v))
-		{
-			EmitString("83 C8");			// or eax, 0x7F
-			Emit1(v);
+			if(mprotect(vm->codeBase, vm->codeLength, PROT_READ|PROT_EXEC))
+			{
+				Sys_UnmapFile(&view);
+				vm->codeBase = NULL;
+			}
+			else
+			{
+				vm->destroy = VM_Destroy_Compiled;
+				vm->sampleStack = VM_SampleStackCompiled;
+			}
 		}
 		else
-		{
-			EmitString("0D");			// or eax, 0x12345678
-			Emit4(v);
-		}
-		EmitCommand(LAST_COMMAND_MOV_STACK_EAX);
-		
-		pc += 1;				 	// OP_BOR
-		instruction += 1;
-		return qtrue;
+			Sys_UnmapFile(&view);
+	}
+#endif
 
-	case OP_BXOR:
-		v = Constant4();
-		
-		EmitMovEAXStack(vm, 0);
-		if(iss8(v))
+	if(!vm->codeBase)
+	{
+		buf = Z_Malloc(header.codeLength);
+
+		fseek(f, header.codeOffset, SEEK_SET);
+
+		if(fread(buf, header.codeLength, 1, f) != 1 || Com_BlockChecksum(buf, header.codeLength) != header.codeChecksum)
 		{
-			EmitString("83 F0");			// xor eax, 0x7F
-			Emit1(v);
+			Z_Free(buf);
+			Z_Free(table);
+			fclose(f);
+			return qfalse;
 		}
-		else
+
+		for(i = 0; i < header.numRelocs; i++)
 		{
-			EmitString("35");			// xor eax, 0x12345678
-			Emit4(v);
+			void *ptr = VM_RelocTarget(relocs[i].target);
+			Com_Memcpy(buf + relocs[i].ofs, &ptr, sizeof(ptr));
 		}
-		EmitCommand(LAST_COMMAND_MOV_STACK_EAX);
-		
-		pc += 1;					// OP_BXOR
-		instruction += 1;
-		return qtrue;
 
-	case OP_EQ:
-	case OP_NE:
-	case OP_LTI:
-	case OP_LEI:
-	case OP_GTI:
-	case OP_GEI:
-	case OP_LTU:
-	case OP_LEU:
-	case OP_GTU:
-	case OP_GEU:
-		EmitMovEAXStack(vm, 0);
-		EmitCommand(LAST_COMMAND_SUB_BL_1);
-		EmitString("3D");				// cmp eax, 0x12345678
-		Emit4(Constant4());
+		VM_InstallCode(vm, header.codeLength);
+		Z_Free(buf);
+	}
 
-		pc++;						// OP_*
-		EmitBranchConditions(vm, op1);
-		instruction++;
+	fclose(f);
 
-		return qtrue;
+	vm->entryOfs = header.entryOfs;
+	for(i = 0; i < key->instructionCount; i++)
+		vm->instructionPointers[i] = (intptr_t) vm->codeBase + ips[i];
 
-	case OP_EQF:
-	case OP_NEF:
-		if(NextConstant4())
-			break;
-		pc += 5;					// CONST + OP_EQF|OP_NEF
+	Z_Free(table);
 
-		EmitMovEAXStack(vm, 0);
-		EmitCommand(LAST_COMMAND_SUB_BL_1);
-		// floating point hack :)
-		EmitString("25");				// and eax, 0x7FFFFFFF
-		Emit4(0x7FFFFFFF);
-		if(op1 == OP_EQF)
-			EmitJumpIns(vm, "0F 84", Constant4());	// jz 0x12345678
-		else
-			EmitJumpIns(vm, "0F 85", Constant4());	// jnz 0x12345678
-		
-		instruction += 1;
-		return qtrue;
+	Com_DPrintf("VM file %s loaded %i bytes of code from the cache\n", vm->name, vm->codeLength);
 
+	return qtrue;
+}
 
-	case OP_JUMP:
-		EmitJumpIns(vm, "E9", Constant4());		// jmp 0x12345678
+/*
+=================
+VM_SaveCodeCache
+=================
+*/
+static void VM_SaveCodeCache(vm_t *vm, const vmCacheKey_t *key)
+{
+	vmCacheHeader_t		header;
+	char				ospath[MAX_OSPATH];
+	char				tmppath[MAX_OSPATH];
+	FILE				*f;
+	int					*table;
+	int					tableLength;
+	int					i;
+	qboolean			ok;
 
-		pc += 1;                  // OP_JUMP
-		instruction += 1;
-		return qtrue;
+	Q_strncpyz(ospath, VM_CachePath(vm), sizeof(ospath));
+	Com_sprintf(tmppath, sizeof(tmppath), "%s.tmp", ospath);
 
-	case OP_CALL:
-		v = Constant4();
-		EmitCallConst(vm, v, callProcOfsSyscall);
+	if(FS_CreatePath(ospath))
+		return;
 
-		pc += 1;                  // OP_CALL
-		instruction += 1;
-		return qtrue;
+	tableLength = (numRelocs * 2 + vm->instructionCount) * sizeof(int);
+	table = Z_Malloc(tableLength);
 
-	default:
-		break;
+	for(i = 0; i < numRelocs; i++)
+	{
+		table[i * 2] = relocs[i].ofs;
+		table[i * 2 + 1] = relocs[i].target;
 	}
 
-	return qfalse;
+	for(i = 0; i < vm->instructionCount; i++)
+		table[numRelocs * 2 + i] = vm->instructionPointers[i] - (intptr_t) vm->codeBase;
+
+	Com_Memset(&header, 0, sizeof(header));
+	header.key = *key;
+	header.entryOfs = vm->entryOfs;
+	header.codeOffset = PAD(sizeof(header) + tableLength, VM_CACHE_ALIGN);
+	header.codeLength = vm->codeLength;
+	header.numRelocs = numRelocs;
+	header.tableChecksum = Com_BlockChecksum(table, tableLength);
+	header.codeChecksum = Com_BlockChecksum(vm->codeBase, vm->codeLength);
+
+	// write to a temporary file and rename it, a running engine may still
+	// have the old one mapped
+	f = Sys_FOpen(tmppath, "wb");
+	if(!f)
+	{
+		Z_Free(table);
+		return;
+	}
+
+	ok = fwrite(&header, sizeof(header), 1, f) == 1 && fwrite(table, tableLength, 1, f) == 1;
+
+	for(i = sizeof(header) + tableLength; ok && i < header.codeOffset; i++)
+		ok = fputc(0, f) != EOF;
+
+	ok = ok && fwrite(vm->codeBase, vm->codeLength, 1, f) == 1;
+	ok = !fclose(f) && ok;
+
+	Z_Free(table);
+
+	if(ok)
+	{
+		remove(ospath);
+		ok = !rename(tmppath, ospath);
+	}
+
+	if(!ok)
+	{
+		remove(tmppath);
+		Com_DPrintf("VM file %s: couldn't write %s\n", vm->name, ospath);
+	}
 }
+#endif
 
 /*
 =================
@@ -1083,6 +3041,28 @@ void VM_Compile(vm_t *vm, vmHeader_t *header)
 	int		v;
 	int		i;
         int		callProcOfsSyscall, callProcOfs, callDoSyscallOfs;
+#ifdef FTOL_PTR
+	int		callFtolOfs;
+#endif
+
+#if idx64
+	vmCacheKey_t	cacheKey;
+	qboolean		useCache = Cvar_VariableIntegerValue("vm_cache");
+
+	if(useCache)
+	{
+		VM_CacheKey(vm, header, &cacheKey);
+		if(VM_LoadCodeCache(vm, &cacheKey))
+			return;
+	}
+
+	if(Cvar_VariableIntegerValue("vm_optimize") && VM_CompileOptimized(vm, header))
+	{
+		if(useCache)
+			VM_SaveCodeCache(vm, &cacheKey);
+		return;
+	}
+#endif
 
 	jusedSize = header->instructionCount + 2;
 
@@ -1110,10 +3090,14 @@ void VM_Compile(vm_t *vm, vmHeader_t *header)
 
 	// Start buffer with x86-VM specific procedures
 	compiledOfs = 0;
+	numRelocs = 0;
 
 	callDoSyscallOfs = compiledOfs;
 	callProcOfs = EmitCallDoSyscall(vm);
 	callProcOfsSyscall = EmitCallProcedure(vm, callDoSyscallOfs);
+#ifdef FTOL_PTR
+	callFtolOfs = EmitFtolThunk(vm);
+#endif
 	vm->entryOfs = compiledOfs;
 
 	for(pass=0; pass < 3; pass++) {
@@ -1604,9 +3588,7 @@ void VM_Compile(vm_t *vm, vmHeader_t *header)
 			EmitString("DB 1C 9F");				// fistp dword ptr [edi + ebx * 4]
 #else // FTOL_PTR
 			// call the library conversion function
-			EmitRexString(0x48, "BA");			// mov edx, Q_VMftol
-			EmitPtr(Q_VMftol);
-			EmitRexString(0x48, "FF D2");			// call edx
+			EmitCallRel(vm, callFtolOfs);			// call Q_VMftol
 			EmitCommand(LAST_COMMAND_MOV_STACK_EAX);	// mov dword ptr [edi + ebx * 4], eax
 #endif
 			break;
@@ -1654,49 +3636,22 @@ void VM_Compile(vm_t *vm, vmHeader_t *header)
 	}
 	}
 
-	// copy to an exact sized buffer with the appropriate permission bits
-	vm->codeLength = compiledOfs;
-#ifdef VM_X86_MMAP
-	vm->codeBase = mmap(NULL, compiledOfs, PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
-	if(vm->codeBase == MAP_FAILED)
-		Com_Error(ERR_FATAL, "VM_CompileX86: can't mmap memory");
-#elif _WIN32
-	// allocate memory with EXECUTE permissions under windows.
-	vm->codeBase = VirtualAlloc(NULL, compiledOfs, MEM_COMMIT, PAGE_EXECUTE_READWRITE);
-	if(!vm->codeBase)
-		Com_Error(ERR_FATAL, "VM_CompileX86: VirtualAlloc failed");
-#else
-	vm->codeBase = malloc(compiledOfs);
-	if(!vm->codeBase)
-	        Com_Error(ERR_FATAL, "VM_CompileX86: malloc failed");
-#endif
-
-	Com_Memcpy( vm->codeBase, buf, compiledOfs );
-
-#ifdef VM_X86_MMAP
-	if(mprotect(vm->codeBase, compiledOfs, PROT_READ|PROT_EXEC))
-		Com_Error(ERR_FATAL, "VM_CompileX86: mprotect failed");
-#elif _WIN32
-	{
-		DWORD oldProtect = 0;
-		
-		// remove write permissions.
-		if(!VirtualProtect(vm->codeBase, compiledOfs, PAGE_EXECUTE_READ, &oldProtect))
-			Com_Error(ERR_FATAL, "VM_CompileX86: VirtualProtect failed");
-	}
-#endif
+	VM_InstallCode(vm, compiledOfs);
 
 	Z_Free( code );
 	Z_Free( buf );
 	Z_Free( jused );
 	Com_DPrintf("VM file %s compiled to %i bytes of code\n", vm->name, compiledOfs);
 
-	vm->destroy = VM_Destroy_Compiled;
-
 	// offset all the instruction pointers for the new location
 	for ( i = 0 ; i < header->instructionCount ; i++ ) {
 		vm->instructionPointers[i] += (intptr_t) vm->codeBase;
 	}
+
+#if idx64
+	if(useCache)
+		VM_SaveCodeCache(vm, &cacheKey);
+#endif
 }
 
 void VM_Destroy_Compiled(vm_t* self)
@@ -1718,13 +3673,20 @@ This function is called directly by the generated code
 ==============
 */
 
+// the optimizing compiler addresses opStack slots on both sides of ebx
+#if idx64
+#define OPSTACK_GUARD	((OPT_MAX_DEPTH + 1) * 4)
+#else
+#define OPSTACK_GUARD	0
+#endif
+
 #if defined(_MSC_VER) && defined(idx64)
 extern uint8_t qvmcall64(int *programStack, int *opStack, intptr_t *instructionPointers, byte *dataBase);
 #endif
 
 int VM_CallCompiled(vm_t *vm, int *args)
 {
-	byte	stack[OPSTACK_SIZE + 15];
+	byte	stack[OPSTACK_SIZE + 2 * OPSTACK_GUARD + 15];
 	void	*entryPoint;
 	int		programStack, stackOnEntry;
 	byte	*image;
@@ -1753,7 +3715,7 @@ int VM_CallCompiled(vm_t *vm, int *args)
 
 	// off we go into generated code...
 	entryPoint = vm->codeBase + vm->entryOfs;
-	opStack = PADP(stack, 16);
+	opStack = PADP(stack + OPSTACK_GUARD, 16);
 	*opStack = 0xDEADBEEF;
 	opStackOfs = 0;
 
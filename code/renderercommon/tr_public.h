@@ -39,7 +39,7 @@ Suite 120, Rockville, Maryland 20850 USA.
   #include <zlib.h>
 #endif
 
-#define	REF_API_VERSION		9
+#define	REF_API_VERSION		11
 
 //
 // these are the functions exported by the refresh module
@@ -162,6 +162,9 @@ typedef struct {
 	void	*(*Hunk_AllocateTempMemory)( int size );
 	void	(*Hunk_FreeTempMemory)( void *block );
 
+	// scratch memory that is released at the start of the next frame
+	void	*(*FrameAlloc)( int size );
+
 #ifdef ZONE_DEBUG
 #define Malloc(size)					MallocDebug(size, #size, __FILE__, __LINE__)
 #define Free(ptr)						FreeDebug(ptr, #ptr, __FILE__, __LINE__)
@@ -202,6 +205,10 @@ typedef struct {
 	// NULL can be passed for buf to just determine existence
 	long	(*FS_ReadFile)( const char *name, void **buf );
 	void	(*FS_FreeFile)( void *buf );
+	// same as FS_ReadFile, but the file may be mapped instead of copied,
+	// so buf has no trailing 0 and must be released with FS_UnmapFile
+	long	(*FS_MapFile)( const char *name, void **buf );
+	void	(*FS_UnmapFile)( void *buf );
 	char **	(*FS_ListFiles)( const char *name, const char *extension, int *numfilesfound );
 	void	(*FS_FreeFileList)( char **filelist );
 	void	(*FS_WriteFile)( const char *qpath, const void *buffer, int size );
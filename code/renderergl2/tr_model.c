@@ -80,7 +80,7 @@ qhandle_t R_RegisterMD3(const char *name, model_t *mod)
 		else
 			Com_sprintf(namebuf, sizeof(namebuf), "%s.%s", filename, fext);
 
-		size = ri.FS_ReadFile( namebuf, &buf.v );
+		size = ri.FS_MapFile( namebuf, &buf.v );
 		if(!buf.u)
 			continue;
 		
@@ -92,7 +92,7 @@ qhandle_t R_RegisterMD3(const char *name, model_t *mod)
 		else
 			ri.Printf(PRINT_WARNING,"R_RegisterMD3: unknown fileid for %s\n", name);
 		
-		ri.FS_FreeFile(buf.v);
+		ri.FS_UnmapFile(buf.v);
 
 		if(loaded)
 		{
@@ -139,7 +139,7 @@ qhandle_t R_RegisterMDR(const char *name, model_t *mod)
 	qboolean loaded = qfalse;
 	int filesize;
 
-	filesize = ri.FS_ReadFile(name, (void **) &buf.v);
+	filesize = ri.FS_MapFile(name, (void **) &buf.v);
 	if(!buf.u)
 	{
 		mod->type = MOD_BAD;
@@ -150,7 +150,7 @@ qhandle_t R_RegisterMDR(const char *name, model_t *mod)
 	if(ident == MDR_IDENT)
 		loaded = R_LoadMDR(mod, buf.u, filesize, name);
 
-	ri.FS_FreeFile (buf.v);
+	ri.FS_UnmapFile (buf.v);
 	
 	if(!loaded)
 	{
@@ -176,7 +176,7 @@ qhandle_t R_RegisterMDS(const char *name, model_t *mod)
 	int	ident;
 	qboolean loaded = qfalse;
 
-	ri.FS_ReadFile(name, (void **) &buf.v);
+	ri.FS_MapFile(name, (void **) &buf.v);
 	if(!buf.u)
 	{
 		mod->type = MOD_BAD;
@@ -191,7 +191,7 @@ qhandle_t R_RegisterMDS(const char *name, model_t *mod)
 	else if(ident == MDX_IDENT)
 		loaded = R_LoadMDX(mod, buf.u, name);
 
-	ri.FS_FreeFile (buf.v);
+	ri.FS_UnmapFile (buf.v);
 	
 	if(!loaded)
 	{
@@ -217,7 +217,7 @@ qhandle_t R_RegisterIQM(const char *name, model_t *mod)
 	qboolean loaded = qfalse;
 	int filesize;
 
-	filesize = ri.FS_ReadFile(name, (void **) &buf.v);
+	filesize = ri.FS_MapFile(name, (void **) &buf.v);
 	if(!buf.u)
 	{
 		mod->type = MOD_BAD;
@@ -226,7 +226,7 @@ qhandle_t R_RegisterIQM(const char *name, model_t *mod)
 	
 	loaded = R_LoadIQM(mod, buf.u, filesize, name);
 
-	ri.FS_FreeFile (buf.v);
+	ri.FS_UnmapFile (buf.v);
 	
 	if(!loaded)
 	{
@@ -251,7 +251,7 @@ qhandle_t R_RegisterTAN(const char *name, model_t *mod)
 	} buf;
 	qboolean loaded = qfalse;
 
-	ri.FS_ReadFile(name, (void **) &buf.v);
+	ri.FS_MapFile(name, (void **) &buf.v);
 	if(!buf.u)
 	{
 		mod->type = MOD_BAD;
@@ -260,7 +260,7 @@ qhandle_t R_RegisterTAN(const char *name, model_t *mod)
 	
 	loaded = R_LoadTAN(mod, buf.u, name);
 
-	ri.FS_FreeFile (buf.v);
+	ri.FS_UnmapFile (buf.v);
 	
 	if(!loaded)
 	{
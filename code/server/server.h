@@ -52,6 +52,13 @@ typedef struct voipServerPacket_s
 } voipServerPacket_t;
 #endif
 
+// links an entity into the entity list of a PVS cluster
+typedef struct svClusterLink_s {
+	struct svClusterLink_s *prev, *next;
+	int			cluster;
+	int			entityNum;
+} svClusterLink_t;
+
 typedef struct svEntity_s {
 	struct worldSector_s *worldSector;
 	struct svEntity_s *nextEntityInWorldSector;
@@ -60,7 +67,9 @@ typedef struct svEntity_s {
 	int			clusternums[MAX_ENT_CLUSTERS];
 	int			lastCluster;		// if all the clusters don't fit in clusternums
 	int			areanum, areanum2;
-	int			snapshotCounter;	// used to prevent double adding from portal views
+
+	svClusterLink_t	clusterLinks[MAX_ENT_CLUSTERS];
+	int			numClusterLinks;
 } svEntity_t;
 
 typedef enum {
@@ -81,7 +90,6 @@ typedef struct {
 	qboolean		restarting;			// if true, send configstring changes during SS_LOADING
 	int				serverId;			// changes each server start
 	int				restartedServerId;	// serverId before a map_restart
-	int				snapshotCounter;	// incremented for each snapshot built
 	int				timeResidual;		// <= 1000 / sv_frame->value
 	int				nextFrameTime;		// when time > nextFrameTime, process world
 	configString_t	configstrings[MAX_CONFIGSTRINGS];
@@ -140,6 +148,8 @@ typedef struct netchan_buffer_s {
 	struct netchan_buffer_s *next;
 } netchan_buffer_t;
 
+typedef struct svDownloadFile_s svDownloadFile_t;
+
 typedef struct player_s {
 	qboolean		inUse;
 	qboolean		inWorld;
@@ -172,7 +182,7 @@ typedef struct client_s {
 
 	// downloading
 	char			downloadName[MAX_QPATH]; // if not empty string, we are downloading
-	fileHandle_t	download;			// file being downloaded
+	svDownloadFile_t	*download;		// file being downloaded
  	int				downloadSize;		// total bytes (can't use EOF because of paks)
  	int				downloadCount;		// bytes sent
 	int				downloadClientBlock;	// last block we sent to the client, awaiting ack
@@ -294,6 +304,7 @@ extern	cvar_t	*sv_master[MAX_MASTER_SERVERS];
 extern	cvar_t	*sv_reconnectlimit;
 extern	cvar_t	*sv_showloss;
 extern	cvar_t	*sv_padPackets;
+extern	cvar_t	*sv_snapshotThreads;
 extern	cvar_t	*sv_killserver;
 extern	cvar_t	*sv_mapname;
 extern	cvar_t	*sv_mapChecksum;
@@ -416,12 +427,37 @@ void SV_Heartbeat_f( void );
 // sv_snapshot.c
 //
 sharedEntityState_t *SV_SnapshotEntity( int num );
+sharedPlayerState_t *SV_SnapshotPlayer( clientSnapshot_t *snap, int num );
 void SV_AddServerCommand( client_t *client, int localPlayerNum, const char *cmd );
 void SV_UpdateServerCommandsToClient( client_t *client, msg_t *msg );
 void SV_WriteFrameToClient (client_t *client, msg_t *msg);
 void SV_SendMessageToClient( msg_t *msg, client_t *client );
 void SV_SendClientMessages( void );
 void SV_SendClientSnapshot( client_t *client );
+void SV_PrepareSnapshotEntities( void );
+void SV_InvalidateSnapshotEntities( void );
+void SV_ShutdownSnapshots( void );
+
+//
+// sv_demo.c
+//
+void SV_DemoRecord_f( void );
+void SV_DemoStopRecord_f( void );
+void SV_DemoStopRecord( void );
+void SV_DemoServerCommand( const char *cmd );
+void SV_DemoConfigstringChanged( int index );
+void SV_DemoAddClientFrame( client_t *client, clientSnapshot_t *frame );
+void SV_DemoWriteFrame( void );
+
+//
+// sv_download.c
+//
+svDownloadFile_t *SV_OpenDownloadFile( const char *name, int *size );
+void SV_CloseDownloadFile( svDownloadFile_t *file );
+int SV_ReadDownloadBlock( svDownloadFile_t *file, int offset, byte *buffer );
+void SV_UpdateDownloadFiles( void );
+qboolean SV_DownloadsPending( void );
+void SV_ShutdownDownloads( void );
 
 //
 // sv_game.c
@@ -453,10 +489,13 @@ int			SV_BotGetServerCommand( int playerNum, char *buf, int size );
 int BotImport_DebugPolygonCreate(int color, int numPoints, vec3_t *points);
 void BotImport_DebugPolygonShow(int id, int color, int numPoints, vec3_t *points);
 void BotImport_DebugPolygonDelete(int id);
+int BotImport_ParallelThreads(void);
+void BotImport_ParallelFor(jobFunc_t func, void *data, int count);
 
 void SV_ForceClientCommand( int playerNum, const char *command );
 
 void SV_BotInitBotLib(void);
+void SV_BotShutdownBotLib(void);
 
 //============================================================
 //
@@ -484,6 +523,20 @@ clipHandle_t SV_ClipHandleForEntity( const sharedEntity_t *ent );
 void SV_SectorList_f( void );
 
 
+void SV_UpdateEntityIndex( void );
+// rebuilds the broadcast list and the visibility dummy lists,
+// call before building snapshots
+
+void SV_MarkPVSEntities( const byte *pvs, byte *entityBits );
+// sets the bits of all entities that are in a cluster set in pvs
+// or have to be checked for every viewpoint
+
+int SV_FirstVisDummyMaster( int dummyNum );
+int SV_NextVisDummyMaster( int masterNum );
+// walks the linked entities whose visDummyNum is dummyNum in ascending
+// order, for a linked SVF_VISDUMMY_MULTIPLE entity. Returns -1 at the end
+
+
 int SV_AreaEntities( const vec3_t mins, const vec3_t maxs, int *entityList, int maxcount );
 // fills in a table of entity numbers with entities that have bounding boxes
 // that intersect the given area.  It is possible for a non-axial bmodel
@@ -508,6 +561,9 @@ void SV_Trace( trace_t *results, const vec3_t start, const vec3_t mins, const ve
 
 // passEntityNum is explicitly excluded from clipping checks (normally ENTITYNUM_NONE)
 
+void SV_TraceBatch( trace_t *results, const vec3_t *starts, const vec3_t mins, const vec3_t maxs, const vec3_t *ends, int count, int passEntityNum, int contentmask, traceType_t type );
+// SV_Trace for count traces with the same size, passEntityNum and contentmask
+
 void SV_ClipToEntities( trace_t *trace, const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end, int entityNum, int contentmask, traceType_t type );
 // clip to entities, but not world
 
@@ -44,6 +44,9 @@ cvar_t *bot_maxdebugpolys;
 
 cvar_t *bot_enable;
 
+static jobPool_t *botRoutingPool;
+cvar_t *bot_routingThreads;
+
 
 /*
 ==================
@@ -210,6 +213,34 @@ void BotImport_DebugPolygonDelete(int id)
 	debugpolygons[id].inuse = qfalse;
 }
 
+/*
+==================
+BotImport_ParallelThreads
+
+QVMs only run on the main thread
+==================
+*/
+int BotImport_ParallelThreads(void) {
+	if ( !gvm || !VM_IsNative( gvm ) ) {
+		return 1;
+	}
+
+	return Job_NumThreads( botRoutingPool );
+}
+
+/*
+==================
+BotImport_ParallelFor
+==================
+*/
+void BotImport_ParallelFor(jobFunc_t func, void *data, int count) {
+	if ( !gvm || !VM_IsNative( gvm ) ) {
+		Com_Error( ERR_DROP, "BotImport_ParallelFor: only game libraries can run jobs" );
+	}
+
+	Job_ParallelFor( botRoutingPool, func, data, count );
+}
+
 /*
 ==================
 SV_ClientForPlayerNum
@@ -262,6 +293,7 @@ Called at start up and map change
 void SV_BotInitCvars(void) {
 	bot_enable = Cvar_Get( "bot_enable", "1", CVAR_LATCH );
 	bot_maxdebugpolys = Cvar_Get( "bot_maxdebugpolys", "2", CVAR_LATCH );
+	bot_routingThreads = Cvar_Get( "bot_routingThreads", "0", CVAR_ARCHIVE | CVAR_LATCH );
 }
 
 /*
@@ -278,6 +310,28 @@ void SV_BotInitBotLib(void) {
 		bot_maxdebugpolys->modified = qfalse;
 	}
 	Com_Memset( debugpolygons, 0, sizeof(bot_debugpoly_t) * bot_maxdebugpolys->integer );
+
+	if ( bot_routingThreads->modified ) {
+		Job_DestroyPool( botRoutingPool );
+		botRoutingPool = NULL;
+		if ( bot_routingThreads->integer > 0 ) {
+			botRoutingPool = Job_CreatePool( "botRouting", bot_routingThreads->integer );
+		}
+		bot_routingThreads->modified = qfalse;
+	}
+}
+
+/*
+==================
+SV_BotShutdownBotLib
+
+Called at server shutdown
+==================
+*/
+void SV_BotShutdownBotLib(void) {
+	Job_DestroyPool( botRoutingPool );
+	botRoutingPool = NULL;
+	bot_routingThreads->modified = qtrue;
 }
 
 
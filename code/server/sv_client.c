@@ -954,9 +954,9 @@ static void SV_CloseDownload( client_t *cl ) {
 
 	// EOF
 	if (cl->download) {
-		FS_FCloseFile( cl->download );
+		SV_CloseDownloadFile( cl->download );
 	}
-	cl->download = 0;
+	cl->download = NULL;
 	*cl->downloadName = 0;
 
 	// Free the temporary buffer space
@@ -1103,13 +1103,13 @@ int SV_WriteDownloadToClient(client_t *cl, msg_t *msg)
 			}
 		}
 
-		cl->download = 0;
+		cl->download = NULL;
 
 		// We open the file here
 		if ( !(sv_allowDownload->integer & DLF_ENABLE) ||
 			(sv_allowDownload->integer & DLF_NO_UDP) ||
 			pakType != PAK_FREE || unreferenced ||
-			( cl->downloadSize = FS_SV_FOpenFileRead( cl->downloadName, &cl->download ) ) < 0 ) {
+			!( cl->download = SV_OpenDownloadFile( cl->downloadName, &cl->downloadSize ) ) ) {
 			// cannot auto-download file
 			if(unreferenced)
 			{
@@ -1155,7 +1155,10 @@ int SV_WriteDownloadToClient(client_t *cl, msg_t *msg)
 			*cl->downloadName = 0;
 			
 			if(cl->download)
-				FS_FCloseFile(cl->download);
+			{
+				SV_CloseDownloadFile(cl->download);
+				cl->download = NULL;
+			}
 			
 			return 1;
 		}
@@ -1177,10 +1180,16 @@ int SV_WriteDownloadToClient(client_t *cl, msg_t *msg)
 		if (!cl->downloadBlocks[curindex])
 			cl->downloadBlocks[curindex] = Z_Malloc(MAX_DOWNLOAD_BLKSIZE);
 
-		cl->downloadBlockSize[curindex] = FS_Read( cl->downloadBlocks[curindex], MAX_DOWNLOAD_BLKSIZE, cl->download );
+		// the data is read by the download thread, send what is loaded
+		cl->downloadBlockSize[curindex] = SV_ReadDownloadBlock( cl->download, cl->downloadCount, cl->downloadBlocks[curindex] );
+
+		if (cl->downloadBlockSize[curindex] == 0)
+			break;
 
 		if (cl->downloadBlockSize[curindex] < 0) {
 			// EOF right now
+			Com_Printf( "clientDownload: %d : failed to read \"%s\"\n", (int) (cl - svs.clients), cl->downloadName );
+			cl->downloadBlockSize[curindex] = 0;
 			cl->downloadCount = cl->downloadSize;
 			break;
 		}
@@ -1290,6 +1299,8 @@ int SV_SendDownloadMessages(void)
 	client_t *cl;
 	msg_t msg;
 	byte msgBuffer[MAX_MSGLEN];
+
+	SV_UpdateDownloadFiles();
 	
 	for(i=0; i < sv_maxclients->integer; i++)
 	{
@@ -0,0 +1,738 @@
+/*
+===========================================================================
+Copyright (C) 1999-2010 id Software LLC, a ZeniMax Media company.
+
+This file is part of Spearmint Source Code.
+
+Spearmint Source Code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 3 of the License,
+or (at your option) any later version.
+
+Spearmint Source Code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Spearmint Source Code.  If not, see <http://www.gnu.org/licenses/>.
+
+In addition, Spearmint Source Code is also subject to certain additional terms.
+You should have received a copy of these additional terms immediately following
+the terms and conditions of the GNU General Public License.  If not, please
+request a copy in writing from id Software at the address below.
+
+If you have questions concerning this license or the applicable additional
+terms, you may contact in writing id Software LLC, c/o ZeniMax Media Inc.,
+Suite 120, Rockville, Maryland 20850 USA.
+===========================================================================
+*/
+// sv_demo.c -- server side demos holding the snapshots of every client
+
+#include "server.h"
+
+/*
+=============================================================================
+
+A server demo starts with an svDemoHeader_t followed by messages stored
+the same way as client demos: 4 byte sequence, 4 byte length, message.
+
+The first message has the gamestate configstrings. Every following
+message holds the broadcast server commands and configstring changes
+since the last one followed by an svc_snapshot:
+
+4	serverTime
+1	number of clients
+	1	client number
+	1	number of playerstates
+		1	player number
+		1	areaBytes
+		<areabytes>
+		<playerstate> delta from the last state recorded for the player
+	2	number of entities that entered or left the client's view
+		<entity numbers>
+<packet entities> every entity seen by any client, delta from the last message
+
+Each entity delta is written once no matter how many clients saw it.
+Messages are handed to a writer thread so disk access doesn't hold up
+the server frame.
+
+=============================================================================
+*/
+
+#define SVDEMO_MAGIC		"SPEARMINT_SVDEMO"
+#define SVDEMO_MSGLEN		0x80000
+#define SVDEMO_BUFFER_SIZE	0x200000	// must be a power of two
+#define SVDEMO_COMMAND_SIZE	0x10000
+
+typedef struct {
+	char	magic[17];		// SVDEMO_MAGIC with null byte
+	byte	padding[3];
+	int		headerSize;
+	int		protocol;
+	int		maxClients;
+	char	startTime[20];	// "YYYY-MM-DD HH:MM:SS" with null byte
+	char	endTime[20];	// "YYYY-MM-DD HH:MM:SS" with null byte
+	int		runTime;		// assumed to be directly after endTime
+} svDemoHeader_t;
+
+typedef struct {
+	qboolean			recording;
+	fileHandle_t		file;
+	char				name[MAX_OSPATH];
+	int					startTime;
+	int					sequence;
+	byte				*msgData;
+
+	// gathered while sending snapshots, written at the end of the frame
+	int					numClients;
+	client_t			*clients[MAX_CLIENTS];
+	clientSnapshot_t	*frames[MAX_CLIENTS];
+	char				commands[SVDEMO_COMMAND_SIZE];
+	int					commandsLength;
+	byte				configstringsChanged[(MAX_CONFIGSTRINGS+7)/8];
+
+	// what the last message left the reader with
+	byte				*entityStates;		// [MAX_GENTITIES*sv.gameEntityStateSize]
+	byte				entityValid[MAX_GENTITIES/8];
+	byte				*playerStates;		// [MAX_CLIENTS*sv.gamePlayerStateSize]
+	byte				playerValid[MAX_CLIENTS/8];
+	byte				clientEntities[MAX_CLIENTS][MAX_GENTITIES/8];
+
+	// writer thread, NULL if messages are written directly
+	void				*thread;
+	void				*mutex;
+	void				*wake;
+	void				*drained;
+	byte				*buffer;
+	unsigned int		head;
+	unsigned int		tail;
+	qboolean			quit;
+	qboolean			writeError;
+	qboolean			warnedFull;
+} svDemo_t;
+
+static svDemo_t svDemo;
+
+/*
+==================
+SV_DemoWriterThread
+
+Writes everything between tail and head, then waits for more.
+==================
+*/
+static void SV_DemoWriterThread( void *arg ) {
+	unsigned int	head, tail, length;
+	qboolean		quit, error;
+
+	for ( ;; ) {
+		Sys_SemaphoreWait( svDemo.wake );
+
+		Sys_LockMutex( svDemo.mutex );
+		head = svDemo.head;
+		tail = svDemo.tail;
+		quit = svDemo.quit;
+		Sys_UnlockMutex( svDemo.mutex );
+
+		while ( tail != head ) {
+			length = MIN( head - tail, SVDEMO_BUFFER_SIZE - ( tail & ( SVDEMO_BUFFER_SIZE - 1 ) ) );
+			// errors are reported by the main thread
+			error = ( FS_ThreadWrite( svDemo.buffer + ( tail & ( SVDEMO_BUFFER_SIZE - 1 ) ), length, svDemo.file ) != length );
+			tail += length;
+
+			Sys_LockMutex( svDemo.mutex );
+			svDemo.tail = tail;
+			if ( error ) {
+				svDemo.writeError = qtrue;
+			}
+			Sys_UnlockMutex( svDemo.mutex );
+
+			Sys_SemaphorePost( svDemo.drained );
+		}
+
+		if ( quit ) {
+			break;
+		}
+	}
+}
+
+/*
+==================
+SV_DemoStartWriter
+==================
+*/
+static void SV_DemoStartWriter( void ) {
+	svDemo.head = svDemo.tail = 0;
+	svDemo.quit = qfalse;
+	svDemo.writeError = qfalse;
+	svDemo.warnedFull = qfalse;
+
+	svDemo.mutex = Sys_CreateMutex();
+	svDemo.wake = Sys_CreateSemaphore( 0 );
+	svDemo.drained = Sys_CreateSemaphore( 0 );
+
+	if ( svDemo.mutex && svDemo.wake && svDemo.drained ) {
+		svDemo.buffer = Z_Malloc( SVDEMO_BUFFER_SIZE );
+		svDemo.thread = Sys_CreateThread( SV_DemoWriterThread, NULL );
+	}
+
+	if ( !svDemo.thread ) {
+		Com_DPrintf( "Server demo writer thread not available, writing directly\n" );
+	}
+}
+
+/*
+==================
+SV_DemoStopWriter
+
+Waits for the writer thread to finish writing all queued data.
+==================
+*/
+static void SV_DemoStopWriter( void ) {
+	if ( svDemo.thread ) {
+		Sys_LockMutex( svDemo.mutex );
+		svDemo.quit = qtrue;
+		Sys_UnlockMutex( svDemo.mutex );
+
+		Sys_SemaphorePost( svDemo.wake );
+		Sys_JoinThread( svDemo.thread );
+		svDemo.thread = NULL;
+	}
+
+	if ( svDemo.buffer ) {
+		Z_Free( svDemo.buffer );
+		svDemo.buffer = NULL;
+	}
+
+	if ( svDemo.drained ) {
+		Sys_DestroySemaphore( svDemo.drained );
+		svDemo.drained = NULL;
+	}
+
+	if ( svDemo.wake ) {
+		Sys_DestroySemaphore( svDemo.wake );
+		svDemo.wake = NULL;
+	}
+
+	if ( svDemo.mutex ) {
+		Sys_DestroyMutex( svDemo.mutex );
+		svDemo.mutex = NULL;
+	}
+}
+
+/*
+==================
+SV_DemoWrite
+
+Queue data for the writer thread. Only waits if the whole buffer is
+still waiting to reach the disk.
+==================
+*/
+static void SV_DemoWrite( const void *data, int length ) {
+	const byte		*in;
+	unsigned int	used, count;
+
+	if ( !svDemo.thread ) {
+		if ( FS_Write( data, length, svDemo.file ) != length ) {
+			svDemo.writeError = qtrue;
+		}
+		return;
+	}
+
+	in = (const byte *)data;
+
+	while ( length > 0 ) {
+		Sys_LockMutex( svDemo.mutex );
+		used = svDemo.head - svDemo.tail;
+		Sys_UnlockMutex( svDemo.mutex );
+
+		if ( used == SVDEMO_BUFFER_SIZE ) {
+			if ( !svDemo.warnedFull ) {
+				Com_Printf( S_COLOR_YELLOW "WARNING: server demo is being written slower than it is recorded\n" );
+				svDemo.warnedFull = qtrue;
+			}
+			Sys_SemaphoreWait( svDemo.drained );
+			continue;
+		}
+
+		count = SVDEMO_BUFFER_SIZE - used;
+		count = MIN( count, SVDEMO_BUFFER_SIZE - ( svDemo.head & ( SVDEMO_BUFFER_SIZE - 1 ) ) );
+		count = MIN( count, length );
+
+		Com_Memcpy( svDemo.buffer + ( svDemo.head & ( SVDEMO_BUFFER_SIZE - 1 ) ), in, count );
+		in += count;
+		length -= count;
+
+		Sys_LockMutex( svDemo.mutex );
+		svDemo.head += count;
+		Sys_UnlockMutex( svDemo.mutex );
+
+		Sys_SemaphorePost( svDemo.wake );
+	}
+}
+
+/*
+==================
+SV_DemoWriteMessage
+==================
+*/
+static void SV_DemoWriteMessage( msg_t *msg ) {
+	int		swlen;
+
+	swlen = LittleLong( svDemo.sequence );
+	SV_DemoWrite( &swlen, 4 );
+	svDemo.sequence++;
+
+	swlen = LittleLong( msg->cursize );
+	SV_DemoWrite( &swlen, 4 );
+	SV_DemoWrite( msg->data, msg->cursize );
+}
+
+/*
+==================
+SV_DemoFreeState
+==================
+*/
+static void SV_DemoFreeState( void ) {
+	if ( svDemo.msgData ) {
+		Z_Free( svDemo.msgData );
+		svDemo.msgData = NULL;
+	}
+
+	if ( svDemo.entityStates ) {
+		Z_Free( svDemo.entityStates );
+		svDemo.entityStates = NULL;
+	}
+
+	if ( svDemo.playerStates ) {
+		Z_Free( svDemo.playerStates );
+		svDemo.playerStates = NULL;
+	}
+}
+
+/*
+==================
+SV_DemoStopRecord
+==================
+*/
+void SV_DemoStopRecord( void ) {
+	int				len;
+	svDemoHeader_t	header;
+	qtime_t			now;
+
+	if ( !svDemo.recording ) {
+		return;
+	}
+
+	// finish up
+	len = -1;
+	SV_DemoWrite( &len, 4 );
+	SV_DemoWrite( &len, 4 );
+
+	SV_DemoStopWriter();
+
+	if ( svDemo.writeError ) {
+		Com_Printf( S_COLOR_YELLOW "WARNING: server demo %s was not completely written\n", svDemo.name );
+	}
+
+	// update end time in header
+	if ( FS_Seek( svDemo.file, offsetof( svDemoHeader_t, endTime ), FS_SEEK_SET ) == 0 ) {
+		Com_RealTime( &now );
+
+		Com_sprintf( header.endTime, sizeof(header.endTime), "%04d-%02d-%02d %02d:%02d:%02d",
+						1900 + now.tm_year,
+						1 + now.tm_mon,
+						now.tm_mday,
+						now.tm_hour,
+						now.tm_min,
+						now.tm_sec );
+
+		header.runTime = LittleLong( Sys_Milliseconds() - svDemo.startTime );
+
+		FS_Write( header.endTime, sizeof(header.endTime), svDemo.file );
+		FS_Write( &header.runTime, sizeof(header.runTime), svDemo.file );
+	}
+
+	FS_FCloseFile( svDemo.file );
+	svDemo.file = 0;
+	svDemo.recording = qfalse;
+
+	SV_DemoFreeState();
+
+	Com_Printf( "Stopped server demo %s.\n", svDemo.name );
+}
+
+/*
+==================
+SV_DemoWriteGamestate
+==================
+*/
+static void SV_DemoWriteGamestate( void ) {
+	msg_t	msg;
+	int		i;
+
+	MSG_Init( &msg, svDemo.msgData, SVDEMO_MSGLEN );
+	MSG_Bitstream( &msg );
+
+	MSG_WriteByte( &msg, svc_gamestate );
+
+	for ( i = 0 ; i < MAX_CONFIGSTRINGS ; i++ ) {
+		if ( sv.configstrings[i].s[0] ) {
+			MSG_WriteByte( &msg, svc_configstring );
+			MSG_WriteShort( &msg, i );
+			MSG_WriteBigString( &msg, sv.configstrings[i].s );
+		}
+	}
+
+	MSG_WriteByte( &msg, svc_EOF );
+
+	SV_DemoWriteMessage( &msg );
+}
+
+/*
+==================
+SV_DemoRecord_f
+
+svrecord [demoname]
+==================
+*/
+void SV_DemoRecord_f( void ) {
+	char			demoName[MAX_QPATH];
+	char			name[MAX_OSPATH];
+	int				number;
+	svDemoHeader_t	header;
+	qtime_t			now;
+
+	if ( Cmd_Argc() > 2 ) {
+		Com_Printf( "svrecord [demoname]\n" );
+		return;
+	}
+
+	if ( !com_sv_running->integer || sv.state != SS_GAME ) {
+		Com_Printf( "Server is not running.\n" );
+		return;
+	}
+
+	if ( svDemo.recording ) {
+		Com_Printf( "Already recording %s.\n", svDemo.name );
+		return;
+	}
+
+	if ( Cmd_Argc() == 2 ) {
+		Q_strncpyz( demoName, Cmd_Argv(1), sizeof( demoName ) );
+		Com_sprintf( name, sizeof(name), "demos/%s.sv%s", demoName, com_demoext->string );
+	} else {
+		// scan for a free demo name
+		for ( number = 0 ; number <= 9999 ; number++ ) {
+			Com_sprintf( demoName, sizeof(demoName), "server%04i", number );
+			Com_sprintf( name, sizeof(name), "demos/%s.sv%s", demoName, com_demoext->string );
+
+			if ( !FS_FileExists( name ) ) {
+				break;	// file doesn't exist
+			}
+		}
+	}
+
+	svDemo.file = FS_FOpenFileWrite( name );
+	if ( !svDemo.file ) {
+		Com_Printf( "ERROR: couldn't open %s.\n", name );
+		return;
+	}
+
+	Com_Printf( "recording server demo to %s.\n", name );
+
+	Q_strncpyz( svDemo.name, name, sizeof( svDemo.name ) );
+	svDemo.recording = qtrue;
+	svDemo.startTime = Sys_Milliseconds();
+	svDemo.sequence = 0;
+	svDemo.numClients = 0;
+	svDemo.commandsLength = 0;
+	Com_Memset( svDemo.configstringsChanged, 0, sizeof( svDemo.configstringsChanged ) );
+	Com_Memset( svDemo.entityValid, 0, sizeof( svDemo.entityValid ) );
+	Com_Memset( svDemo.playerValid, 0, sizeof( svDemo.playerValid ) );
+	Com_Memset( svDemo.clientEntities, 0, sizeof( svDemo.clientEntities ) );
+
+	svDemo.msgData = Z_Malloc( SVDEMO_MSGLEN );
+	svDemo.entityStates = Z_Malloc( MAX_GENTITIES * sv.gameEntityStateSize );
+	svDemo.playerStates = Z_Malloc( MAX_CLIENTS * sv.gamePlayerStateSize );
+
+	SV_DemoStartWriter();
+
+	// setup demo header
+	Com_RealTime( &now );
+
+	Com_Memset( &header, 0, sizeof ( header ) );
+	Com_Memcpy( header.magic, SVDEMO_MAGIC, sizeof ( header.magic ) );
+	header.headerSize = LittleLong( sizeof( header ) );
+	header.protocol = LittleLong( com_protocol->integer );
+	header.maxClients = LittleLong( sv_maxclients->integer );
+
+	Com_sprintf( header.startTime, sizeof(header.startTime), "%04d-%02d-%02d %02d:%02d:%02d",
+					1900 + now.tm_year,
+					1 + now.tm_mon,
+					now.tm_mday,
+					now.tm_hour,
+					now.tm_min,
+					now.tm_sec );
+
+	SV_DemoWrite( &header, sizeof( header ) );
+
+	SV_DemoWriteGamestate();
+}
+
+/*
+==================
+SV_DemoStopRecord_f
+==================
+*/
+void SV_DemoStopRecord_f( void ) {
+	if ( !svDemo.recording ) {
+		Com_Printf( "Not recording a server demo.\n" );
+		return;
+	}
+
+	SV_DemoStopRecord();
+}
+
+/*
+==================
+SV_DemoServerCommand
+
+Called for server commands sent to every client.
+==================
+*/
+void SV_DemoServerCommand( const char *cmd ) {
+	int		length;
+
+	if ( !svDemo.recording ) {
+		return;
+	}
+
+	length = strlen( cmd ) + 1;
+
+	if ( svDemo.commandsLength + length > sizeof( svDemo.commands ) ) {
+		Com_DPrintf( "SV_DemoServerCommand: dropped %s\n", cmd );
+		return;
+	}
+
+	Com_Memcpy( svDemo.commands + svDemo.commandsLength, cmd, length );
+	svDemo.commandsLength += length;
+}
+
+/*
+==================
+SV_DemoConfigstringChanged
+==================
+*/
+void SV_DemoConfigstringChanged( int index ) {
+	if ( !svDemo.recording ) {
+		return;
+	}
+
+	svDemo.configstringsChanged[index >> 3] |= 1 << ( index & 7 );
+}
+
+/*
+==================
+SV_DemoAddClientFrame
+
+Called after a client's snapshot has been built.
+==================
+*/
+void SV_DemoAddClientFrame( client_t *client, clientSnapshot_t *frame ) {
+	if ( !svDemo.recording || svDemo.numClients == MAX_CLIENTS ) {
+		return;
+	}
+
+	svDemo.clients[svDemo.numClients] = client;
+	svDemo.frames[svDemo.numClients] = frame;
+	svDemo.numClients++;
+}
+
+/*
+==================
+SV_DemoWriteClient
+
+Write the client's playerstates and the changes to the set of entities it can see.
+==================
+*/
+static void SV_DemoWriteClient( msg_t *msg, client_t *client, clientSnapshot_t *frame, const byte *entityBits ) {
+	sharedPlayerState_t	*ps, *oldps;
+	byte				*seen;
+	byte				changed[MAX_GENTITIES/8];
+	int					clientNum, playerNum;
+	int					i, numChanged;
+
+	clientNum = client - svs.clients;
+
+	MSG_WriteByte( msg, clientNum );
+	MSG_WriteByte( msg, frame->numPSs );
+
+	for ( i = 0; i < frame->numPSs; i++ ) {
+		ps = SV_SnapshotPlayer( frame, i );
+		playerNum = ps->playerNum;
+
+		MSG_WriteByte( msg, playerNum );
+		MSG_WriteByte( msg, frame->areabytes[i] );
+		MSG_WriteData( msg, frame->areabits[i], frame->areabytes[i] );
+
+		if ( playerNum < 0 || playerNum >= MAX_CLIENTS ) {
+			MSG_WriteDeltaPlayerstate( msg, NULL, ps );
+			continue;
+		}
+
+		oldps = (sharedPlayerState_t *)( svDemo.playerStates + playerNum * sv.gamePlayerStateSize );
+
+		if ( svDemo.playerValid[playerNum >> 3] & ( 1 << ( playerNum & 7 ) ) ) {
+			MSG_WriteDeltaPlayerstate( msg, oldps, ps );
+		} else {
+			MSG_WriteDeltaPlayerstate( msg, NULL, ps );
+		}
+
+		Com_Memcpy( oldps, ps, sv.gamePlayerStateSize );
+		svDemo.playerValid[playerNum >> 3] |= 1 << ( playerNum & 7 );
+	}
+
+	// entities that entered or left the view since the client's last recorded frame
+	seen = svDemo.clientEntities[clientNum];
+	for ( i = 0; i < MAX_GENTITIES/8; i++ ) {
+		changed[i] = seen[i] ^ entityBits[i];
+		seen[i] = entityBits[i];
+	}
+
+	numChanged = 0;
+	for ( i = 0; i < MAX_GENTITIES; i++ ) {
+		if ( changed[i >> 3] & ( 1 << ( i & 7 ) ) ) {
+			numChanged++;
+		}
+	}
+
+	MSG_WriteShort( msg, numChanged );
+
+	for ( i = 0; i < MAX_GENTITIES; i++ ) {
+		if ( changed[i >> 3] & ( 1 << ( i & 7 ) ) ) {
+			MSG_WriteBits( msg, i, GENTITYNUM_BITS );
+		}
+	}
+}
+
+/*
+==================
+SV_DemoWriteEntities
+
+Delta every entity seen this frame from the last written message.
+==================
+*/
+static void SV_DemoWriteEntities( msg_t *msg, const byte *entityBits, sharedEntityState_t **states ) {
+	sharedEntityState_t	*oldent;
+	int					num;
+	qboolean			oldValid, newValid;
+
+	for ( num = 0; num < MAX_GENTITIES - 1; num++ ) {
+		oldValid = ( svDemo.entityValid[num >> 3] & ( 1 << ( num & 7 ) ) ) != 0;
+		newValid = ( entityBits[num >> 3] & ( 1 << ( num & 7 ) ) ) != 0;
+
+		if ( !oldValid && !newValid ) {
+			continue;
+		}
+
+		oldent = (sharedEntityState_t *)( svDemo.entityStates + num * sv.gameEntityStateSize );
+
+		if ( !newValid ) {
+			// the entity isn't seen by anyone anymore
+			MSG_WriteDeltaEntity( msg, oldent, NULL, qtrue );
+			continue;
+		}
+
+		if ( oldValid ) {
+			MSG_WriteDeltaEntity( msg, oldent, states[num], qfalse );
+		} else {
+			MSG_WriteDeltaEntity( msg, NULL, states[num], qtrue );
+		}
+
+		Com_Memcpy( oldent, states[num], sv.gameEntityStateSize );
+	}
+
+	MSG_WriteBits( msg, (MAX_GENTITIES-1), GENTITYNUM_BITS );	// end of packetentities
+
+	Com_Memcpy( svDemo.entityValid, entityBits, sizeof( svDemo.entityValid ) );
+}
+
+/*
+==================
+SV_DemoWriteFrame
+
+Called after snapshots have been sent to clients.
+==================
+*/
+void SV_DemoWriteFrame( void ) {
+	static sharedEntityState_t	*states[MAX_GENTITIES];
+	byte				allEntities[MAX_GENTITIES/8];
+	byte				clientEntities[MAX_GENTITIES/8];
+	clientSnapshot_t	*frame;
+	sharedEntityState_t	*state;
+	msg_t				msg;
+	int					i, j, num;
+
+	if ( !svDemo.recording ) {
+		return;
+	}
+
+	if ( !svDemo.numClients && !svDemo.commandsLength ) {
+		return;
+	}
+
+	MSG_Init( &msg, svDemo.msgData, SVDEMO_MSGLEN );
+	MSG_Bitstream( &msg );
+
+	for ( i = 0; i < svDemo.commandsLength; i += strlen( svDemo.commands + i ) + 1 ) {
+		MSG_WriteByte( &msg, svc_serverCommand );
+		MSG_WriteString( &msg, svDemo.commands + i );
+	}
+	svDemo.commandsLength = 0;
+
+	for ( i = 0; i < MAX_CONFIGSTRINGS; i++ ) {
+		if ( svDemo.configstringsChanged[i >> 3] & ( 1 << ( i & 7 ) ) ) {
+			MSG_WriteByte( &msg, svc_configstring );
+			MSG_WriteShort( &msg, i );
+			MSG_WriteBigString( &msg, sv.configstrings[i].s );
+		}
+	}
+	Com_Memset( svDemo.configstringsChanged, 0, sizeof( svDemo.configstringsChanged ) );
+
+	MSG_WriteByte( &msg, svc_snapshot );
+	MSG_WriteLong( &msg, sv.time );
+	MSG_WriteByte( &msg, svDemo.numClients );
+
+	Com_Memset( allEntities, 0, sizeof( allEntities ) );
+
+	for ( i = 0; i < svDemo.numClients; i++ ) {
+		frame = svDemo.frames[i];
+
+		Com_Memset( clientEntities, 0, sizeof( clientEntities ) );
+
+		for ( j = 0; j < frame->num_entities; j++ ) {
+			state = SV_SnapshotEntity( frame->first_entity + j );
+			num = state->number;
+
+			clientEntities[num >> 3] |= 1 << ( num & 7 );
+			allEntities[num >> 3] |= 1 << ( num & 7 );
+			states[num] = state;
+		}
+
+		SV_DemoWriteClient( &msg, svDemo.clients[i], frame, clientEntities );
+	}
+	svDemo.numClients = 0;
+
+	SV_DemoWriteEntities( &msg, allEntities, states );
+
+	MSG_WriteByte( &msg, svc_EOF );
+
+	if ( msg.overflowed ) {
+		Com_Printf( S_COLOR_YELLOW "WARNING: server demo frame overflowed\n" );
+		SV_DemoStopRecord();
+		return;
+	}
+
+	SV_DemoWriteMessage( &msg );
+}
@@ -0,0 +1,495 @@
+/*
+===========================================================================
+Copyright (C) 1999-2010 id Software LLC, a ZeniMax Media company.
+
+This file is part of Spearmint Source Code.
+
+Spearmint Source Code is free software; you can redistribute it
+and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation; either version 3 of the License,
+or (at your option) any later version.
+
+Spearmint Source Code is distributed in the hope that it will be
+useful, but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Spearmint Source Code.  If not, see <http://www.gnu.org/licenses/>.
+
+In addition, Spearmint Source Code is also subject to certain additional terms.
+You should have received a copy of these additional terms immediately following
+the terms and conditions of the GNU General Public License.  If not, please
+request a copy in writing from id Software at the address below.
+
+If you have questions concerning this license or the applicable additional
+terms, you may contact in writing id Software LLC, c/o ZeniMax Media Inc.,
+Suite 120, Rockville, Maryland 20850 USA.
+===========================================================================
+*/
+// sv_download.c -- file data for client downloads, read ahead on a worker thread
+
+#include "server.h"
+
+/*
+=============================================================================
+
+Files being downloaded are shared by every client downloading them and
+are loaded in chunks by a worker thread, so sending download blocks
+never waits for the disk. A client that gets ahead of the loaded data
+simply sends nothing until the chunk arrives.
+
+=============================================================================
+*/
+
+#define DOWNLOAD_CHUNK_SIZE		( 64 * MAX_DOWNLOAD_BLKSIZE )
+#define DOWNLOAD_READAHEAD		2		// chunks loaded ahead of the one being sent
+#define DOWNLOAD_CHUNK_TIMEOUT	10000	// msec to keep a chunk nobody asked for
+#define MAX_DOWNLOAD_FILES		16
+#define MAX_DOWNLOAD_REQUESTS	64
+
+typedef enum {
+	DLCHUNK_EMPTY,
+	DLCHUNK_QUEUED,		// waiting for or being read by the worker thread
+	DLCHUNK_READY,
+	DLCHUNK_FAILED
+} downloadChunkState_t;
+
+typedef struct {
+	byte					*data;
+	downloadChunkState_t	state;
+	int						lastUsed;
+} downloadChunk_t;
+
+struct svDownloadFile_s {
+	char				name[MAX_QPATH];
+	fileHandle_t		file;		// only read by the worker thread once opened
+	int					size;
+	int					numChunks;
+	downloadChunk_t		*chunks;
+	int					refCount;
+	int					pending;	// chunks queued for the worker thread
+};
+
+typedef struct {
+	svDownloadFile_t	*file;
+	int					chunk;
+} downloadRequest_t;
+
+static svDownloadFile_t		downloadFiles[MAX_DOWNLOAD_FILES];
+
+static downloadRequest_t	downloadRequests[MAX_DOWNLOAD_REQUESTS];
+static int					downloadRequestHead;
+static int					downloadRequestTail;
+
+static void					*downloadThread;
+static void					*downloadMutex;
+static void					*downloadWake;
+static qboolean				downloadQuit;
+static qboolean				downloadThreadTried;
+
+/*
+==================
+SV_LoadDownloadChunk
+==================
+*/
+static downloadChunkState_t SV_LoadDownloadChunk( svDownloadFile_t *file, int chunk, byte *data ) {
+	int		offset, length;
+
+	offset = chunk * DOWNLOAD_CHUNK_SIZE;
+	length = MIN( DOWNLOAD_CHUNK_SIZE, file->size - offset );
+
+	if ( FS_Seek( file->file, offset, FS_SEEK_SET ) != 0 ) {
+		return DLCHUNK_FAILED;
+	}
+
+	// counted by SV_QueueDownloadChunk on the main thread
+	if ( FS_ThreadRead( data, length, file->file ) != length ) {
+		return DLCHUNK_FAILED;
+	}
+
+	return DLCHUNK_READY;
+}
+
+/*
+==================
+SV_DownloadThread
+==================
+*/
+static void SV_DownloadThread( void *arg ) {
+	downloadRequest_t		request;
+	downloadChunkState_t	state;
+
+	for ( ;; ) {
+		Sys_SemaphoreWait( downloadWake );
+
+		Sys_LockMutex( downloadMutex );
+		if ( downloadRequestTail == downloadRequestHead ) {
+			if ( downloadQuit ) {
+				Sys_UnlockMutex( downloadMutex );
+				break;
+			}
+			Sys_UnlockMutex( downloadMutex );
+			continue;
+		}
+		request = downloadRequests[downloadRequestTail % MAX_DOWNLOAD_REQUESTS];
+		Sys_UnlockMutex( downloadMutex );
+
+		state = SV_LoadDownloadChunk( request.file, request.chunk, request.file->chunks[request.chunk].data );
+
+		Sys_LockMutex( downloadMutex );
+		request.file->chunks[request.chunk].state = state;
+		request.file->pending--;
+		downloadRequestTail++;
+		Sys_UnlockMutex( downloadMutex );
+	}
+}
+
+/*
+==================
+SV_StartDownloadThread
+==================
+*/
+static void SV_StartDownloadThread( void ) {
+	if ( downloadThreadTried ) {
+		return;
+	}
+	downloadThreadTried = qtrue;
+
+	downloadRequestHead = downloadRequestTail = 0;
+	downloadQuit = qfalse;
+
+	downloadMutex = Sys_CreateMutex();
+	downloadWake = Sys_CreateSemaphore( 0 );
+
+	if ( downloadMutex && downloadWake ) {
+		downloadThread = Sys_CreateThread( SV_DownloadThread, NULL );
+	}
+
+	if ( !downloadThread ) {
+		Com_DPrintf( "Download thread not available, reading downloads directly\n" );
+	}
+}
+
+/*
+==================
+SV_QueueDownloadChunk
+==================
+*/
+static void SV_QueueDownloadChunk( svDownloadFile_t *file, int chunk ) {
+	downloadChunk_t	*dlChunk;
+	int				length;
+
+	if ( chunk < 0 || chunk >= file->numChunks ) {
+		return;
+	}
+
+	dlChunk = &file->chunks[chunk];
+
+	// the worker thread only touches queued chunks
+	if ( dlChunk->state != DLCHUNK_EMPTY ) {
+		return;
+	}
+
+	length = MIN( DOWNLOAD_CHUNK_SIZE, file->size - chunk * DOWNLOAD_CHUNK_SIZE );
+
+	if ( !dlChunk->data ) {
+		dlChunk->data = Z_Malloc( length );
+	}
+
+	dlChunk->lastUsed = Sys_Milliseconds();
+
+	if ( !downloadThread ) {
+		FS_CountRead( length );
+		dlChunk->state = SV_LoadDownloadChunk( file, chunk, dlChunk->data );
+		return;
+	}
+
+	Sys_LockMutex( downloadMutex );
+	if ( downloadRequestHead - downloadRequestTail == MAX_DOWNLOAD_REQUESTS ) {
+		// try again later
+		Sys_UnlockMutex( downloadMutex );
+		return;
+	}
+
+	downloadRequests[downloadRequestHead % MAX_DOWNLOAD_REQUESTS].file = file;
+	downloadRequests[downloadRequestHead % MAX_DOWNLOAD_REQUESTS].chunk = chunk;
+	downloadRequestHead++;
+	dlChunk->state = DLCHUNK_QUEUED;
+	file->pending++;
+	Sys_UnlockMutex( downloadMutex );
+
+	FS_CountRead( length );
+
+	Sys_SemaphorePost( downloadWake );
+}
+
+/*
+==================
+SV_ChunkState
+==================
+*/
+static downloadChunkState_t SV_ChunkState( downloadChunk_t *chunk ) {
+	downloadChunkState_t	state;
+
+	if ( !downloadThread ) {
+		return chunk->state;
+	}
+
+	Sys_LockMutex( downloadMutex );
+	state = chunk->state;
+	Sys_UnlockMutex( downloadMutex );
+
+	return state;
+}
+
+/*
+==================
+SV_FreeDownloadChunks
+
+Free chunks that are loaded and not used for a while, or all of them.
+==================
+*/
+static void SV_FreeDownloadChunks( svDownloadFile_t *file, qboolean all ) {
+	downloadChunk_t	*chunk;
+	int				i, now;
+
+	now = Sys_Milliseconds();
+
+	for ( i = 0, chunk = file->chunks; i < file->numChunks; i++, chunk++ ) {
+		if ( !chunk->data || SV_ChunkState( chunk ) == DLCHUNK_QUEUED ) {
+			continue;
+		}
+
+		if ( !all && now - chunk->lastUsed < DOWNLOAD_CHUNK_TIMEOUT ) {
+			continue;
+		}
+
+		Z_Free( chunk->data );
+		chunk->data = NULL;
+		chunk->state = DLCHUNK_EMPTY;
+	}
+}
+
+/*
+==================
+SV_CloseDownloadFile
+
+Drop a reference, the file is closed in SV_UpdateDownloadFiles once
+the worker thread is done with it.
+==================
+*/
+void SV_CloseDownloadFile( svDownloadFile_t *file ) {
+	if ( file && file->refCount > 0 ) {
+		file->refCount--;
+	}
+}
+
+/*
+==================
+SV_UpdateDownloadFiles
+
+Release chunks and files nobody is using.
+==================
+*/
+void SV_UpdateDownloadFiles( void ) {
+	svDownloadFile_t	*file;
+	int					i, pending;
+
+	for ( i = 0, file = downloadFiles; i < MAX_DOWNLOAD_FILES; i++, file++ ) {
+		if ( !file->file ) {
+			continue;
+		}
+
+		if ( file->refCount ) {
+			SV_FreeDownloadChunks( file, qfalse );
+			continue;
+		}
+
+		if ( downloadThread ) {
+			Sys_LockMutex( downloadMutex );
+			pending = file->pending;
+			Sys_UnlockMutex( downloadMutex );
+
+			if ( pending ) {
+				continue;
+			}
+		}
+
+		SV_FreeDownloadChunks( file, qtrue );
+		Z_Free( file->chunks );
+		FS_FCloseFile( file->file );
+		Com_Memset( file, 0, sizeof( *file ) );
+	}
+}
+
+/*
+==================
+SV_DownloadsPending
+
+Returns qtrue if chunks are being read, so downloads should be checked again soon.
+==================
+*/
+qboolean SV_DownloadsPending( void ) {
+	qboolean	pending;
+
+	if ( !downloadThread ) {
+		return qfalse;
+	}
+
+	Sys_LockMutex( downloadMutex );
+	pending = ( downloadRequestHead != downloadRequestTail );
+	Sys_UnlockMutex( downloadMutex );
+
+	return pending;
+}
+
+/*
+==================
+SV_OpenDownloadFile
+
+Returns a file shared with other clients downloading the same name, or
+NULL with size set to -1 if it can't be opened.
+==================
+*/
+svDownloadFile_t *SV_OpenDownloadFile( const char *name, int *size ) {
+	svDownloadFile_t	*file, *freeFile;
+	int					i;
+
+	SV_StartDownloadThread();
+
+	freeFile = NULL;
+	for ( i = 0, file = downloadFiles; i < MAX_DOWNLOAD_FILES; i++, file++ ) {
+		if ( !file->file ) {
+			if ( !freeFile ) {
+				freeFile = file;
+			}
+			continue;
+		}
+
+		if ( !FS_FilenameCompare( file->name, name ) ) {
+			file->refCount++;
+			*size = file->size;
+			return file;
+		}
+	}
+
+	if ( !freeFile ) {
+		// close files nobody uses anymore to make room
+		SV_UpdateDownloadFiles();
+
+		for ( i = 0, file = downloadFiles; i < MAX_DOWNLOAD_FILES; i++, file++ ) {
+			if ( !file->file ) {
+				freeFile = file;
+				break;
+			}
+		}
+
+		if ( !freeFile ) {
+			Com_Printf( "SV_OpenDownloadFile: too many files being downloaded\n" );
+			*size = -1;
+			return NULL;
+		}
+	}
+
+	file = freeFile;
+
+	file->size = FS_SV_FOpenFileRead( name, &file->file );
+	if ( file->size < 0 || !file->file ) {
+		if ( file->file ) {
+			FS_FCloseFile( file->file );
+		}
+		Com_Memset( file, 0, sizeof( *file ) );
+		*size = -1;
+		return NULL;
+	}
+
+	Q_strncpyz( file->name, name, sizeof( file->name ) );
+	file->numChunks = ( file->size + DOWNLOAD_CHUNK_SIZE - 1 ) / DOWNLOAD_CHUNK_SIZE;
+	file->chunks = Z_Malloc( MAX( file->numChunks, 1 ) * sizeof( file->chunks[0] ) );
+	file->refCount = 1;
+	file->pending = 0;
+
+	*size = file->size;
+	return file;
+}
+
+/*
+==================
+SV_ReadDownloadBlock
+
+Copy up to MAX_DOWNLOAD_BLKSIZE bytes at offset, which must be a multiple
+of MAX_DOWNLOAD_BLKSIZE. Returns the number of bytes copied, 0 if the
+data is still being loaded or -1 if it couldn't be read.
+==================
+*/
+int SV_ReadDownloadBlock( svDownloadFile_t *file, int offset, byte *buffer ) {
+	downloadChunk_t	*dlChunk;
+	int				chunk, length, i;
+
+	if ( offset < 0 || offset >= file->size ) {
+		return -1;
+	}
+
+	chunk = offset / DOWNLOAD_CHUNK_SIZE;
+	dlChunk = &file->chunks[chunk];
+
+	// keep the worker thread ahead of the client
+	for ( i = 0; i <= DOWNLOAD_READAHEAD; i++ ) {
+		SV_QueueDownloadChunk( file, chunk + i );
+	}
+
+	switch ( SV_ChunkState( dlChunk ) ) {
+		case DLCHUNK_READY:
+			break;
+		case DLCHUNK_FAILED:
+			return -1;
+		default:
+			return 0;
+	}
+
+	dlChunk->lastUsed = Sys_Milliseconds();
+
+	length = MIN( MAX_DOWNLOAD_BLKSIZE, file->size - offset );
+	Com_Memcpy( buffer, dlChunk->data + ( offset - chunk * DOWNLOAD_CHUNK_SIZE ), length );
+
+	return length;
+}
+
+/*
+==================
+SV_ShutdownDownloads
+==================
+*/
+void SV_ShutdownDownloads( void ) {
+	int		i;
+
+	if ( downloadThread ) {
+		Sys_LockMutex( downloadMutex );
+		downloadQuit = qtrue;
+		Sys_UnlockMutex( downloadMutex );
+
+		Sys_SemaphorePost( downloadWake );
+		Sys_JoinThread( downloadThread );
+		downloadThread = NULL;
+	}
+
+	if ( downloadWake ) {
+		Sys_DestroySemaphore( downloadWake );
+		downloadWake = NULL;
+	}
+
+	if ( downloadMutex ) {
+		Sys_DestroyMutex( downloadMutex );
+		downloadMutex = NULL;
+	}
+
+	downloadThreadTried = qfalse;
+
+	// clients have been dropped, so nothing references the files anymore
+	for ( i = 0; i < MAX_DOWNLOAD_FILES; i++ ) {
+		downloadFiles[i].refCount = 0;
+	}
+
+	SV_UpdateDownloadFiles();
+}
@@ -473,6 +473,17 @@ intptr_t SV_GameSystemCalls( intptr_t *args ) {
 	case G_CLIPTOENTITIESCAPSULE:
 		SV_ClipToEntities( VMA(1), VMA(2), VMA(3), VMA(4), VMA(5), args[6], args[7], TT_CAPSULE );
 		return 0;
+	case G_TRACEBATCH:
+		SV_TraceBatch( VMA(1), VMA(2), VMA(3), VMA(4), VMA(5), args[6], args[7], args[8], TT_AABB );
+		return 0;
+	case G_TRACEBATCHCAPSULE:
+		SV_TraceBatch( VMA(1), VMA(2), VMA(3), VMA(4), VMA(5), args[6], args[7], args[8], TT_CAPSULE );
+		return 0;
+	case G_BOT_PARALLEL_THREADS:
+		return BotImport_ParallelThreads();
+	case G_BOT_PARALLEL_FOR:
+		BotImport_ParallelFor( (jobFunc_t)args[1], VMA(2), args[3] );
+		return 0;
 	case G_POINT_CONTENTS:
 		return SV_PointContents( VMA(1), args[2] );
 	case G_GET_BRUSH_BOUNDS:
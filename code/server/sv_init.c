@@ -134,6 +134,8 @@ void SV_SetConfigstring (int index, const char *val) {
 	Z_Free( sv.configstrings[index].s );
 	sv.configstrings[index].s = CopyString( val );
 
+	SV_DemoConfigstringChanged( index );
+
 	// send it to all the clients if we aren't
 	// spawning a new server
 	if ( sv.state == SS_GAME || sv.restarting ) {
@@ -488,6 +490,9 @@ void SV_SpawnServer( char *server, qboolean killBots ) {
 	char		systemInfo[16384];
 	const char	*p;
 
+	// a server demo can't continue across levels
+	SV_DemoStopRecord();
+
 	// shut down the existing game if it is running
 	SV_ShutdownGameProgs();
 
@@ -806,6 +811,7 @@ void SV_Init (void)
 	sv_reconnectlimit = Cvar_Get ("sv_reconnectlimit", "3", 0);
 	sv_showloss = Cvar_Get ("sv_showloss", "0", 0);
 	sv_padPackets = Cvar_Get ("sv_padPackets", "0", 0);
+	sv_snapshotThreads = Cvar_Get ("sv_snapshotThreads", "0", CVAR_ARCHIVE);
 	sv_killserver = Cvar_Get ("sv_killserver", "0", 0);
 	sv_mapChecksum = Cvar_Get ("sv_mapChecksum", "", CVAR_ROM);
 	sv_lanForceRate = Cvar_Get ("sv_lanForceRate", "1", CVAR_ARCHIVE );
@@ -836,6 +842,9 @@ void SV_FinalMessage( char *message ) {
 	int			i, j;
 	client_t	*cl;
 	
+	// the game doesn't run while the messages are sent
+	SV_PrepareSnapshotEntities();
+
 	// send it twice, ignoring rate
 	for ( j = 0 ; j < 2 ; j++ ) {
 		for (i=0, cl = svs.clients ; i < sv_maxclients->integer ; i++, cl++) {
@@ -851,6 +860,8 @@ void SV_FinalMessage( char *message ) {
 			}
 		}
 	}
+
+	SV_InvalidateSnapshotEntities();
 }
 
 
@@ -875,9 +886,13 @@ void SV_Shutdown( char *finalmsg ) {
 		SV_FinalMessage( finalmsg );
 	}
 
+	SV_DemoStopRecord();
+	SV_ShutdownSnapshots();
+	SV_ShutdownDownloads();
 	SV_RemoveOperatorCommands();
 	SV_MasterShutdown();
 	SV_ShutdownGameProgs();
+	SV_BotShutdownBotLib();
 
 #ifdef DEDICATED
 	Com_ShutdownRef();
@@ -54,6 +54,7 @@ cvar_t	*sv_master[MAX_MASTER_SERVERS];	// master server ip address
 cvar_t	*sv_reconnectlimit;		// minimum seconds between connect messages
 cvar_t	*sv_showloss;			// report when usercmds are lost
 cvar_t	*sv_padPackets;			// add nop bytes to messages
+cvar_t	*sv_snapshotThreads;	// worker threads building snapshots, 0 = build on the main thread
 cvar_t	*sv_killserver;			// menu system can set to 1 to shut server down
 cvar_t	*sv_mapname;
 cvar_t	*sv_mapChecksum;
@@ -233,6 +234,8 @@ void QDECL SV_SendServerCommand(client_t *cl, int localPlayerNum, const char *fm
 		Com_Printf ("broadcast: %s\n", SV_ExpandNewlines((char *)message) );
 	}
 
+	SV_DemoServerCommand( (char *)message );
+
 	// send the data to all relevant clients
 	for (j = 0, client = svs.clients; j < sv_maxclients->integer ; j++, client++) {
 		SV_AddServerCommand( client, -1, (char *)message );
@@ -1309,6 +1312,8 @@ int SV_RateMsec(client_t *client)
 		return rateMsec - rate;
 }
 
+#define DOWNLOAD_RATE_WINDOW	100	// msec
+
 /*
 ====================
 SV_SendQueuedPackets
@@ -1322,8 +1327,10 @@ Return the time in msec until we expect to be called next
 int SV_SendQueuedPackets()
 {
 	int numBlocks;
-	int dlStart, deltaT, delayT;
-	static int dlNextRound = 0;
+	int now, elapsed, limit, used, delayT;
+	static int dlWindowStart = 0;
+	static int dlWindowBytes = 0;
+	static int dlLastWindowBytes = 0;
 	int timeVal = INT_MAX;
 
 	// Send out fragmented packets now that we're idle
@@ -1333,51 +1340,60 @@ int SV_SendQueuedPackets()
 
 	if(sv_dlRate->integer)
 	{
-		// Rate limiting. This is very imprecise for high
-		// download rates due to millisecond timedelta resolution
-		dlStart = Sys_Milliseconds();
-		deltaT = dlNextRound - dlStart;
-
-		if(deltaT > 0)
-		{
-			if(deltaT < timeVal)
-				timeVal = deltaT + 1;
-		}
-		else
+		// Sliding window rate limiting. The bytes sent in the last
+		// window count less the further the current window goes,
+		// which avoids both bursts at window boundaries and the
+		// rounding of per round delays at high rates.
+		now = Sys_Milliseconds();
+		elapsed = now - dlWindowStart;
+
+		if(elapsed >= DOWNLOAD_RATE_WINDOW)
 		{
-			numBlocks = SV_SendDownloadMessages();
-
-			if(numBlocks)
+			if(elapsed >= 2 * DOWNLOAD_RATE_WINDOW)
+			{
+				dlLastWindowBytes = 0;
+				dlWindowStart = now;
+			}
+			else
 			{
-				// There are active downloads
-				deltaT = Sys_Milliseconds() - dlStart;
+				dlLastWindowBytes = dlWindowBytes;
+				dlWindowStart += DOWNLOAD_RATE_WINDOW;
+			}
+
+			dlWindowBytes = 0;
+			elapsed = now - dlWindowStart;
+		}
 
-				delayT = 1000 * numBlocks * MAX_DOWNLOAD_BLKSIZE;
-				delayT /= sv_dlRate->integer * 1024;
+		limit = sv_dlRate->integer * 1024 / (1000 / DOWNLOAD_RATE_WINDOW);
+		used = dlWindowBytes + dlLastWindowBytes * (DOWNLOAD_RATE_WINDOW - elapsed) / DOWNLOAD_RATE_WINDOW;
 
-				if(delayT <= deltaT + 1)
-				{
-					// Sending the last round of download messages
-					// took too long for given rate, don't wait for
-					// next round, but always enforce a 1ms delay
-					// between DL message rounds so we don't hog
-					// all of the bandwidth. This will result in an
-					// effective maximum rate of 1MB/s per user, but the
-					// low download window size limits this anyways.
-					if(timeVal > 2)
-						timeVal = 2;
-
-					dlNextRound = dlStart + deltaT + 1;
-				}
-				else
-				{
-					dlNextRound = dlStart + delayT;
-					delayT -= deltaT;
+		if(used < limit)
+		{
+			numBlocks = SV_SendDownloadMessages();
+			dlWindowBytes += numBlocks * MAX_DOWNLOAD_BLKSIZE;
+			used += numBlocks * MAX_DOWNLOAD_BLKSIZE;
+
+			// There are active downloads, come back for the next
+			// round but always keep a 1ms delay between rounds so
+			// we don't hog all of the bandwidth
+			if(numBlocks && used < limit && timeVal > 1)
+				timeVal = 1;
+		}
 
-					if(delayT < timeVal)
-						timeVal = delayT;
-				}
-			}
+		if(used >= limit)
+		{
+			// wait until enough of the last window has slid out,
+			// or the current one is over
+			if(dlLastWindowBytes > 0)
+				delayT = (used - limit) * DOWNLOAD_RATE_WINDOW / dlLastWindowBytes + 1;
+			else
+				delayT = DOWNLOAD_RATE_WINDOW - elapsed + 1;
+
+			if(delayT > DOWNLOAD_RATE_WINDOW - elapsed + 1)
+				delayT = DOWNLOAD_RATE_WINDOW - elapsed + 1;
+
+			if(delayT < timeVal)
+				timeVal = delayT;
 		}
 	}
 	else
@@ -1386,5 +1402,9 @@ int SV_SendQueuedPackets()
 			timeVal = 0;
 	}
 
+	// download data is being loaded, check back soon
+	if(SV_DownloadsPending() && timeVal > 5)
+		timeVal = 5;
+
 	return timeVal;
 }
@@ -76,6 +76,204 @@ A normal server packet will look like:
 =============================================================================
 */
 
+/*
+=============================================================================
+
+Clients that acknowledged the same snapshot, and entities that are sent from
+their baseline, produce the same entity deltas. The encoded bits are kept
+for the frame and copied into the other clients' messages. Entries are
+matched by comparing the states, so a hit always gives the same bits as
+encoding the delta again.
+
+=============================================================================
+*/
+
+#define	DELTA_CACHE_ENTRIES		2048
+#define	DELTA_CACHE_HASH		1024
+#define	DELTA_CACHE_BYTES		(256*1024)
+#define	DELTA_CACHE_MAX_DELTA	1024		// longer deltas aren't cached
+
+typedef struct deltaCacheEntry_s {
+	unsigned int		hash;
+	qboolean			force;
+	byte				*from, *to;
+	byte				*bits;
+	int					numBits;
+	int					numChangedFields;	// for the field statistics
+	unsigned int		changeMask[MAX_NETF_MASK_WORDS];
+	struct deltaCacheEntry_s	*next;
+} deltaCacheEntry_t;
+
+typedef struct {
+	void				*mutex;
+	int					stateSize;
+	byte				*states;			// from and to for each entry
+
+	int					numEntries;
+	int					bytesUsed;
+	deltaCacheEntry_t	*hashTable[DELTA_CACHE_HASH];
+	deltaCacheEntry_t	entries[DELTA_CACHE_ENTRIES];
+	byte				bits[DELTA_CACHE_BYTES];
+} deltaCache_t;
+
+static deltaCache_t		*deltaCache;
+
+/*
+=============
+SV_ClearDeltaCache
+
+Called before the snapshots of a frame are written
+=============
+*/
+static void SV_ClearDeltaCache( void ) {
+	if ( deltaCache && deltaCache->stateSize != sv.gameEntityStateSize ) {
+		Z_Free( deltaCache->states );
+		deltaCache->states = NULL;
+	}
+
+	if ( !deltaCache ) {
+		deltaCache = Z_Malloc( sizeof( *deltaCache ) );
+		deltaCache->mutex = Sys_CreateMutex();
+	}
+
+	if ( !deltaCache->states ) {
+		deltaCache->stateSize = sv.gameEntityStateSize;
+		deltaCache->states = Z_Malloc( DELTA_CACHE_ENTRIES * 2 * deltaCache->stateSize );
+	}
+
+	deltaCache->numEntries = 0;
+	deltaCache->bytesUsed = 0;
+	Com_Memset( deltaCache->hashTable, 0, sizeof( deltaCache->hashTable ) );
+}
+
+/*
+=============
+SV_FreeDeltaCache
+=============
+*/
+static void SV_FreeDeltaCache( void ) {
+	if ( !deltaCache ) {
+		return;
+	}
+
+	Sys_DestroyMutex( deltaCache->mutex );
+	if ( deltaCache->states ) {
+		Z_Free( deltaCache->states );
+	}
+	Z_Free( deltaCache );
+	deltaCache = NULL;
+}
+
+/*
+=============
+SV_DeltaCacheHash
+=============
+*/
+static unsigned int SV_DeltaCacheHash( const byte *from, const byte *to, int size, qboolean force ) {
+	unsigned int	hash;
+	unsigned int	word;
+	int				i;
+
+	hash = force ? 0x9e3779b9 : 0;
+
+	for ( i = 0; i + 4 <= size; i += 4 ) {
+		Com_Memcpy( &word, from + i, 4 );
+		hash = ( hash ^ word ) * 0x01000193;
+		Com_Memcpy( &word, to + i, 4 );
+		hash = ( hash ^ word ) * 0x01000193;
+	}
+	for ( ; i < size; i++ ) {
+		hash = ( hash ^ from[i] ) * 0x01000193;
+		hash = ( hash ^ to[i] ) * 0x01000193;
+	}
+
+	return hash ^ ( hash >> 16 );
+}
+
+/*
+=============
+SV_WriteDeltaEntity
+
+MSG_WriteDeltaEntity for a delta that other clients may need too.
+Safe to call from a worker thread.
+=============
+*/
+static void SV_WriteDeltaEntity( msg_t *msg, sharedEntityState_t *from, sharedEntityState_t *to, qboolean force ) {
+	deltaCacheEntry_t	*entry;
+	unsigned int		hash;
+	int					size;
+	byte				buf[DELTA_CACHE_MAX_DELTA];
+	msg_t				delta;
+	int					numChangedFields;
+	unsigned int		changeMask[MAX_NETF_MASK_WORDS];
+
+	size = sv.gameEntityStateSize;
+
+	if ( !deltaCache || deltaCache->stateSize != size ) {
+		MSG_WriteDeltaEntity( msg, from, to, force );
+		return;
+	}
+
+	// nothing at all will be written for an unchanged entity
+	if ( !force && !memcmp( from, to, size ) ) {
+		return;
+	}
+
+	hash = SV_DeltaCacheHash( (byte *)from, (byte *)to, size, force );
+
+	Sys_LockMutex( deltaCache->mutex );
+	for ( entry = deltaCache->hashTable[hash & ( DELTA_CACHE_HASH - 1 )]; entry; entry = entry->next ) {
+		if ( entry->hash == hash && entry->force == force
+			&& !memcmp( entry->from, from, size ) && !memcmp( entry->to, to, size ) ) {
+			break;
+		}
+	}
+	Sys_UnlockMutex( deltaCache->mutex );
+
+	// entries don't change once they are added
+	if ( entry ) {
+		MSG_WriteBitsFrom( msg, entry->bits, entry->numBits );
+		MSG_CountDeltaEntity( msg, entry->numChangedFields, entry->changeMask );
+		return;
+	}
+
+	MSG_Init( &delta, buf, sizeof( buf ) );
+	delta.allowoverflow = qtrue;
+	delta.stats = msg->stats;
+	numChangedFields = MSG_WriteDeltaEntityChanges( &delta, from, to, force, changeMask );
+
+	if ( delta.overflowed ) {
+		MSG_WriteDeltaEntity( msg, from, to, force );
+		return;
+	}
+
+	MSG_WriteBitsFrom( msg, delta.data, delta.bit );
+
+	Sys_LockMutex( deltaCache->mutex );
+	if ( deltaCache->numEntries < DELTA_CACHE_ENTRIES
+		&& deltaCache->bytesUsed + delta.cursize <= DELTA_CACHE_BYTES ) {
+		entry = &deltaCache->entries[deltaCache->numEntries];
+		entry->hash = hash;
+		entry->force = force;
+		entry->from = deltaCache->states + deltaCache->numEntries * 2 * size;
+		entry->to = entry->from + size;
+		Com_Memcpy( entry->from, from, size );
+		Com_Memcpy( entry->to, to, size );
+		entry->bits = deltaCache->bits + deltaCache->bytesUsed;
+		entry->numBits = delta.bit;
+		entry->numChangedFields = numChangedFields;
+		Com_Memcpy( entry->changeMask, changeMask, sizeof( entry->changeMask ) );
+		Com_Memcpy( entry->bits, delta.data, delta.cursize );
+
+		deltaCache->numEntries++;
+		deltaCache->bytesUsed += delta.cursize;
+
+		entry->next = deltaCache->hashTable[hash & ( DELTA_CACHE_HASH - 1 )];
+		deltaCache->hashTable[hash & ( DELTA_CACHE_HASH - 1 )] = entry;
+	}
+	Sys_UnlockMutex( deltaCache->mutex );
+}
+
 /*
 =============
 SV_EmitPacketEntities
@@ -119,7 +317,7 @@ static void SV_EmitPacketEntities( clientSnapshot_t *from, clientSnapshot_t *to,
 			// delta update from old position
 			// because the force parm is qfalse, this will not result
 			// in any bytes being emitted if the entity has not changed at all
-			MSG_WriteDeltaEntity (msg, oldent, newent, qfalse );
+			SV_WriteDeltaEntity (msg, oldent, newent, qfalse );
 			oldindex++;
 			newindex++;
 			continue;
@@ -127,7 +325,7 @@ static void SV_EmitPacketEntities( clientSnapshot_t *from, clientSnapshot_t *to,
 
 		if ( newnum < oldnum ) {
 			// this is a new entity, send it from the baseline
-			MSG_WriteDeltaEntity (msg, DA_ElementPointer( sv.svEntitiesBaseline, newnum ), newent, qtrue );
+			SV_WriteDeltaEntity (msg, DA_ElementPointer( sv.svEntitiesBaseline, newnum ), newent, qtrue );
 			newindex++;
 			continue;
 		}
@@ -150,9 +348,8 @@ static void SV_EmitPacketEntities( clientSnapshot_t *from, clientSnapshot_t *to,
 SV_WriteSnapshotToClient
 ==================
 */
-static void SV_WriteSnapshotToClient( client_t *client, msg_t *msg ) {
-	clientSnapshot_t	*frame, *oldframe;
-	int					lastframe;
+static void SV_WriteSnapshotToClient( client_t *client, clientSnapshot_t *oldframe, int lastframe, msg_t *msg ) {
+	clientSnapshot_t	*frame;
 	int					i;
 	int					snapFlags;
 
@@ -164,30 +361,6 @@ static void SV_WriteSnapshotToClient( client_t *client, msg_t *msg ) {
 		return;
 	}
 
-	// try to use a previous frame as the source for delta compressing the snapshot
-	if ( client->deltaMessage <= 0 || client->state != CS_ACTIVE ) {
-		// client is asking for a retransmit
-		oldframe = NULL;
-		lastframe = 0;
-	} else if ( client->netchan.outgoingSequence - client->deltaMessage 
-		>= (PACKET_BACKUP - 3) ) {
-		// client hasn't gotten a good message through in a long time
-		Com_DPrintf ("%s: Delta request from out of date packet.\n", SV_ClientName( client ));
-		oldframe = NULL;
-		lastframe = 0;
-	} else {
-		// we have a valid snapshot to delta from
-		oldframe = &client->frames[ client->deltaMessage & PACKET_MASK ];
-		lastframe = client->netchan.outgoingSequence - client->deltaMessage;
-
-		// the snapshot's entities may still have rolled off the buffer, though
-		if ( oldframe->first_entity <= svs.nextSnapshotEntities - svs.numSnapshotEntities ) {
-			Com_DPrintf ("%s: Delta request from out of date entities.\n", SV_ClientName( client ));
-			oldframe = NULL;
-			lastframe = 0;
-		}
-	}
-
 	MSG_WriteByte (msg, svc_snapshot);
 
 	// NOTE, MRE: now sent at the start of every message from server to client
@@ -221,12 +394,6 @@ static void SV_WriteSnapshotToClient( client_t *client, msg_t *msg ) {
 
 	MSG_WriteByte (msg, snapFlags);
 
-	// send playerstates
-	if (frame->numPSs > MAX_SPLITVIEW) {
-		Com_DPrintf(S_COLOR_YELLOW "Warning: Almost sent numPSs as %d (max=%d)\n", frame->numPSs, MAX_SPLITVIEW);
-		frame->numPSs = MAX_SPLITVIEW;
-	}
-
 	// send number of playerstates and local player indexes
 	MSG_WriteByte (msg, frame->numPSs);
 	for (i = 0; i < MAX_SPLITVIEW; i++) {
@@ -317,12 +484,62 @@ Build a client snapshot structure
 =============================================================================
 */
 
+/*
+Building a snapshot is split in three passes so the expensive visibility
+tests can be run for several clients at the same time:
+
+SV_BeginClientSnapshot copies off the player states on the main thread.
+
+SV_CollectSnapshotEntities walks the entities and records every entity that
+is visible from one of the viewpoints, in the order they were found. It only
+reads the world and uses a private set of counters to prevent double adding,
+so it can be run on a worker thread.
+
+SV_FinishClientSnapshot asks the game which of the candidates it wants to
+send and copies the entity states out on the main thread, in client order.
+This gives the same snapshots as doing it all in one pass.
+*/
+
+typedef struct {
+	int		snapshotCounter;					// incremented for each snapshot built
+	int		entityCounters[MAX_GENTITIES];		// used to prevent double adding from portal views
+} snapshotVisibility_t;
+
+typedef struct {
+	int		numEntities;
+	int		viewEnd[MAX_SPLITVIEW];				// end of the candidates found from each viewpoint
+	int		entities[MAX_GENTITIES];
+} snapshotCandidates_t;
+
 typedef struct {
 	int		numSnapshotEntities;
 	int		maxSnapshotEntities;
-	int		snapshotEntities[MAX_SNAPSHOT_ENTITIES * MAX_SPLITVIEW];	
+	int		snapshotEntities[MAX_SNAPSHOT_ENTITIES * MAX_SPLITVIEW];
 } snapshotEntityNumbers_t;
 
+// snapshot and message for one client
+typedef struct {
+	client_t				*client;
+	qboolean				visible;		// frame has player states, collect entities
+	qboolean				written;		// message was already written on the main thread
+	clientSnapshot_t		*oldframe;		// frame to delta from, NULL for a full snapshot
+	int						lastframe;
+	msg_t					msg;
+	byte					*msgBuf;		// MAX_MSGLEN from the frame arena of the writing thread
+	msgStats_t				*msgStats;		// field statistics of the writing thread, NULL on the main thread
+	snapshotCandidates_t	candidates;
+} snapshotJob_t;
+
+static snapshotVisibility_t	mainSnapshotVisibility;
+
+static jobPool_t			*snapshotPool;
+static snapshotVisibility_t	*snapshotVisibility;	// for each worker thread
+static msgStats_t			*snapshotMsgStats;		// for each worker thread
+static snapshotJob_t		*snapshotJobs;			// for each client slot
+static int					numSnapshotJobs;
+
+static qboolean				snapshotEntitiesValid;	// entity index is current for this send
+
 /*
 =======================
 SV_QsortEntityNumbers
@@ -351,33 +568,15 @@ static int QDECL SV_QsortEntityNumbers( const void *a, const void *b ) {
 SV_AddEntToSnapshot
 ===============
 */
-static void SV_AddEntToSnapshot( clientSnapshot_t *frame, svEntity_t *svEnt, sharedEntity_t *gEnt, snapshotEntityNumbers_t *eNums ) {
-	int i;
-
+static void SV_AddEntToSnapshot( snapshotVisibility_t *vis, sharedEntity_t *gEnt, snapshotCandidates_t *candidates ) {
 	// if we have already added this entity to this snapshot, don't add again
-	if ( svEnt->snapshotCounter == sv.snapshotCounter ) {
-		return;
-	}
-	svEnt->snapshotCounter = sv.snapshotCounter;
-
-	// if we are full, silently discard entities
-	if ( eNums->numSnapshotEntities == eNums->maxSnapshotEntities ) {
-		return;
-	}
-
-	// check if game wants to send entity to one of these clients
-	for (i = 0; i < frame->numPSs; i++) {
-		if ( (qboolean)VM_Call( gvm, GAME_SNAPSHOT_CALLBACK, gEnt->s.number, SV_SnapshotPlayer( frame, i )->playerNum ) ) {
-			break;
-		}
-	}
-
-	if (i == frame->numPSs) {
+	if ( vis->entityCounters[ gEnt->s.number ] == vis->snapshotCounter ) {
 		return;
 	}
+	vis->entityCounters[ gEnt->s.number ] = vis->snapshotCounter;
 
-	eNums->snapshotEntities[ eNums->numSnapshotEntities ] = gEnt->s.number;
-	eNums->numSnapshotEntities++;
+	candidates->entities[ candidates->numEntities ] = gEnt->s.number;
+	candidates->numEntities++;
 }
 
 /*
@@ -385,8 +584,8 @@ static void SV_AddEntToSnapshot( clientSnapshot_t *frame, svEntity_t *svEnt, sha
 SV_AddEntitiesVisibleFromPoint
 ===============
 */
-static void SV_AddEntitiesVisibleFromPoint( int psIndex, int playerNum, vec3_t origin, clientSnapshot_t *frame, 
-									snapshotEntityNumbers_t *eNums, qboolean portal ) {
+static void SV_AddEntitiesVisibleFromPoint( snapshotVisibility_t *vis, int psIndex, int playerNum, vec3_t origin, clientSnapshot_t *frame, 
+									snapshotCandidates_t *candidates, qboolean portal ) {
 	int		e, i;
 	sharedEntity_t *ent;
 	svEntity_t	*svEnt;
@@ -395,6 +594,7 @@ static void SV_AddEntitiesVisibleFromPoint( int psIndex, int playerNum, vec3_t o
 	int		leafnum;
 	byte	*clientpvs;
 	byte	*bitvector;
+	byte	entityBits[MAX_GENTITIES / 8];
 
 	// during an error shutdown message we may need to transmit
 	// the shutdown message after the server has shutdown, so
@@ -412,7 +612,18 @@ static void SV_AddEntitiesVisibleFromPoint( int psIndex, int playerNum, vec3_t o
 
 	clientpvs = CM_ClusterPVS (clientcluster);
 
+	// only entities in the PVS and broadcast entities can be visible
+	Com_Memset( entityBits, 0, sizeof( entityBits ) );
+	SV_MarkPVSEntities( clientpvs, entityBits );
+
 	for ( e = 0 ; e < sv.num_entities ; e++ ) {
+		if ( !( entityBits[e >> 3] & ( 1 << ( e & 7 ) ) ) ) {
+			if ( !entityBits[e >> 3] ) {
+				e |= 7;
+			}
+			continue;
+		}
+
 		ent = SV_GentityNum(e);
 
 		// never send entities that aren't linked in
@@ -420,11 +631,6 @@ static void SV_AddEntitiesVisibleFromPoint( int psIndex, int playerNum, vec3_t o
 			continue;
 		}
 
-		if (ent->s.number != e) {
-			Com_DPrintf ("FIXING ENT->S.NUMBER!!!\n");
-			ent->s.number = e;
-		}
-
 		// entities can be flagged to explicitly not be sent to the client
 		if ( ent->r.svFlags & SVF_NOCLIENT ) {
 			continue;
@@ -436,10 +642,10 @@ static void SV_AddEntitiesVisibleFromPoint( int psIndex, int playerNum, vec3_t o
 				continue;
 		}
 
-		svEnt = SV_SvEntityForGentity( ent );
+		svEnt = &sv.svEntities[ e ];
 
 		// don't double add an entity through portals
-		if ( svEnt->snapshotCounter == sv.snapshotCounter ) {
+		if ( vis->entityCounters[ e ] == vis->snapshotCounter ) {
 			continue;
 		}
 
@@ -454,7 +660,7 @@ static void SV_AddEntitiesVisibleFromPoint( int psIndex, int playerNum, vec3_t o
 
 		// broadcast entities are always sent
 		if ( ent->r.svFlags & SVF_BROADCAST ) {
-			SV_AddEntToSnapshot( frame, svEnt, ent, eNums );
+			SV_AddEntToSnapshot( vis, ent, candidates );
 			continue;
 		}
 
@@ -507,14 +713,12 @@ static void SV_AddEntitiesVisibleFromPoint( int psIndex, int playerNum, vec3_t o
 			ment = SV_GentityNum( ent->r.visDummyNum );
 
 			if ( ment ) {
-				svEntity_t *master = NULL;
-				master = SV_SvEntityForGentity( ment );
-
-				if ( master->snapshotCounter == sv.snapshotCounter || !ment->r.linked ) {
+				if ( !ment->r.linked || ment->s.number < 0 || ment->s.number >= MAX_GENTITIES
+					|| vis->entityCounters[ ment->s.number ] == vis->snapshotCounter ) {
 					continue;
 				}
 
-				SV_AddEntToSnapshot( frame, master, ment, eNums );
+				SV_AddEntToSnapshot( vis, ment, candidates );
 			}
 
 			// master needs to be added, but not this dummy ent
@@ -522,40 +726,28 @@ static void SV_AddEntitiesVisibleFromPoint( int psIndex, int playerNum, vec3_t o
 		} else if ( ent->r.svFlags & SVF_VISDUMMY_MULTIPLE ) {
 			int h;
 			sharedEntity_t *ment = NULL;
-			svEntity_t *master = NULL;
 
-			for ( h = 0; h < sv.num_entities; h++ ) {
+			for ( h = SV_FirstVisDummyMaster( e ); h != -1; h = SV_NextVisDummyMaster( h ) ) {
 				ment = SV_GentityNum( h );
 
 				if ( ment == ent ) {
 					continue;
 				}
 
-				if ( ment ) {
-					master = SV_SvEntityForGentity( ment );
-				} else {
-					continue;
-				}
-
 				if ( !ment->r.linked ) {
 					continue;
 				}
 
-				if ( ment->s.number != h ) {
-					Com_DPrintf( "FIXING vis dummy multiple ment->S.NUMBER!!!\n" );
-					ment->s.number = h;
-				}
-
 				if ( ment->r.svFlags & SVF_NOCLIENT ) {
 					continue;
 				}
 
-				if ( master->snapshotCounter == sv.snapshotCounter ) {
+				if ( vis->entityCounters[ h ] == vis->snapshotCounter ) {
 					continue;
 				}
 
 				if ( ment->r.visDummyNum == ent->s.number ) {
-					SV_AddEntToSnapshot( frame, master, ment, eNums );
+					SV_AddEntToSnapshot( vis, ment, candidates );
 				}
 			}
 
@@ -564,7 +756,7 @@ static void SV_AddEntitiesVisibleFromPoint( int psIndex, int playerNum, vec3_t o
 		}
 
 		// add it
-		SV_AddEntToSnapshot( frame, svEnt, ent, eNums );
+		SV_AddEntToSnapshot( vis, ent, candidates );
 
 		// if it's a portal entity, add everything visible from its camera position
 		if ( ent->r.svFlags & SVF_PORTAL ) {
@@ -575,7 +767,7 @@ static void SV_AddEntitiesVisibleFromPoint( int psIndex, int playerNum, vec3_t o
 					continue;
 				}
 			}
-			SV_AddEntitiesVisibleFromPoint( psIndex, playerNum, ent->s.origin2, frame, eNums, qtrue );
+			SV_AddEntitiesVisibleFromPoint( vis, psIndex, playerNum, ent->s.origin2, frame, candidates, qtrue );
 		}
 
 	}
@@ -583,41 +775,78 @@ static void SV_AddEntitiesVisibleFromPoint( int psIndex, int playerNum, vec3_t o
 
 /*
 =============
-SV_BuildClientSnapshot
+SV_PrepareSnapshotEntities
 
-Decides which entities are going to be visible to the client, and
-copies off the playerstate and areabits.
+The visibility checks index entities by ent->s.number, make sure it is
+right and the entity index is up to date before they run.
 
-This properly handles multiple recursive portals, but the render
-currently doesn't.
+Done once for all snapshots sent together, the index stays valid until
+SV_InvalidateSnapshotEntities since no game code runs in between.
 =============
 */
-static void SV_BuildClientSnapshot( client_t *client ) {
-	vec3_t						org;
+void SV_PrepareSnapshotEntities( void ) {
+	int				e;
+	sharedEntity_t	*ent;
+
+	if ( !sv.state ) {
+		return;
+	}
+
+	for ( e = 0 ; e < sv.num_entities ; e++ ) {
+		ent = SV_GentityNum(e);
+
+		if ( !ent->r.linked ) {
+			continue;
+		}
+
+		if (ent->s.number != e) {
+			Com_DPrintf ("FIXING ENT->S.NUMBER!!!\n");
+			ent->s.number = e;
+		}
+	}
+
+	SV_UpdateEntityIndex();
+
+	snapshotEntitiesValid = qtrue;
+}
+
+/*
+=============
+SV_InvalidateSnapshotEntities
+
+Called after the snapshots are sent, the game may move entities before
+the next ones are built.
+=============
+*/
+void SV_InvalidateSnapshotEntities( void ) {
+	snapshotEntitiesValid = qfalse;
+}
+
+/*
+=============
+SV_BeginClientSnapshot
+
+Clears the frame and copies off the player states.
+Returns qfalse if there is nothing to add entities for.
+=============
+*/
+static qboolean SV_BeginClientSnapshot( client_t *client ) {
 	clientSnapshot_t			*frame;
-	snapshotEntityNumbers_t		entityNumbers;
 	int							i;
-	int							psIndex;
-	sharedEntityState_t			*state;
-	svEntity_t					*svEnt;
 	int							playerNum;
 	sharedPlayerState_t			*ps;
 
-	// bump the counter used to prevent double adding
-	sv.snapshotCounter++;
-
 	// this is the frame we are creating
 	frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
 
 	// clear everything in this snapshot
-	entityNumbers.numSnapshotEntities = 0;
 	Com_Memset( frame->areabits, 0, sizeof( frame->areabits ) );
 
   // https://zerowing.idsoftware.com/bugzilla/show_bug.cgi?id=62
 	frame->num_entities = 0;
-	
+
 	if ( client->state == CS_ZOMBIE ) {
-		return;
+		return qfalse;
 	}
 
 	// allocate player states for frame if needed
@@ -642,19 +871,46 @@ static void SV_BuildClientSnapshot( client_t *client ) {
 	}
 
 	if ( !frame->numPSs ) {
-		return;
+		return qfalse;
 	}
 
-	// never send player's own entity, because it can
-	// be regenerated from the playerstate
 	for (i = 0; i < frame->numPSs; i++) {
 		playerNum = SV_SnapshotPlayer(frame, i)->playerNum;
 		if ( playerNum < 0 || playerNum >= MAX_GENTITIES ) {
 			Com_Error( ERR_DROP, "SV_SvEntityForGentity: bad gEnt" );
 		}
-		svEnt = &sv.svEntities[ playerNum ];
+	}
+
+	return qtrue;
+}
+
+/*
+=============
+SV_CollectSnapshotEntities
+
+Finds the entities visible from the client's viewpoints.
+Safe to call from a worker thread.
+
+This properly handles multiple recursive portals, but the render
+currently doesn't.
+=============
+*/
+static void SV_CollectSnapshotEntities( snapshotVisibility_t *vis, client_t *client, snapshotCandidates_t *candidates ) {
+	vec3_t						org;
+	clientSnapshot_t			*frame;
+	int							i;
+
+	// bump the counter used to prevent double adding
+	vis->snapshotCounter++;
+
+	frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
 
-		svEnt->snapshotCounter = sv.snapshotCounter;
+	candidates->numEntities = 0;
+
+	// never send player's own entity, because it can
+	// be regenerated from the playerstate
+	for (i = 0; i < frame->numPSs; i++) {
+		vis->entityCounters[ SV_SnapshotPlayer(frame, i)->playerNum ] = vis->snapshotCounter;
 	}
 
 	// Now that local players have been marked as no send, add visible entities.
@@ -663,20 +919,72 @@ static void SV_BuildClientSnapshot( client_t *client ) {
 		VectorCopy( SV_SnapshotPlayer(frame, i)->origin, org );
 		org[2] += SV_SnapshotPlayer(frame, i)->viewheight;
 
-		// allow MAX_SNAPSHOT_ENTITIES to be added for this view point
-		entityNumbers.maxSnapshotEntities = entityNumbers.numSnapshotEntities + MAX_SNAPSHOT_ENTITIES;
-
 		// add all the entities directly visible to the eye, which
 		// may include portal entities that merge other viewpoints
-		SV_AddEntitiesVisibleFromPoint( i, SV_SnapshotPlayer(frame, i)->playerNum, org, frame, &entityNumbers, qfalse );
+		SV_AddEntitiesVisibleFromPoint( vis, i, SV_SnapshotPlayer(frame, i)->playerNum, org, frame, candidates, qfalse );
+
+		candidates->viewEnd[i] = candidates->numEntities;
+	}
+}
+
+/*
+=============
+SV_FinishClientSnapshot
+
+Decides which of the visible entities are going to be sent to the client,
+and copies off the entity states.
+=============
+*/
+static void SV_FinishClientSnapshot( client_t *client, snapshotCandidates_t *candidates ) {
+	clientSnapshot_t			*frame;
+	snapshotEntityNumbers_t		*entityNumbers;
+	sharedEntity_t				*gEnt;
+	int							i, j, c;
+	int							psIndex;
+	sharedEntityState_t			*state;
+	int							mark;
+
+	frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
+
+	mark = Com_FrameMark();
+	entityNumbers = Com_FrameAlloc( sizeof( *entityNumbers ) );
+
+	entityNumbers->numSnapshotEntities = 0;
+
+	for ( psIndex = 0, c = 0; psIndex < frame->numPSs; psIndex++ ) {
+		// allow MAX_SNAPSHOT_ENTITIES to be added for this view point
+		entityNumbers->maxSnapshotEntities = entityNumbers->numSnapshotEntities + MAX_SNAPSHOT_ENTITIES;
+
+		for ( ; c < candidates->viewEnd[psIndex]; c++ ) {
+			// if we are full, silently discard entities
+			if ( entityNumbers->numSnapshotEntities == entityNumbers->maxSnapshotEntities ) {
+				continue;
+			}
+
+			gEnt = SV_GentityNum( candidates->entities[c] );
+
+			// check if game wants to send entity to one of these clients
+			for (j = 0; j < frame->numPSs; j++) {
+				if ( (qboolean)VM_Call( gvm, GAME_SNAPSHOT_CALLBACK, gEnt->s.number, SV_SnapshotPlayer( frame, j )->playerNum ) ) {
+					break;
+				}
+			}
+
+			if (j == frame->numPSs) {
+				continue;
+			}
+
+			entityNumbers->snapshotEntities[ entityNumbers->numSnapshotEntities ] = gEnt->s.number;
+			entityNumbers->numSnapshotEntities++;
+		}
 	}
 
 	// if there were portals visible, there may be out of order entities
 	// in the list which will need to be resorted for the delta compression
 	// to work correctly.  This also catches the error condition
 	// of an entity being included twice.
-	qsort( entityNumbers.snapshotEntities, entityNumbers.numSnapshotEntities, 
-		sizeof( entityNumbers.snapshotEntities[0] ), SV_QsortEntityNumbers );
+	qsort( entityNumbers->snapshotEntities, entityNumbers->numSnapshotEntities,
+		sizeof( entityNumbers->snapshotEntities[0] ), SV_QsortEntityNumbers );
 
 	// now that all viewpoint's areabits have been OR'd together, invert
 	// all of them to make it a mask vector, which is what the renderer wants
@@ -689,8 +997,8 @@ static void SV_BuildClientSnapshot( client_t *client ) {
 	// copy the entity states out
 	frame->num_entities = 0;
 	frame->first_entity = svs.nextSnapshotEntities;
-	for ( i = 0 ; i < entityNumbers.numSnapshotEntities ; i++ ) {
-		state = SV_GameEntityStateNum( entityNumbers.snapshotEntities[i] );
+	for ( i = 0 ; i < entityNumbers->numSnapshotEntities ; i++ ) {
+		state = SV_GameEntityStateNum( entityNumbers->snapshotEntities[i] );
 		DA_SetElement( &svs.snapshotEntities, svs.nextSnapshotEntities % svs.numSnapshotEntities, state );
 		svs.nextSnapshotEntities++;
 		// this should never hit, map should always be restarted first in SV_Frame
@@ -699,6 +1007,139 @@ static void SV_BuildClientSnapshot( client_t *client ) {
 		}
 		frame->num_entities++;
 	}
+
+	Com_FrameClearToMark( mark );
+
+	SV_DemoAddClientFrame( client, frame );
+}
+
+/*
+=============
+SV_BuildClientSnapshot
+
+Decides which entities are going to be visible to the client, and
+copies off the playerstate and areabits.
+=============
+*/
+static void SV_BuildClientSnapshot( snapshotJob_t *job ) {
+	if ( !snapshotEntitiesValid ) {
+		SV_PrepareSnapshotEntities();
+	}
+
+	if ( !SV_BeginClientSnapshot( job->client ) ) {
+		return;
+	}
+
+	SV_CollectSnapshotEntities( &mainSnapshotVisibility, job->client, &job->candidates );
+	SV_FinishClientSnapshot( job->client, &job->candidates );
+}
+
+/*
+=============================================================================
+
+Write a client message
+
+=============================================================================
+*/
+
+/*
+==================
+SV_PrepareClientMessage
+
+Chooses the frame to delta the snapshot from.
+==================
+*/
+static void SV_PrepareClientMessage( snapshotJob_t *job ) {
+	client_t			*client = job->client;
+	clientSnapshot_t	*frame, *oldframe;
+	int					lastframe;
+
+	job->oldframe = NULL;
+	job->lastframe = 0;
+
+	// snapshot is only sent to active and zombie clients
+	if ( client->state != CS_ACTIVE && client->state != CS_ZOMBIE ) {
+		return;
+	}
+
+	// this is the snapshot we are creating
+	frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
+
+	// snapshot wasn't ever built
+	if ( !frame->playerStates.pointer ) {
+		return;
+	}
+
+	// try to use a previous frame as the source for delta compressing the snapshot
+	if ( client->deltaMessage <= 0 || client->state != CS_ACTIVE ) {
+		// client is asking for a retransmit
+		oldframe = NULL;
+		lastframe = 0;
+	} else if ( client->netchan.outgoingSequence - client->deltaMessage
+		>= (PACKET_BACKUP - 3) ) {
+		// client hasn't gotten a good message through in a long time
+		Com_DPrintf ("%s: Delta request from out of date packet.\n", SV_ClientName( client ));
+		oldframe = NULL;
+		lastframe = 0;
+	} else {
+		// we have a valid snapshot to delta from
+		oldframe = &client->frames[ client->deltaMessage & PACKET_MASK ];
+		lastframe = client->netchan.outgoingSequence - client->deltaMessage;
+
+		// the snapshot's entities may still have rolled off the buffer, though
+		if ( oldframe->first_entity <= svs.nextSnapshotEntities - svs.numSnapshotEntities ) {
+			Com_DPrintf ("%s: Delta request from out of date entities.\n", SV_ClientName( client ));
+			oldframe = NULL;
+			lastframe = 0;
+		}
+	}
+
+	// send playerstates
+	if (frame->numPSs > MAX_SPLITVIEW) {
+		Com_DPrintf(S_COLOR_YELLOW "Warning: Almost sent numPSs as %d (max=%d)\n", frame->numPSs, MAX_SPLITVIEW);
+		frame->numPSs = MAX_SPLITVIEW;
+	}
+
+	job->oldframe = oldframe;
+	job->lastframe = lastframe;
+}
+
+/*
+==================
+SV_WriteClientMessage
+
+Writes the reliable commands and the snapshot.
+Safe to call from a worker thread.
+==================
+*/
+static void SV_WriteClientMessage( snapshotJob_t *job ) {
+	client_t	*client = job->client;
+	msg_t		*msg = &job->msg;
+
+	MSG_Init (msg, job->msgBuf, MAX_MSGLEN);
+	msg->allowoverflow = qtrue;
+	msg->stats = job->msgStats;
+
+	// NOTE, MRE: all server->client messages now acknowledge
+	// let the client know which reliable clientCommands we have received
+	MSG_WriteLong( msg, client->lastClientCommand );
+
+	// (re)send any reliable server commands
+	SV_UpdateServerCommandsToClient( client, msg );
+
+	// if client is awaiting gamestate (or downloading a pk3), hold off sending snapshot as it
+	// can't be loaded until after cgame is loaded.
+	// must send snapshot to kicked (zombie) clients for them to process disconnect.
+	if ( client->state != CS_ACTIVE && client->state != CS_ZOMBIE ) {
+		client->needBaseline = qtrue;
+	} else {
+		// entities delta baseline
+		SV_WriteBaselineToClient( client, msg );
+
+		// send over all the relevant entityState_t
+		// and playerState_t
+		SV_WriteSnapshotToClient( client, job->oldframe, job->lastframe, msg );
+	}
 }
 
 #ifdef USE_VOIP
@@ -766,6 +1207,30 @@ void SV_SendMessageToClient(msg_t *msg, client_t *client)
 	SV_Netchan_Transmit(client, msg);
 }
 
+/*
+=======================
+SV_FinishClientMessage
+
+Adds the VoIP data and sends the message
+=======================
+*/
+static void SV_FinishClientMessage( snapshotJob_t *job ) {
+	client_t	*client = job->client;
+	msg_t		*msg = &job->msg;
+
+#ifdef USE_VOIP
+	SV_WriteVoipToClient( client, msg );
+#endif
+
+	// check for overflow
+	if ( msg->overflowed ) {
+		Com_Printf ("WARNING: msg overflowed for %s\n", SV_ClientName( client ));
+		MSG_Clear (msg);
+	}
+
+	SV_SendMessageToClient( msg, client );
+}
+
 
 /*
 =======================
@@ -776,53 +1241,217 @@ Also called by SV_FinalMessage
 =======================
 */
 void SV_SendClientSnapshot( client_t *client ) {
-	byte		msg_buf[MAX_MSGLEN];
-	msg_t		msg;
+	snapshotJob_t	*job;
+	int				mark;
+
+	// the job is only needed until the message is sent
+	mark = Com_FrameMark();
+	job = Com_FrameAlloc( sizeof( *job ) );
+	job->client = client;
+	job->msgStats = NULL;
 
 	// build the snapshot
-	SV_BuildClientSnapshot( client );
+	SV_BuildClientSnapshot( job );
 
 	// bots need to have their snapshots build, but
 	// the query them directly without needing to be sent
-	if ( client->netchan.remoteAddress.type == NA_BOT ) {
+	if ( client->netchan.remoteAddress.type != NA_BOT ) {
+		job->msgBuf = Com_FrameAlloc( MAX_MSGLEN );
+
+		SV_PrepareClientMessage( job );
+		SV_WriteClientMessage( job );
+		SV_FinishClientMessage( job );
+	}
+
+	Com_FrameClearToMark( mark );
+}
+
+/*
+=============================================================================
+
+Threaded snapshots
+
+=============================================================================
+*/
+
+static void SV_ShutdownSnapshotThreads( void );
+
+/*
+=======================
+SV_ShutdownSnapshots
+=======================
+*/
+void SV_ShutdownSnapshots( void ) {
+	SV_ShutdownSnapshotThreads();
+	SV_FreeDeltaCache();
+}
+
+/*
+=======================
+SV_ShutdownSnapshotThreads
+=======================
+*/
+static void SV_ShutdownSnapshotThreads( void ) {
+	Job_DestroyPool( snapshotPool );
+	snapshotPool = NULL;
+
+	if ( snapshotVisibility ) {
+		Z_Free( snapshotVisibility );
+		snapshotVisibility = NULL;
+	}
+
+	if ( snapshotMsgStats ) {
+		Z_Free( snapshotMsgStats );
+		snapshotMsgStats = NULL;
+	}
+
+	if ( snapshotJobs ) {
+		Z_Free( snapshotJobs );
+		snapshotJobs = NULL;
+	}
+
+	numSnapshotJobs = 0;
+}
+
+/*
+=======================
+SV_UpdateSnapshotThreads
+
+(Re)start the snapshot workers when sv_snapshotThreads or sv_maxclients changed
+=======================
+*/
+static void SV_UpdateSnapshotThreads( void ) {
+	int numThreads;
+
+	if ( !sv_snapshotThreads->modified && ( !snapshotPool || numSnapshotJobs == sv_maxclients->integer ) ) {
 		return;
 	}
 
-	MSG_Init (&msg, msg_buf, sizeof(msg_buf));
-	msg.allowoverflow = qtrue;
+	sv_snapshotThreads->modified = qfalse;
 
-	// NOTE, MRE: all server->client messages now acknowledge
-	// let the client know which reliable clientCommands we have received
-	MSG_WriteLong( &msg, client->lastClientCommand );
+	SV_ShutdownSnapshotThreads();
 
-	// (re)send any reliable server commands
-	SV_UpdateServerCommandsToClient( client, &msg );
+	if ( sv_snapshotThreads->integer <= 0 ) {
+		return;
+	}
 
-	// if client is awaiting gamestate (or downloading a pk3), hold off sending snapshot as it
-	// can't be loaded until after cgame is loaded.
-	// must send snapshot to kicked (zombie) clients for them to process disconnect.
-	if ( client->state != CS_ACTIVE && client->state != CS_ZOMBIE ) {
-		client->needBaseline = qtrue;
-	} else {
-		// entities delta baseline
-		SV_WriteBaselineToClient( client, &msg );
+	snapshotPool = Job_CreatePool( "snapshot", sv_snapshotThreads->integer );
 
-		// send over all the relevant entityState_t
-		// and playerState_t
-		SV_WriteSnapshotToClient( client, &msg );
+	numThreads = Job_NumThreads( snapshotPool );
+	if ( numThreads < 2 ) {
+		SV_ShutdownSnapshotThreads();
+		return;
 	}
 
-#ifdef USE_VOIP
-	SV_WriteVoipToClient( client, &msg );
-#endif
+	// the main thread uses mainSnapshotVisibility
+	snapshotVisibility = Z_Malloc( ( numThreads - 1 ) * sizeof( snapshotVisibility[0] ) );
+	snapshotMsgStats = Z_Malloc( ( numThreads - 1 ) * sizeof( snapshotMsgStats[0] ) );
 
-	// check for overflow
-	if ( msg.overflowed ) {
-		Com_Printf ("WARNING: msg overflowed for %s\n", SV_ClientName( client ));
-		MSG_Clear (&msg);
+	numSnapshotJobs = sv_maxclients->integer;
+	snapshotJobs = Z_Malloc( numSnapshotJobs * sizeof( snapshotJobs[0] ) );
+}
+
+/*
+=======================
+SV_CollectSnapshotJob
+=======================
+*/
+static void SV_CollectSnapshotJob( void *data, int index, int threadNum ) {
+	snapshotJob_t			*job = (snapshotJob_t *)data + index;
+	snapshotVisibility_t	*vis;
+
+	if ( !job->visible ) {
+		return;
 	}
 
-	SV_SendMessageToClient( &msg, client );
+	vis = threadNum ? &snapshotVisibility[ threadNum - 1 ] : &mainSnapshotVisibility;
+
+	SV_CollectSnapshotEntities( vis, job->client, &job->candidates );
+}
+
+/*
+=======================
+SV_WriteClientMessageJob
+=======================
+*/
+static void SV_WriteClientMessageJob( void *data, int index, int threadNum ) {
+	snapshotJob_t *job = (snapshotJob_t *)data + index;
+
+	if ( job->written || job->client->netchan.remoteAddress.type == NA_BOT ) {
+		return;
+	}
+
+	job->msgBuf = Job_FrameAlloc( snapshotPool, threadNum, MAX_MSGLEN );
+	job->msgStats = threadNum ? &snapshotMsgStats[ threadNum - 1 ] : NULL;
+	SV_WriteClientMessage( job );
+}
+
+/*
+=======================
+SV_SendClientSnapshotJobs
+
+Same as calling SV_SendClientSnapshot for each client in turn, but the
+visibility checks and message encoding are spread over the worker threads.
+Everything that calls into the game or prints stays on the main thread.
+=======================
+*/
+static void SV_SendClientSnapshotJobs( int numJobs ) {
+	snapshotJob_t	*job;
+	int				i;
+	int				pending;
+
+	for ( i = 0, job = snapshotJobs; i < numJobs; i++, job++ ) {
+		job->visible = SV_BeginClientSnapshot( job->client );
+		job->written = qfalse;
+		job->msgStats = NULL;
+		job->candidates.numEntities = 0;
+	}
+
+	Job_ParallelFor( snapshotPool, SV_CollectSnapshotJob, snapshotJobs, numJobs );
+
+	pending = 0;
+	for ( i = 0, job = snapshotJobs; i < numJobs; i++, job++ ) {
+		pending += job->candidates.numEntities;
+	}
+
+	// entity states have to be copied out in client order so each
+	// client gets the same first_entity as in the serial case
+	for ( i = 0, job = snapshotJobs; i < numJobs; i++, job++ ) {
+		pending -= job->candidates.numEntities;
+
+		if ( job->visible ) {
+			SV_FinishClientSnapshot( job->client, &job->candidates );
+		}
+
+		if ( job->client->netchan.remoteAddress.type == NA_BOT ) {
+			continue;
+		}
+
+		SV_PrepareClientMessage( job );
+
+		// the remaining snapshots could overwrite the entities of the delta
+		// frame before the workers get to it, so write this one right away
+		if ( job->oldframe && job->oldframe->first_entity <= svs.nextSnapshotEntities + pending - svs.numSnapshotEntities ) {
+			job->msgBuf = Com_FrameAlloc( MAX_MSGLEN );
+			SV_WriteClientMessage( job );
+			job->written = qtrue;
+		}
+	}
+
+	Job_ParallelFor( snapshotPool, SV_WriteClientMessageJob, snapshotJobs, numJobs );
+
+	for ( i = 0; i < Job_NumThreads( snapshotPool ) - 1; i++ ) {
+		MSG_AddStats( &snapshotMsgStats[i] );
+	}
+
+	for ( i = 0, job = snapshotJobs; i < numJobs; i++, job++ ) {
+		if ( job->client->netchan.remoteAddress.type != NA_BOT ) {
+			SV_FinishClientMessage( job );
+		}
+
+		job->client->lastSnapshotTime = svs.time;
+		job->client->rateDelayed = qfalse;
+	}
 }
 
 
@@ -835,6 +1464,15 @@ void SV_SendClientMessages(void)
 {
 	int		i;
 	client_t	*c;
+	int		numJobs;
+
+	SV_UpdateSnapshotThreads();
+	SV_ClearDeltaCache();
+	SV_PrepareSnapshotEntities();
+	numJobs = 0;
+
+	// collect the snapshot datagrams and hand them to the socket layer at once
+	NET_BeginPacketBatch();
 
 	// send a message to each connected client
 	for(i=0; i < sv_maxclients->integer; i++)
@@ -868,9 +1506,25 @@ void SV_SendClientMessages(void)
 			}
 		}
 
+		// generated and sent together after the loop
+		if(snapshotPool)
+		{
+			snapshotJobs[numJobs++].client = c;
+			continue;
+		}
+
 		// generate and send a new message
 		SV_SendClientSnapshot(c);
 		c->lastSnapshotTime = svs.time;
 		c->rateDelayed = qfalse;
 	}
+
+	if(numJobs)
+		SV_SendClientSnapshotJobs(numJobs);
+
+	SV_InvalidateSnapshotEntities();
+
+	SV_DemoWriteFrame();
+
+	NET_EndPacketBatch();
 }
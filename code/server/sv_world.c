@@ -58,9 +58,14 @@ clipHandle_t SV_ClipHandleForEntity( const sharedEntity_t *ent ) {
 ENTITY CHECKING
 
 To avoid linearly searching through lists of entities during environment testing,
-the world is carved up with an evenly spaced, axially aligned bsp tree.  Entities
-are kept in chains either at the final leafs, or at the first node that splits
-them, which prevents having to deal with multiple fragments of a single entity.
+the world is carved up with an axially aligned bsp tree.  Entities are kept in
+chains either at the final leafs, or at the first node that splits them, which
+prevents having to deal with multiple fragments of a single entity.
+
+The tree starts out evenly subdivided to AREA_MIN_DEPTH.  A leaf that collects
+more than AREA_SPLIT_ENTITIES entities is split in half along its longest axis,
+and a split node with fewer than AREA_MERGE_ENTITIES entities left below it is
+collapsed back into a leaf, so crowded parts of large maps get smaller sectors.
 
 ===============================================================================
 */
@@ -69,14 +74,37 @@ typedef struct worldSector_s {
 	int		axis;		// -1 = leaf node
 	float	dist;
 	struct worldSector_s	*children[2];
+	struct worldSector_s	*parent;
+	vec3_t	mins, maxs;
+	int		depth;
+	int		numEntities;		// linked to this node
+	int		numTreeEntities;	// linked to this node and all nodes below it
 	svEntity_t	*entities;
 } worldSector_t;
 
-#define	AREA_DEPTH	4
-#define	AREA_NODES	64
+#define	AREA_MIN_DEPTH		4
+#define	AREA_MAX_DEPTH		12
+#define	AREA_NODES			1024
+#define	AREA_SPLIT_ENTITIES	16
+#define	AREA_MERGE_ENTITIES	6
 
 worldSector_t	sv_worldSectors[AREA_NODES];
 int			sv_numworldSectors;
+static worldSector_t	*sv_freeWorldSectors;
+
+static int			sv_worldSectorSplits;
+static int			sv_worldSectorMerges;
+
+static svClusterLink_t	**sv_clusterEntities;	// first link for each cluster
+static int			sv_numClusters;
+
+static int			sv_alwaysCheckEntities[MAX_GENTITIES];
+static int			sv_numAlwaysCheckEntities;
+
+static int			sv_entityIndexCount;				// incremented by each SV_UpdateEntityIndex
+static int			sv_visDummyCount[MAX_GENTITIES];	// sv_entityIndexCount if a multiple vis dummy
+static int			sv_visDummyFirst[MAX_GENTITIES];	// first master of a multiple vis dummy
+static int			sv_visDummyNext[MAX_GENTITIES];		// next master of the same dummy
 
 
 /*
@@ -88,58 +116,261 @@ void SV_SectorList_f( void ) {
 	int				i, c;
 	worldSector_t	*sec;
 	svEntity_t		*ent;
+	int				numLeafs, numLinked, maxEntities, maxDepth;
+
+	numLeafs = numLinked = maxEntities = maxDepth = 0;
 
 	for ( i = 0 ; i < AREA_NODES ; i++ ) {
 		sec = &sv_worldSectors[i];
 
+		// on the free list
+		if ( sec != sv_worldSectors && !sec->parent ) {
+			continue;
+		}
+
 		c = 0;
 		for ( ent = sec->entities ; ent ; ent = ent->nextEntityInWorldSector ) {
 			c++;
 		}
-		Com_Printf( "sector %i: %i entities\n", i, c );
+
+		if ( sec->axis == -1 ) {
+			numLeafs++;
+		}
+		numLinked += c;
+		maxEntities = MAX( maxEntities, c );
+		maxDepth = MAX( maxDepth, sec->depth );
+
+		if ( c ) {
+			Com_Printf( "sector %i: depth %i, %i entities\n", i, sec->depth, c );
+		}
 	}
+
+	Com_Printf( "%i of %i sectors used, %i leafs, max depth %i\n", sv_numworldSectors, AREA_NODES, numLeafs, maxDepth );
+	Com_Printf( "%i entities linked, max %i in one sector\n", numLinked, maxEntities );
+	Com_Printf( "%i splits, %i merges since map load\n", sv_worldSectorSplits, sv_worldSectorMerges );
 }
 
 /*
 ===============
-SV_CreateworldSector
-
-Builds a uniformly subdivided tree for the given world size
+SV_AllocWorldSector
 ===============
 */
-static worldSector_t *SV_CreateworldSector( int depth, vec3_t mins, vec3_t maxs ) {
+static worldSector_t *SV_AllocWorldSector( worldSector_t *parent, vec3_t mins, vec3_t maxs ) {
 	worldSector_t	*anode;
-	vec3_t		size;
-	vec3_t		mins1, maxs1, mins2, maxs2;
 
-	anode = &sv_worldSectors[sv_numworldSectors];
+	anode = sv_freeWorldSectors;
+	if ( !anode ) {
+		return NULL;
+	}
+	sv_freeWorldSectors = anode->children[0];
 	sv_numworldSectors++;
 
-	if (depth == AREA_DEPTH) {
-		anode->axis = -1;
-		anode->children[0] = anode->children[1] = NULL;
-		return anode;
+	Com_Memset( anode, 0, sizeof( *anode ) );
+	anode->axis = -1;
+	anode->parent = parent;
+	anode->depth = parent ? parent->depth + 1 : 0;
+	VectorCopy( mins, anode->mins );
+	VectorCopy( maxs, anode->maxs );
+
+	return anode;
+}
+
+/*
+===============
+SV_FreeWorldSector
+===============
+*/
+static void SV_FreeWorldSector( worldSector_t *anode ) {
+	Com_Memset( anode, 0, sizeof( *anode ) );
+	anode->children[0] = sv_freeWorldSectors;
+	sv_freeWorldSectors = anode;
+	sv_numworldSectors--;
+}
+
+/*
+===============
+SV_DivideWorldSector
+
+Gives a leaf two children by cutting it in half along the longest axis.
+Returns qfalse if there aren't enough free nodes.
+===============
+*/
+static qboolean SV_DivideWorldSector( worldSector_t *anode ) {
+	vec3_t		size;
+	vec3_t		mins1, maxs1, mins2, maxs2;
+	int			axis;
+
+	if ( sv_numworldSectors + 2 > AREA_NODES ) {
+		return qfalse;
 	}
-	
-	VectorSubtract (maxs, mins, size);
+
+	VectorSubtract (anode->maxs, anode->mins, size);
 	if (size[0] > size[1]) {
-		anode->axis = 0;
+		axis = 0;
 	} else {
-		anode->axis = 1;
+		axis = 1;
+	}
+	// below the initial tree, tall sectors can be cut horizontally too
+	if ( anode->depth >= AREA_MIN_DEPTH && size[2] > size[axis] ) {
+		axis = 2;
 	}
 
-	anode->dist = 0.5 * (maxs[anode->axis] + mins[anode->axis]);
-	VectorCopy (mins, mins1);	
-	VectorCopy (mins, mins2);	
-	VectorCopy (maxs, maxs1);	
-	VectorCopy (maxs, maxs2);	
-	
-	maxs1[anode->axis] = mins2[anode->axis] = anode->dist;
-	
-	anode->children[0] = SV_CreateworldSector (depth+1, mins2, maxs2);
-	anode->children[1] = SV_CreateworldSector (depth+1, mins1, maxs1);
+	anode->axis = axis;
+	anode->dist = 0.5 * (anode->maxs[axis] + anode->mins[axis]);
+	VectorCopy (anode->mins, mins1);
+	VectorCopy (anode->mins, mins2);
+	VectorCopy (anode->maxs, maxs1);
+	VectorCopy (anode->maxs, maxs2);
 
-	return anode;
+	maxs1[axis] = mins2[axis] = anode->dist;
+
+	anode->children[0] = SV_AllocWorldSector (anode, mins2, maxs2);
+	anode->children[1] = SV_AllocWorldSector (anode, mins1, maxs1);
+
+	return qtrue;
+}
+
+/*
+===============
+SV_CreateworldSector
+
+Builds a uniformly subdivided tree for the given world size
+===============
+*/
+static void SV_CreateworldSector( worldSector_t *anode ) {
+	if (anode->depth == AREA_MIN_DEPTH) {
+		return;
+	}
+
+	SV_DivideWorldSector( anode );
+	SV_CreateworldSector( anode->children[0] );
+	SV_CreateworldSector( anode->children[1] );
+}
+
+/*
+===============
+SV_LinkToWorldSector
+===============
+*/
+static void SV_LinkToWorldSector( svEntity_t *ent, worldSector_t *node ) {
+	worldSector_t	*n;
+
+	ent->worldSector = node;
+	ent->nextEntityInWorldSector = node->entities;
+	node->entities = ent;
+	node->numEntities++;
+
+	for ( n = node ; n ; n = n->parent ) {
+		n->numTreeEntities++;
+	}
+}
+
+/*
+===============
+SV_SplitWorldSector
+
+Divides a crowded leaf and moves the entities that fit
+completely on one side down to the new children
+===============
+*/
+static void SV_SplitWorldSector( worldSector_t *node ) {
+	svEntity_t		*ent, *next;
+	sharedEntity_t	*gEnt;
+	worldSector_t	*child;
+
+	if ( node->depth >= AREA_MAX_DEPTH || !SV_DivideWorldSector( node ) ) {
+		return;
+	}
+
+	sv_worldSectorSplits++;
+
+	ent = node->entities;
+	node->entities = NULL;
+	node->numEntities = 0;
+	node->numTreeEntities = 0;
+
+	for ( ; ent ; ent = next ) {
+		next = ent->nextEntityInWorldSector;
+		gEnt = SV_GEntityForSvEntity( ent );
+
+		if ( gEnt->r.absmin[node->axis] > node->dist ) {
+			child = node->children[0];
+		} else if ( gEnt->r.absmax[node->axis] < node->dist ) {
+			child = node->children[1];
+		} else {
+			child = node;
+		}
+
+		// node's parents already counted it
+		child->numEntities++;
+		child->numTreeEntities++;
+		if ( child != node ) {
+			node->numTreeEntities++;
+		}
+
+		ent->worldSector = child;
+		ent->nextEntityInWorldSector = child->entities;
+		child->entities = ent;
+	}
+}
+
+/*
+===============
+SV_CollapseWorldSector_r
+
+Moves all entities below node up to dest and frees the nodes
+===============
+*/
+static void SV_CollapseWorldSector_r( worldSector_t *node, worldSector_t *dest ) {
+	svEntity_t		*ent, *next;
+
+	if ( node->axis != -1 ) {
+		SV_CollapseWorldSector_r( node->children[0], dest );
+		SV_CollapseWorldSector_r( node->children[1], dest );
+	}
+
+	if ( node == dest ) {
+		node->axis = -1;
+		node->children[0] = node->children[1] = NULL;
+		return;
+	}
+
+	for ( ent = node->entities ; ent ; ent = next ) {
+		next = ent->nextEntityInWorldSector;
+
+		ent->worldSector = dest;
+		ent->nextEntityInWorldSector = dest->entities;
+		dest->entities = ent;
+		dest->numEntities++;
+	}
+
+	SV_FreeWorldSector( node );
+}
+
+/*
+===============
+SV_MergeWorldSectors
+
+Collapses the highest node above node that was split
+but has few entities left below it
+===============
+*/
+static void SV_MergeWorldSectors( worldSector_t *node ) {
+	worldSector_t	*merge;
+
+	merge = NULL;
+	for ( ; node && node->depth >= AREA_MIN_DEPTH ; node = node->parent ) {
+		if ( node->axis != -1 && node->numTreeEntities < AREA_MERGE_ENTITIES ) {
+			merge = node;
+		}
+	}
+
+	if ( !merge ) {
+		return;
+	}
+
+	sv_worldSectorMerges++;
+	SV_CollapseWorldSector_r( merge, merge );
 }
 
 /*
@@ -151,14 +382,196 @@ SV_ClearWorld
 void SV_ClearWorld( void ) {
 	clipHandle_t	h;
 	vec3_t			mins, maxs;
+	int				i;
 
 	Com_Memset( sv_worldSectors, 0, sizeof(sv_worldSectors) );
 	sv_numworldSectors = 0;
+	sv_worldSectorSplits = 0;
+	sv_worldSectorMerges = 0;
+
+	sv_freeWorldSectors = NULL;
+	for ( i = AREA_NODES - 1 ; i >= 0 ; i-- ) {
+		sv_worldSectors[i].children[0] = sv_freeWorldSectors;
+		sv_freeWorldSectors = &sv_worldSectors[i];
+	}
 
 	// get world map bounds
 	h = CM_InlineModel( 0 );
 	CM_ModelBounds( h, mins, maxs );
-	SV_CreateworldSector( 0, mins, maxs );
+	SV_CreateworldSector( SV_AllocWorldSector( NULL, mins, maxs ) );
+
+	// the hunk is cleared before each map is loaded
+	sv_numClusters = CM_NumClusters();
+	sv_clusterEntities = Hunk_Alloc( sv_numClusters * sizeof( *sv_clusterEntities ), h_high );
+}
+
+
+/*
+===============================================================================
+
+ENTITY VISIBILITY INDEX
+
+Linked entities are kept in a list for each PVS cluster they touch, so
+building a snapshot only has to look at entities in clusters that can be
+seen. Broadcast entities and entities touching more clusters than fit in
+clusternums are checked for every viewpoint.
+
+The game can change svFlags and visDummyNum without relinking, so the lists
+depending on them are rebuilt by SV_UpdateEntityIndex before the snapshots
+are built.
+
+===============================================================================
+*/
+
+/*
+===============
+SV_LinkEntityClusters
+===============
+*/
+static void SV_LinkEntityClusters( svEntity_t *ent, int entityNum ) {
+	svClusterLink_t	*link;
+	int				i;
+
+	ent->numClusterLinks = 0;
+
+	for ( i = 0 ; i < ent->numClusters ; i++ ) {
+		if ( ent->clusternums[i] < 0 || ent->clusternums[i] >= sv_numClusters ) {
+			continue;
+		}
+
+		link = &ent->clusterLinks[ent->numClusterLinks++];
+		link->cluster = ent->clusternums[i];
+		link->entityNum = entityNum;
+		link->prev = NULL;
+		link->next = sv_clusterEntities[link->cluster];
+		if ( link->next ) {
+			link->next->prev = link;
+		}
+		sv_clusterEntities[link->cluster] = link;
+	}
+}
+
+/*
+===============
+SV_UnlinkEntityClusters
+===============
+*/
+static void SV_UnlinkEntityClusters( svEntity_t *ent ) {
+	svClusterLink_t	*link;
+	int				i;
+
+	for ( i = 0 ; i < ent->numClusterLinks ; i++ ) {
+		link = &ent->clusterLinks[i];
+
+		if ( link->prev ) {
+			link->prev->next = link->next;
+		} else {
+			sv_clusterEntities[link->cluster] = link->next;
+		}
+		if ( link->next ) {
+			link->next->prev = link->prev;
+		}
+	}
+
+	ent->numClusterLinks = 0;
+}
+
+/*
+===============
+SV_UpdateEntityIndex
+===============
+*/
+void SV_UpdateEntityIndex( void ) {
+	int				e, d;
+	sharedEntity_t	*ent;
+
+	sv_numAlwaysCheckEntities = 0;
+	sv_entityIndexCount++;
+
+	for ( e = 0 ; e < sv.num_entities ; e++ ) {
+		ent = SV_GentityNum( e );
+
+		if ( !ent->r.linked ) {
+			continue;
+		}
+
+		if ( ( ent->r.svFlags & SVF_BROADCAST ) || sv.svEntities[e].lastCluster ) {
+			sv_alwaysCheckEntities[sv_numAlwaysCheckEntities++] = e;
+		}
+
+		if ( ent->r.svFlags & SVF_VISDUMMY_MULTIPLE ) {
+			sv_visDummyCount[e] = sv_entityIndexCount;
+			sv_visDummyFirst[e] = -1;
+		}
+	}
+
+	// link masters in backwards so the lists are in ascending order
+	for ( e = sv.num_entities - 1 ; e >= 0 ; e-- ) {
+		ent = SV_GentityNum( e );
+
+		if ( !ent->r.linked ) {
+			continue;
+		}
+
+		d = ent->r.visDummyNum;
+		if ( d < 0 || d >= MAX_GENTITIES || sv_visDummyCount[d] != sv_entityIndexCount ) {
+			continue;
+		}
+
+		sv_visDummyNext[e] = sv_visDummyFirst[d];
+		sv_visDummyFirst[d] = e;
+	}
+}
+
+/*
+===============
+SV_MarkPVSEntities
+===============
+*/
+void SV_MarkPVSEntities( const byte *pvs, byte *entityBits ) {
+	svClusterLink_t	*link;
+	int				i, c;
+
+	for ( c = 0 ; c < sv_numClusters ; c++ ) {
+		if ( !pvs[c >> 3] ) {
+			c |= 7;
+			continue;
+		}
+		if ( !( pvs[c >> 3] & ( 1 << ( c & 7 ) ) ) ) {
+			continue;
+		}
+
+		for ( link = sv_clusterEntities[c] ; link ; link = link->next ) {
+			entityBits[link->entityNum >> 3] |= 1 << ( link->entityNum & 7 );
+		}
+	}
+
+	for ( i = 0 ; i < sv_numAlwaysCheckEntities ; i++ ) {
+		c = sv_alwaysCheckEntities[i];
+		entityBits[c >> 3] |= 1 << ( c & 7 );
+	}
+}
+
+/*
+===============
+SV_FirstVisDummyMaster
+===============
+*/
+int SV_FirstVisDummyMaster( int dummyNum ) {
+	if ( sv_visDummyCount[dummyNum] != sv_entityIndexCount ) {
+		return -1;
+	}
+
+	return sv_visDummyFirst[dummyNum];
+}
+
+/*
+===============
+SV_NextVisDummyMaster
+===============
+*/
+int SV_NextVisDummyMaster( int masterNum ) {
+	return sv_visDummyNext[masterNum];
 }
 
 
@@ -171,7 +584,7 @@ SV_UnlinkEntity
 void SV_UnlinkEntity( sharedEntity_t *gEnt ) {
 	svEntity_t		*ent;
 	svEntity_t		*scan;
-	worldSector_t	*ws;
+	worldSector_t	*ws, *node;
 	sharedPlayerState_t	*ps;
 
 	ent = SV_SvEntityForGentity( gEnt );
@@ -188,19 +601,30 @@ void SV_UnlinkEntity( sharedEntity_t *gEnt ) {
 	}
 	ent->worldSector = NULL;
 
+	SV_UnlinkEntityClusters( ent );
+
 	if ( ws->entities == ent ) {
 		ws->entities = ent->nextEntityInWorldSector;
-		return;
-	}
+	} else {
+		for ( scan = ws->entities ; scan ; scan = scan->nextEntityInWorldSector ) {
+			if ( scan->nextEntityInWorldSector == ent ) {
+				scan->nextEntityInWorldSector = ent->nextEntityInWorldSector;
+				break;
+			}
+		}
 
-	for ( scan = ws->entities ; scan ; scan = scan->nextEntityInWorldSector ) {
-		if ( scan->nextEntityInWorldSector == ent ) {
-			scan->nextEntityInWorldSector = ent->nextEntityInWorldSector;
+		if ( !scan ) {
+			Com_Printf( "WARNING: SV_UnlinkEntity: not found in worldSector\n" );
 			return;
 		}
 	}
 
-	Com_Printf( "WARNING: SV_UnlinkEntity: not found in worldSector\n" );
+	ws->numEntities--;
+	for ( node = ws ; node ; node = node->parent ) {
+		node->numTreeEntities--;
+	}
+
+	SV_MergeWorldSectors( ws );
 }
 
 
@@ -327,9 +751,13 @@ void SV_LinkEntity( sharedEntity_t *gEnt ) {
 	}
 	
 	// link it in
-	ent->worldSector = node;
-	ent->nextEntityInWorldSector = node->entities;
-	node->entities = ent;
+	SV_LinkEntityClusters( ent, gEnt->s.number );
+
+	SV_LinkToWorldSector( ent, node );
+
+	if ( node->axis == -1 && node->numEntities > AREA_SPLIT_ENTITIES ) {
+		SV_SplitWorldSector( node );
+	}
 
 	gEnt->r.linked = qtrue;
 	if (gEnt->s.number < MAX_CLIENTS) {
@@ -580,27 +1008,18 @@ static void SV_ClipMoveToEntities( moveclip_t *clip ) {
 
 /*
 ==================
-SV_Trace
+SV_ClipWorldTraceToEntities
 
-Moves the given mins/maxs volume through the world from start to end.
-passEntityNum and entities owned by passEntityNum are explicitly not checked.
+Finishes an SV_Trace once the world has been traced
 ==================
 */
-void SV_Trace( trace_t *results, const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end, int passEntityNum, int contentmask, traceType_t type ) {
+static void SV_ClipWorldTraceToEntities( trace_t *results, const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end, int passEntityNum, int contentmask, traceType_t type ) {
 	moveclip_t	clip;
 	int			i;
 
-	if ( !mins ) {
-		mins = vec3_origin;
-	}
-	if ( !maxs ) {
-		maxs = vec3_origin;
-	}
-
 	Com_Memset ( &clip, 0, sizeof ( moveclip_t ) );
 
-	// clip to world
-	CM_BoxTrace( &clip.trace, start, end, mins, maxs, 0, contentmask, type );
+	clip.trace = *results;
 	clip.trace.entityNum = clip.trace.fraction != 1.0 ? ENTITYNUM_WORLD : ENTITYNUM_NONE;
 	if ( clip.trace.fraction == 0 ) {
 		*results = clip.trace;
@@ -636,6 +1055,57 @@ void SV_Trace( trace_t *results, const vec3_t start, const vec3_t mins, const ve
 	*results = clip.trace;
 }
 
+/*
+==================
+SV_Trace
+
+Moves the given mins/maxs volume through the world from start to end.
+passEntityNum and entities owned by passEntityNum are explicitly not checked.
+==================
+*/
+void SV_Trace( trace_t *results, const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end, int passEntityNum, int contentmask, traceType_t type ) {
+	if ( !mins ) {
+		mins = vec3_origin;
+	}
+	if ( !maxs ) {
+		maxs = vec3_origin;
+	}
+
+	// clip to world
+	CM_BoxTrace( results, start, end, mins, maxs, 0, contentmask, type );
+
+	SV_ClipWorldTraceToEntities( results, start, mins, maxs, end, passEntityNum, contentmask, type );
+}
+
+/*
+==================
+SV_TraceBatch
+
+SV_Trace for count traces that share a size, passEntityNum and contentmask.
+The world part is done for all of them at once with CM_TraceBatch.
+==================
+*/
+void SV_TraceBatch( trace_t *results, const vec3_t *starts, const vec3_t mins, const vec3_t maxs, const vec3_t *ends, int count, int passEntityNum, int contentmask, traceType_t type ) {
+	int			i;
+
+	if ( count <= 0 ) {
+		return;
+	}
+	if ( !mins ) {
+		mins = vec3_origin;
+	}
+	if ( !maxs ) {
+		maxs = vec3_origin;
+	}
+
+	// clip to world
+	CM_TraceBatch( results, starts, ends, count, mins, maxs, 0, contentmask, type );
+
+	for ( i = 0 ; i < count ; i++ ) {
+		SV_ClipWorldTraceToEntities( &results[i], starts[i], mins, maxs, ends[i], passEntityNum, contentmask, type );
+	}
+}
+
 
 /*
 =============
@@ -47,6 +47,7 @@ Suite 120, Rockville, Maryland 20850 USA.
 #include <fenv.h>
 #include <sys/wait.h>
 #include <time.h>
+#include <pthread.h>
 
 qboolean stdinIsATTY;
 
@@ -142,6 +143,29 @@ int Sys_Milliseconds (void)
 	return curtime;
 }
 
+/*
+================
+Sys_Microseconds
+
+Monotonic time for profiling, the origin is arbitrary
+================
+*/
+int64_t Sys_Microseconds( void )
+{
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+
+	if( !clock_gettime( CLOCK_MONOTONIC, &ts ) )
+		return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+	{
+		struct timeval tp;
+
+		gettimeofday( &tp, NULL );
+		return (int64_t)tp.tv_sec * 1000000 + tp.tv_usec;
+	}
+}
+
 /*
 ==================
 Sys_RandomBytes
@@ -312,6 +336,65 @@ int Sys_StatFile( char *ospath ) {
 	return 0;
 }
 
+/*
+==================
+Sys_FileInfo
+
+Get the size and modification time of a file, returns qfalse if it doesn't exist
+==================
+*/
+qboolean Sys_FileInfo( const char *ospath, int *size, int *mtime ) {
+	struct stat stat_buf;
+	if ( stat( ospath, &stat_buf ) == -1 || S_ISDIR( stat_buf.st_mode ) ) {
+		return qfalse;
+	}
+	*size = (int)stat_buf.st_size;
+	*mtime = (int)stat_buf.st_mtime;
+	return qtrue;
+}
+
+/*
+==================
+Sys_MapFile
+
+Map part of an open file into memory. The view is copy on write, so
+changes made to it never reach the file.
+==================
+*/
+qboolean Sys_MapFile( FILE *f, long offset, long length, sysFileMapping_t *mapping ) {
+	long	pageSize = sysconf( _SC_PAGESIZE );
+	long	start;
+	void	*base;
+
+	if ( length <= 0 || pageSize <= 0 ) {
+		return qfalse;
+	}
+
+	start = offset & ~( pageSize - 1 );
+
+	base = mmap( NULL, length + ( offset - start ), PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno( f ), start );
+	if ( base == MAP_FAILED ) {
+		return qfalse;
+	}
+
+	mapping->base = base;
+	mapping->size = length + ( offset - start );
+	mapping->data = (byte *)base + ( offset - start );
+	return qtrue;
+}
+
+/*
+==================
+Sys_UnmapFile
+==================
+*/
+void Sys_UnmapFile( sysFileMapping_t *mapping ) {
+	if ( mapping->base ) {
+		munmap( mapping->base, mapping->size );
+	}
+	Com_Memset( mapping, 0, sizeof( *mapping ) );
+}
+
 /*
 ==================
 Sys_Cwd
@@ -1015,3 +1098,194 @@ qboolean Sys_PathIsAbsolute( const char *path ) {
 
 	return ( path[0] == '/' );
 }
+
+/*
+==============================================================
+
+THREADS
+
+==============================================================
+*/
+
+typedef struct {
+	pthread_t	thread;
+	void		(*function)( void *arg );
+	void		*arg;
+} sysThread_t;
+
+typedef struct {
+	pthread_mutex_t	mutex;
+	pthread_cond_t	cond;
+	int				value;
+} sysSemaphore_t;
+
+/*
+=================
+Sys_ThreadMain
+=================
+*/
+static void *Sys_ThreadMain( void *arg ) {
+	sysThread_t *thread = arg;
+
+	thread->function( thread->arg );
+	return NULL;
+}
+
+/*
+=================
+Sys_CreateThread
+
+Returns NULL if the thread couldn't be started
+=================
+*/
+void *Sys_CreateThread( void (*function)( void *arg ), void *arg ) {
+#if defined( __EMSCRIPTEN__ ) && !defined( __EMSCRIPTEN_PTHREADS__ )
+	return NULL;
+#else
+	sysThread_t *thread;
+
+	thread = Z_Malloc( sizeof( *thread ) );
+	thread->function = function;
+	thread->arg = arg;
+
+	if ( pthread_create( &thread->thread, NULL, Sys_ThreadMain, thread ) != 0 ) {
+		Z_Free( thread );
+		return NULL;
+	}
+
+	return thread;
+#endif
+}
+
+/*
+=================
+Sys_JoinThread
+
+Wait for the thread to exit and free it
+=================
+*/
+void Sys_JoinThread( void *thread ) {
+	sysThread_t *t = thread;
+
+	pthread_join( t->thread, NULL );
+	Z_Free( t );
+}
+
+/*
+=================
+Sys_CreateMutex
+=================
+*/
+void *Sys_CreateMutex( void ) {
+	pthread_mutex_t *mutex;
+
+	mutex = Z_Malloc( sizeof( *mutex ) );
+	pthread_mutex_init( mutex, NULL );
+
+	return mutex;
+}
+
+/*
+=================
+Sys_DestroyMutex
+=================
+*/
+void Sys_DestroyMutex( void *mutex ) {
+	pthread_mutex_destroy( mutex );
+	Z_Free( mutex );
+}
+
+/*
+=================
+Sys_LockMutex
+=================
+*/
+void Sys_LockMutex( void *mutex ) {
+	pthread_mutex_lock( mutex );
+}
+
+/*
+=================
+Sys_UnlockMutex
+=================
+*/
+void Sys_UnlockMutex( void *mutex ) {
+	pthread_mutex_unlock( mutex );
+}
+
+/*
+=================
+Sys_CreateSemaphore
+
+Built on a condition variable as unnamed POSIX semaphores aren't
+available on macOS
+=================
+*/
+void *Sys_CreateSemaphore( int value ) {
+	sysSemaphore_t *sem;
+
+	sem = Z_Malloc( sizeof( *sem ) );
+	pthread_mutex_init( &sem->mutex, NULL );
+	pthread_cond_init( &sem->cond, NULL );
+	sem->value = value;
+
+	return sem;
+}
+
+/*
+=================
+Sys_DestroySemaphore
+=================
+*/
+void Sys_DestroySemaphore( void *semaphore ) {
+	sysSemaphore_t *sem = semaphore;
+
+	pthread_cond_destroy( &sem->cond );
+	pthread_mutex_destroy( &sem->mutex );
+	Z_Free( sem );
+}
+
+/*
+=================
+Sys_SemaphoreWait
+=================
+*/
+void Sys_SemaphoreWait( void *semaphore ) {
+	sysSemaphore_t *sem = semaphore;
+
+	pthread_mutex_lock( &sem->mutex );
+	while ( sem->value <= 0 ) {
+		pthread_cond_wait( &sem->cond, &sem->mutex );
+	}
+	sem->value--;
+	pthread_mutex_unlock( &sem->mutex );
+}
+
+/*
+=================
+Sys_SemaphorePost
+=================
+*/
+void Sys_SemaphorePost( void *semaphore ) {
+	sysSemaphore_t *sem = semaphore;
+
+	pthread_mutex_lock( &sem->mutex );
+	sem->value++;
+	pthread_cond_signal( &sem->cond );
+	pthread_mutex_unlock( &sem->mutex );
+}
+
+/*
+=================
+Sys_ProcessorCount
+=================
+*/
+int Sys_ProcessorCount( void ) {
+	long count = sysconf( _SC_NPROCESSORS_ONLN );
+
+	if ( count < 1 ) {
+		return 1;
+	}
+
+	return count;
+}
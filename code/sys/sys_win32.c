@@ -159,6 +159,27 @@ int Sys_Milliseconds (void)
 	return sys_curtime;
 }
 
+/*
+================
+Sys_Microseconds
+
+Monotonic time for profiling, the origin is arbitrary
+================
+*/
+int64_t Sys_Microseconds( void )
+{
+	static LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+
+	if ( !frequency.QuadPart ) {
+		QueryPerformanceFrequency( &frequency );
+	}
+	QueryPerformanceCounter( &counter );
+
+	return counter.QuadPart / frequency.QuadPart * 1000000 +
+		counter.QuadPart % frequency.QuadPart * 1000000 / frequency.QuadPart;
+}
+
 /*
 ================
 Sys_RandomBytes
@@ -346,6 +367,80 @@ int Sys_StatFile( char *ospath ) {
 	return 0;
 }
 
+/*
+==============
+Sys_FileInfo
+
+Get the size and modification time of a file, returns qfalse if it doesn't exist
+==============
+*/
+qboolean Sys_FileInfo( const char *ospath, int *size, int *mtime ) {
+	struct _stat st;
+	if ( _stat( ospath, &st ) == -1 || ( st.st_mode & _S_IFDIR ) ) {
+		return qfalse;
+	}
+	*size = (int)st.st_size;
+	*mtime = (int)st.st_mtime;
+	return qtrue;
+}
+
+/*
+==============
+Sys_MapFile
+
+Map part of an open file into memory. The view is copy on write, so
+changes made to it never reach the file.
+==============
+*/
+qboolean Sys_MapFile( FILE *f, long offset, long length, sysFileMapping_t *mapping ) {
+	SYSTEM_INFO	info;
+	HANDLE		file, map;
+	long		start;
+	void		*base;
+
+	if ( length <= 0 ) {
+		return qfalse;
+	}
+
+	file = (HANDLE)_get_osfhandle( _fileno( f ) );
+	if ( file == INVALID_HANDLE_VALUE ) {
+		return qfalse;
+	}
+
+	GetSystemInfo( &info );
+	start = offset - ( offset % (long)info.dwAllocationGranularity );
+
+	map = CreateFileMapping( file, NULL, PAGE_WRITECOPY, 0, 0, NULL );
+	if ( !map ) {
+		return qfalse;
+	}
+
+	// the view keeps the mapping object alive
+	base = MapViewOfFile( map, FILE_MAP_COPY, 0, (DWORD)start, length + ( offset - start ) );
+	CloseHandle( map );
+
+	if ( !base ) {
+		return qfalse;
+	}
+
+	mapping->base = base;
+	mapping->size = length + ( offset - start );
+	mapping->data = (byte *)base + ( offset - start );
+	return qtrue;
+}
+
+/*
+==============
+Sys_UnmapFile
+==============
+*/
+void Sys_UnmapFile( sysFileMapping_t *mapping ) {
+	if ( mapping->base ) {
+		UnmapViewOfFile( mapping->base );
+	}
+	Com_Memset( mapping, 0, sizeof( *mapping ) );
+}
+
 /*
 ==============
 Sys_Cwd
@@ -842,3 +937,162 @@ qboolean Sys_PathIsAbsolute( const char *path ) {
 
 	return ( PathIsRelative( filename ) == FALSE );
 }
+
+/*
+==============================================================
+
+THREADS
+
+==============================================================
+*/
+
+typedef struct {
+	HANDLE		handle;
+	void		(*function)( void *arg );
+	void		*arg;
+} sysThread_t;
+
+/*
+=================
+Sys_ThreadMain
+=================
+*/
+static DWORD WINAPI Sys_ThreadMain( LPVOID arg ) {
+	sysThread_t *thread = arg;
+
+	thread->function( thread->arg );
+	return 0;
+}
+
+/*
+=================
+Sys_CreateThread
+
+Returns NULL if the thread couldn't be started
+=================
+*/
+void *Sys_CreateThread( void (*function)( void *arg ), void *arg ) {
+	sysThread_t *thread;
+
+	thread = Z_Malloc( sizeof( *thread ) );
+	thread->function = function;
+	thread->arg = arg;
+
+	thread->handle = CreateThread( NULL, 0, Sys_ThreadMain, thread, 0, NULL );
+	if ( !thread->handle ) {
+		Z_Free( thread );
+		return NULL;
+	}
+
+	return thread;
+}
+
+/*
+=================
+Sys_JoinThread
+
+Wait for the thread to exit and free it
+=================
+*/
+void Sys_JoinThread( void *thread ) {
+	sysThread_t *t = thread;
+
+	WaitForSingleObject( t->handle, INFINITE );
+	CloseHandle( t->handle );
+	Z_Free( t );
+}
+
+/*
+=================
+Sys_CreateMutex
+=================
+*/
+void *Sys_CreateMutex( void ) {
+	CRITICAL_SECTION *mutex;
+
+	mutex = Z_Malloc( sizeof( *mutex ) );
+	InitializeCriticalSection( mutex );
+
+	return mutex;
+}
+
+/*
+=================
+Sys_DestroyMutex
+=================
+*/
+void Sys_DestroyMutex( void *mutex ) {
+	DeleteCriticalSection( mutex );
+	Z_Free( mutex );
+}
+
+/*
+=================
+Sys_LockMutex
+=================
+*/
+void Sys_LockMutex( void *mutex ) {
+	EnterCriticalSection( mutex );
+}
+
+/*
+=================
+Sys_UnlockMutex
+=================
+*/
+void Sys_UnlockMutex( void *mutex ) {
+	LeaveCriticalSection( mutex );
+}
+
+/*
+=================
+Sys_CreateSemaphore
+=================
+*/
+void *Sys_CreateSemaphore( int value ) {
+	return CreateSemaphore( NULL, value, 0x7fffffff, NULL );
+}
+
+/*
+=================
+Sys_DestroySemaphore
+=================
+*/
+void Sys_DestroySemaphore( void *semaphore ) {
+	CloseHandle( semaphore );
+}
+
+/*
+=================
+Sys_SemaphoreWait
+=================
+*/
+void Sys_SemaphoreWait( void *semaphore ) {
+	WaitForSingleObject( semaphore, INFINITE );
+}
+
+/*
+=================
+Sys_SemaphorePost
+=================
+*/
+void Sys_SemaphorePost( void *semaphore ) {
+	ReleaseSemaphore( semaphore, 1, NULL );
+}
+
+/*
+=================
+Sys_ProcessorCount
+=================
+*/
+int Sys_ProcessorCount( void ) {
+	SYSTEM_INFO info;
+
+	GetSystemInfo( &info );
+
+	if ( info.dwNumberOfProcessors < 1 ) {
+		return 1;
+	}
+
+	return info.dwNumberOfProcessors;
+}